@@ -0,0 +1,101 @@
+#include "AllocationTracker.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+// Replaces the global operator new and delete, so only nbody_headless links this and only with
+// NBODY_TRACK_ALLOCATIONS, see CMakeLists.txt
+
+namespace
+{
+	// Keeps what follows it aligned for anything
+	const std::size_t HEADER_SIZE = 16;
+
+	struct Header
+	{
+		std::uint64_t size;
+		// MemoryTag + 1, or 0 if it was allocated while not tracking
+		std::uint32_t tag;
+	};
+
+	void* allocate(std::size_t size)
+	{
+		if(size > SIZE_MAX - HEADER_SIZE)
+		{
+			return nullptr;
+		}
+		char* block = static_cast<char*>(std::malloc(size + HEADER_SIZE));
+		if(!block)
+		{
+			return nullptr;
+		}
+		Header* header = reinterpret_cast<Header*>(block);
+		header->size = size;
+		header->tag = count_allocation(size);
+		return block + HEADER_SIZE;
+	}
+
+	void* allocate_or_throw(std::size_t size)
+	{
+		// Like the default operator new, zero bytes still get a unique pointer
+		void* memory = allocate(size);
+		if(!memory)
+		{
+			throw std::bad_alloc();
+		}
+		return memory;
+	}
+
+	void deallocate(void* memory)
+	{
+		if(!memory)
+		{
+			return;
+		}
+		char* block = static_cast<char*>(memory) - HEADER_SIZE;
+		const Header* header = reinterpret_cast<const Header*>(block);
+		count_free(header->tag, header->size);
+		std::free(block);
+	}
+}
+
+void* operator new(std::size_t size)
+{
+	return allocate_or_throw(size);
+}
+
+void* operator new[](std::size_t size)
+{
+	return allocate_or_throw(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	return allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+	return allocate(size);
+}
+
+void operator delete(void* memory) noexcept
+{
+	deallocate(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+	deallocate(memory);
+}
+
+void operator delete(void* memory, const std::nothrow_t&) noexcept
+{
+	deallocate(memory);
+}
+
+void operator delete[](void* memory, const std::nothrow_t&) noexcept
+{
+	deallocate(memory);
+}
@@ -0,0 +1,135 @@
+#include "AllocationTracker.h"
+
+#include <atomic>
+
+namespace
+{
+	struct TagCounters
+	{
+		std::atomic<long long> current_bytes;
+		std::atomic<long long> peak_bytes;
+		std::atomic<unsigned long long> allocations;
+		std::atomic<unsigned long long> frees;
+	};
+
+	// Zero initialized before any constructor runs, so allocations during static initialization are fine
+	std::atomic<bool> tracking;
+	TagCounters tag_counters[MEMORY_TAG_COUNT];
+	std::atomic<long long> total_bytes;
+	std::atomic<long long> total_peak_bytes;
+#ifdef NBODY_TRACK_ALLOCATIONS
+	thread_local MemoryTag current_tag = MemoryTag::Other;
+
+	void raise_peak(std::atomic<long long>& peak, long long value)
+	{
+		long long previous = peak.load(std::memory_order_relaxed);
+		while(value > previous && !peak.compare_exchange_weak(previous, value, std::memory_order_relaxed))
+		{
+		}
+	}
+#endif
+}
+
+const char* memory_tag_name(MemoryTag tag)
+{
+	switch(tag)
+	{
+	case MemoryTag::Other:
+		return "Other";
+	case MemoryTag::Bodies:
+		return "Bodies";
+	case MemoryTag::Gravity:
+		return "Gravity";
+	case MemoryTag::Collisions:
+		return "Collisions";
+	case MemoryTag::Observers:
+		return "Observers";
+	}
+	return "";
+}
+
+bool can_track_allocations()
+{
+#ifdef NBODY_TRACK_ALLOCATIONS
+	return true;
+#else
+	return false;
+#endif
+}
+
+void set_allocation_tracking(bool enabled)
+{
+	tracking.store(enabled && can_track_allocations());
+}
+
+bool is_tracking_allocations()
+{
+	return tracking.load();
+}
+
+MemoryStats get_memory_stats()
+{
+	MemoryStats stats = MemoryStats();
+	for(std::size_t i = 0; i < MEMORY_TAG_COUNT; ++i)
+	{
+		stats.tags[i].current_bytes = tag_counters[i].current_bytes.load();
+		stats.tags[i].peak_bytes = tag_counters[i].peak_bytes.load();
+		stats.tags[i].allocations = tag_counters[i].allocations.load();
+		stats.tags[i].frees = tag_counters[i].frees.load();
+		stats.allocations += stats.tags[i].allocations;
+	}
+	stats.current_bytes = total_bytes.load();
+	stats.peak_bytes = total_peak_bytes.load();
+	return stats;
+}
+
+void reset_memory_peaks()
+{
+	for(TagCounters& counters : tag_counters)
+	{
+		counters.peak_bytes.store(counters.current_bytes.load());
+	}
+	total_peak_bytes.store(total_bytes.load());
+}
+
+#ifdef NBODY_TRACK_ALLOCATIONS
+unsigned int count_allocation(std::size_t bytes)
+{
+	if(!tracking.load(std::memory_order_relaxed))
+	{
+		return 0;
+	}
+	const std::size_t tag = static_cast<std::size_t>(current_tag);
+	TagCounters& counters = tag_counters[tag];
+	const long long size = static_cast<long long>(bytes);
+	raise_peak(counters.peak_bytes, counters.current_bytes.fetch_add(size, std::memory_order_relaxed) + size);
+	raise_peak(total_peak_bytes, total_bytes.fetch_add(size, std::memory_order_relaxed) + size);
+	counters.allocations.fetch_add(1, std::memory_order_relaxed);
+	return static_cast<unsigned int>(tag + 1);
+}
+
+void count_free(unsigned int header_tag, std::size_t bytes)
+{
+	// Memory allocated while tracking counts as freed even if tracking has stopped since
+	if(header_tag == 0)
+	{
+		return;
+	}
+	TagCounters& counters = tag_counters[header_tag - 1];
+	const long long size = static_cast<long long>(bytes);
+	counters.current_bytes.fetch_sub(size, std::memory_order_relaxed);
+	total_bytes.fetch_sub(size, std::memory_order_relaxed);
+	counters.frees.fetch_add(1, std::memory_order_relaxed);
+}
+
+MemoryScope::MemoryScope(MemoryTag tag)
+: m_previous(current_tag)
+{
+	current_tag = tag;
+}
+
+MemoryScope::~MemoryScope()
+{
+	current_tag = m_previous;
+}
+#endif
@@ -0,0 +1,80 @@
+#ifndef SPELFYSIK_SLUTUPPGIFT_ALLOCATIONTRACKER_H
+#define SPELFYSIK_SLUTUPPGIFT_ALLOCATIONTRACKER_H
+
+#include <cstddef>
+
+// Heap accounting per subsystem, for nbody_headless --memory-report. Only in builds with the CMake option
+// NBODY_TRACK_ALLOCATIONS, which links replacements of the global operator new and delete (AllocationHooks.cpp)
+// into nbody_headless and no other program. Those give every allocation a 16 byte header with its size and
+// subsystem, whether tracking is on or not. Without the option nothing is counted and MemoryScope does nothing.
+
+// What memory is for, set per thread with MemoryScope
+enum class MemoryTag
+{
+	Other,
+	Bodies,
+	Gravity,
+	Collisions,
+	Observers
+};
+
+const std::size_t MEMORY_TAG_COUNT = 5;
+
+const char* memory_tag_name(MemoryTag tag);
+
+struct MemoryTagStats
+{
+	// Allocated while tracking and not freed yet, requested sizes without the headers
+	long long current_bytes;
+	long long peak_bytes;
+	unsigned long long allocations;
+	unsigned long long frees;
+};
+
+struct MemoryStats
+{
+	// Indexed by MemoryTag
+	MemoryTagStats tags[MEMORY_TAG_COUNT];
+	// Over every subsystem, the peak of the sum rather than the sum of the peaks
+	long long current_bytes;
+	long long peak_bytes;
+	unsigned long long allocations;
+};
+
+// False if this build can't track, see NBODY_TRACK_ALLOCATIONS
+bool can_track_allocations();
+void set_allocation_tracking(bool enabled);
+bool is_tracking_allocations();
+MemoryStats get_memory_stats();
+// Starts the peaks over from the current bytes
+void reset_memory_peaks();
+
+#ifdef NBODY_TRACK_ALLOCATIONS
+// For the operator new and delete of AllocationHooks.cpp. Counts an allocation for the tag of the calling
+// thread and returns what to keep in its header, 0 while not tracking.
+unsigned int count_allocation(std::size_t bytes);
+void count_free(unsigned int header_tag, std::size_t bytes);
+
+// Tags the allocations of the calling thread until it goes out of scope
+class MemoryScope
+{
+public:
+	explicit MemoryScope(MemoryTag tag);
+	~MemoryScope();
+	MemoryScope(const MemoryScope&) = delete;
+	MemoryScope& operator=(const MemoryScope&) = delete;
+
+private:
+	const MemoryTag m_previous;
+};
+#else
+class MemoryScope
+{
+public:
+	explicit MemoryScope(MemoryTag) {}
+	MemoryScope(const MemoryScope&) = delete;
+	MemoryScope& operator=(const MemoryScope&) = delete;
+};
+#endif
+
+#endif //SPELFYSIK_SLUTUPPGIFT_ALLOCATIONTRACKER_H
@@ -0,0 +1,188 @@
+#include "BackgroundCheckpointer.h"
+
+#include <cerrno>
+#include <cstdlib>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+BackgroundCheckpointer::BackgroundCheckpointer()
+: m_state(State::Idle), m_child(0), m_exit_code(0), m_signal(0), m_path(), m_last_stall(0), m_start_time(),
+  m_last_duration(0)
+{
+}
+
+BackgroundCheckpointer::~BackgroundCheckpointer()
+{
+	wait();
+}
+
+bool BackgroundCheckpointer::start(const Simulation& simulation, const std::string& path, bool wait_if_busy)
+{
+	const auto start_time = std::chrono::steady_clock::now();
+	if(poll() == State::Running)
+	{
+		if(!wait_if_busy)
+		{
+			return false;
+		}
+		wait();
+	}
+	m_path = path;
+	m_exit_code = 0;
+	m_signal = 0;
+	m_start_time = std::chrono::steady_clock::now();
+
+#ifndef _WIN32
+	// Made before the fork, the child must not allocate
+	const std::string temporary_path = path + ".tmp";
+	pid_t pid = fork();
+	if(pid == 0)
+	{
+		// Child: write the frozen state and leave without running the parent's exit handlers. Only the
+		// forking thread lives on in the child, and locks other threads held at the fork (like the one of
+		// malloc) stay locked forever, so the child sticks to async signal safe calls.
+		_exit(simulation.write_checkpoint_after_fork(path.c_str(), temporary_path.c_str()) ? EXIT_SUCCESS
+		                                                                                     : EXIT_FAILURE);
+	}
+	m_last_stall = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time);
+	if(pid < 0)
+	{
+		m_state = State::Failed;
+		m_exit_code = -1;
+		return false;
+	}
+	m_child = pid;
+	m_state = State::Running;
+	return true;
+#else
+	// No fork, so pay for the whole write here
+	const bool ok = simulation.write_checkpoint(path);
+	m_last_stall = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time);
+	m_last_duration = m_last_stall;
+	m_state = ok ? State::Succeeded : State::Failed;
+	m_exit_code = ok ? EXIT_SUCCESS : EXIT_FAILURE;
+	return ok;
+#endif
+}
+
+BackgroundCheckpointer::State BackgroundCheckpointer::poll()
+{
+#ifndef _WIN32
+	if(m_state == State::Running)
+	{
+		int status = 0;
+		pid_t pid = waitpid(static_cast<pid_t>(m_child), &status, WNOHANG);
+		if(pid == static_cast<pid_t>(m_child))
+		{
+			record_exit(status);
+		}
+		else if(pid < 0)
+		{
+			// The child is gone without us seeing its status
+			m_state = State::Failed;
+			m_exit_code = -1;
+			m_child = 0;
+		}
+	}
+#endif
+	return m_state;
+}
+
+BackgroundCheckpointer::State BackgroundCheckpointer::wait()
+{
+#ifndef _WIN32
+	if(m_state == State::Running)
+	{
+		int status = 0;
+		pid_t pid;
+		do
+		{
+			pid = waitpid(static_cast<pid_t>(m_child), &status, 0);
+		}
+		while(pid < 0 && errno == EINTR);
+		if(pid == static_cast<pid_t>(m_child))
+		{
+			record_exit(status);
+		}
+		else
+		{
+			m_state = State::Failed;
+			m_exit_code = -1;
+			m_child = 0;
+		}
+	}
+#endif
+	return m_state;
+}
+
+int BackgroundCheckpointer::get_exit_code() const
+{
+	return m_exit_code;
+}
+
+int BackgroundCheckpointer::get_signal() const
+{
+	return m_signal;
+}
+
+const std::string& BackgroundCheckpointer::get_path() const
+{
+	return m_path;
+}
+
+std::chrono::microseconds BackgroundCheckpointer::get_last_stall() const
+{
+	return m_last_stall;
+}
+
+std::chrono::microseconds BackgroundCheckpointer::get_last_duration() const
+{
+	return m_last_duration;
+}
+
+std::string BackgroundCheckpointer::describe() const
+{
+	const std::string stall = " (stalled " + std::to_string(m_last_stall.count()) + " us)";
+	switch(m_state)
+	{
+	case State::Idle:
+		return "";
+	case State::Running:
+		return "Writing checkpoint to " + m_path + stall;
+	case State::Succeeded:
+		return "Checkpoint saved to " + m_path + stall;
+	case State::Failed:
+		if(m_signal != 0)
+		{
+			return "Checkpoint writer for " + m_path + " killed by signal " + std::to_string(m_signal);
+		}
+		return "Failed to save checkpoint to " + m_path + ", exit code " + std::to_string(m_exit_code);
+	}
+	return ""; // Silence warning
+}
+
+void BackgroundCheckpointer::record_exit(int status)
+{
+#ifndef _WIN32
+	m_child = 0;
+	m_last_duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()
+	                                                                         - m_start_time);
+	if(WIFEXITED(status))
+	{
+		m_exit_code = WEXITSTATUS(status);
+		m_state = m_exit_code == EXIT_SUCCESS ? State::Succeeded : State::Failed;
+	}
+	else
+	{
+		m_signal = WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+		m_exit_code = -1;
+		m_state = State::Failed;
+	}
+#else
+	(void)status;
+#endif
+}
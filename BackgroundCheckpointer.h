@@ -0,0 +1,58 @@
+#ifndef SPELFYSIK_SLUTUPPGIFT_BACKGROUNDCHECKPOINTER_H
+#define SPELFYSIK_SLUTUPPGIFT_BACKGROUNDCHECKPOINTER_H
+
+#include "Simulation.h"
+
+#include <chrono>
+#include <string>
+
+// Writes checkpoints from a fork()ed child. The child gets a copy-on-write snapshot of the simulation
+// as it was at the step boundary, so the caller can keep simulating after paying for the fork alone.
+// Only one child runs at a time. Where fork() isn't available the checkpoint is written in place.
+class BackgroundCheckpointer
+{
+public:
+	enum class State
+	{
+		Idle, Running, Succeeded, Failed
+	};
+
+	BackgroundCheckpointer();
+	// Waits for a running child so its checkpoint is complete
+	~BackgroundCheckpointer();
+	BackgroundCheckpointer(const BackgroundCheckpointer&) = delete;
+	BackgroundCheckpointer& operator=(const BackgroundCheckpointer&) = delete;
+
+	// Starts a checkpoint of simulation to path. If the previous one is still being written this
+	// waits for it when wait_if_busy is set, otherwise it returns false without doing anything.
+	// Also returns false if the child couldn't be started.
+	bool start(const Simulation& simulation, const std::string& path, bool wait_if_busy);
+	// Reaps the child if it has finished, never blocks
+	State poll();
+	// Blocks until the running child (if any) has finished
+	State wait();
+	// Exit code of the last finished child, or the signal that killed it (0 if it wasn't killed)
+	int get_exit_code() const;
+	int get_signal() const;
+	const std::string& get_path() const;
+	// How long the last start() stalled the caller, including any wait for the previous child
+	std::chrono::microseconds get_last_stall() const;
+	// How long the last finished checkpoint took from start() until poll() or wait() saw it done
+	std::chrono::microseconds get_last_duration() const;
+	// Human readable state, e.g. for the on screen text
+	std::string describe() const;
+
+private:
+	void record_exit(int status);
+
+	State m_state;
+	long m_child;
+	int m_exit_code;
+	int m_signal;
+	std::string m_path;
+	std::chrono::microseconds m_last_stall;
+	std::chrono::steady_clock::time_point m_start_time;
+	std::chrono::microseconds m_last_duration;
+};
+
+#endif //SPELFYSIK_SLUTUPPGIFT_BACKGROUNDCHECKPOINTER_H
@@ -0,0 +1,289 @@
+#include "Checkpoint.h"
+#include "Checksum.h"
+#include "MappedFile.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+CheckpointWriter::CheckpointWriter(std::uint64_t body_count, std::uint64_t step_count, std::uint64_t next_id,
+                                   double elapsed_time, double step_size)
+: m_body_count(body_count),
+  m_buffer(CheckpointFormat::file_size(body_count), 0)
+{
+	using namespace CheckpointFormat;
+	char* header = m_buffer.data();
+	std::memcpy(header, MAGIC, sizeof(MAGIC));
+	std::memcpy(header + 8, &VERSION, sizeof(VERSION));
+	std::memcpy(header + 16, &body_count, sizeof(body_count));
+	std::memcpy(header + 24, &step_count, sizeof(step_count));
+	std::memcpy(header + 32, &elapsed_time, sizeof(elapsed_time));
+	std::memcpy(header + 40, &step_size, sizeof(step_size));
+	std::memcpy(header + 56, &next_id, sizeof(next_id));
+}
+
+double* CheckpointWriter::positions()
+{
+	// The buffer comes from operator new, so it's aligned well enough for doubles
+	return reinterpret_cast<double*>(m_buffer.data() + CheckpointFormat::HEADER_SIZE);
+}
+
+double* CheckpointWriter::previous_positions()
+{
+	return positions() + 3 * m_body_count;
+}
+
+double* CheckpointWriter::masses()
+{
+	return previous_positions() + 3 * m_body_count;
+}
+
+double* CheckpointWriter::radii()
+{
+	return masses() + m_body_count;
+}
+
+std::uint64_t* CheckpointWriter::ids()
+{
+	return reinterpret_cast<std::uint64_t*>(radii() + m_body_count);
+}
+
+bool CheckpointWriter::write(const std::string& path)
+{
+	using namespace CheckpointFormat;
+	if(!host_is_little_endian())
+	{
+		return false;
+	}
+	char* data = m_buffer.data();
+	const std::size_t size = m_buffer.size();
+	const std::uint64_t checksum = checksum64(data + HEADER_SIZE, size - HEADER_SIZE);
+	std::memcpy(data + 48, &checksum, sizeof(checksum));
+
+	const std::string temporary_path = path + ".tmp";
+	std::FILE* file = std::fopen(temporary_path.c_str(), "wb");
+	if(!file)
+	{
+		return false;
+	}
+	bool ok = std::fwrite(data, 1, size, file) == size && std::fflush(file) == 0;
+#ifndef _WIN32
+	// Make sure it's on disk before it replaces the previous checkpoint
+	ok = ok && fsync(fileno(file)) == 0;
+#endif
+	ok = (std::fclose(file) == 0) && ok;
+#ifdef _WIN32
+	// rename() won't replace an existing file on Windows
+	std::remove(path.c_str());
+#endif
+	ok = ok && std::rename(temporary_path.c_str(), path.c_str()) == 0;
+	if(!ok)
+	{
+		std::remove(temporary_path.c_str());
+	}
+	return ok;
+}
+
+CheckpointStreamWriter::CheckpointStreamWriter(std::uint64_t body_count, std::uint64_t step_count,
+                                               std::uint64_t next_id, double elapsed_time, double step_size)
+: m_header(), m_temporary_path(nullptr), m_file(-1), m_ok(true), m_checksum(), m_buffer_size(0), m_unchecked(0)
+{
+	using namespace CheckpointFormat;
+	std::memcpy(m_header, MAGIC, sizeof(MAGIC));
+	std::memcpy(m_header + 8, &VERSION, sizeof(VERSION));
+	std::memcpy(m_header + 16, &body_count, sizeof(body_count));
+	std::memcpy(m_header + 24, &step_count, sizeof(step_count));
+	std::memcpy(m_header + 32, &elapsed_time, sizeof(elapsed_time));
+	std::memcpy(m_header + 40, &step_size, sizeof(step_size));
+	std::memcpy(m_header + 56, &next_id, sizeof(next_id));
+}
+
+CheckpointStreamWriter::~CheckpointStreamWriter()
+{
+#ifndef _WIN32
+	if(m_file >= 0)
+	{
+		::close(m_file);
+		unlink(m_temporary_path);
+	}
+#endif
+}
+
+bool CheckpointStreamWriter::open(const char* temporary_path)
+{
+#ifndef _WIN32
+	if(!host_is_little_endian())
+	{
+		return false;
+	}
+	m_temporary_path = temporary_path;
+	m_file = ::open(temporary_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	// The checksum goes into the header once everything after it has been written
+	std::memcpy(m_buffer, m_header, sizeof(m_header));
+	m_buffer_size = sizeof(m_header);
+	m_unchecked = sizeof(m_header);
+	return m_file >= 0;
+#else
+	(void)temporary_path;
+	return false;
+#endif
+}
+
+void CheckpointStreamWriter::add(double value)
+{
+	if(m_buffer_size + sizeof(value) > sizeof(m_buffer))
+	{
+		flush();
+	}
+	std::memcpy(m_buffer + m_buffer_size, &value, sizeof(value));
+	m_buffer_size += sizeof(value);
+}
+
+void CheckpointStreamWriter::add(std::uint64_t value)
+{
+	if(m_buffer_size + sizeof(value) > sizeof(m_buffer))
+	{
+		flush();
+	}
+	std::memcpy(m_buffer + m_buffer_size, &value, sizeof(value));
+	m_buffer_size += sizeof(value);
+}
+
+bool CheckpointStreamWriter::flush()
+{
+#ifndef _WIN32
+	m_checksum.update(m_buffer + m_unchecked, m_buffer_size - m_unchecked);
+	m_unchecked = 0;
+	std::size_t written = 0;
+	while(m_ok && written < m_buffer_size)
+	{
+		const ssize_t count = write(m_file, m_buffer + written, m_buffer_size - written);
+		if(count < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		m_ok = count > 0;
+		written += count > 0 ? static_cast<std::size_t>(count) : 0;
+	}
+	m_buffer_size = 0;
+#endif
+	return m_ok;
+}
+
+bool CheckpointStreamWriter::finish(const char* path)
+{
+#ifndef _WIN32
+	if(m_file < 0 || !flush())
+	{
+		return false;
+	}
+	const std::uint64_t checksum = m_checksum.get();
+	m_ok = lseek(m_file, 48, SEEK_SET) == 48 && write(m_file, &checksum, sizeof(checksum)) == sizeof(checksum)
+	       && fsync(m_file) == 0;
+	m_ok = ::close(m_file) == 0 && m_ok;
+	m_file = -1;
+	m_ok = m_ok && rename(m_temporary_path, path) == 0;
+	if(!m_ok)
+	{
+		unlink(m_temporary_path);
+	}
+	return m_ok;
+#else
+	(void)path;
+	return false;
+#endif
+}
+
+CheckpointFile::CheckpointFile(const std::string& path)
+: m_file(), m_error(), m_data()
+{
+	using namespace CheckpointFormat;
+	if(!host_is_little_endian())
+	{
+		m_error = "Checkpoints can only be read on little endian machines";
+		return;
+	}
+	if(!m_file.open(path))
+	{
+		m_error = "Could not open " + path;
+		return;
+	}
+	const char* data = m_file.data();
+	if(m_file.size() < HEADER_SIZE || std::memcmp(data, MAGIC, sizeof(MAGIC)) != 0)
+	{
+		m_error = path + " is not a checkpoint";
+		return;
+	}
+	const std::uint32_t version = read_value<std::uint32_t>(data + 8);
+	if(version != 1 && version != VERSION)
+	{
+		m_error = path + " has an unsupported version";
+		return;
+	}
+	const std::uint64_t count = read_value<std::uint64_t>(data + 16);
+	if(count > (m_file.size() - HEADER_SIZE) / body_size(version) || m_file.size() != file_size(count, version))
+	{
+		m_error = path + " has the wrong size";
+		return;
+	}
+	m_file.will_read_sequentially();
+	if(read_value<std::uint64_t>(data + 48) != checksum64(data + HEADER_SIZE, m_file.size() - HEADER_SIZE))
+	{
+		m_error = path + " is corrupt, checksum mismatch";
+		return;
+	}
+
+	m_data.body_count = count;
+	m_data.step_count = read_value<std::uint64_t>(data + 24);
+	m_data.next_id = version == 1 ? count : read_value<std::uint64_t>(data + 56);
+	m_data.elapsed_time = read_value<double>(data + 32);
+	m_data.step_size = read_value<double>(data + 40);
+	m_data.positions = reinterpret_cast<const double*>(data + HEADER_SIZE);
+	m_data.previous_positions = m_data.positions + 3 * count;
+	m_data.masses = m_data.previous_positions + 3 * count;
+	m_data.radii = m_data.masses + count;
+	m_data.ids = version == 1 ? nullptr : reinterpret_cast<const std::uint64_t*>(m_data.radii + count);
+}
+
+bool CheckpointFile::is_valid() const
+{
+	return m_error.empty();
+}
+
+const std::string& CheckpointFile::get_error() const
+{
+	return m_error;
+}
+
+const CheckpointData& CheckpointFile::get_data() const
+{
+	return m_data;
+}
+
+std::size_t CheckpointFile::body_count() const
+{
+	return is_valid() ? static_cast<std::size_t>(m_data.body_count) : 0;
+}
+
+void CheckpointFile::generate(std::size_t /*chunk*/, std::size_t begin, std::size_t end, const BodySink& sink) const
+{
+	for(std::size_t i = begin; i < end; ++i)
+	{
+		const double* p = m_data.positions + 3 * i;
+		const double* pp = m_data.previous_positions + 3 * i;
+		sink(i, Vector3d(p[0], p[1], p[2]), Vector3d(pp[0], pp[1], pp[2]), m_data.masses[i]);
+	}
+}
+
+bool is_checkpoint_file(const std::string& path)
+{
+	char magic[sizeof(CheckpointFormat::MAGIC)];
+	std::ifstream file(path, std::ios::binary);
+	return file.read(magic, sizeof(magic)) && std::memcmp(magic, CheckpointFormat::MAGIC, sizeof(magic)) == 0;
+}
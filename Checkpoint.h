@@ -0,0 +1,143 @@
+#ifndef SPELFYSIK_SLUTUPPGIFT_CHECKPOINT_H
+#define SPELFYSIK_SLUTUPPGIFT_CHECKPOINT_H
+
+#include "InitialConditions.h"
+#include "MappedFile.h"
+#include "Checksum.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Checkpoint file (.nbck), everything little endian:
+//
+//   offset  size      contents
+//   0       8         magic "NBODYCK" followed by a zero byte
+//   8       4         uint32 version, currently 2
+//   12      4         uint32 reserved, must be 0
+//   16      8         uint64 body count N
+//   24      8         uint64 steps taken
+//   32      8         double elapsed simulated time in seconds
+//   40      8         double step size in seconds
+//   48      8         uint64 checksum64() of everything after the header
+//   56      8         uint64 id the next merged body will get
+//   64      24*N      positions, double x, y, z per body
+//   64+24N  24*N      previous positions, double x, y, z per body
+//   64+48N  8*N       masses, double
+//   64+56N  8*N       radii, double
+//   64+64N  8*N       persistent body ids, uint64
+//
+// Version 1 files lack the ids and the next id, bodies are then numbered in order.
+//
+// Bodies are stored in simulation order, which together with the exact doubles is what makes
+// a restarted run continue bit for bit. Simulation::simulate() draws no random numbers,
+// so there is no generator state to store.
+namespace CheckpointFormat
+{
+	const char MAGIC[8] = {'N', 'B', 'O', 'D', 'Y', 'C', 'K', '\0'};
+	const std::uint32_t VERSION = 2;
+	const std::size_t HEADER_SIZE = 64;
+	// Bytes each body takes up in a file of the given version
+	inline std::size_t body_size(std::uint32_t version)
+	{
+		return (version == 1 ? 8 : 9) * sizeof(double);
+	}
+	inline std::size_t file_size(std::uint64_t body_count, std::uint32_t version = VERSION)
+	{
+		return HEADER_SIZE + body_size(version) * static_cast<std::size_t>(body_count);
+	}
+}
+
+// Column views of a checkpoint, vectors are x, y, z interleaved
+struct CheckpointData
+{
+	std::uint64_t body_count;
+	std::uint64_t step_count;
+	std::uint64_t next_id;
+	double elapsed_time;
+	double step_size;
+	const double* positions;
+	const double* previous_positions;
+	const double* masses;
+	const double* radii;
+	// Null for version 1 files
+	const std::uint64_t* ids;
+};
+
+// Buffer laid out exactly like the file, filled in place and then written in one go
+class CheckpointWriter
+{
+public:
+	CheckpointWriter(std::uint64_t body_count, std::uint64_t step_count, std::uint64_t next_id, double elapsed_time,
+	                 double step_size);
+	double* positions();
+	double* previous_positions();
+	double* masses();
+	double* radii();
+	std::uint64_t* ids();
+	// Checksums the buffer and writes it next to path, renaming it into place once it's complete
+	// so a crash never leaves a half written checkpoint behind. Returns false on failure.
+	bool write(const std::string& path);
+
+private:
+	std::uint64_t m_body_count;
+	std::vector<char> m_buffer;
+};
+
+// Writes a checkpoint through a small fixed buffer as the body values come in, column after column in
+// the order of the file. Allocates nothing, starts no threads and only makes async signal safe calls,
+// for the forked child of BackgroundCheckpointer. Needs POSIX, elsewhere open() fails.
+class CheckpointStreamWriter
+{
+public:
+	CheckpointStreamWriter(std::uint64_t body_count, std::uint64_t step_count, std::uint64_t next_id,
+	                       double elapsed_time, double step_size);
+	// Closes and removes a file that wasn't finished
+	~CheckpointStreamWriter();
+	CheckpointStreamWriter(const CheckpointStreamWriter&) = delete;
+	CheckpointStreamWriter& operator=(const CheckpointStreamWriter&) = delete;
+
+	// Starts writing to temporary_path. Returns false on failure.
+	bool open(const char* temporary_path);
+	void add(double value);
+	void add(std::uint64_t value);
+	// Fills in the checksum, syncs the file and renames it to path. Returns false if anything failed.
+	bool finish(const char* path);
+
+private:
+	bool flush();
+
+	char m_header[CheckpointFormat::HEADER_SIZE];
+	const char* m_temporary_path;
+	int m_file;
+	bool m_ok;
+	Checksum64 m_checksum;
+	std::size_t m_buffer_size;
+	// Bytes at the start of the buffer the checksum skips, the header until it has been written
+	std::size_t m_unchecked;
+	char m_buffer[1 << 16];
+};
+
+// A checkpoint that has been opened and verified.
+// It can also seed a fresh simulation (e.g. SimulationFloat) as an initial condition generator.
+class CheckpointFile : public InitialConditionGenerator
+{
+public:
+	explicit CheckpointFile(const std::string& path);
+	// False if the file couldn't be opened, is not a checkpoint or fails the checksum
+	bool is_valid() const;
+	const std::string& get_error() const;
+	const CheckpointData& get_data() const;
+	std::size_t body_count() const override;
+	void generate(std::size_t chunk, std::size_t begin, std::size_t end, const BodySink& sink) const override;
+
+private:
+	MappedFile m_file;
+	std::string m_error;
+	CheckpointData m_data;
+};
+
+// Cheap check of the magic bytes only
+bool is_checkpoint_file(const std::string& path);
+
+#endif //SPELFYSIK_SLUTUPPGIFT_CHECKPOINT_H
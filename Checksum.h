@@ -0,0 +1,108 @@
+#ifndef SPELFYSIK_SLUTUPPGIFT_CHECKSUM_H
+#define SPELFYSIK_SLUTUPPGIFT_CHECKSUM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace checksum_detail
+{
+	const std::uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+	const std::uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+	const std::uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+
+	inline std::uint64_t rotate_left(std::uint64_t value, int bits)
+	{
+		return (value << bits) | (value >> (64 - bits));
+	}
+	inline std::uint64_t round(std::uint64_t lane, std::uint64_t word)
+	{
+		return rotate_left(lane + word * PRIME2, 31) * PRIME1;
+	}
+}
+
+// Fast non-cryptographic 64 bit checksum in the spirit of xxHash64.
+// Four independent lanes of 8 byte words keep it close to memory bandwidth.
+// Data can be added piece by piece, the checksum only depends on the bytes and their order.
+class Checksum64
+{
+public:
+	explicit Checksum64(std::uint64_t seed = 0)
+	: m_lanes{seed + checksum_detail::PRIME1 + checksum_detail::PRIME2, seed + checksum_detail::PRIME2, seed,
+	          seed - checksum_detail::PRIME1},
+	  m_pending(), m_pending_size(0), m_size(0)
+	{
+	}
+
+	void update(const void* data, std::size_t size)
+	{
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		m_size += size;
+		// Fill up the block left over from the last update first
+		if(m_pending_size > 0)
+		{
+			const std::size_t count = size < 32 - m_pending_size ? size : 32 - m_pending_size;
+			std::memcpy(m_pending + m_pending_size, bytes, count);
+			m_pending_size += count;
+			bytes += count;
+			size -= count;
+			if(m_pending_size < 32)
+			{
+				return;
+			}
+			add_block(m_pending);
+			m_pending_size = 0;
+		}
+		for(; size >= 32; bytes += 32, size -= 32)
+		{
+			add_block(bytes);
+		}
+		std::memcpy(m_pending, bytes, size);
+		m_pending_size = size;
+	}
+
+	std::uint64_t get() const
+	{
+		using namespace checksum_detail;
+		std::uint64_t hash = rotate_left(m_lanes[0], 1) + rotate_left(m_lanes[1], 7)
+		                     + rotate_left(m_lanes[2], 12) + rotate_left(m_lanes[3], 18);
+		hash += m_size;
+		for(std::size_t i = 0; i < m_pending_size; ++i)
+		{
+			hash ^= m_pending[i] * PRIME3;
+			hash = rotate_left(hash, 11) * PRIME1;
+		}
+		// Avalanche
+		hash ^= hash >> 33;
+		hash *= PRIME2;
+		hash ^= hash >> 29;
+		hash *= PRIME3;
+		hash ^= hash >> 32;
+		return hash;
+	}
+
+private:
+	void add_block(const unsigned char* block)
+	{
+		std::uint64_t words[4];
+		std::memcpy(words, block, 32);
+		m_lanes[0] = checksum_detail::round(m_lanes[0], words[0]);
+		m_lanes[1] = checksum_detail::round(m_lanes[1], words[1]);
+		m_lanes[2] = checksum_detail::round(m_lanes[2], words[2]);
+		m_lanes[3] = checksum_detail::round(m_lanes[3], words[3]);
+	}
+
+	std::uint64_t m_lanes[4];
+	unsigned char m_pending[32];
+	std::size_t m_pending_size;
+	std::uint64_t m_size;
+};
+
+inline std::uint64_t checksum64(const void* data, std::size_t size, std::uint64_t seed = 0)
+{
+	Checksum64 checksum(seed);
+	checksum.update(data, size);
+	return checksum.get();
+}
+
+#endif //SPELFYSIK_SLUTUPPGIFT_CHECKSUM_H
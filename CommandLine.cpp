@@ -0,0 +1,318 @@
+#include "CommandLine.h"
+
+#include <algorithm>
+#include <iterator>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+
+namespace
+{
+	const char* const INITIAL_CONDITION_OPTIONS[] = {
+			"layout", "bodies", "seed", "step-size", "mass", "mass-variance", "distribution",
+			"distribution-variance", "speed", "speed-variance"};
+
+	std::string trim(const std::string& string)
+	{
+		const std::size_t begin = string.find_first_not_of(" \t\r\n");
+		if(begin == std::string::npos)
+		{
+			return "";
+		}
+		const std::size_t end = string.find_last_not_of(" \t\r\n");
+		return string.substr(begin, end - begin + 1);
+	}
+
+	bool parse_number(const std::string& string, double& value)
+	{
+		char* end = nullptr;
+		value = std::strtod(string.c_str(), &end);
+		return !string.empty() && *end == '\0' && std::isfinite(value);
+	}
+}
+
+CommandLine::CommandLine(int argc, char* argv[], const std::vector<std::string>& known_options)
+: m_known(known_options), m_options(), m_error()
+{
+	m_known.push_back("config");
+	m_known.insert(m_known.end(), std::begin(INITIAL_CONDITION_OPTIONS), std::end(INITIAL_CONDITION_OPTIONS));
+	for(int i = 1; i < argc; ++i)
+	{
+		const std::string argument = argv[i];
+		const std::string name = argument.compare(0, 2, "--") == 0 ? argument.substr(2) : "";
+		if(!is_known(name))
+		{
+			m_error = "Unknown option " + argument;
+			return;
+		}
+		if(i + 1 >= argc)
+		{
+			m_error = argument + " needs a value";
+			return;
+		}
+		m_options[name] = argv[++i];
+	}
+	const std::map<std::string, std::string>::const_iterator config = m_options.find("config");
+	if(config != m_options.end())
+	{
+		read_config(config->second);
+	}
+}
+
+SimulationInitialConditions CommandLine::default_initial_conditions()
+{
+	// Same as the interactive simulator
+	SimulationInitialConditions cond;
+	cond.layout = InitialLayout::Grid;
+	cond.step_size = 60*30;
+	cond.random_seed = 42;
+	cond.number_of_bodies = 128;
+	cond.system_mass = 400000000;
+	cond.mass_variance = 1.00;
+	cond.distribution = 1500;
+	cond.distribution_variance = 1.80;
+	cond.speed = 0.003;
+	cond.speed_variance = 1.8;
+	return cond;
+}
+
+bool CommandLine::is_valid() const
+{
+	return m_error.empty();
+}
+
+const std::string& CommandLine::get_error() const
+{
+	return m_error;
+}
+
+bool CommandLine::has(const std::string& name) const
+{
+	return m_options.count(name) > 0;
+}
+
+bool CommandLine::get(const std::string& name, std::string& value) const
+{
+	const std::map<std::string, std::string>::const_iterator option = m_options.find(name);
+	if(option != m_options.end())
+	{
+		value = option->second;
+	}
+	return true;
+}
+
+bool CommandLine::get(const std::string& name, double& value) const
+{
+	const std::map<std::string, std::string>::const_iterator option = m_options.find(name);
+	if(option == m_options.end())
+	{
+		return true;
+	}
+	double parsed;
+	if(!parse_number(option->second, parsed))
+	{
+		return fail(name + " must be a number, not " + option->second);
+	}
+	value = parsed;
+	return true;
+}
+
+bool CommandLine::get(const std::string& name, unsigned long long& value) const
+{
+	const std::map<std::string, std::string>::const_iterator option = m_options.find(name);
+	if(option == m_options.end())
+	{
+		return true;
+	}
+	char* end = nullptr;
+	const unsigned long long parsed = std::strtoull(option->second.c_str(), &end, 10);
+	if(option->second.empty() || option->second[0] == '-' || *end != '\0')
+	{
+		return fail(name + " must be a whole number, not " + option->second);
+	}
+	value = parsed;
+	return true;
+}
+
+bool CommandLine::get(const std::string& name, int& value) const
+{
+	unsigned long long parsed = 0;
+	if(!has(name) || !get(name, parsed))
+	{
+		return !has(name);
+	}
+	if(parsed > 0x7fffffff)
+	{
+		return fail(name + " is too large");
+	}
+	value = static_cast<int>(parsed);
+	return true;
+}
+
+bool CommandLine::get(const std::string& name, std::vector<double>& values) const
+{
+	const std::map<std::string, std::string>::const_iterator option = m_options.find(name);
+	if(option == m_options.end())
+	{
+		return true;
+	}
+	const std::string& string = option->second;
+	std::vector<double> parsed;
+	if(string.find(':') != std::string::npos)
+	{
+		// first:last or first:last:step, inclusive of last if a step lands on it
+		const std::size_t colon = string.find(':');
+		const std::size_t second_colon = string.find(':', colon + 1);
+		double first, last, step = 1.0;
+		if(!parse_number(string.substr(0, colon), first)
+		   || !parse_number(string.substr(colon + 1, second_colon - colon - 1), last)
+		   || (second_colon != std::string::npos && !parse_number(string.substr(second_colon + 1), step))
+		   || step <= 0.0 || last < first)
+		{
+			return fail(name + " must be first:last or first:last:step with first <= last, not " + string);
+		}
+		const double count = std::floor((last - first) / step * (1.0 + 1e-12)) + 1.0;
+		if(count > 1e6)
+		{
+			return fail(name + " has too many values");
+		}
+		for(double i = 0.0; i < count; ++i)
+		{
+			parsed.push_back(first + i * step);
+		}
+	}
+	else
+	{
+		std::size_t begin = 0;
+		while(begin <= string.size())
+		{
+			const std::size_t comma = string.find(',', begin);
+			const std::size_t end = comma == std::string::npos ? string.size() : comma;
+			double value;
+			if(!parse_number(trim(string.substr(begin, end - begin)), value))
+			{
+				return fail(name + " must be a list of numbers, not " + string);
+			}
+			parsed.push_back(value);
+			begin = end + 1;
+		}
+	}
+	values.swap(parsed);
+	return true;
+}
+
+bool CommandLine::get(const std::string& name, std::vector<int>& values) const
+{
+	std::vector<double> numbers;
+	if(!get(name, numbers))
+	{
+		return false;
+	}
+	if(!has(name))
+	{
+		return true;
+	}
+	std::vector<int> parsed;
+	for(double number : numbers)
+	{
+		if(number != std::floor(number) || number < 0.0 || number > 0x7fffffff)
+		{
+			return fail(name + " must be whole numbers");
+		}
+		parsed.push_back(static_cast<int>(number));
+	}
+	values.swap(parsed);
+	return true;
+}
+
+bool CommandLine::get(const std::string& name, std::vector<std::string>& values) const
+{
+	const std::map<std::string, std::string>::const_iterator option = m_options.find(name);
+	if(option == m_options.end())
+	{
+		return true;
+	}
+	const std::string& string = option->second;
+	std::vector<std::string> parsed;
+	std::size_t begin = 0;
+	while(begin <= string.size())
+	{
+		const std::size_t comma = string.find(',', begin);
+		const std::size_t end = comma == std::string::npos ? string.size() : comma;
+		parsed.push_back(trim(string.substr(begin, end - begin)));
+		if(parsed.back().empty())
+		{
+			return fail(name + " must be a comma separated list, not " + string);
+		}
+		begin = end + 1;
+	}
+	values.swap(parsed);
+	return true;
+}
+
+bool CommandLine::get_initial_conditions(SimulationInitialConditions& cond) const
+{
+	std::string layout = layout_name(cond.layout);
+	if(!get("layout", layout) || !get("bodies", cond.number_of_bodies) || !get("seed", cond.random_seed)
+	   || !get("step-size", cond.step_size) || !get("mass", cond.system_mass)
+	   || !get("mass-variance", cond.mass_variance) || !get("distribution", cond.distribution)
+	   || !get("distribution-variance", cond.distribution_variance) || !get("speed", cond.speed)
+	   || !get("speed-variance", cond.speed_variance))
+	{
+		return false;
+	}
+	if(!layout_from_name(layout, cond.layout))
+	{
+		return fail("Unknown layout " + layout);
+	}
+	if(cond.step_size <= 0)
+	{
+		return fail("step-size must be positive");
+	}
+	return true;
+}
+
+bool CommandLine::is_known(const std::string& name) const
+{
+	for(const std::string& option : m_known)
+	{
+		if(name == option)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool CommandLine::read_config(const std::string& path)
+{
+	std::ifstream file(path);
+	if(!file)
+	{
+		return fail("Could not open " + path);
+	}
+	std::string line;
+	for(int line_number = 1; std::getline(file, line); ++line_number)
+	{
+		line = trim(line.substr(0, line.find('#')));
+		if(line.empty())
+		{
+			continue;
+		}
+		const std::size_t equals = line.find('=');
+		const std::string name = trim(line.substr(0, equals));
+		if(equals == std::string::npos || !is_known(name) || name == "config")
+		{
+			return fail(path + ":" + std::to_string(line_number) + ": expected option = value");
+		}
+		// Only adds options that weren't given as arguments
+		m_options.insert(std::make_pair(name, trim(line.substr(equals + 1))));
+	}
+	return true;
+}
+
+bool CommandLine::fail(const std::string& error) const
+{
+	m_error = error;
+	return false;
+}
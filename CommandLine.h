@@ -0,0 +1,51 @@
+#ifndef SPELFYSIK_SLUTUPPGIFT_COMMANDLINE_H
+#define SPELFYSIK_SLUTUPPGIFT_COMMANDLINE_H
+
+#include "Simulation.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Options for the command line tools, given as "--name value" arguments or as "name = value" lines in the
+// file named by --config, with # starting a comment. Arguments override the config file.
+class CommandLine
+{
+public:
+	// Any option not in known_options is an error. "config" and the initial condition options are always known.
+	CommandLine(int argc, char* argv[], const std::vector<std::string>& known_options);
+	// The defaults of the interactive simulator
+	static SimulationInitialConditions default_initial_conditions();
+
+	// False if an argument or the config file couldn't be parsed
+	bool is_valid() const;
+	// Says what was wrong, also after a get() that failed
+	const std::string& get_error() const;
+	bool has(const std::string& name) const;
+
+	// These leave value alone if the option isn't set, and return false if it is set to something invalid
+	bool get(const std::string& name, std::string& value) const;
+	bool get(const std::string& name, double& value) const;
+	bool get(const std::string& name, unsigned long long& value) const;
+	bool get(const std::string& name, int& value) const;
+	// Comma separated values, or first:last or first:last:step for evenly spaced ones
+	bool get(const std::string& name, std::vector<double>& values) const;
+	// The same, but only whole numbers from 0 up to the largest int
+	bool get(const std::string& name, std::vector<int>& values) const;
+	// Comma separated words
+	bool get(const std::string& name, std::vector<std::string>& values) const;
+	// Reads the options layout, bodies, seed, step-size, mass, mass-variance, distribution,
+	// distribution-variance, speed and speed-variance into cond
+	bool get_initial_conditions(SimulationInitialConditions& cond) const;
+
+private:
+	bool is_known(const std::string& name) const;
+	bool read_config(const std::string& path);
+	bool fail(const std::string& error) const;
+
+	std::vector<std::string> m_known;
+	std::map<std::string, std::string> m_options;
+	mutable std::string m_error;
+};
+
+#endif //SPELFYSIK_SLUTUPPGIFT_COMMANDLINE_H
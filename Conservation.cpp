@@ -0,0 +1,47 @@
+#include "Conservation.h"
+#include "PhysicalConstants.h"
+
+#include <cmath>
+
+double total_energy(const double* positions, const double* velocities, const double* masses, std::size_t count)
+{
+	using PhysicalConstants::G;
+	double kinetic = 0.0;
+	double potential = 0.0;
+	for(std::size_t i = 0; i < count; ++i)
+	{
+		const double* p = &positions[3 * i];
+		const double* v = &velocities[3 * i];
+		kinetic += 0.5 * masses[i] * (v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+		for(std::size_t j = i + 1; j < count; ++j)
+		{
+			const double dx = positions[3 * j] - p[0];
+			const double dy = positions[3 * j + 1] - p[1];
+			const double dz = positions[3 * j + 2] - p[2];
+			potential -= G * masses[i] * masses[j] / std::sqrt(dx*dx + dy*dy + dz*dz);
+		}
+	}
+	return kinetic + potential;
+}
+
+Vector3d total_momentum(const double* velocities, const double* masses, std::size_t count)
+{
+	Vector3d momentum(0.0, 0.0, 0.0);
+	for(std::size_t i = 0; i < count; ++i)
+	{
+		const double* v = &velocities[3 * i];
+		momentum += Vector3d(v[0], v[1], v[2]) * masses[i];
+	}
+	return momentum;
+}
+
+double momentum_scale(const double* velocities, const double* masses, std::size_t count)
+{
+	double scale = 0.0;
+	for(std::size_t i = 0; i < count; ++i)
+	{
+		const double* v = &velocities[3 * i];
+		scale += masses[i] * std::sqrt(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+	}
+	return scale;
+}
@@ -0,0 +1,17 @@
+#ifndef SPELFYSIK_SLUTUPPGIFT_CONSERVATION_H
+#define SPELFYSIK_SLUTUPPGIFT_CONSERVATION_H
+
+#include "Vector3d.h"
+
+#include <cstddef>
+
+// Quantities a simulation should conserve, summed over bodies given as the columns copy_columns() fills,
+// positions and velocities x, y, z interleaved. Only the energy depends on the positions.
+
+// Kinetic plus gravitational potential energy, a direct sum over every pair
+double total_energy(const double* positions, const double* velocities, const double* masses, std::size_t count);
+Vector3d total_momentum(const double* velocities, const double* masses, std::size_t count);
+// Summed momentum magnitudes, what a change of the total momentum is relative to since the total is often close to 0
+double momentum_scale(const double* velocities, const double* masses, std::size_t count);
+
+#endif //SPELFYSIK_SLUTUPPGIFT_CONSERVATION_H
@@ -0,0 +1,168 @@
+#include "Ensemble.h"
+#include "Parallel.h"
+#include "SimulationBatch.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <mutex>
+
+namespace
+{
+	// Whether two runs can go in the same batch
+	bool same_batch(const EnsembleRun& a, const EnsembleRun& b)
+	{
+		return a.conditions.layout == b.conditions.layout
+		       && a.conditions.number_of_bodies == b.conditions.number_of_bodies
+		       && a.conditions.step_size == b.conditions.step_size && a.steps == b.steps;
+	}
+}
+
+std::vector<EnsembleRun> make_parameter_grid(const SimulationInitialConditions& base, unsigned long long steps,
+                                             const std::vector<int>& random_seeds,
+                                             const std::vector<int>& body_counts,
+                                             const std::vector<double>& mass_variances,
+                                             const std::vector<double>& speed_variances)
+{
+	const std::vector<int> seeds = random_seeds.empty() ? std::vector<int>(1, base.random_seed) : random_seeds;
+	const std::vector<int> counts = body_counts.empty() ? std::vector<int>(1, base.number_of_bodies) : body_counts;
+	const std::vector<double> masses = mass_variances.empty() ? std::vector<double>(1, base.mass_variance)
+	                                                          : mass_variances;
+	const std::vector<double> speeds = speed_variances.empty() ? std::vector<double>(1, base.speed_variance)
+	                                                           : speed_variances;
+	std::vector<EnsembleRun> runs;
+	runs.reserve(seeds.size() * counts.size() * masses.size() * speeds.size());
+	for(int count : counts)
+	{
+		for(double mass_variance : masses)
+		{
+			for(double speed_variance : speeds)
+			{
+				for(int seed : seeds)
+				{
+					EnsembleRun run = {base, steps};
+					run.conditions.number_of_bodies = count;
+					run.conditions.mass_variance = mass_variance;
+					run.conditions.speed_variance = speed_variance;
+					run.conditions.random_seed = seed;
+					runs.push_back(run);
+				}
+			}
+		}
+	}
+	return runs;
+}
+
+std::vector<EnsembleResult> run_ensemble(const std::vector<EnsembleRun>& runs, unsigned int thread_count,
+                                         const std::function<void(const EnsembleResult&)>& on_finished,
+                                         unsigned int lanes)
+{
+	// Gravity is O(N^2) per step, so start the expensive runs first to not end up waiting on one of them
+	std::vector<std::size_t> order(runs.size());
+	for(std::size_t i = 0; i < order.size(); ++i)
+	{
+		order[i] = i;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b)
+	{
+		const double n_a = runs[a].conditions.number_of_bodies;
+		const double n_b = runs[b].conditions.number_of_bodies;
+		return n_a * n_a * runs[a].steps > n_b * n_b * runs[b].steps;
+	});
+
+	// Runs that can share a batch, each batch in the order above. Single runs without lanes.
+	std::vector<std::vector<std::size_t>> batches;
+	std::vector<bool> batched(runs.size(), false);
+	for(std::size_t i = 0; i < order.size(); ++i)
+	{
+		if(batched[order[i]])
+		{
+			continue;
+		}
+		batches.push_back(std::vector<std::size_t>(1, order[i]));
+		batched[order[i]] = true;
+		for(std::size_t j = i + 1; j < order.size() && batches.back().size() < lanes; ++j)
+		{
+			if(!batched[order[j]] && same_batch(runs[order[i]], runs[order[j]]))
+			{
+				batches.back().push_back(order[j]);
+				batched[order[j]] = true;
+			}
+		}
+	}
+
+	std::vector<EnsembleResult> results(runs.size());
+	std::mutex finished_mutex;
+	// The grid layout uses std::rand, which has one hidden state shared by every thread
+	std::mutex generator_mutex;
+	// One batch per chunk makes parallel_for_chunks hand out the batches one at a time
+	parallel_for_chunks(batches.size(), 1, [&](std::size_t, std::size_t begin, std::size_t)
+	{
+		const std::vector<std::size_t>& batch = batches[begin];
+		const EnsembleRun& run = runs[batch.front()];
+		const std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+		std::unique_lock<std::mutex> generator_lock(generator_mutex, std::defer_lock);
+		if(run.conditions.layout == InitialLayout::Grid)
+		{
+			generator_lock.lock();
+		}
+		std::unique_ptr<Simulation> simulation;
+		std::unique_ptr<SimulationBatch> simulation_batch;
+		if(batch.size() == 1)
+		{
+			simulation.reset(new Simulation(run.conditions));
+		}
+		else
+		{
+			std::vector<SimulationInitialConditions> conditions;
+			for(std::size_t index : batch)
+			{
+				conditions.push_back(runs[index].conditions);
+			}
+			simulation_batch.reset(new SimulationBatch(conditions));
+		}
+		if(generator_lock.owns_lock())
+		{
+			generator_lock.unlock();
+		}
+		std::vector<int> initial_body_counts;
+		std::vector<Vector3d> initial_system_velocities;
+		for(std::size_t lane = 0; lane < batch.size(); ++lane)
+		{
+			initial_body_counts.push_back(simulation ? simulation->get_body_count()
+			                                         : simulation_batch->get_body_count(lane));
+			initial_system_velocities.push_back(simulation ? simulation->get_system_velocity()
+			                                               : simulation_batch->get_system_velocity(lane));
+		}
+		if(simulation)
+		{
+			simulate_steps(*simulation, run.steps);
+		}
+		else
+		{
+			simulate_steps(*simulation_batch, run.steps);
+		}
+		const double wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+		for(std::size_t lane = 0; lane < batch.size(); ++lane)
+		{
+			const std::size_t index = batch[lane];
+			EnsembleResult& result = results[index];
+			result.run = index;
+			result.initial_body_count = initial_body_counts[lane];
+			result.final_body_count = simulation ? simulation->get_body_count()
+			                                     : simulation_batch->get_body_count(lane);
+			result.velocity_deviation = velocity_deviation(initial_system_velocities[lane], simulation
+			                                               ? simulation->get_system_velocity()
+			                                               : simulation_batch->get_system_velocity(lane));
+			result.wall_time = wall_time;
+			if(on_finished)
+			{
+				std::lock_guard<std::mutex> lock(finished_mutex);
+				on_finished(result);
+			}
+		}
+	}, thread_count);
+	return results;
+}
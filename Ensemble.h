@@ -0,0 +1,48 @@
+#ifndef SPELFYSIK_SLUTUPPGIFT_ENSEMBLE_H
+#define SPELFYSIK_SLUTUPPGIFT_ENSEMBLE_H
+
+#include "Simulation.h"
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+// One independent simulation of a sweep
+struct EnsembleRun
+{
+	SimulationInitialConditions conditions;
+	unsigned long long steps;
+};
+
+// What a run ended up with
+struct EnsembleResult
+{
+	// Index into the runs given to run_ensemble()
+	std::size_t run;
+	int initial_body_count;
+	int final_body_count;
+	// Same metric as the interactive performance test, the summed change of the system velocity components in m/s
+	double velocity_deviation;
+	// In seconds, of the whole batch when the run was batched
+	double wall_time;
+};
+
+// Every combination of the values, all other conditions taken from base. Empty lists keep the value in base.
+std::vector<EnsembleRun> make_parameter_grid(const SimulationInitialConditions& base, unsigned long long steps,
+                                             const std::vector<int>& random_seeds,
+                                             const std::vector<int>& body_counts,
+                                             const std::vector<double>& mass_variances,
+                                             const std::vector<double>& speed_variances);
+
+// Runs every simulation on up to thread_count threads, one simulation per thread at a time.
+// Runs are started largest first and handed to whichever thread is free, since merges make
+// their run times hard to predict. on_finished is called as each run finishes, one call at a time.
+// Returns the results in the same order as runs.
+//
+// With more than one lane, up to lanes runs with the same layout, number of bodies, step size and number of
+// steps are stepped together as one SimulationBatch, which vectorizes across them. The results are the same.
+std::vector<EnsembleResult> run_ensemble(const std::vector<EnsembleRun>& runs, unsigned int thread_count,
+                                         const std::function<void(const EnsembleResult&)>& on_finished = nullptr,
+                                         unsigned int lanes = 1);
+
+#endif //SPELFYSIK_SLUTUPPGIFT_ENSEMBLE_H
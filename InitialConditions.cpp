@@ -0,0 +1,334 @@
+#include "InitialConditions.h"
+
+#include <cassert>
+#include <cstdlib>
+#include <random>
+
+namespace
+{
+	using PhysicalConstants::G;
+	using PhysicalConstants::PI;
+	// Bodies per chunk for the generators that run in parallel
+	const std::size_t CHUNK_SIZE = 1 << 14;
+
+	static const double D_RAND_MAX = static_cast<double>(RAND_MAX);
+
+	// Returns a random value in the range (-base*size/2, base*size/2)
+	double variance(double base, double size)
+	{
+		double rand = static_cast<double>(std::rand()) / D_RAND_MAX;
+		return (base * size) * (rand - 0.5);
+	}
+
+	Vector3d random_step(double speed, double distribution, double step_size)
+	{
+		// Get random direction
+		double x, y, z;
+		// Loop because direction must not be all zeroes
+		do
+		{
+			x = (static_cast<double>(std::rand()) / D_RAND_MAX) - 0.5;
+			y = (static_cast<double>(std::rand()) / D_RAND_MAX) - 0.5;
+			z = (static_cast<double>(std::rand()) / D_RAND_MAX) - 0.5;
+		}
+		while(x == 0.0 && y == 0.0 && z == 0.0);
+		Vector3d direction(x, y, z);
+		direction.normalize();
+
+		// Get random speed
+		double rand_speed = variance(speed, distribution);
+
+		// Return step of the correct size
+		return direction * (rand_speed * step_size);
+	}
+
+	// Each chunk gets its own engine seeded from the run seed and the chunk index,
+	// that way the result doesn't depend on how many threads generated it
+	class ChunkRandom
+	{
+	public:
+		ChunkRandom(int random_seed, std::size_t chunk)
+		: m_engine()
+		{
+			std::seed_seq seed{static_cast<unsigned int>(random_seed), static_cast<unsigned int>(chunk),
+			                   static_cast<unsigned int>(static_cast<unsigned long long>(chunk) >> 32)};
+			m_engine.seed(seed);
+		}
+		// In the range [0, 1), from the top 53 bits. Done by hand because std::uniform_real_distribution gives
+		// different values with different standard libraries, and the engine and seed_seq don't.
+		double uniform()
+		{
+			return static_cast<double>(m_engine() >> 11) * (1.0 / 9007199254740992.0);
+		}
+		// Same as variance() above
+		double variance(double base, double size)
+		{
+			return (base * size) * (uniform() - 0.5);
+		}
+		Vector3d direction()
+		{
+			const double z = 2.0 * uniform() - 1.0;
+			const double phi = 2.0 * PI * uniform();
+			const double r = std::sqrt(1.0 - z * z);
+			return Vector3d(r * std::cos(phi), r * std::sin(phi), z);
+		}
+
+	private:
+		std::mt19937_64 m_engine;
+	};
+}
+
+const char* layout_name(InitialLayout layout)
+{
+	switch(layout)
+	{
+	case InitialLayout::Grid:
+		return "grid";
+	case InitialLayout::Plummer:
+		return "plummer";
+	case InitialLayout::KeplerDisk:
+		return "kepler-disk";
+	case InitialLayout::ColdCollapse:
+		return "cold-collapse";
+	}
+	return ""; // Silence warning
+}
+
+InitialLayout next_layout(InitialLayout layout)
+{
+	switch(layout)
+	{
+	case InitialLayout::Grid:
+		return InitialLayout::Plummer;
+	case InitialLayout::Plummer:
+		return InitialLayout::KeplerDisk;
+	case InitialLayout::KeplerDisk:
+		return InitialLayout::ColdCollapse;
+	case InitialLayout::ColdCollapse:
+	default:
+		return InitialLayout::Grid;
+	}
+}
+
+bool layout_from_name(const std::string& name, InitialLayout& layout)
+{
+	InitialLayout candidate = InitialLayout::Grid;
+	do
+	{
+		if(name == layout_name(candidate))
+		{
+			layout = candidate;
+			return true;
+		}
+		candidate = next_layout(candidate);
+	}
+	while(candidate != InitialLayout::Grid);
+	return false;
+}
+
+std::size_t InitialConditionGenerator::chunk_size() const
+{
+	return CHUNK_SIZE;
+}
+
+GridGenerator::GridGenerator(int number_of_bodies, int random_seed, double step_size, double system_mass,
+                             double mass_variance, double distribution, double distribution_variance, double speed,
+                             double speed_variance)
+// Due to rounding we'll likely be placing a bit too few bodies. But who's counting?
+: m_quadrant_side(static_cast<int>(std::sqrt(number_of_bodies / 4.0))),
+  m_random_seed(random_seed),
+  m_step_size(step_size),
+  m_average_mass(system_mass / number_of_bodies),
+  m_mass_variance(mass_variance),
+  m_distribution(distribution),
+  m_distribution_variance(distribution_variance),
+  m_speed(speed),
+  m_speed_variance(speed_variance)
+{
+}
+
+std::size_t GridGenerator::body_count() const
+{
+	return 4 * static_cast<std::size_t>(m_quadrant_side) * m_quadrant_side;
+}
+
+std::size_t GridGenerator::chunk_size() const
+{
+	// std::rand has a single hidden state, so everything goes in one chunk
+	return body_count() > 0 ? body_count() : 1;
+}
+
+void GridGenerator::generate(std::size_t /*chunk*/, std::size_t begin, std::size_t end, const BodySink& sink) const
+{
+	assert(begin == 0 && end == body_count() && "GridGenerator must be generated in one chunk");
+	(void)begin; (void)end;
+	std::srand(m_random_seed);
+
+	const double hd = m_distribution / 2.0;
+	std::size_t index = 0;
+	for(int i = 0; i < m_quadrant_side; ++i)
+	{
+		for(int j = 0; j < m_quadrant_side; ++j)
+		{
+			const double x_base = hd + i*m_distribution;
+			const double y_base = hd + j*m_distribution;
+
+			for(int k = 0; k < 4; ++k)
+			{
+				double x_pos = x_base + variance(m_distribution, m_distribution_variance);
+				double y_pos = y_base + variance(m_distribution, m_distribution_variance);
+				Vector3d position(0.0, 0.0, 0.0);
+
+				switch(k)
+				{
+				case 0:
+					// First quadrant +x +y
+					position = Vector3d(x_pos, y_pos, 0.0);
+					break;
+				case 1:
+					// Second quadrant +x -y
+					position = Vector3d(x_pos, -y_pos, 0.0);
+					break;
+				case 2:
+					// Third quadrant -x -y
+					position = Vector3d(-x_pos, -y_pos, 0.0);
+					break;
+				case 3:
+					// Forth quadrant -x +y
+					position = Vector3d(-x_pos, y_pos, 0.0);
+					break;
+				}
+				double mass = m_average_mass + variance(m_average_mass, m_mass_variance);
+				Vector3d previous_pos = position + random_step(m_speed, m_speed_variance, m_step_size);
+				sink(index++, position, previous_pos, mass);
+			}
+		}
+	}
+}
+
+PlummerGenerator::PlummerGenerator(std::size_t number_of_bodies, int random_seed, double step_size,
+                                   double system_mass, double mass_variance, double scale_radius)
+: m_count(number_of_bodies),
+  m_random_seed(random_seed),
+  m_step_size(step_size),
+  m_system_mass(system_mass),
+  m_mass_variance(mass_variance),
+  m_scale_radius(scale_radius)
+{
+}
+
+std::size_t PlummerGenerator::body_count() const
+{
+	return m_count;
+}
+
+void PlummerGenerator::generate(std::size_t chunk, std::size_t begin, std::size_t end, const BodySink& sink) const
+{
+	ChunkRandom random(m_random_seed, chunk);
+	const double average_mass = m_system_mass / m_count;
+	const double a = m_scale_radius;
+	for(std::size_t i = begin; i < end; ++i)
+	{
+		// Invert the cumulative mass profile M(r) = M*r^3/(r^2 + a^2)^(3/2).
+		// The profile has infinite extent, so cut it off at 10 scale radii like Aarseth et al. do
+		double r;
+		do
+		{
+			const double m = random.uniform();
+			r = m > 0.0 ? a / std::sqrt(std::pow(m, -2.0 / 3.0) - 1.0) : 0.0;
+		}
+		while(!(r < 10.0 * a));
+		Vector3d position = random.direction() * r;
+
+		// Speed as a fraction q of the escape velocity, rejection sampled from g(q) = q^2 * (1 - q^2)^(7/2)
+		double q, g;
+		do
+		{
+			q = random.uniform();
+			g = 0.1 * random.uniform();
+		}
+		while(g > q * q * std::pow(1.0 - q * q, 3.5));
+		const double escape_speed = std::sqrt(2.0 * G * m_system_mass) * std::pow(r * r + a * a, -0.25);
+		Vector3d velocity = random.direction() * (q * escape_speed);
+
+		double mass = average_mass + random.variance(average_mass, m_mass_variance);
+		sink(i, position, position - velocity * m_step_size, mass);
+	}
+}
+
+KeplerDiskGenerator::KeplerDiskGenerator(std::size_t number_of_bodies, int random_seed, double step_size,
+                                         double central_mass, double disk_mass, double mass_variance,
+                                         double inner_radius, double outer_radius)
+: m_count(number_of_bodies),
+  m_random_seed(random_seed),
+  m_step_size(step_size),
+  m_central_mass(central_mass),
+  m_disk_mass(disk_mass),
+  m_mass_variance(mass_variance),
+  m_inner_radius(inner_radius),
+  m_outer_radius(outer_radius)
+{
+}
+
+std::size_t KeplerDiskGenerator::body_count() const
+{
+	return m_count;
+}
+
+void KeplerDiskGenerator::generate(std::size_t chunk, std::size_t begin, std::size_t end, const BodySink& sink) const
+{
+	ChunkRandom random(m_random_seed, chunk);
+	const double average_mass = m_count > 1 ? m_disk_mass / (m_count - 1) : 0.0;
+	const double inner_squared = m_inner_radius * m_inner_radius;
+	const double outer_squared = m_outer_radius * m_outer_radius;
+	// Keep the disk thin compared to the gaps between orbits
+	const double thickness = 0.01 * (m_outer_radius - m_inner_radius);
+	for(std::size_t i = begin; i < end; ++i)
+	{
+		if(i == 0)
+		{
+			Vector3d origin(0.0, 0.0, 0.0);
+			sink(i, origin, origin, m_central_mass);
+			continue;
+		}
+		// Uniform surface density
+		const double r = std::sqrt(inner_squared + random.uniform() * (outer_squared - inner_squared));
+		const double phi = 2.0 * PI * random.uniform();
+		Vector3d position(r * std::cos(phi), r * std::sin(phi), random.variance(thickness, 1.0));
+		// Circular orbit around the central body, counter clockwise seen from +z
+		const double speed = std::sqrt(G * m_central_mass / r);
+		Vector3d velocity(-std::sin(phi) * speed, std::cos(phi) * speed, 0.0);
+
+		double mass = average_mass + random.variance(average_mass, m_mass_variance);
+		sink(i, position, position - velocity * m_step_size, mass);
+	}
+}
+
+ColdCollapseGenerator::ColdCollapseGenerator(std::size_t number_of_bodies, int random_seed, double system_mass,
+                                             double mass_variance, double radius)
+: m_count(number_of_bodies),
+  m_random_seed(random_seed),
+  m_system_mass(system_mass),
+  m_mass_variance(mass_variance),
+  m_radius(radius)
+{
+}
+
+std::size_t ColdCollapseGenerator::body_count() const
+{
+	return m_count;
+}
+
+void ColdCollapseGenerator::generate(std::size_t chunk, std::size_t begin, std::size_t end, const BodySink& sink) const
+{
+	ChunkRandom random(m_random_seed, chunk);
+	const double average_mass = m_system_mass / m_count;
+	for(std::size_t i = begin; i < end; ++i)
+	{
+		// Cube root gives uniform density over the volume
+		Vector3d position = random.direction() * (m_radius * std::cbrt(random.uniform()));
+		double mass = average_mass + random.variance(average_mass, m_mass_variance);
+		// Previous position equal to position means no velocity
+		sink(i, position, position, mass);
+	}
+}
@@ -0,0 +1,145 @@
+#ifndef SPELFYSIK_SLUTUPPGIFT_INITIALCONDITIONS_H
+#define SPELFYSIK_SLUTUPPGIFT_INITIALCONDITIONS_H
+
+#include "Vector3d.h"
+#include "PhysicalConstants.h"
+
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+
+enum class InitialLayout
+{
+	Grid, Plummer, KeplerDisk, ColdCollapse
+};
+
+const char* layout_name(InitialLayout layout);
+InitialLayout next_layout(InitialLayout layout);
+// The layout called name by layout_name(), returns false if there is none
+bool layout_from_name(const std::string& name, InitialLayout& layout);
+
+// Produces the starting state of a simulation one body at a time.
+// Bodies are generated in chunks which may run on different threads, so generate() must be thread safe.
+// A body may only depend on its index and the chunk it's in, never on the order chunks are generated in.
+class InitialConditionGenerator
+{
+public:
+	// Called once per body with index, position, previous position and mass
+	typedef std::function<void(std::size_t, const Vector3d&, const Vector3d&, double)> BodySink;
+
+	virtual ~InitialConditionGenerator() {}
+	virtual std::size_t body_count() const = 0;
+	// Generators that can't run in parallel return body_count() here
+	virtual std::size_t chunk_size() const;
+	// Generates bodies [begin, end), which is chunk number chunk
+	virtual void generate(std::size_t chunk, std::size_t begin, std::size_t end, const BodySink& sink) const = 0;
+};
+
+// The original layout: four quadrants of a jittered grid in the xy-plane with random velocities.
+// Uses std::rand so it reproduces old runs exactly, which also means it is generated on one thread.
+class GridGenerator : public InitialConditionGenerator
+{
+public:
+	GridGenerator(int number_of_bodies, int random_seed, double step_size, double system_mass, double mass_variance,
+	              double distribution, double distribution_variance, double speed, double speed_variance);
+	std::size_t body_count() const override;
+	std::size_t chunk_size() const override;
+	void generate(std::size_t chunk, std::size_t begin, std::size_t end, const BodySink& sink) const override;
+
+private:
+	int m_quadrant_side;
+	int m_random_seed;
+	double m_step_size;
+	double m_average_mass, m_mass_variance;
+	double m_distribution, m_distribution_variance;
+	double m_speed, m_speed_variance;
+};
+
+// Plummer sphere in virial equilibrium, sampled as in Aarseth, Henon & Wielen 1974
+class PlummerGenerator : public InitialConditionGenerator
+{
+public:
+	PlummerGenerator(std::size_t number_of_bodies, int random_seed, double step_size, double system_mass,
+	                 double mass_variance, double scale_radius);
+	std::size_t body_count() const override;
+	void generate(std::size_t chunk, std::size_t begin, std::size_t end, const BodySink& sink) const override;
+
+private:
+	std::size_t m_count;
+	int m_random_seed;
+	double m_step_size;
+	double m_system_mass, m_mass_variance;
+	double m_scale_radius;
+};
+
+// A central body (index 0) orbited by a thin disk of bodies on circular orbits in the xy-plane
+class KeplerDiskGenerator : public InitialConditionGenerator
+{
+public:
+	KeplerDiskGenerator(std::size_t number_of_bodies, int random_seed, double step_size, double central_mass,
+	                    double disk_mass, double mass_variance, double inner_radius, double outer_radius);
+	std::size_t body_count() const override;
+	void generate(std::size_t chunk, std::size_t begin, std::size_t end, const BodySink& sink) const override;
+
+private:
+	std::size_t m_count;
+	int m_random_seed;
+	double m_step_size;
+	double m_central_mass, m_disk_mass, m_mass_variance;
+	double m_inner_radius, m_outer_radius;
+};
+
+// Uniform density sphere where every body starts at rest
+class ColdCollapseGenerator : public InitialConditionGenerator
+{
+public:
+	ColdCollapseGenerator(std::size_t number_of_bodies, int random_seed, double system_mass, double mass_variance,
+	                      double radius);
+	std::size_t body_count() const override;
+	void generate(std::size_t chunk, std::size_t begin, std::size_t end, const BodySink& sink) const override;
+
+private:
+	std::size_t m_count;
+	int m_random_seed;
+	double m_system_mass, m_mass_variance;
+	double m_radius;
+};
+
+// Builds the generator selected by cond.layout. Works for both SimulationInitialConditions and
+// SimulationFloatInitialConditions. Besides the grid, the layouts are sized so that every body
+// gets roughly a distribution^3 (or distribution^2 for the disk) sized piece of space to itself.
+template<typename Conditions>
+std::unique_ptr<InitialConditionGenerator> make_initial_condition_generator(const Conditions& cond)
+{
+	const std::size_t count = cond.number_of_bodies > 0 ? static_cast<std::size_t>(cond.number_of_bodies) : 0;
+	const double distribution = cond.distribution;
+	switch(cond.layout)
+	{
+	case InitialLayout::Plummer:
+		return std::unique_ptr<InitialConditionGenerator>(new PlummerGenerator(
+				count, cond.random_seed, cond.step_size, cond.system_mass, cond.mass_variance,
+				0.5 * distribution * std::cbrt(static_cast<double>(count))));
+	case InitialLayout::KeplerDisk:
+	{
+		// The central body holds most of the mass, otherwise the orbits wouldn't be very Keplerian
+		const double outer_radius = distribution * std::sqrt(count / PhysicalConstants::PI);
+		return std::unique_ptr<InitialConditionGenerator>(new KeplerDiskGenerator(
+				count, cond.random_seed, cond.step_size, 0.9 * cond.system_mass, 0.1 * cond.system_mass,
+				cond.mass_variance, 0.1 * outer_radius, outer_radius));
+	}
+	case InitialLayout::ColdCollapse:
+		// (4/3)*Pi*r^3 = count * distribution^3
+		return std::unique_ptr<InitialConditionGenerator>(new ColdCollapseGenerator(
+				count, cond.random_seed, cond.system_mass, cond.mass_variance,
+				distribution * std::cbrt(count * 3.0 / (4.0 * PhysicalConstants::PI))));
+	case InitialLayout::Grid:
+	default:
+		return std::unique_ptr<InitialConditionGenerator>(new GridGenerator(
+				cond.number_of_bodies, cond.random_seed, cond.step_size, cond.system_mass, cond.mass_variance,
+				cond.distribution, cond.distribution_variance, cond.speed, cond.speed_variance));
+	}
+}
+
+#endif //SPELFYSIK_SLUTUPPGIFT_INITIALCONDITIONS_H
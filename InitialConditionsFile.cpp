@@ -0,0 +1,128 @@
+#include "InitialConditionsFile.h"
+#include "Parallel.h"
+#include "MappedFile.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+InitialConditionsFile::InitialConditionsFile(const std::string& path, double step_size)
+: m_file(),
+  m_error(),
+  m_count(0),
+  m_step_size(step_size),
+  m_positions(nullptr),
+  m_velocities(nullptr),
+  m_masses(nullptr)
+{
+	using namespace InitialConditionsFormat;
+	if(!host_is_little_endian())
+	{
+		m_error = "Initial condition files can only be read on little endian machines";
+		return;
+	}
+	if(!m_file.open(path))
+	{
+		m_error = "Could not open " + path;
+		return;
+	}
+	const char* data = m_file.data();
+	if(m_file.size() < HEADER_SIZE || std::memcmp(data, MAGIC, sizeof(MAGIC)) != 0)
+	{
+		m_error = path + " is not an initial condition file";
+		return;
+	}
+	if(read_value<std::uint32_t>(data + 8) != VERSION)
+	{
+		m_error = path + " has an unsupported version";
+		return;
+	}
+	const std::uint64_t count = read_value<std::uint64_t>(data + 16);
+	// Check the count before multiplying with it so a garbage header can't overflow the size
+	if(count > (m_file.size() - HEADER_SIZE) / (7 * sizeof(double)) || m_file.size() < file_size(count))
+	{
+		m_error = path + " is truncated";
+		return;
+	}
+
+	m_count = static_cast<std::size_t>(count);
+	m_positions = reinterpret_cast<const double*>(data + HEADER_SIZE);
+	m_velocities = m_positions + 3 * m_count;
+	m_masses = m_velocities + 3 * m_count;
+	m_file.will_read_sequentially();
+}
+
+bool InitialConditionsFile::is_valid() const
+{
+	return m_error.empty();
+}
+
+const std::string& InitialConditionsFile::get_error() const
+{
+	return m_error;
+}
+
+std::size_t InitialConditionsFile::body_count() const
+{
+	return m_count;
+}
+
+void InitialConditionsFile::generate(std::size_t /*chunk*/, std::size_t begin, std::size_t end,
+                                     const BodySink& sink) const
+{
+	for(std::size_t i = begin; i < end; ++i)
+	{
+		const double* p = m_positions + 3 * i;
+		const double* v = m_velocities + 3 * i;
+		Vector3d position(p[0], p[1], p[2]);
+		Vector3d velocity(v[0], v[1], v[2]);
+		sink(i, position, position - velocity * m_step_size, m_masses[i]);
+	}
+}
+
+bool save_initial_conditions(const std::string& path, const InitialConditionGenerator& generator, double step_size)
+{
+	using namespace InitialConditionsFormat;
+	if(!host_is_little_endian())
+	{
+		return false;
+	}
+
+	// Generate everything into the file's column layout first so it can be written in a few large blocks
+	const std::size_t count = generator.body_count();
+	std::vector<double> positions(3 * count), velocities(3 * count), masses(count);
+	const double inverse_step = 1.0 / step_size;
+	parallel_for_chunks(count, generator.chunk_size(), [&](std::size_t chunk, std::size_t begin, std::size_t end)
+	{
+		generator.generate(chunk, begin, end,
+		                   [&](std::size_t index, const Vector3d& position, const Vector3d& previous_position, double mass)
+		{
+			Vector3d velocity = (position - previous_position) * inverse_step;
+			positions[3 * index] = position.get_x();
+			positions[3 * index + 1] = position.get_y();
+			positions[3 * index + 2] = position.get_z();
+			velocities[3 * index] = velocity.get_x();
+			velocities[3 * index + 1] = velocity.get_y();
+			velocities[3 * index + 2] = velocity.get_z();
+			masses[index] = mass;
+		});
+	});
+
+	char header[HEADER_SIZE] = {};
+	std::memcpy(header, MAGIC, sizeof(MAGIC));
+	std::memcpy(header + 8, &VERSION, sizeof(VERSION));
+	const std::uint64_t body_count = count;
+	std::memcpy(header + 16, &body_count, sizeof(body_count));
+
+	std::FILE* file = std::fopen(path.c_str(), "wb");
+	if(!file)
+	{
+		return false;
+	}
+	bool ok = std::fwrite(header, 1, HEADER_SIZE, file) == HEADER_SIZE
+	          && std::fwrite(positions.data(), sizeof(double), positions.size(), file) == positions.size()
+	          && std::fwrite(velocities.data(), sizeof(double), velocities.size(), file) == velocities.size()
+	          && std::fwrite(masses.data(), sizeof(double), masses.size(), file) == masses.size();
+	ok = (std::fclose(file) == 0) && ok;
+	return ok;
+}
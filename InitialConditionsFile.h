@@ -0,0 +1,61 @@
+#ifndef SPELFYSIK_SLUTUPPGIFT_INITIALCONDITIONSFILE_H
+#define SPELFYSIK_SLUTUPPGIFT_INITIALCONDITIONSFILE_H
+
+#include "InitialConditions.h"
+#include "MappedFile.h"
+
+#include <cstdint>
+#include <string>
+
+// Binary initial condition file (.nbic), everything little endian:
+//
+//   offset  size      contents
+//   0       8         magic "NBODYIC" followed by a zero byte
+//   8       4         uint32 version, currently 1
+//   12      4         uint32 reserved, must be 0
+//   16      8         uint64 body count N
+//   24      8         reserved, must be 0
+//   32      24*N      positions in meters, double x, y, z per body
+//   32+24N  24*N      velocities in m/s, double x, y, z per body
+//   32+48N  8*N       masses in kg, double
+//
+// Every array starts on an 8 byte boundary, so a mapped file can be read in place
+// (e.g. numpy.memmap with offset 32 and shape (N, 3)).
+namespace InitialConditionsFormat
+{
+	const char MAGIC[8] = {'N', 'B', 'O', 'D', 'Y', 'I', 'C', '\0'};
+	const std::uint32_t VERSION = 1;
+	const std::size_t HEADER_SIZE = 32;
+	// Size of a file holding body_count bodies
+	inline std::size_t file_size(std::uint64_t body_count)
+	{
+		return HEADER_SIZE + 7 * sizeof(double) * static_cast<std::size_t>(body_count);
+	}
+}
+
+// Reads bodies straight out of a mapped .nbic file. Velocities are turned into previous positions using the step size.
+class InitialConditionsFile : public InitialConditionGenerator
+{
+public:
+	InitialConditionsFile(const std::string& path, double step_size);
+	// False if the file couldn't be opened or isn't a valid .nbic file
+	bool is_valid() const;
+	// Says what was wrong with the file if it isn't valid
+	const std::string& get_error() const;
+	std::size_t body_count() const override;
+	void generate(std::size_t chunk, std::size_t begin, std::size_t end, const BodySink& sink) const override;
+
+private:
+	MappedFile m_file;
+	std::string m_error;
+	std::size_t m_count;
+	double m_step_size;
+	const double* m_positions;
+	const double* m_velocities;
+	const double* m_masses;
+};
+
+// Writes every body of generator to a .nbic file. Returns false on failure.
+bool save_initial_conditions(const std::string& path, const InitialConditionGenerator& generator, double step_size);
+
+#endif //SPELFYSIK_SLUTUPPGIFT_INITIALCONDITIONSFILE_H
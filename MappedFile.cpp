@@ -0,0 +1,127 @@
+#include "MappedFile.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+: m_data(nullptr), m_size(0), m_open(false), m_mapped(false), m_buffer()
+{
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const std::string& path)
+{
+	close();
+#ifndef _WIN32
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if(fd < 0)
+	{
+		return false;
+	}
+	struct stat info;
+	if(fstat(fd, &info) != 0)
+	{
+		::close(fd);
+		return false;
+	}
+	m_size = static_cast<std::size_t>(info.st_size);
+	if(m_size > 0)
+	{
+		void* address = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+		if(address != MAP_FAILED)
+		{
+			m_data = static_cast<const char*>(address);
+			m_mapped = true;
+		}
+	}
+	// The mapping keeps its own reference to the file
+	::close(fd);
+	if(m_mapped || m_size == 0)
+	{
+		m_open = true;
+		return true;
+	}
+#endif
+	// Fall back to reading everything
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if(!file)
+	{
+		m_size = 0;
+		return false;
+	}
+	m_buffer.resize(static_cast<std::size_t>(file.tellg()));
+	file.seekg(0);
+	file.read(m_buffer.data(), m_buffer.size());
+	if(!file)
+	{
+		m_buffer.clear();
+		m_size = 0;
+		return false;
+	}
+	m_data = m_buffer.data();
+	m_size = m_buffer.size();
+	m_open = true;
+	return true;
+}
+
+void MappedFile::close()
+{
+#ifndef _WIN32
+	if(m_mapped)
+	{
+		munmap(const_cast<char*>(m_data), m_size);
+	}
+#endif
+	m_data = nullptr;
+	m_size = 0;
+	m_open = false;
+	m_mapped = false;
+	m_buffer.clear();
+	m_buffer.shrink_to_fit();
+}
+
+bool MappedFile::is_open() const
+{
+	return m_open;
+}
+
+const char* MappedFile::data() const
+{
+	return m_data;
+}
+
+std::size_t MappedFile::size() const
+{
+	return m_size;
+}
+
+void MappedFile::will_read_sequentially() const
+{
+#ifndef _WIN32
+	if(m_mapped)
+	{
+		madvise(const_cast<char*>(m_data), m_size, MADV_SEQUENTIAL);
+		madvise(const_cast<char*>(m_data), m_size, MADV_WILLNEED);
+	}
+#endif
+}
+
+bool host_is_little_endian()
+{
+	const std::uint16_t one = 1;
+	unsigned char first_byte;
+	std::memcpy(&first_byte, &one, 1);
+	return first_byte == 1;
+}
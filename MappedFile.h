@@ -0,0 +1,55 @@
+#ifndef SPELFYSIK_SLUTUPPGIFT_MAPPEDFILE_H
+#define SPELFYSIK_SLUTUPPGIFT_MAPPEDFILE_H
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Read only view of a whole file. Uses mmap where available so pages are only read when touched,
+// elsewhere the file is simply read into memory.
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// Returns false if the file couldn't be opened, any previously opened file is closed either way
+	bool open(const std::string& path);
+	void close();
+	bool is_open() const;
+	const char* data() const;
+	std::size_t size() const;
+	// Hint that the whole file will be read front to back soon
+	void will_read_sequentially() const;
+
+private:
+	const char* m_data;
+	std::size_t m_size;
+	bool m_open;
+	bool m_mapped;
+	// Only used when the file couldn't be mapped
+	std::vector<char> m_buffer;
+};
+
+// True if the host stores numbers little endian, which all our binary formats use
+bool host_is_little_endian();
+
+// Fields of the binary formats at any alignment, in host byte order
+template<typename T>
+T read_value(const char* address)
+{
+	T value;
+	std::memcpy(&value, address, sizeof(T));
+	return value;
+}
+
+template<typename T>
+void write_value(char* address, const T& value)
+{
+	std::memcpy(address, &value, sizeof(T));
+}
+
+#endif //SPELFYSIK_SLUTUPPGIFT_MAPPEDFILE_H
@@ -0,0 +1,268 @@
+#include "MergeLog.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace
+{
+	// How long the writer sleeps when there's nothing to write
+	const std::chrono::milliseconds WRITER_IDLE(10);
+}
+
+MergeLog::Buffer::Buffer(std::size_t size)
+: owner(std::this_thread::get_id()), data(size), head(0), tail(0), event()
+{
+}
+
+MergeLog::MergeLog(const std::string& path, std::size_t buffer_size)
+: m_file(nullptr),
+  m_buffer_size(buffer_size > 0 ? buffer_size : 1),
+  m_buffers(),
+  m_buffer_count(0),
+  m_register_mutex(),
+  m_events_logged(0),
+  m_events_dropped(0),
+  m_write_failed(false),
+  m_stop(false),
+  m_thread()
+{
+	using namespace MergeLogFormat;
+	if(!host_is_little_endian())
+	{
+		return;
+	}
+	m_file = std::fopen(path.c_str(), "wb");
+	if(!m_file)
+	{
+		return;
+	}
+	char header[HEADER_SIZE] = {};
+	std::memcpy(header, MAGIC, sizeof(MAGIC));
+	std::memcpy(header + 8, &VERSION, sizeof(VERSION));
+	m_write_failed = std::fwrite(header, 1, HEADER_SIZE, m_file) != HEADER_SIZE;
+	m_thread = std::thread(&MergeLog::run, this);
+}
+
+MergeLog::~MergeLog()
+{
+	if(m_thread.joinable())
+	{
+		m_stop = true;
+		m_thread.join();
+	}
+	if(m_file)
+	{
+		std::fclose(m_file);
+	}
+}
+
+bool MergeLog::is_open() const
+{
+	return m_thread.joinable();
+}
+
+bool MergeLog::is_ok() const
+{
+	return is_open() && !m_write_failed;
+}
+
+void MergeLog::on_step(const Simulation&)
+{
+}
+
+void MergeLog::on_merge(const Simulation&, const MergeEvent& merge)
+{
+	using namespace MergeLogFormat;
+	Buffer* buffer = is_open() ? buffer_for_this_thread() : nullptr;
+	const std::size_t size = event_size(merge.participant_count);
+	if(!buffer || size > buffer->data.size())
+	{
+		++m_events_dropped;
+		return;
+	}
+
+	std::vector<char>& event = buffer->event;
+	event.assign(size, 0);
+	write_value(event.data(), static_cast<std::uint64_t>(merge.step));
+	write_value(event.data() + 8, static_cast<std::uint32_t>(merge.id));
+	write_value(event.data() + 12, static_cast<std::uint32_t>(merge.participant_count));
+	write_value(event.data() + 16, merge.mass);
+	write_value(event.data() + 24, merge.position.get_x());
+	write_value(event.data() + 32, merge.position.get_y());
+	write_value(event.data() + 40, merge.position.get_z());
+	static_assert(sizeof(unsigned int) == 4, "Body ids are stored as 32 bit integers");
+	std::memcpy(event.data() + EVENT_HEADER_SIZE, merge.participant_ids, 4 * merge.participant_count);
+	std::memcpy(event.data() + size - 8 * merge.participant_count, merge.participant_masses,
+	            8 * merge.participant_count);
+
+	// Wait for the writer to make room, merges are rare enough that this hardly ever happens
+	const std::uint64_t head = buffer->head.load(std::memory_order_relaxed);
+	const std::size_t capacity = buffer->data.size();
+	while(capacity - (head - buffer->tail.load(std::memory_order_acquire)) < size)
+	{
+		std::this_thread::yield();
+	}
+	const std::size_t start = static_cast<std::size_t>(head % capacity);
+	const std::size_t first = std::min(size, capacity - start);
+	std::memcpy(buffer->data.data() + start, event.data(), first);
+	std::memcpy(buffer->data.data(), event.data() + first, size - first);
+	// Publish the whole event at once, so the writer never sees half of it
+	buffer->head.store(head + size, std::memory_order_release);
+	++m_events_logged;
+}
+
+unsigned long long MergeLog::get_events_logged() const
+{
+	return m_events_logged;
+}
+
+unsigned long long MergeLog::get_events_dropped() const
+{
+	return m_events_dropped;
+}
+
+MergeLog::Buffer* MergeLog::buffer_for_this_thread()
+{
+	const std::thread::id id = std::this_thread::get_id();
+	const std::size_t count = m_buffer_count.load(std::memory_order_acquire);
+	for(std::size_t i = 0; i < count; ++i)
+	{
+		if(m_buffers[i]->owner == id)
+		{
+			return m_buffers[i].get();
+		}
+	}
+
+	// First merge from this thread
+	std::lock_guard<std::mutex> lock(m_register_mutex);
+	const std::size_t index = m_buffer_count.load(std::memory_order_relaxed);
+	if(index == MAX_THREADS)
+	{
+		return nullptr;
+	}
+	m_buffers[index].reset(new Buffer(m_buffer_size));
+	m_buffer_count.store(index + 1, std::memory_order_release);
+	return m_buffers[index].get();
+}
+
+void MergeLog::run()
+{
+	while(!m_stop)
+	{
+		if(!drain())
+		{
+			m_write_failed = true;
+		}
+		std::this_thread::sleep_for(WRITER_IDLE);
+	}
+	// Reporting has stopped, write what's left
+	if(!drain() || std::fflush(m_file) != 0)
+	{
+		m_write_failed = true;
+	}
+}
+
+bool MergeLog::drain()
+{
+	bool ok = true;
+	const std::size_t count = m_buffer_count.load(std::memory_order_acquire);
+	for(std::size_t i = 0; i < count; ++i)
+	{
+		Buffer& buffer = *m_buffers[i];
+		const std::uint64_t tail = buffer.tail.load(std::memory_order_relaxed);
+		const std::uint64_t head = buffer.head.load(std::memory_order_acquire);
+		if(head == tail)
+		{
+			continue;
+		}
+		const std::size_t capacity = buffer.data.size();
+		const std::size_t start = static_cast<std::size_t>(tail % capacity);
+		const std::size_t size = static_cast<std::size_t>(head - tail);
+		const std::size_t first = std::min(size, capacity - start);
+		ok = ok && !m_write_failed
+		     && std::fwrite(buffer.data.data() + start, 1, first, m_file) == first
+		     && std::fwrite(buffer.data.data(), 1, size - first, m_file) == size - first;
+		// Free the space even after a failure, so the simulation never waits for a broken file
+		buffer.tail.store(head, std::memory_order_release);
+	}
+	return ok;
+}
+
+MergeLogFile::MergeLogFile(const std::string& path)
+: m_error(), m_events(), m_truncated(false)
+{
+	using namespace MergeLogFormat;
+	if(!host_is_little_endian())
+	{
+		m_error = "Merge logs can only be read on little endian machines";
+		return;
+	}
+	MappedFile file;
+	if(!file.open(path))
+	{
+		m_error = "Could not open " + path;
+		return;
+	}
+	const char* data = file.data();
+	const std::size_t size = file.size();
+	if(size < HEADER_SIZE || std::memcmp(data, MAGIC, sizeof(MAGIC)) != 0)
+	{
+		m_error = path + " is not a merge log";
+		return;
+	}
+	if(read_value<std::uint32_t>(data + 8) != VERSION)
+	{
+		m_error = path + " has an unsupported version";
+		return;
+	}
+	file.will_read_sequentially();
+
+	std::size_t offset = HEADER_SIZE;
+	while(offset < size)
+	{
+		if(size - offset < EVENT_HEADER_SIZE
+		   || size - offset < event_size(read_value<std::uint32_t>(data + offset + 12)))
+		{
+			// Where a crashed run stopped writing
+			m_truncated = true;
+			break;
+		}
+		const char* event = data + offset;
+		const std::size_t participant_count = read_value<std::uint32_t>(event + 12);
+		const std::size_t event_bytes = event_size(participant_count);
+		MergeRecord record;
+		record.step = read_value<std::uint64_t>(event);
+		record.id = read_value<std::uint32_t>(event + 8);
+		record.mass = read_value<double>(event + 16);
+		std::memcpy(record.position, event + 24, sizeof(record.position));
+		record.participant_ids.resize(participant_count);
+		std::memcpy(record.participant_ids.data(), event + EVENT_HEADER_SIZE, 4 * participant_count);
+		record.participant_masses.resize(participant_count);
+		std::memcpy(record.participant_masses.data(), event + event_bytes - 8 * participant_count,
+		            8 * participant_count);
+		m_events.push_back(std::move(record));
+		offset += event_bytes;
+	}
+}
+
+bool MergeLogFile::is_valid() const
+{
+	return m_error.empty();
+}
+
+const std::string& MergeLogFile::get_error() const
+{
+	return m_error;
+}
+
+const std::vector<MergeRecord>& MergeLogFile::get_events() const
+{
+	return m_events;
+}
+
+bool MergeLogFile::is_truncated() const
+{
+	return m_truncated;
+}
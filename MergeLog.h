@@ -0,0 +1,133 @@
+#ifndef SPELFYSIK_SLUTUPPGIFT_MERGELOG_H
+#define SPELFYSIK_SLUTUPPGIFT_MERGELOG_H
+
+#include "Simulation.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Merge log (.nbmg), an append-only list of merge events, everything little endian:
+//
+//   Header
+//   0       8         magic "NBODYMG" followed by a zero byte
+//   8       4         uint32 version, currently 1
+//   12      20        reserved, must be 0
+//
+//   Event, repeated until the end of the file
+//   0       8         uint64 step count after the step the merge happened in
+//   8       4         uint32 id of the resulting body
+//   12      4         uint32 number of participants K
+//   16      8         double mass of the resulting body in kg
+//   24      24        double x, y, z of the resulting body in meters
+//   48      4*K       uint32 participant ids, padded with zeroes to a multiple of 8 bytes
+//   ...     8*K       double participant masses in kg
+//
+// Events from one simulation are in the order they happened. A log that wasn't closed properly may
+// end with an incomplete event, which readers ignore.
+namespace MergeLogFormat
+{
+	const char MAGIC[8] = {'N', 'B', 'O', 'D', 'Y', 'M', 'G', '\0'};
+	const std::uint32_t VERSION = 1;
+	const std::size_t HEADER_SIZE = 32;
+	const std::size_t EVENT_HEADER_SIZE = 48;
+	inline std::size_t event_size(std::uint64_t participant_count)
+	{
+		return EVENT_HEADER_SIZE + (4 * static_cast<std::size_t>(participant_count) + 7) / 8 * 8
+		       + 8 * static_cast<std::size_t>(participant_count);
+	}
+}
+
+// Logs merges without making the simulation wait for the disk. Every thread that reports merges gets
+// its own ring buffer that only it writes to and only the writer thread reads from, so apart from a
+// thread's first merge, reporting takes no locks. The writer thread drains the buffers to the file.
+class MergeLog : public SimulationObserver
+{
+public:
+	// buffer_size is per reporting thread, events bigger than that are dropped
+	explicit MergeLog(const std::string& path, std::size_t buffer_size = 1 << 20);
+	// Writes whatever is still buffered before closing the file
+	~MergeLog();
+	MergeLog(const MergeLog&) = delete;
+	MergeLog& operator=(const MergeLog&) = delete;
+
+	// False if the file couldn't be created
+	bool is_open() const;
+	// False if the file couldn't be created or a write has failed
+	bool is_ok() const;
+	void on_step(const Simulation& simulation) override;
+	void on_merge(const Simulation& simulation, const MergeEvent& merge) override;
+	// Events handed to the writer thread
+	unsigned long long get_events_logged() const;
+	unsigned long long get_events_dropped() const;
+
+private:
+	// Single producer, single consumer byte ring
+	struct Buffer
+	{
+		explicit Buffer(std::size_t size);
+
+		std::thread::id owner;
+		std::vector<char> data;
+		// Total bytes ever written and read, the difference is what's waiting
+		std::atomic<std::uint64_t> head;
+		std::atomic<std::uint64_t> tail;
+		// Only touched by the owner
+		std::vector<char> event;
+	};
+
+	Buffer* buffer_for_this_thread();
+	void run();
+	// Writes everything that has been published, returns false on a write error
+	bool drain();
+
+	static const std::size_t MAX_THREADS = 64;
+
+	std::FILE* m_file;
+	const std::size_t m_buffer_size;
+	// Buffers below m_buffer_count are in use and never move, new ones are added under m_register_mutex
+	std::unique_ptr<Buffer> m_buffers[MAX_THREADS];
+	std::atomic<std::size_t> m_buffer_count;
+	std::mutex m_register_mutex;
+	std::atomic<unsigned long long> m_events_logged;
+	std::atomic<unsigned long long> m_events_dropped;
+	std::atomic<bool> m_write_failed;
+	std::atomic<bool> m_stop;
+	std::thread m_thread;
+};
+
+// One merge as read back from a log
+struct MergeRecord
+{
+	unsigned long long step;
+	unsigned int id;
+	double mass;
+	double position[3];
+	std::vector<unsigned int> participant_ids;
+	std::vector<double> participant_masses;
+};
+
+// Reads a whole merge log
+class MergeLogFile
+{
+public:
+	explicit MergeLogFile(const std::string& path);
+	// False if the file couldn't be opened or isn't a merge log
+	bool is_valid() const;
+	const std::string& get_error() const;
+	const std::vector<MergeRecord>& get_events() const;
+	// True if the log ended with an incomplete event
+	bool is_truncated() const;
+
+private:
+	std::string m_error;
+	std::vector<MergeRecord> m_events;
+	bool m_truncated;
+};
+
+#endif //SPELFYSIK_SLUTUPPGIFT_MERGELOG_H
@@ -0,0 +1,349 @@
+#include "MetricsServer.h"
+#include "Conservation.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	// How long the server thread waits for a connection before checking whether it should stop
+	const int POLL_TIMEOUT_MS = 100;
+	// A scraper that doesn't send its request or read the answer in time is dropped
+	const int CLIENT_TIMEOUT_S = 2;
+	const std::size_t MAX_REQUEST_SIZE = 8192;
+
+	void add_metric(std::string& text, const char* name, const char* type, const char* help, double value)
+	{
+		char line[64];
+		std::snprintf(line, sizeof(line), " %.17g\n", value);
+		text += std::string("# HELP ") + name + " " + help + "\n# TYPE " + name + " " + type + "\n" + name + line;
+	}
+
+#ifndef _WIN32
+	bool send_all(int socket, const std::string& data)
+	{
+		std::size_t sent = 0;
+		while(sent < data.size())
+		{
+#ifdef MSG_NOSIGNAL
+			const ssize_t count = send(socket, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+#else
+			const ssize_t count = send(socket, data.data() + sent, data.size() - sent, 0);
+#endif
+			if(count <= 0)
+			{
+				return false;
+			}
+			sent += static_cast<std::size_t>(count);
+		}
+		return true;
+	}
+#endif
+}
+
+MetricsServer::MetricsServer(unsigned short port, unsigned int interval)
+: m_error(),
+  m_interval(interval > 0 ? interval : 1),
+  m_listener(-1),
+  m_rate_steps(0),
+  m_rate_start(std::chrono::steady_clock::now()),
+  m_copy_mutex(),
+  m_copy_ready(),
+  m_has_copy(false),
+  m_copy_positions(),
+  m_copy_velocities(),
+  m_copy_masses(),
+  m_positions(),
+  m_velocities(),
+  m_masses(),
+  m_has_initial(false),
+  m_initial_energy(0.0),
+  m_initial_momentum(0.0, 0.0, 0.0),
+  m_initial_momentum_scale(0.0),
+  m_steps(0),
+  m_bodies(0),
+  m_simulated_seconds(0.0),
+  m_steps_per_second(0.0),
+  m_energy(0.0),
+  m_energy_drift(0.0),
+  m_momentum_drift(0.0),
+  m_checkpoints(0),
+  m_checkpoint_stall_seconds(0.0),
+  m_last_checkpoint_stall_seconds(0.0),
+  m_last_checkpoint_seconds(0.0),
+  m_scrapes(0),
+  m_stop(false),
+  m_thread(),
+  m_sampler()
+{
+#ifndef _WIN32
+	sockaddr_in address;
+	std::memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	// Never reachable from other machines
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	m_listener = socket(AF_INET, SOCK_STREAM, 0);
+	// A restarted run gets the port back right away
+	const int reuse = 1;
+	if(m_listener < 0 || setsockopt(m_listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0
+	   || bind(m_listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(m_listener, 8) != 0)
+	{
+		m_error = "Could not listen on 127.0.0.1:" + std::to_string(port);
+		return;
+	}
+	m_thread = std::thread(&MetricsServer::run, this);
+	m_sampler = std::thread(&MetricsServer::sample, this);
+#else
+	(void)port;
+	m_error = "The metrics server needs POSIX sockets";
+#endif
+}
+
+MetricsServer::~MetricsServer()
+{
+#ifndef _WIN32
+	if(m_thread.joinable())
+	{
+		{
+			// Under the lock, so the sampling thread can't miss it between checking and waiting
+			std::lock_guard<std::mutex> lock(m_copy_mutex);
+			m_stop = true;
+		}
+		m_copy_ready.notify_one();
+		m_thread.join();
+		// After a sum that is under way
+		m_sampler.join();
+	}
+	if(m_listener >= 0)
+	{
+		close(m_listener);
+	}
+#endif
+}
+
+bool MetricsServer::is_open() const
+{
+	return m_thread.joinable();
+}
+
+const std::string& MetricsServer::get_error() const
+{
+	return m_error;
+}
+
+void MetricsServer::on_step(const Simulation& simulation)
+{
+	if(simulation.get_step_count() % m_interval == 0)
+	{
+		publish(simulation);
+		return;
+	}
+	m_steps.store(simulation.get_step_count(), std::memory_order_relaxed);
+	m_bodies.store(simulation.get_body_count(), std::memory_order_relaxed);
+	m_simulated_seconds.store(simulation.get_elapsed_time(), std::memory_order_relaxed);
+}
+
+void MetricsServer::publish(const Simulation& simulation)
+{
+	bool copied = false;
+	{
+		std::lock_guard<std::mutex> lock(m_copy_mutex);
+		// Dropped rather than overwritten, so that the first sample is never lost
+		if(!m_has_copy)
+		{
+			const std::size_t count = simulation.get_body_count();
+			m_copy_positions.resize(3 * count);
+			m_copy_velocities.resize(3 * count);
+			m_copy_masses.resize(count);
+			simulation.copy_columns(m_copy_positions.data(), m_copy_velocities.data(), m_copy_masses.data(), nullptr,
+			                        nullptr);
+			m_has_copy = true;
+			copied = true;
+		}
+	}
+	if(copied)
+	{
+		m_copy_ready.notify_one();
+	}
+
+	// Over the steps since the last sample
+	const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	const double seconds = std::chrono::duration<double>(now - m_rate_start).count();
+	const unsigned long long steps = simulation.get_step_count();
+	if(steps > m_rate_steps && seconds > 0.0)
+	{
+		m_steps_per_second.store((steps - m_rate_steps) / seconds, std::memory_order_relaxed);
+	}
+	m_rate_steps = steps;
+	m_rate_start = now;
+
+	m_steps.store(steps, std::memory_order_relaxed);
+	m_bodies.store(simulation.get_body_count(), std::memory_order_relaxed);
+	m_simulated_seconds.store(simulation.get_elapsed_time(), std::memory_order_relaxed);
+}
+
+void MetricsServer::sample()
+{
+	while(true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_copy_mutex);
+			m_copy_ready.wait(lock, [this]() { return m_has_copy || m_stop; });
+			if(m_stop)
+			{
+				return;
+			}
+			// The buffers go back and forth, so neither thread allocates once they are big enough
+			m_positions.swap(m_copy_positions);
+			m_velocities.swap(m_copy_velocities);
+			m_masses.swap(m_copy_masses);
+			m_has_copy = false;
+		}
+
+		const std::size_t count = m_masses.size();
+		const double energy = total_energy(m_positions.data(), m_velocities.data(), m_masses.data(), count);
+		const Vector3d momentum = total_momentum(m_velocities.data(), m_masses.data(), count);
+		if(!m_has_initial)
+		{
+			m_has_initial = true;
+			m_initial_energy = energy;
+			m_initial_momentum = momentum;
+			m_initial_momentum_scale = momentum_scale(m_velocities.data(), m_masses.data(), count);
+		}
+		// Relative, like nbody_pareto. Merges lose energy, so the energy drifts in runs with collisions anyway.
+		const Vector3d momentum_change = momentum - m_initial_momentum;
+		m_energy.store(energy, std::memory_order_relaxed);
+		m_energy_drift.store(m_initial_energy != 0.0 ? std::abs(energy - m_initial_energy) / std::abs(m_initial_energy)
+		                                             : 0.0, std::memory_order_relaxed);
+		m_momentum_drift.store(m_initial_momentum_scale > 0.0 ? momentum_change.length() / m_initial_momentum_scale
+		                                                      : 0.0, std::memory_order_relaxed);
+	}
+}
+
+void MetricsServer::add_checkpoint(std::chrono::microseconds stall, std::chrono::microseconds duration)
+{
+	// Only the simulating thread writes these, so they don't need to be added atomically
+	const double stall_seconds = stall.count() * 1e-6;
+	m_checkpoint_stall_seconds.store(m_checkpoint_stall_seconds.load(std::memory_order_relaxed) + stall_seconds,
+	                                 std::memory_order_relaxed);
+	m_last_checkpoint_stall_seconds.store(stall_seconds, std::memory_order_relaxed);
+	m_last_checkpoint_seconds.store(duration.count() * 1e-6, std::memory_order_relaxed);
+	m_checkpoints.fetch_add(1, std::memory_order_relaxed);
+}
+
+unsigned long long MetricsServer::get_scrape_count() const
+{
+	return m_scrapes;
+}
+
+void MetricsServer::run()
+{
+#ifndef _WIN32
+	while(!m_stop)
+	{
+		pollfd listener = {m_listener, POLLIN, 0};
+		const int ready = poll(&listener, 1, POLL_TIMEOUT_MS);
+		if(ready < 0 && errno != EINTR)
+		{
+			break;
+		}
+		if(ready > 0 && (listener.revents & POLLIN))
+		{
+			const int client = accept(m_listener, nullptr, nullptr);
+			if(client >= 0)
+			{
+				// Scrapes are rare and small, one at a time is plenty
+				serve(client);
+				close(client);
+			}
+		}
+	}
+#endif
+}
+
+void MetricsServer::serve(int client)
+{
+#ifndef _WIN32
+	timeval timeout;
+	timeout.tv_sec = CLIENT_TIMEOUT_S;
+	timeout.tv_usec = 0;
+	setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	// Only the request line matters, but the headers are read too so that closing doesn't reset the connection
+	std::string request;
+	char buffer[1024];
+	while(request.find("\r\n\r\n") == std::string::npos && request.size() < MAX_REQUEST_SIZE)
+	{
+		const ssize_t count = recv(client, buffer, sizeof(buffer), 0);
+		if(count <= 0)
+		{
+			return;
+		}
+		request.append(buffer, static_cast<std::size_t>(count));
+	}
+	const std::string line = request.substr(0, request.find("\r\n"));
+	std::string status = "200 OK";
+	std::string body;
+	if(line.compare(0, 4, "GET ") != 0)
+	{
+		status = "405 Method Not Allowed";
+		body = "Only GET is supported\n";
+	}
+	else if(line.compare(4, 9, "/metrics ") != 0 && line.compare(4, 9, "/metrics?") != 0)
+	{
+		status = "404 Not Found";
+		body = "Metrics are at /metrics\n";
+	}
+	else
+	{
+		++m_scrapes;
+		body = format_metrics();
+	}
+	send_all(client, "HTTP/1.1 " + status + "\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+	                 "Content-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body);
+#else
+	(void)client;
+#endif
+}
+
+std::string MetricsServer::format_metrics() const
+{
+	std::string text;
+	add_metric(text, "nbody_steps_total", "counter", "Steps simulated, including those before a restart.",
+	           static_cast<double>(m_steps.load(std::memory_order_relaxed)));
+	add_metric(text, "nbody_steps_per_second", "gauge", "Steps per wall clock second over the last sample interval.",
+	           m_steps_per_second.load(std::memory_order_relaxed));
+	add_metric(text, "nbody_bodies", "gauge", "Bodies left.", m_bodies.load(std::memory_order_relaxed));
+	add_metric(text, "nbody_simulated_seconds", "gauge", "Time simulated.",
+	           m_simulated_seconds.load(std::memory_order_relaxed));
+	add_metric(text, "nbody_energy_joules", "gauge", "Total kinetic and potential energy at the last sample.",
+	           m_energy.load(std::memory_order_relaxed));
+	add_metric(text, "nbody_energy_drift_ratio", "gauge", "Change of the total energy relative to the first sample.",
+	           m_energy_drift.load(std::memory_order_relaxed));
+	add_metric(text, "nbody_momentum_drift_ratio", "gauge",
+	           "Change of the total momentum relative to the summed momentum magnitudes at the first sample.",
+	           m_momentum_drift.load(std::memory_order_relaxed));
+	add_metric(text, "nbody_checkpoints_total", "counter", "Checkpoints written.",
+	           static_cast<double>(m_checkpoints.load(std::memory_order_relaxed)));
+	add_metric(text, "nbody_checkpoint_stall_seconds_total", "counter", "Time checkpoints held up the simulation.",
+	           m_checkpoint_stall_seconds.load(std::memory_order_relaxed));
+	add_metric(text, "nbody_last_checkpoint_stall_seconds", "gauge", "Time the last checkpoint held up the simulation.",
+	           m_last_checkpoint_stall_seconds.load(std::memory_order_relaxed));
+	add_metric(text, "nbody_last_checkpoint_seconds", "gauge",
+	           "Time the last checkpoint took until it was written, in the background for periodic ones.",
+	           m_last_checkpoint_seconds.load(std::memory_order_relaxed));
+	return text;
+}
@@ -0,0 +1,91 @@
+#ifndef SPELFYSIK_SLUTUPPGIFT_METRICSSERVER_H
+#define SPELFYSIK_SLUTUPPGIFT_METRICSSERVER_H
+
+#include "Simulation.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Serves the progress of a run to Prometheus over HTTP on 127.0.0.1, at /metrics in the text exposition
+// format. The simulating thread only stores into atomics, the server thread reads them whenever it is
+// scraped, so a scrape never holds up simulate(). Energy and momentum are sums over every body, the
+// energy over every pair, so every interval steps the simulating thread copies the bodies and a sampling
+// thread adds them up. Scrapes don't wait for a sum, they get the last one that was done.
+class MetricsServer : public SimulationObserver
+{
+public:
+	MetricsServer(unsigned short port, unsigned int interval);
+	~MetricsServer();
+	MetricsServer(const MetricsServer&) = delete;
+	MetricsServer& operator=(const MetricsServer&) = delete;
+
+	// False if the port couldn't be listened on
+	bool is_open() const;
+	const std::string& get_error() const;
+	// Counts the step and samples the energy and momentum if the step is on the interval
+	void on_step(const Simulation& simulation) override;
+	// Samples everything regardless of the step. The first sample is what the drifts are relative to. While
+	// the server thread hasn't taken the last copy of the bodies yet, the energy and momentum aren't sampled.
+	void publish(const Simulation& simulation);
+	// How long a checkpoint held up the simulation and how long it took until it was written
+	void add_checkpoint(std::chrono::microseconds stall, std::chrono::microseconds duration);
+
+	unsigned long long get_scrape_count() const;
+
+private:
+	void run();
+	void serve(int client);
+	// Adds up the energy and momentum of every copy of the bodies publish() leaves, until stopped
+	void sample();
+	std::string format_metrics() const;
+
+	std::string m_error;
+	const unsigned int m_interval;
+	int m_listener;
+
+	// Only touched by the simulating thread
+	unsigned long long m_rate_steps;
+	std::chrono::steady_clock::time_point m_rate_start;
+
+	// The bodies copied by publish(), swapped out by the sampling thread
+	std::mutex m_copy_mutex;
+	std::condition_variable m_copy_ready;
+	bool m_has_copy;
+	std::vector<double> m_copy_positions;
+	std::vector<double> m_copy_velocities;
+	std::vector<double> m_copy_masses;
+
+	// Only touched by the sampling thread
+	std::vector<double> m_positions;
+	std::vector<double> m_velocities;
+	std::vector<double> m_masses;
+	bool m_has_initial;
+	double m_initial_energy;
+	Vector3d m_initial_momentum;
+	double m_initial_momentum_scale;
+
+	// Written by the simulating and sampling threads, read by the server thread
+	std::atomic<unsigned long long> m_steps;
+	std::atomic<int> m_bodies;
+	std::atomic<double> m_simulated_seconds;
+	std::atomic<double> m_steps_per_second;
+	std::atomic<double> m_energy;
+	std::atomic<double> m_energy_drift;
+	std::atomic<double> m_momentum_drift;
+	std::atomic<unsigned long long> m_checkpoints;
+	std::atomic<double> m_checkpoint_stall_seconds;
+	std::atomic<double> m_last_checkpoint_stall_seconds;
+	std::atomic<double> m_last_checkpoint_seconds;
+
+	std::atomic<unsigned long long> m_scrapes;
+	std::atomic<bool> m_stop;
+	std::thread m_thread;
+	std::thread m_sampler;
+};
+
+#endif //SPELFYSIK_SLUTUPPGIFT_METRICSSERVER_H
@@ -0,0 +1,105 @@
+#include "Parallel.h"
+
+WorkerPool& WorkerPool::get()
+{
+	static WorkerPool pool;
+	return pool;
+}
+
+WorkerPool::WorkerPool()
+: m_busy(false),
+  m_task(nullptr),
+  m_context(nullptr),
+  m_worker_count(0),
+  m_generation(0),
+  m_running(0),
+  m_stop(false)
+{
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_start.notify_all();
+	for(std::thread& thread : m_threads)
+	{
+		thread.join();
+	}
+}
+
+bool WorkerPool::run(unsigned int worker_count, Task task, void* context)
+{
+	bool expected = false;
+	if(!m_busy.compare_exchange_strong(expected, true))
+	{
+		return false;
+	}
+	if(worker_count > 1)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			// Threads are only started the first time that many are asked for
+			while(m_threads.size() + 1 < worker_count)
+			{
+				m_threads.emplace_back(&WorkerPool::work, this, static_cast<unsigned int>(m_threads.size() + 1),
+				                       m_generation);
+			}
+			m_task = task;
+			m_context = context;
+			m_worker_count = worker_count;
+			m_running = worker_count - 1;
+			++m_generation;
+		}
+		m_start.notify_all();
+	}
+	task(context, 0);
+	if(worker_count > 1)
+	{
+		// Time the calling thread spends waiting for the others
+		TraceScope trace("worker", "Join");
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_done.wait(lock, [this]() { return m_running == 0; });
+	}
+	m_busy = false;
+	return true;
+}
+
+void WorkerPool::work(unsigned int worker, unsigned long long generation)
+{
+	bool named = false;
+	for(;;)
+	{
+		Task task;
+		void* context;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_start.wait(lock, [&]() { return m_stop || m_generation != generation; });
+			if(m_stop)
+			{
+				return;
+			}
+			generation = m_generation;
+			// Runs with fewer workers leave the rest of the pool idle
+			if(worker >= m_worker_count)
+			{
+				continue;
+			}
+			task = m_task;
+			context = m_context;
+		}
+		if(!named && is_tracing())
+		{
+			set_trace_thread_name("Worker");
+			named = true;
+		}
+		task(context, worker);
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if(--m_running == 0)
+		{
+			m_done.notify_one();
+		}
+	}
+}
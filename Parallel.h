@@ -0,0 +1,153 @@
+#ifndef SPELFYSIK_SLUTUPPGIFT_PARALLEL_H
+#define SPELFYSIK_SLUTUPPGIFT_PARALLEL_H
+
+#include "Trace.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Number of worker threads to use when the caller doesn't care
+inline unsigned int default_thread_count()
+{
+	unsigned int threads = std::thread::hardware_concurrency();
+	return threads > 0 ? threads : 1;
+}
+
+// Threads that are kept between parallel calls, so a step doesn't pay for starting and joining threads.
+// One caller has the pool at a time. Anyone else, like a parallel call made from inside a task, gets
+// threads of its own.
+class WorkerPool
+{
+public:
+	typedef void (*Task)(void* context, unsigned int worker);
+
+	static WorkerPool& get();
+	~WorkerPool();
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	// Calls task(context, worker) for every worker in [0, worker_count), worker 0 on the calling thread,
+	// and returns when they are all done. Returns false without calling anything if the pool is in use.
+	bool run(unsigned int worker_count, Task task, void* context);
+
+private:
+	WorkerPool();
+	void work(unsigned int worker, unsigned long long generation);
+
+	std::atomic<bool> m_busy;
+	std::mutex m_mutex;
+	std::condition_variable m_start;
+	std::condition_variable m_done;
+	std::vector<std::thread> m_threads;
+	// The current run, guarded by m_mutex
+	Task m_task;
+	void* m_context;
+	unsigned int m_worker_count;
+	unsigned long long m_generation;
+	unsigned int m_running;
+	bool m_stop;
+};
+
+namespace parallel_detail
+{
+	template<typename Function>
+	void call(void* context, unsigned int worker)
+	{
+		(*static_cast<Function*>(context))(worker);
+	}
+
+	// Calls fn(worker) for every worker in [0, worker_count), worker 0 on the calling thread
+	template<typename Function>
+	void run_workers(unsigned int worker_count, Function& fn)
+	{
+		if(worker_count <= 1)
+		{
+			fn(0u);
+			return;
+		}
+		if(WorkerPool::get().run(worker_count, &call<Function>, &fn))
+		{
+			return;
+		}
+		std::vector<std::thread> threads;
+		threads.reserve(worker_count - 1);
+		for(unsigned int worker = 1; worker < worker_count; ++worker)
+		{
+			threads.emplace_back([&fn, worker]()
+			{
+				if(is_tracing())
+				{
+					set_trace_thread_name("Worker");
+				}
+				fn(worker);
+			});
+		}
+		fn(0u);
+		// Time the calling thread spends waiting for the others
+		TraceScope trace("worker", "Join");
+		for(std::thread& thread : threads)
+		{
+			thread.join();
+		}
+	}
+}
+
+// Splits [0, count) into fixed chunks of chunk_size and calls fn(chunk, begin, end) for each of them.
+// Chunks are handed out dynamically, but their boundaries only depend on count and chunk_size,
+// so anything derived from the chunk index (like a random seed) is independent of the thread count.
+template<typename Function>
+void parallel_for_chunks(std::size_t count, std::size_t chunk_size, Function fn,
+                         unsigned int thread_count = default_thread_count())
+{
+	const std::size_t chunks = (count + chunk_size - 1) / chunk_size;
+	std::atomic<std::size_t> next_chunk(0);
+	auto worker = [&](unsigned int)
+	{
+		for(std::size_t chunk = next_chunk++; chunk < chunks; chunk = next_chunk++)
+		{
+			const std::size_t begin = chunk * chunk_size;
+			const std::size_t end = begin + chunk_size < count ? begin + chunk_size : count;
+			TraceScope trace("worker", "Chunk");
+			fn(chunk, begin, end);
+		}
+	};
+
+	// No point in starting more threads than there is work for
+	const std::size_t wanted = thread_count > 0 ? thread_count : 1;
+	const std::size_t workers = chunks > 0 ? (wanted < chunks ? wanted : chunks) : 1;
+	// The calling thread does its share of the work too
+	parallel_detail::run_workers(static_cast<unsigned int>(workers), worker);
+}
+
+// Calls fn(worker) once on each of thread_count threads, the calling thread being worker 0
+template<typename Function>
+void parallel_workers(unsigned int thread_count, Function fn)
+{
+	auto traced = [&](unsigned int worker)
+	{
+		TraceScope trace("worker", "Task");
+		fn(worker);
+	};
+	parallel_detail::run_workers(thread_count, traced);
+}
+
+// Calls add(target, source) for every step of a pairwise reduction over count partial results, after which
+// partial 0 holds the total. Sources always come after their target. The order only depends on count, so
+// the rounding is the same whichever threads computed the partials.
+template<typename Function>
+void reduce_tree(std::size_t count, Function add)
+{
+	for(std::size_t stride = 1; stride < count; stride *= 2)
+	{
+		for(std::size_t target = 0; target + stride < count; target += 2 * stride)
+		{
+			add(target, target + stride);
+		}
+	}
+}
+
+#endif //SPELFYSIK_SLUTUPPGIFT_PARALLEL_H
@@ -0,0 +1,218 @@
+#include "PerfCounters.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+#ifdef __linux__
+	struct CounterConfig
+	{
+		std::uint32_t type;
+		std::uint64_t config;
+	};
+
+	std::uint64_t cache_config(std::uint64_t cache)
+	{
+		return cache | (static_cast<std::uint64_t>(PERF_COUNT_HW_CACHE_OP_READ) << 8)
+		       | (static_cast<std::uint64_t>(PERF_COUNT_HW_CACHE_RESULT_MISS) << 16);
+	}
+
+	// In the order of PerfCounter
+	const CounterConfig COUNTER_CONFIGS[PERF_COUNTER_COUNT] = {
+			{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+			{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+			{PERF_TYPE_HW_CACHE, cache_config(PERF_COUNT_HW_CACHE_L1D)},
+			{PERF_TYPE_HW_CACHE, cache_config(PERF_COUNT_HW_CACHE_LL)},
+			{PERF_TYPE_HW_CACHE, cache_config(PERF_COUNT_HW_CACHE_DTLB)},
+			{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES}};
+
+	// Leads a new group with a group_fd of -1
+	int open_counter(const CounterConfig& config, int group_fd)
+	{
+		perf_event_attr attr;
+		std::memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = config.type;
+		attr.config = config.config;
+		attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		// Only the opening thread. Inherited counts are only added when a thread ends, which pool workers don't.
+		attr.inherit = 0;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0));
+	}
+#endif
+}
+
+const char* perf_counter_name(PerfCounter counter)
+{
+	switch(counter)
+	{
+	case PerfCounter::Cycles:
+		return "cycles";
+	case PerfCounter::Instructions:
+		return "instructions";
+	case PerfCounter::L1dMisses:
+		return "l1d_misses";
+	case PerfCounter::LlcMisses:
+		return "llc_misses";
+	case PerfCounter::DtlbMisses:
+		return "dtlb_misses";
+	case PerfCounter::BranchMisses:
+		return "branch_misses";
+	}
+	return "";
+}
+
+double PhaseCounts::get(Phase phase, PerfCounter counter) const
+{
+	return counts[static_cast<std::size_t>(phase)][static_cast<std::size_t>(counter)];
+}
+
+void PhaseCounts::add(const PhaseCounts& other)
+{
+	for(std::size_t phase = 0; phase < PHASE_COUNT; ++phase)
+	{
+		for(std::size_t counter = 0; counter < PERF_COUNTER_COUNT; ++counter)
+		{
+			counts[phase][counter] += other.counts[phase][counter];
+		}
+		samples[phase] += other.samples[phase];
+	}
+}
+
+PerfCounters::PerfCounters()
+: m_files(), m_positions(), m_group_size(0), m_leader(-1), m_start(), m_started(false), m_counts(), m_error()
+{
+	for(int& file : m_files)
+	{
+		file = -1;
+	}
+#ifdef __linux__
+	for(std::size_t i = 0; i < PERF_COUNTER_COUNT; ++i)
+	{
+		// The kernel refuses members the CPU can't count at the same time as the rest of the group
+		m_files[i] = open_counter(COUNTER_CONFIGS[i], m_leader);
+		if(m_files[i] >= 0)
+		{
+			m_leader = m_leader >= 0 ? m_leader : m_files[i];
+			m_positions[i] = m_group_size++;
+		}
+		else
+		{
+			m_error += std::string(m_error.empty() ? "" : ", ") + perf_counter_name(static_cast<PerfCounter>(i))
+			           + ": " + std::strerror(errno);
+		}
+	}
+	if(!m_error.empty())
+	{
+		m_error = "Counters not available (" + m_error + ")";
+	}
+#else
+	m_error = "Hardware counters need Linux perf_event_open";
+#endif
+}
+
+PerfCounters::~PerfCounters()
+{
+#ifdef __linux__
+	// Members first, then the leader
+	for(std::size_t i = PERF_COUNTER_COUNT; i-- > 0;)
+	{
+		if(m_files[i] >= 0)
+		{
+			::close(m_files[i]);
+		}
+	}
+#endif
+}
+
+bool PerfCounters::is_open() const
+{
+	return m_leader >= 0;
+}
+
+bool PerfCounters::has(PerfCounter counter) const
+{
+	return m_files[static_cast<std::size_t>(counter)] >= 0;
+}
+
+const std::string& PerfCounters::get_error() const
+{
+	return m_error;
+}
+
+void PerfCounters::begin()
+{
+	m_started = read(m_start);
+}
+
+void PerfCounters::end(Phase phase)
+{
+	Reading reading;
+	if(!m_started || !read(reading))
+	{
+		return;
+	}
+	m_started = false;
+	const std::size_t index = static_cast<std::size_t>(phase);
+	++m_counts.samples[index];
+	// Scaled by the share of the phase the group was on the CPU, the totals since opening can't be scaled
+	// before subtracting since the share changes over time
+	const std::uint64_t running = reading.time_running - m_start.time_running;
+	if(running == 0)
+	{
+		return;
+	}
+	const double scale = static_cast<double>(reading.time_enabled - m_start.time_enabled) / running;
+	for(std::size_t i = 0; i < PERF_COUNTER_COUNT; ++i)
+	{
+		if(m_files[i] >= 0)
+		{
+			const std::size_t position = m_positions[i];
+			m_counts.counts[index][i] += static_cast<double>(reading.values[position] - m_start.values[position])
+			                             * scale;
+		}
+	}
+}
+
+const PhaseCounts& PerfCounters::get_counts() const
+{
+	return m_counts;
+}
+
+void PerfCounters::reset()
+{
+	m_counts = PhaseCounts();
+}
+
+bool PerfCounters::read(Reading& reading) const
+{
+#ifdef __linux__
+	// Number of counters, time enabled, time running and then the values, all in one read
+	std::uint64_t data[3 + PERF_COUNTER_COUNT];
+	const ssize_t size = static_cast<ssize_t>((3 + m_group_size) * sizeof(std::uint64_t));
+	if(m_leader < 0 || ::read(m_leader, data, sizeof(data)) != size || data[0] != m_group_size)
+	{
+		return false;
+	}
+	reading.time_enabled = data[1];
+	reading.time_running = data[2];
+	for(std::size_t i = 0; i < m_group_size; ++i)
+	{
+		reading.values[i] = data[3 + i];
+	}
+	return true;
+#else
+	(void)reading;
+	return false;
+#endif
+}
@@ -0,0 +1,113 @@
+#ifndef SPELFYSIK_SLUTUPPGIFT_PERFCOUNTERS_H
+#define SPELFYSIK_SLUTUPPGIFT_PERFCOUNTERS_H
+
+#include "PhaseTimer.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Hardware events counted by PerfCounters
+enum class PerfCounter
+{
+	Cycles,
+	Instructions,
+	L1dMisses,
+	LlcMisses,
+	DtlbMisses,
+	BranchMisses
+};
+
+const std::size_t PERF_COUNTER_COUNT = 6;
+
+const char* perf_counter_name(PerfCounter counter);
+
+// Counter totals of every phase
+struct PhaseCounts
+{
+	// Indexed by Phase and PerfCounter
+	double counts[PHASE_COUNT][PERF_COUNTER_COUNT];
+	// Times each phase was counted
+	unsigned long long samples[PHASE_COUNT];
+
+	double get(Phase phase, PerfCounter counter) const;
+	void add(const PhaseCounts& other);
+};
+
+// Hardware performance counters of the calling thread alone, through Linux perf_event_open. Work handed to
+// other threads isn't counted, so the counts of a phase are only complete when it runs on one thread. The
+// counters are opened as one group, so the kernel schedules them together and their ratios are from the same
+// instructions. Counters the kernel doesn't allow, the CPU doesn't have or that don't fit in the group are left
+// out, which is common in containers and virtual machines. When other users take the counters the kernel
+// multiplexes the group, and the counts of a phase are scaled up to the time it was enabled during the phase.
+// Every phase costs two reads of the group, a few microseconds, so small simulations count slower than they run.
+class PerfCounters
+{
+public:
+	PerfCounters();
+	~PerfCounters();
+	PerfCounters(const PerfCounters&) = delete;
+	PerfCounters& operator=(const PerfCounters&) = delete;
+
+	// False if no counter could be opened
+	bool is_open() const;
+	bool has(PerfCounter counter) const;
+	// Says which counters are missing and why
+	const std::string& get_error() const;
+	// Start and end of a phase, begin() must come before every end()
+	void begin();
+	void end(Phase phase);
+	const PhaseCounts& get_counts() const;
+	void reset();
+
+private:
+	// Raw totals of the group since it was opened
+	struct Reading
+	{
+		// Indexed by position in the group, the leader first
+		std::uint64_t values[PERF_COUNTER_COUNT];
+		std::uint64_t time_enabled;
+		std::uint64_t time_running;
+	};
+
+	bool read(Reading& reading) const;
+
+	// -1 for counters that couldn't be opened, the first open one leads the group
+	int m_files[PERF_COUNTER_COUNT];
+	std::size_t m_positions[PERF_COUNTER_COUNT];
+	std::size_t m_group_size;
+	int m_leader;
+	Reading m_start;
+	bool m_started;
+	PhaseCounts m_counts;
+	std::string m_error;
+};
+
+// Counts the phase until it goes out of scope, does nothing if counters is null
+class ScopedPerfCounters
+{
+public:
+	ScopedPerfCounters(PerfCounters* counters, Phase phase)
+	: m_counters(counters), m_phase(phase)
+	{
+		if(m_counters)
+		{
+			m_counters->begin();
+		}
+	}
+	~ScopedPerfCounters()
+	{
+		if(m_counters)
+		{
+			m_counters->end(m_phase);
+		}
+	}
+	ScopedPerfCounters(const ScopedPerfCounters&) = delete;
+	ScopedPerfCounters& operator=(const ScopedPerfCounters&) = delete;
+
+private:
+	PerfCounters* const m_counters;
+	const Phase m_phase;
+};
+
+#endif //SPELFYSIK_SLUTUPPGIFT_PERFCOUNTERS_H
@@ -0,0 +1,122 @@
+#include "PhaseTimer.h"
+
+#include <algorithm>
+#include <sstream>
+
+const char* phase_name(Phase phase)
+{
+	switch(phase)
+	{
+	case Phase::Gravity:
+		return "Gravity";
+	case Phase::Integrate:
+		return "Integrate";
+	case Phase::Collisions:
+		return "Collisions";
+	case Phase::Compaction:
+		return "Compaction";
+	case Phase::Draw:
+		return "Draw";
+	case Phase::EndFrame:
+		return "End frame";
+	}
+	return "";
+}
+
+PhaseStats::PhaseStats(std::size_t window)
+: m_window(window > 0 ? window : 1), m_phases(), m_pairs()
+{
+	clear();
+}
+
+void PhaseStats::add(Phase phase, double duration)
+{
+	push(m_phases[static_cast<std::size_t>(phase)], duration);
+}
+
+void PhaseStats::add_pairs(unsigned long long pairs)
+{
+	push(m_pairs, static_cast<double>(pairs));
+}
+
+void PhaseStats::clear()
+{
+	for(Window& window : m_phases)
+	{
+		window = Window{std::vector<double>(m_window, 0.0), 0, 0};
+	}
+	m_pairs = Window{std::vector<double>(m_window, 0.0), 0, 0};
+}
+
+std::size_t PhaseStats::get_sample_count(Phase phase) const
+{
+	return m_phases[static_cast<std::size_t>(phase)].count;
+}
+
+double PhaseStats::get_mean(Phase phase) const
+{
+	const Window& window = m_phases[static_cast<std::size_t>(phase)];
+	return window.count > 0 ? sum(window) / window.count : 0.0;
+}
+
+double PhaseStats::get_p99(Phase phase) const
+{
+	const Window& window = m_phases[static_cast<std::size_t>(phase)];
+	if(window.count == 0)
+	{
+		return 0.0;
+	}
+	// The unused part of the window is at the end until it has filled up
+	std::vector<double> sorted(window.samples.begin(), window.samples.begin() + window.count);
+	const std::size_t rank = std::min(window.count - 1, window.count * 99 / 100);
+	std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+	return sorted[rank];
+}
+
+double PhaseStats::get_pairs_per_second() const
+{
+	const double seconds = sum(m_phases[static_cast<std::size_t>(Phase::Gravity)]);
+	return seconds > 0.0 ? sum(m_pairs) / seconds : 0.0;
+}
+
+double PhaseStats::get_gflops() const
+{
+	return get_pairs_per_second() * FLOPS_PER_PAIR * 1e-9;
+}
+
+std::string PhaseStats::describe() const
+{
+	std::ostringstream text;
+	text.precision(3);
+	text << "Phase: mean / p99 ms over the last " << m_window << " samples";
+	for(std::size_t i = 0; i < PHASE_COUNT; ++i)
+	{
+		const Phase phase = static_cast<Phase>(i);
+		if(get_sample_count(phase) > 0)
+		{
+			text << "\n" << phase_name(phase) << ": " << get_mean(phase) * 1e3 << " / " << get_p99(phase) * 1e3;
+		}
+	}
+	if(get_sample_count(Phase::Gravity) > 0)
+	{
+		text << "\n" << get_pairs_per_second() << " pairs/s, " << get_gflops() << " GFLOP/s";
+	}
+	return text.str();
+}
+
+void PhaseStats::push(Window& window, double value)
+{
+	window.samples[window.next] = value;
+	window.next = (window.next + 1) % window.samples.size();
+	window.count = std::min(window.count + 1, window.samples.size());
+}
+
+double PhaseStats::sum(const Window& window)
+{
+	double total = 0.0;
+	for(std::size_t i = 0; i < window.count; ++i)
+	{
+		total += window.samples[i];
+	}
+	return total;
+}
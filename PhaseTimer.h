@@ -0,0 +1,97 @@
+#ifndef SPELFYSIK_SLUTUPPGIFT_PHASETIMER_H
+#define SPELFYSIK_SLUTUPPGIFT_PHASETIMER_H
+
+#include "Trace.h"
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// The parts of a step and of a frame that get timed
+enum class Phase
+{
+	Gravity,
+	Integrate,
+	Collisions,
+	Compaction,
+	Draw,
+	EndFrame
+};
+
+const std::size_t PHASE_COUNT = 6;
+
+const char* phase_name(Phase phase);
+
+// Rolling statistics over the latest durations of every phase
+class PhaseStats
+{
+public:
+	// window is the number of latest samples kept per phase
+	explicit PhaseStats(std::size_t window = 240);
+	// In seconds
+	void add(Phase phase, double duration);
+	// Pair interactions of one gravity pass, added once per step like the gravity duration
+	void add_pairs(unsigned long long pairs);
+	void clear();
+
+	std::size_t get_sample_count(Phase phase) const;
+	// In seconds, over the window, 0 without samples
+	double get_mean(Phase phase) const;
+	double get_p99(Phase phase) const;
+	// Over the gravity samples in the window
+	double get_pairs_per_second() const;
+	double get_gflops() const;
+	// One line per phase with samples, then the gravity throughput
+	std::string describe() const;
+
+	// Floating point operations of one pair in the gravity, counting square roots and divisions as one
+	static const int FLOPS_PER_PAIR = 30;
+
+private:
+	struct Window
+	{
+		std::vector<double> samples;
+		std::size_t next;
+		std::size_t count;
+	};
+
+	void push(Window& window, double value);
+	static double sum(const Window& window);
+
+	const std::size_t m_window;
+	Window m_phases[PHASE_COUNT];
+	Window m_pairs;
+};
+
+// Adds the time until it goes out of scope to stats, does nothing if stats is null. Also shows up in traces.
+class ScopedPhaseTimer
+{
+public:
+	ScopedPhaseTimer(PhaseStats* stats, Phase phase)
+	: m_trace(phase < Phase::Draw ? "simulation" : "render", phase_name(phase)), m_stats(stats), m_phase(phase),
+	  m_start()
+	{
+		if(m_stats)
+		{
+			m_start = std::chrono::steady_clock::now();
+		}
+	}
+	~ScopedPhaseTimer()
+	{
+		if(m_stats)
+		{
+			m_stats->add(m_phase, std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count());
+		}
+	}
+	ScopedPhaseTimer(const ScopedPhaseTimer&) = delete;
+	ScopedPhaseTimer& operator=(const ScopedPhaseTimer&) = delete;
+
+private:
+	TraceScope m_trace;
+	PhaseStats* const m_stats;
+	const Phase m_phase;
+	std::chrono::steady_clock::time_point m_start;
+};
+
+#endif //SPELFYSIK_SLUTUPPGIFT_PHASETIMER_H
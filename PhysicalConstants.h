@@ -0,0 +1,12 @@
+#ifndef SPELFYSIK_SLUTUPPGIFT_PHYSICALCONSTANTS_H
+#define SPELFYSIK_SLUTUPPGIFT_PHYSICALCONSTANTS_H
+
+// The one definition of the constants the simulations, the initial conditions and the tools share
+namespace PhysicalConstants
+{
+	// In N*m^2/kg^2, 6.674*10^-11
+	constexpr double G = 0.00000000006674;
+	constexpr double PI = 3.141592653589793238463;
+}
+
+#endif //SPELFYSIK_SLUTUPPGIFT_PHYSICALCONSTANTS_H
@@ -0,0 +1,275 @@
+#include "SharedState.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	const std::size_t PAGE_SIZE = 4096;
+
+	std::size_t page_aligned(std::size_t size)
+	{
+		return (size + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+	}
+
+	// The sequence number lives in memory shared with other processes, which is fine for lock free atomics
+	static_assert(sizeof(std::atomic<std::uint64_t>) == sizeof(std::uint64_t), "Sequence must be a plain uint64");
+
+	std::atomic<std::uint64_t>* sequence_of(char* data)
+	{
+		return reinterpret_cast<std::atomic<std::uint64_t>*>(data + SharedStateFormat::SEQUENCE_OFFSET);
+	}
+
+	const std::atomic<std::uint64_t>* sequence_of(const char* data)
+	{
+		return reinterpret_cast<const std::atomic<std::uint64_t>*>(data + SharedStateFormat::SEQUENCE_OFFSET);
+	}
+}
+
+SharedStateExporter::SharedStateExporter(const std::string& name, const Simulation& simulation,
+                                         unsigned int interval, std::size_t capacity)
+: m_name(name),
+  m_error(),
+  m_interval(interval > 0 ? interval : 1),
+  m_data(nullptr),
+  m_size(0),
+  m_capacity(std::max(capacity, static_cast<std::size_t>(simulation.get_body_count()))),
+  m_updates(0)
+{
+	using namespace SharedStateFormat;
+#ifndef _WIN32
+	const std::size_t vector_size = page_aligned(3 * sizeof(double) * m_capacity);
+	const std::size_t scalar_size = page_aligned(sizeof(double) * m_capacity);
+	const std::size_t positions = page_aligned(HEADER_SIZE);
+	const std::size_t velocities = positions + vector_size;
+	const std::size_t masses = velocities + vector_size;
+	const std::size_t radii = masses + scalar_size;
+	const std::size_t ids = radii + scalar_size;
+	m_size = ids + page_aligned(sizeof(std::uint32_t) * m_capacity);
+
+	const int fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+	if(fd < 0)
+	{
+		m_error = "Could not create shared memory " + name;
+		return;
+	}
+	void* data = MAP_FAILED;
+	if(ftruncate(fd, m_size) == 0)
+	{
+		data = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	::close(fd);
+	if(data == MAP_FAILED)
+	{
+		shm_unlink(name.c_str());
+		m_error = "Could not map shared memory " + name;
+		return;
+	}
+	m_data = static_cast<char*>(data);
+
+	// A new segment is all zeroes, so the sequence number starts out even
+	std::memcpy(m_data, MAGIC, sizeof(MAGIC));
+	write_value(m_data + 8, VERSION);
+	write_value(m_data + 24, static_cast<std::uint64_t>(m_capacity));
+	write_value(m_data + 56, simulation.STEPSIZE);
+	write_value(m_data + 64, static_cast<std::uint64_t>(positions));
+	write_value(m_data + 72, static_cast<std::uint64_t>(velocities));
+	write_value(m_data + 80, static_cast<std::uint64_t>(masses));
+	write_value(m_data + 88, static_cast<std::uint64_t>(radii));
+	write_value(m_data + 96, static_cast<std::uint64_t>(ids));
+	publish(simulation);
+#else
+	m_error = "Shared memory export needs POSIX shared memory";
+#endif
+}
+
+SharedStateExporter::~SharedStateExporter()
+{
+#ifndef _WIN32
+	if(m_data)
+	{
+		munmap(m_data, m_size);
+		shm_unlink(m_name.c_str());
+	}
+#endif
+}
+
+bool SharedStateExporter::is_open() const
+{
+	return m_data != nullptr;
+}
+
+const std::string& SharedStateExporter::get_error() const
+{
+	return m_error;
+}
+
+const std::string& SharedStateExporter::get_name() const
+{
+	return m_name;
+}
+
+void SharedStateExporter::on_step(const Simulation& simulation)
+{
+	if(simulation.get_step_count() % m_interval == 0)
+	{
+		publish(simulation);
+	}
+}
+
+bool SharedStateExporter::publish(const Simulation& simulation)
+{
+	const std::size_t body_count = simulation.get_body_count();
+	if(!m_data || body_count > m_capacity)
+	{
+		return false;
+	}
+	std::atomic<std::uint64_t>* sequence = sequence_of(m_data);
+	const std::uint64_t start = sequence->load(std::memory_order_relaxed);
+	// Odd tells readers an update is in progress, and the fence keeps the writes below after it
+	sequence->store(start + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	write_value(m_data + 32, static_cast<std::uint64_t>(body_count));
+	write_value(m_data + 40, static_cast<std::uint64_t>(simulation.get_step_count()));
+	write_value(m_data + 48, simulation.get_elapsed_time());
+	simulation.copy_columns(reinterpret_cast<double*>(m_data + read_value<std::uint64_t>(m_data + 64)),
+	                        reinterpret_cast<double*>(m_data + read_value<std::uint64_t>(m_data + 72)),
+	                        reinterpret_cast<double*>(m_data + read_value<std::uint64_t>(m_data + 80)),
+	                        reinterpret_cast<double*>(m_data + read_value<std::uint64_t>(m_data + 88)),
+	                        reinterpret_cast<unsigned int*>(m_data + read_value<std::uint64_t>(m_data + 96)));
+
+	sequence->store(start + 2, std::memory_order_release);
+	++m_updates;
+	return true;
+}
+
+unsigned long long SharedStateExporter::get_updates() const
+{
+	return m_updates;
+}
+
+SharedStateReader::SharedStateReader(const std::string& name)
+: m_error(), m_data(nullptr), m_size(0)
+{
+	using namespace SharedStateFormat;
+#ifndef _WIN32
+	const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+	if(fd < 0)
+	{
+		m_error = "Could not open shared memory " + name;
+		return;
+	}
+	struct stat info;
+	void* data = MAP_FAILED;
+	if(fstat(fd, &info) == 0 && info.st_size > 0)
+	{
+		m_size = static_cast<std::size_t>(info.st_size);
+		data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	::close(fd);
+	if(data == MAP_FAILED)
+	{
+		m_error = "Could not map shared memory " + name;
+		return;
+	}
+	m_data = static_cast<const char*>(data);
+
+	bool valid = m_size >= HEADER_SIZE && std::memcmp(m_data, MAGIC, sizeof(MAGIC)) == 0
+	             && read_value<std::uint32_t>(m_data + 8) == VERSION;
+	// Every column has to fit the segment
+	const std::uint64_t capacity = valid ? read_value<std::uint64_t>(m_data + 24) : 0;
+	const std::uint64_t column_sizes[5] = {24 * capacity, 24 * capacity, 8 * capacity, 8 * capacity, 4 * capacity};
+	for(int column = 0; valid && column < 5; ++column)
+	{
+		const std::uint64_t offset = read_value<std::uint64_t>(m_data + 64 + 8 * column);
+		valid = offset >= HEADER_SIZE && offset <= m_size && column_sizes[column] <= m_size - offset;
+	}
+	if(!valid)
+	{
+		m_error = name + " is not an exported simulation state";
+	}
+#else
+	m_error = "Shared memory export needs POSIX shared memory";
+#endif
+}
+
+SharedStateReader::~SharedStateReader()
+{
+#ifndef _WIN32
+	if(m_data)
+	{
+		munmap(const_cast<char*>(m_data), m_size);
+	}
+#endif
+}
+
+bool SharedStateReader::is_valid() const
+{
+	return m_error.empty();
+}
+
+const std::string& SharedStateReader::get_error() const
+{
+	return m_error;
+}
+
+unsigned long long SharedStateReader::get_sequence() const
+{
+	return is_valid() ? sequence_of(m_data)->load(std::memory_order_acquire) / 2 * 2 : 0;
+}
+
+bool SharedStateReader::read(State& state, unsigned int max_attempts) const
+{
+	if(!is_valid())
+	{
+		return false;
+	}
+	const std::atomic<std::uint64_t>* sequence = sequence_of(m_data);
+	const std::uint64_t capacity = read_value<std::uint64_t>(m_data + 24);
+	for(unsigned int attempt = 0; attempt < max_attempts; ++attempt)
+	{
+		const std::uint64_t before = sequence->load(std::memory_order_acquire);
+		if(before % 2 != 0)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+		// Anything read here may be torn, so only trust it once the sequence number checks out
+		const std::uint64_t body_count = read_value<std::uint64_t>(m_data + 32);
+		if(body_count > capacity)
+		{
+			continue;
+		}
+		const std::size_t count = static_cast<std::size_t>(body_count);
+		state.step = read_value<std::uint64_t>(m_data + 40);
+		state.time = read_value<double>(m_data + 48);
+		state.step_size = read_value<double>(m_data + 56);
+		state.positions.resize(3 * count);
+		state.velocities.resize(3 * count);
+		state.masses.resize(count);
+		state.radii.resize(count);
+		state.ids.resize(count);
+		std::memcpy(state.positions.data(), m_data + read_value<std::uint64_t>(m_data + 64), 24 * count);
+		std::memcpy(state.velocities.data(), m_data + read_value<std::uint64_t>(m_data + 72), 24 * count);
+		std::memcpy(state.masses.data(), m_data + read_value<std::uint64_t>(m_data + 80), 8 * count);
+		std::memcpy(state.radii.data(), m_data + read_value<std::uint64_t>(m_data + 88), 8 * count);
+		std::memcpy(state.ids.data(), m_data + read_value<std::uint64_t>(m_data + 96), 4 * count);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if(sequence->load(std::memory_order_relaxed) == before)
+		{
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,116 @@
+#ifndef SPELFYSIK_SLUTUPPGIFT_SHAREDSTATE_H
+#define SPELFYSIK_SLUTUPPGIFT_SHAREDSTATE_H
+
+#include "Simulation.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Live simulation state in a POSIX shared memory segment, everything in host byte order:
+//
+//   Header
+//   0       8         magic "NBODYSH" followed by a zero byte
+//   8       4         uint32 version, currently 1
+//   12      4         uint32 reserved, 0
+//   16      8         uint64 sequence number, odd while the state is being updated
+//   24      8         uint64 capacity, the most bodies the columns have room for
+//   32      8         uint64 body count N
+//   40      8         uint64 step
+//   48      8         double time in seconds
+//   56      8         double step size in seconds
+//   64      8         uint64 offset of the positions, N * double x, y, z in meters
+//   72      8         uint64 offset of the velocities, N * double x, y, z in m/s
+//   80      8         uint64 offset of the masses, N * double in kg
+//   88      8         uint64 offset of the radii, N * double in meters
+//   96      8         uint64 offset of the ids, N * uint32
+//
+// Offsets are from the start of the segment and page aligned, and the columns never move, so a
+// reader can map them as arrays once. Only the first N entries of each column are valid.
+// The header is a seqlock: read the sequence number, wait while it's odd, read what you need and
+// read the sequence number again. If it changed the state was updated in between and the read has
+// to be retried. Readers that can't retry, like plain NumPy views, can see a torn update.
+namespace SharedStateFormat
+{
+	const char MAGIC[8] = {'N', 'B', 'O', 'D', 'Y', 'S', 'H', '\0'};
+	const std::uint32_t VERSION = 1;
+	const std::size_t HEADER_SIZE = 104;
+	const std::size_t SEQUENCE_OFFSET = 16;
+}
+
+// Copies the bodies into the shared segment every interval steps, straight from the bodies into the
+// columns in one pass. The segment is removed again when the exporter is destroyed.
+class SharedStateExporter : public SimulationObserver
+{
+public:
+	// name is a shm_open() name like "/nbody". The columns get room for capacity bodies,
+	// or for the current body count if that is larger.
+	SharedStateExporter(const std::string& name, const Simulation& simulation, unsigned int interval,
+	                    std::size_t capacity = 0);
+	~SharedStateExporter();
+	SharedStateExporter(const SharedStateExporter&) = delete;
+	SharedStateExporter& operator=(const SharedStateExporter&) = delete;
+
+	// False if the segment couldn't be created
+	bool is_open() const;
+	const std::string& get_error() const;
+	const std::string& get_name() const;
+	// Publishes the state if the step is on the export interval
+	void on_step(const Simulation& simulation) override;
+	// Publishes the state regardless of the step. Returns false if it doesn't fit the segment.
+	bool publish(const Simulation& simulation);
+	unsigned long long get_updates() const;
+
+private:
+	std::string m_name;
+	std::string m_error;
+	const unsigned int m_interval;
+	char* m_data;
+	std::size_t m_size;
+	std::size_t m_capacity;
+	unsigned long long m_updates;
+};
+
+// Consistent copies of the state exported by another process
+class SharedStateReader
+{
+public:
+	// A copy of the state, reusing its memory between reads
+	struct State
+	{
+		unsigned long long step;
+		double time;
+		double step_size;
+		std::vector<double> positions;
+		std::vector<double> velocities;
+		std::vector<double> masses;
+		std::vector<double> radii;
+		std::vector<unsigned int> ids;
+
+		std::size_t body_count() const
+		{
+			return ids.size();
+		}
+	};
+
+	explicit SharedStateReader(const std::string& name);
+	~SharedStateReader();
+	SharedStateReader(const SharedStateReader&) = delete;
+	SharedStateReader& operator=(const SharedStateReader&) = delete;
+
+	bool is_valid() const;
+	const std::string& get_error() const;
+	// Sequence number of the latest complete update, changes every time the state does
+	unsigned long long get_sequence() const;
+	// Copies the latest complete update, retrying while the exporter is writing.
+	// Returns false if no update finished within max_attempts tries.
+	bool read(State& state, unsigned int max_attempts = 1000) const;
+
+private:
+	std::string m_error;
+	const char* m_data;
+	std::size_t m_size;
+};
+
+#endif //SPELFYSIK_SLUTUPPGIFT_SHAREDSTATE_H
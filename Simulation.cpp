@@ -1,116 +1,231 @@
+#include <algorithm>
+#include <atomic>
 #include <deque>
 #include <unordered_map>
 #include <cmath>
 #include "Simulation.h"
+#include "PhysicalConstants.h"
+#include "AllocationTracker.h"
+#include "Parallel.h"
+#include "PhaseTimer.h"
+#include "PerfCounters.h"
+#include "Trace.h"
+#include "Checkpoint.h"
 
-const double Simulation::G = 0.00000000006674; //6.674*10^-11
-const double Simulation::PI = 3.141592653589793238463;
+const double Simulation::G = PhysicalConstants::G;
+const double Simulation::PI = PhysicalConstants::PI;
 
 namespace
 {
-	static const double D_RAND_MAX = static_cast<double>(RAND_MAX);
+	// Bodies per chunk when copying bodies in or out in parallel
+	const std::size_t COPY_CHUNK_SIZE = 1 << 15;
+	// Row blocks of the gravity, fixed so that reproducible sums don't depend on the thread count
+	const std::size_t GRAVITY_BLOCKS = 32;
+	// Bodies per chunk when adding up the partial forces
+	const std::size_t FORCE_CHUNK_SIZE = 1024;
+	// Bodies per partial sum of get_system_velocity()
+	const std::size_t VELOCITY_CHUNK_SIZE = 4096;
+	// Size of the blocks std::deque keeps its elements in, while they are smaller than that
+#ifdef _LIBCPP_VERSION
+	const std::size_t DEQUE_BLOCK_BYTES = 4096;
+#else
+	const std::size_t DEQUE_BLOCK_BYTES = 512;
+#endif
 
-	// Returns a random value in the range (-base*size/2, base*size/2)
-	double variance(double base, double size)
+	// First rows of blocks with about the same number of pairs each, the last entry being body_count
+	std::vector<std::size_t> gravity_block_rows(std::size_t body_count, std::size_t blocks)
 	{
-		double rand = static_cast<double>(std::rand()) / D_RAND_MAX;
-		return (base * size) * (rand - 0.5);
-	}
-
-	Vector3d random_step(double speed, double distribution, double step_size)
-	{
-		// Get random direction
-		double x, y, z;
-		// Loop because direction must not be all zeroes
-		do
+		std::vector<std::size_t> rows(blocks + 1, body_count);
+		rows[0] = 0;
+		const double pairs = 0.5 * body_count * (body_count - 1.0);
+		double pairs_so_far = 0.0;
+		std::size_t block = 1;
+		for(std::size_t row = 0; row < body_count && block < blocks; ++row)
 		{
-			x = (static_cast<double>(std::rand()) / D_RAND_MAX) - 0.5;
-			y = (static_cast<double>(std::rand()) / D_RAND_MAX) - 0.5;
-			z = (static_cast<double>(std::rand()) / D_RAND_MAX) - 0.5;
+			while(block < blocks && pairs_so_far >= pairs * block / blocks)
+			{
+				rows[block++] = row;
+			}
+			pairs_so_far += body_count - 1 - row;
 		}
-		while(x == 0.0 && y == 0.0 && z == 0.0);
-		Vector3d direction(x, y, z);
-		direction.normalize();
-
-		// Get random speed
-		double rand_speed = variance(speed, distribution);
-
-		// Return step of the correct size
-		return direction * (rand_speed * step_size);
+		return rows;
 	}
+
+	// Momentum and mass of some bodies, for the system velocity
+	struct MomentumSum
+	{
+		Vector3d momentum;
+		double mass;
+	};
 }
 
 Simulation::Simulation(const SimulationInitialConditions& cond)
-: STEPSIZE(cond.step_size), m_bodies()
+: Simulation(*make_initial_condition_generator(cond), cond.step_size)
+{
+}
+
+Simulation::Simulation(const InitialConditionGenerator& generator, double step_size)
+: STEPSIZE(step_size), m_bodies(), m_step_count(0), m_next_id(0), m_observers(),
+  m_merge_ids(), m_merge_masses(), m_thread_count(1), m_reduction_mode(ReductionMode::Fast), m_force_partials(),
+  m_phase_stats(nullptr), m_perf_counters(nullptr)
 {
-	std::srand(cond.random_seed);
-
-	const double dist = cond.distribution;
-	const double hd = dist / 2.0;
-	const double average_mass = cond.system_mass / cond.number_of_bodies;
-	// Due to rounding we'll likely be placing a bit too few bodies. But who's counting?
-	const int quadrant_side = static_cast<int>(std::sqrt(cond.number_of_bodies / 4.0));
-	for(int i = 0; i < quadrant_side; ++i)
+	MemoryScope memory(MemoryTag::Bodies);
+	// Make room for every body up front so the chunks can be filled in concurrently
+	const Body empty_body({0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}, 0.0, 0);
+	m_bodies.resize(generator.body_count(), empty_body);
+	m_next_id = m_bodies.size();
+	parallel_for_chunks(generator.body_count(), generator.chunk_size(),
+	                    [&](std::size_t chunk, std::size_t begin, std::size_t end)
 	{
-		for(int j = 0; j < quadrant_side; ++j)
+		generator.generate(chunk, begin, end,
+		                   [&](std::size_t index, const Vector3d& position, const Vector3d& previous_position, double mass)
 		{
-			const double x_base = hd + i*cond.distribution;
-			const double y_base = hd + j*cond.distribution;
-
-			for(int k = 0; k < 4; ++k)
-			{
-				double x_pos = x_base + variance(cond.distribution, cond.distribution_variance);
-				double y_pos = y_base + variance(cond.distribution, cond.distribution_variance);
-				Vector3d position(0.0, 0.0, 0.0);
+			m_bodies[index] = Body(position, previous_position, mass, index);
+		});
+	});
+}
 
-				switch(k)
-				{
-				case 0:
-					// First quadrant +x +y
-					position = Vector3d(x_pos, y_pos, 0.0);
-					break;
-				case 1:
-					// Second quadrant +x -y
-					position = Vector3d(x_pos, -y_pos, 0.0);
-					break;
-				case 2:
-					// Third quadrant -x -y
-					position = Vector3d(-x_pos, -y_pos, 0.0);
-					break;
-				case 3:
-					// Forth quadrant -x +y
-					position = Vector3d(-x_pos, y_pos, 0.0);
-					break;
-				}
-				double mass = average_mass + variance(average_mass, cond.mass_variance);
-				Vector3d previous_pos = position + random_step(cond.speed, cond.speed_variance, STEPSIZE);
-				m_bodies.emplace_back(position, previous_pos, mass);
-			}
+Simulation::Simulation(const CheckpointFile& checkpoint)
+: STEPSIZE(checkpoint.get_data().step_size),
+  m_bodies(),
+  m_step_count(checkpoint.get_data().step_count),
+  m_next_id(checkpoint.get_data().next_id),
+  m_observers(),
+  m_merge_ids(),
+  m_merge_masses(),
+  m_thread_count(1),
+  m_reduction_mode(ReductionMode::Fast),
+  m_force_partials(),
+  m_phase_stats(nullptr),
+  m_perf_counters(nullptr)
+{
+	MemoryScope memory(MemoryTag::Bodies);
+	const CheckpointData& data = checkpoint.get_data();
+	const Body empty_body({0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}, 0.0, 0);
+	m_bodies.resize(data.body_count, empty_body);
+	parallel_for_chunks(data.body_count, COPY_CHUNK_SIZE, [&](std::size_t, std::size_t begin, std::size_t end)
+	{
+		for(std::size_t i = begin; i < end; ++i)
+		{
+			const double* p = data.positions + 3 * i;
+			const double* pp = data.previous_positions + 3 * i;
+			Body& body = m_bodies[i];
+			const unsigned int id = data.ids ? data.ids[i] : i;
+			body = Body({p[0], p[1], p[2]}, {pp[0], pp[1], pp[2]}, data.masses[i], id);
+			body.radius = data.radii[i];
 		}
-	}
+	});
 }
 
 void Simulation::simulate(int steps)
 {
 	for(int i = 0; i < steps; ++i)
 	{
-		calculate_gravity();
-		integrate();
-		handle_collisions();
-		m_bodies.erase(std::remove_if(m_bodies.begin(), m_bodies.end(), [](const Body& b){return b.remove;}), m_bodies.end());
+		TraceScope trace("simulation", "Step");
+		if(m_phase_stats)
+		{
+			const unsigned long long body_count = m_bodies.size();
+			m_phase_stats->add_pairs(body_count > 1 ? body_count * (body_count - 1) / 2 : 0);
+		}
+		{
+			ScopedPhaseTimer timer(m_phase_stats, Phase::Gravity);
+			ScopedPerfCounters counters(m_perf_counters, Phase::Gravity);
+			MemoryScope memory(MemoryTag::Gravity);
+			calculate_gravity();
+		}
+		{
+			ScopedPhaseTimer timer(m_phase_stats, Phase::Integrate);
+			ScopedPerfCounters counters(m_perf_counters, Phase::Integrate);
+			integrate();
+		}
+		{
+			ScopedPhaseTimer timer(m_phase_stats, Phase::Collisions);
+			ScopedPerfCounters counters(m_perf_counters, Phase::Collisions);
+			MemoryScope memory(MemoryTag::Collisions);
+			handle_collisions();
+		}
+		{
+			ScopedPhaseTimer timer(m_phase_stats, Phase::Compaction);
+			ScopedPerfCounters counters(m_perf_counters, Phase::Compaction);
+			MemoryScope memory(MemoryTag::Bodies);
+			remove_merged_bodies();
+		}
+		++m_step_count;
+		TraceScope observers_trace("simulation", "Observers");
+		MemoryScope memory(MemoryTag::Observers);
+		for(SimulationObserver* observer : m_observers)
+		{
+			observer->on_step(*this);
+		}
 	}
 }
 
-void Simulation::draw(Graphics& drawer)
+void Simulation::set_parallelism(unsigned int thread_count, ReductionMode mode)
 {
-	for(Body& i : m_bodies)
-	{
-		drawer.draw_sphere(i.position, i.radius);
-	}
+	m_thread_count = thread_count > 0 ? thread_count : 1;
+	m_reduction_mode = mode;
+}
+
+void Simulation::set_phase_stats(PhaseStats* stats)
+{
+	m_phase_stats = stats;
+}
+
+void Simulation::set_perf_counters(PerfCounters* counters)
+{
+	m_perf_counters = counters;
 }
 
 Vector3d Simulation::get_system_velocity() const
 {
+	if(m_thread_count > 1 || m_reduction_mode == ReductionMode::Reproducible)
+	{
+		const std::size_t body_count = m_bodies.size();
+		const std::size_t chunks = (body_count + VELOCITY_CHUNK_SIZE - 1) / VELOCITY_CHUNK_SIZE;
+		const bool reproducible = m_reduction_mode == ReductionMode::Reproducible;
+		// One sum per chunk, or one per thread that takes chunks as they come
+		std::vector<MomentumSum> sums(reproducible ? chunks : m_thread_count, MomentumSum{{0.0, 0.0, 0.0}, 0.0});
+		auto add_chunk = [&](std::size_t chunk, MomentumSum& sum)
+		{
+			const std::size_t end = std::min(body_count, (chunk + 1) * VELOCITY_CHUNK_SIZE);
+			for(std::size_t i = chunk * VELOCITY_CHUNK_SIZE; i < end; ++i)
+			{
+				const Body& body = m_bodies[i];
+				sum.momentum += (body.position - body.previous_position) * (1.0 / STEPSIZE) * body.mass;
+				sum.mass += body.mass;
+			}
+		};
+		if(reproducible)
+		{
+			parallel_for_chunks(chunks, 1, [&](std::size_t chunk, std::size_t, std::size_t)
+			{
+				add_chunk(chunk, sums[chunk]);
+			}, m_thread_count);
+			reduce_tree(sums.size(), [&](std::size_t target, std::size_t source)
+			{
+				sums[target].momentum += sums[source].momentum;
+				sums[target].mass += sums[source].mass;
+			});
+		}
+		else
+		{
+			std::atomic<std::size_t> next_chunk(0);
+			parallel_workers(m_thread_count, [&](unsigned int worker)
+			{
+				for(std::size_t chunk = next_chunk++; chunk < chunks; chunk = next_chunk++)
+				{
+					add_chunk(chunk, sums[worker]);
+				}
+			});
+			for(std::size_t worker = 1; worker < sums.size(); ++worker)
+			{
+				sums[0].momentum += sums[worker].momentum;
+				sums[0].mass += sums[worker].mass;
+			}
+		}
+		return sums.empty() ? Vector3d(0.0, 0.0, 0.0) : sums[0].momentum * (1.0 / sums[0].mass);
+	}
+
 	Vector3d velocity(0.0, 0.0, 0.0);
 	double system_mass = 0.0;
 	for(const Body& i : m_bodies)
@@ -128,8 +243,191 @@ int Simulation::get_body_count() const
 	return m_bodies.size();
 }
 
+unsigned long long Simulation::get_step_count() const
+{
+	return m_step_count;
+}
+
+std::size_t Simulation::get_bytes_per_body()
+{
+	return sizeof(Body);
+}
+
+std::size_t Simulation::estimate_bytes(std::size_t body_count, unsigned int thread_count, ReductionMode mode)
+{
+	// m_bodies: whole blocks, one of them partly empty, and the array of pointers to them. It starts with room
+	// for 8 and grows to about twice the blocks.
+	const std::size_t bodies_per_block = std::max<std::size_t>(DEQUE_BLOCK_BYTES / sizeof(Body), 1);
+	const std::size_t blocks = body_count / bodies_per_block + 1;
+	std::size_t bytes = blocks * bodies_per_block * sizeof(Body)
+	                    + std::max<std::size_t>(2 * (blocks + 1), 8) * sizeof(Body*);
+	// Same partials as calculate_gravity_blocks()
+	if(body_count > 1 && (thread_count > 1 || mode == ReductionMode::Reproducible))
+	{
+		const std::size_t partial_count = mode == ReductionMode::Reproducible ? std::min(GRAVITY_BLOCKS, body_count)
+		                                                                      : thread_count;
+		bytes += partial_count * 3 * body_count * sizeof(double);
+	}
+	return bytes;
+}
+
+double Simulation::get_elapsed_time() const
+{
+	return m_step_count * STEPSIZE;
+}
+
+bool Simulation::write_checkpoint(const std::string& path) const
+{
+	const std::size_t body_count = m_bodies.size();
+	CheckpointWriter writer(body_count, m_step_count, m_next_id, get_elapsed_time(), STEPSIZE);
+	double* positions = writer.positions();
+	double* previous_positions = writer.previous_positions();
+	double* masses = writer.masses();
+	double* radii = writer.radii();
+	std::uint64_t* ids = writer.ids();
+	parallel_for_chunks(body_count, COPY_CHUNK_SIZE, [&](std::size_t, std::size_t begin, std::size_t end)
+	{
+		for(std::size_t i = begin; i < end; ++i)
+		{
+			const Body& body = m_bodies[i];
+			positions[3 * i] = body.position.get_x();
+			positions[3 * i + 1] = body.position.get_y();
+			positions[3 * i + 2] = body.position.get_z();
+			previous_positions[3 * i] = body.previous_position.get_x();
+			previous_positions[3 * i + 1] = body.previous_position.get_y();
+			previous_positions[3 * i + 2] = body.previous_position.get_z();
+			masses[i] = body.mass;
+			radii[i] = body.radius;
+			ids[i] = body.id;
+		}
+	});
+	return writer.write(path);
+}
+
+bool Simulation::write_checkpoint_after_fork(const char* path, const char* temporary_path) const
+{
+	CheckpointStreamWriter writer(m_bodies.size(), m_step_count, m_next_id, get_elapsed_time(), STEPSIZE);
+	if(!writer.open(temporary_path))
+	{
+		return false;
+	}
+	// Column by column, in the order of the file
+	for(const Body& body : m_bodies)
+	{
+		writer.add(body.position.get_x());
+		writer.add(body.position.get_y());
+		writer.add(body.position.get_z());
+	}
+	for(const Body& body : m_bodies)
+	{
+		writer.add(body.previous_position.get_x());
+		writer.add(body.previous_position.get_y());
+		writer.add(body.previous_position.get_z());
+	}
+	for(const Body& body : m_bodies)
+	{
+		writer.add(body.mass);
+	}
+	for(const Body& body : m_bodies)
+	{
+		writer.add(body.radius);
+	}
+	for(const Body& body : m_bodies)
+	{
+		writer.add(static_cast<std::uint64_t>(body.id));
+	}
+	return writer.finish(path);
+}
+
+void Simulation::copy_snapshot(Snapshot& snapshot) const
+{
+	const std::size_t body_count = m_bodies.size();
+	snapshot.step = m_step_count;
+	snapshot.time = get_elapsed_time();
+	snapshot.ids.resize(body_count);
+	snapshot.positions.resize(3 * body_count);
+	snapshot.radii.resize(body_count);
+	unsigned int* ids = snapshot.ids.data();
+	double* positions = snapshot.positions.data();
+	double* radii = snapshot.radii.data();
+	for(const Body& body : m_bodies)
+	{
+		*ids++ = body.id;
+		*positions++ = body.position.get_x();
+		*positions++ = body.position.get_y();
+		*positions++ = body.position.get_z();
+		*radii++ = body.radius;
+	}
+}
+
+void Simulation::copy_forces(double* forces) const
+{
+	// Integration clears the forces after every step, so calculate them again on a copy
+	Simulation copy(*this);
+	copy.calculate_gravity();
+	for(const Body& body : copy.m_bodies)
+	{
+		*forces++ = body.incoming_force.get_x();
+		*forces++ = body.incoming_force.get_y();
+		*forces++ = body.incoming_force.get_z();
+	}
+}
+
+void Simulation::copy_columns(double* positions, double* velocities, double* masses, double* radii,
+                              unsigned int* ids) const
+{
+	parallel_for_chunks(m_bodies.size(), COPY_CHUNK_SIZE, [&](std::size_t, std::size_t begin, std::size_t end)
+	{
+		for(std::size_t i = begin; i < end; ++i)
+		{
+			const Body& body = m_bodies[i];
+			if(positions)
+			{
+				positions[3 * i] = body.position.get_x();
+				positions[3 * i + 1] = body.position.get_y();
+				positions[3 * i + 2] = body.position.get_z();
+			}
+			if(velocities)
+			{
+				// Same estimate as get_system_velocity()
+				const Vector3d velocity = (body.position - body.previous_position) * (1.0 / STEPSIZE);
+				velocities[3 * i] = velocity.get_x();
+				velocities[3 * i + 1] = velocity.get_y();
+				velocities[3 * i + 2] = velocity.get_z();
+			}
+			if(masses)
+			{
+				masses[i] = body.mass;
+			}
+			if(radii)
+			{
+				radii[i] = body.radius;
+			}
+			if(ids)
+			{
+				ids[i] = body.id;
+			}
+		}
+	});
+}
+
+void Simulation::add_observer(SimulationObserver* observer)
+{
+	m_observers.push_back(observer);
+}
+
+void Simulation::remove_observer(SimulationObserver* observer)
+{
+	m_observers.erase(std::remove(m_observers.begin(), m_observers.end(), observer), m_observers.end());
+}
+
 void Simulation::calculate_gravity()
 {
+	if(m_thread_count > 1 || m_reduction_mode == ReductionMode::Reproducible)
+	{
+		calculate_gravity_blocks();
+		return;
+	}
 	const unsigned int body_count = m_bodies.size();
 	for(unsigned int i = 0; i < body_count; ++i)
 	{
@@ -147,6 +445,103 @@ void Simulation::calculate_gravity()
 	}
 }
 
+void Simulation::calculate_gravity_blocks()
+{
+	const std::size_t body_count = m_bodies.size();
+	if(body_count < 2)
+	{
+		return;
+	}
+	const std::size_t blocks = std::min(GRAVITY_BLOCKS, body_count);
+	const std::vector<std::size_t> block_rows = gravity_block_rows(body_count, blocks);
+	const bool reproducible = m_reduction_mode == ReductionMode::Reproducible;
+	// Reproducible sums keep every block apart, fast ones only every thread
+	const std::size_t partial_count = reproducible ? blocks : m_thread_count;
+	const std::size_t partial_size = 3 * body_count;
+	m_force_partials.resize(partial_count * partial_size);
+
+	// Same order of operations as calculate_gravity() within a block. Rows only push forces onto
+	// themselves and later bodies, so a block never touches the partial forces before its first row.
+	auto add_block = [&](std::size_t block, double* partial)
+	{
+		for(std::size_t i = block_rows[block]; i < block_rows[block + 1]; ++i)
+		{
+			const Body& I = m_bodies[i];
+			Vector3d i_force(partial[3 * i], partial[3 * i + 1], partial[3 * i + 2]);
+			for(std::size_t j = i + 1; j < body_count; ++j)
+			{
+				const Body& J = m_bodies[j];
+				Vector3d direction = J.position - I.position;
+				double distance_squared = direction.length_squared();
+				direction.normalize();
+				Vector3d force = direction * (G * I.mass * J.mass / distance_squared);
+				i_force += force;
+				partial[3 * j] -= force.get_x();
+				partial[3 * j + 1] -= force.get_y();
+				partial[3 * j + 2] -= force.get_z();
+			}
+			partial[3 * i] = i_force.get_x();
+			partial[3 * i + 1] = i_force.get_y();
+			partial[3 * i + 2] = i_force.get_z();
+		}
+	};
+
+	if(reproducible)
+	{
+		parallel_for_chunks(blocks, 1, [&](std::size_t block, std::size_t, std::size_t)
+		{
+			double* partial = &m_force_partials[block * partial_size];
+			std::fill(partial + 3 * block_rows[block], partial + partial_size, 0.0);
+			add_block(block, partial);
+		}, m_thread_count);
+	}
+	else
+	{
+		std::atomic<std::size_t> next_block(0);
+		parallel_workers(m_thread_count, [&](unsigned int worker)
+		{
+			double* partial = &m_force_partials[worker * partial_size];
+			std::fill(partial, partial + partial_size, 0.0);
+			for(std::size_t block = next_block++; block < blocks; block = next_block++)
+			{
+				add_block(block, partial);
+			}
+		});
+	}
+
+	parallel_for_chunks(body_count, FORCE_CHUNK_SIZE, [&](std::size_t, std::size_t begin, std::size_t end)
+	{
+		double* total = m_force_partials.data();
+		if(reproducible)
+		{
+			// Sources only hold forces from their first row on
+			reduce_tree(blocks, [&](std::size_t target, std::size_t source)
+			{
+				const double* partial = &m_force_partials[source * partial_size];
+				for(std::size_t k = 3 * std::max(begin, block_rows[source]); k < 3 * end; ++k)
+				{
+					total[target * partial_size + k] += partial[k];
+				}
+			});
+		}
+		else
+		{
+			for(std::size_t worker = 1; worker < partial_count; ++worker)
+			{
+				const double* partial = &m_force_partials[worker * partial_size];
+				for(std::size_t k = 3 * begin; k < 3 * end; ++k)
+				{
+					total[k] += partial[k];
+				}
+			}
+		}
+		for(std::size_t i = begin; i < end; ++i)
+		{
+			m_bodies[i].incoming_force = Vector3d(total[3 * i], total[3 * i + 1], total[3 * i + 2]);
+		}
+	}, m_thread_count);
+}
+
 void Simulation::integrate()
 {
 	// Using Strmer-Verlet, because velocity is lame
@@ -165,7 +560,8 @@ void Simulation::handle_collisions()
 	typedef std::vector<Body*> MergeList;
 	// Important! Deque does not invalidate member pointers on insert
 	std::deque<MergeList> merge_lists;
-	std::unordered_map<unsigned int, MergeList*> merge_look_up;
+	// Every body in a merge list points to that list here
+	std::unordered_map<const Body*, MergeList*> merge_look_up;
 	const unsigned int body_count = m_bodies.size();
 	// Identify colliding objects and put them in together in "merge lists"
 	for(unsigned int i = 0; i < body_count ; ++i)
@@ -178,38 +574,46 @@ void Simulation::handle_collisions()
 			if(distance <= J.radius + I.radius)
 			{
 				// Check if they already are to be merged
-				bool i_merging = merge_look_up.count(i);
-				bool j_merging = merge_look_up.count(j);
+				bool i_merging = merge_look_up.count(&I);
+				bool j_merging = merge_look_up.count(&J);
 				if(!i_merging && !j_merging)
 				{
 					// Create new merge list
 					merge_lists.emplace_back(std::initializer_list<Body*>{&I, &J});
 					MergeList* mlp = &merge_lists.back();
-					merge_look_up[i] = mlp;
-					merge_look_up[j] = mlp;
+					merge_look_up[&I] = mlp;
+					merge_look_up[&J] = mlp;
 				}
 				else if(i_merging && !j_merging)
 				{
-					// Add j to i's merge list
-					merge_look_up[i]->push_back(&J);
+					// Add j to i's merge list, j must point to it too or a later collision starts a second list for it
+					MergeList* mlp = merge_look_up[&I];
+					mlp->push_back(&J);
+					merge_look_up[&J] = mlp;
 				}
 				else if(!i_merging && j_merging)
 				{
 					// Add i to j's merge list
-					merge_look_up[j]->push_back(&I);
+					MergeList* mlp = merge_look_up[&J];
+					mlp->push_back(&I);
+					merge_look_up[&I] = mlp;
 				}
 				else //if(i_merging && j_merging) We don't need this check
 				{
-					MergeList* mlp1 = merge_look_up[i];
-					MergeList* mlp2 = merge_look_up[j];
+					MergeList* mlp1 = merge_look_up[&I];
+					MergeList* mlp2 = merge_look_up[&J];
 					if(mlp1 != mlp2)
 					{
 						// They are in different merge lists
-						// Merge the two merge lists
+						// Merge the two merge lists, every body of the emptied one has to point to the other
+						// one, not only j, or a later collision adds to the emptied list again
+						for(const Body* body : *mlp2)
+						{
+							merge_look_up[body] = mlp1;
+						}
 						mlp1->reserve(mlp1->size() + mlp2->size());
 						mlp1->insert(mlp1->end(), mlp2->begin(), mlp2->end());
 						mlp2->clear();
-						merge_look_up[j] = mlp1;
 					}
 				}
 			}
@@ -219,7 +623,12 @@ void Simulation::handle_collisions()
 	// Merge all colliding objects
 	for(MergeList& ml : merge_lists)
 	{
-		Body new_body({0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}, 0.0);
+		// Lists that were merged into others are empty, and would give a body without mass
+		if(ml.empty())
+		{
+			continue;
+		}
+		Body new_body({0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}, 0.0, m_next_id++);
 		for(Body* body : ml)
 		{
 			new_body.mass += body->mass;
@@ -234,17 +643,40 @@ void Simulation::handle_collisions()
 			new_body.previous_position += (new_body.inverse_mass * body->mass) * body->previous_position;
 		}
 		new_body.radius = radius_from_mass(new_body.mass);
+		if(!m_observers.empty())
+		{
+			m_merge_ids.clear();
+			m_merge_masses.clear();
+			for(const Body* body : ml)
+			{
+				m_merge_ids.push_back(body->id);
+				m_merge_masses.push_back(body->mass);
+			}
+			const MergeEvent merge = {m_step_count + 1, new_body.id, new_body.mass, new_body.position, ml.size(),
+			                          m_merge_ids.data(), m_merge_masses.data()};
+			for(SimulationObserver* observer : m_observers)
+			{
+				observer->on_merge(*this, merge);
+			}
+		}
+		MemoryScope memory(MemoryTag::Bodies);
 		m_bodies.push_back(new_body);
 	}
 }
 
-Simulation::Body::Body(Vector3d position, Vector3d previous_position, double mass)
+void Simulation::remove_merged_bodies()
+{
+	m_bodies.erase(std::remove_if(m_bodies.begin(), m_bodies.end(), [](const Body& b){return b.remove;}), m_bodies.end());
+}
+
+Simulation::Body::Body(Vector3d position, Vector3d previous_position, double mass, unsigned int id)
 : position(position),
   previous_position(previous_position),
   incoming_force(0.0, 0.0, 0.0),
   mass(mass),
   inverse_mass(mass > 0.0 ? 1.0/mass : 0.0), // Don't divide by zero
   radius(radius_from_mass(mass)),
+  id(id),
   remove(false)
 {
 }
@@ -2,12 +2,48 @@
 #define SPELFYSIK_SLUTUPPGIFT_SIMULATION_H
 
 #include "Vector3d.h"
-#include "Graphics.h"
+#include "InitialConditions.h"
+#include "Snapshot.h"
 
 #include <deque>
+#include <string>
+#include <vector>
+
+class CheckpointFile;
+class Graphics;
+class PhaseStats;
+class PerfCounters;
+class Simulation;
+
+// Bodies that collided during a step and the body they became
+struct MergeEvent
+{
+	// Step count after the step the merge happened in
+	unsigned long long step;
+	unsigned int id;
+	// In kg
+	double mass;
+	// In meters, center of mass of the participants
+	Vector3d position;
+	std::size_t participant_count;
+	const unsigned int* participant_ids;
+	// In kg
+	const double* participant_masses;
+};
+
+// Gets called after every step of Simulation::simulate(), on the simulating thread
+class SimulationObserver
+{
+public:
+	virtual ~SimulationObserver() {}
+	virtual void on_step(const Simulation& simulation) = 0;
+	// Called for every merge while the step is still in progress, so only the event is valid
+	virtual void on_merge(const Simulation&, const MergeEvent&) {}
+};
 
 struct SimulationInitialConditions
 {
+	InitialLayout layout;
 	int step_size;
 	int random_seed;
 	// No guarantees that it will give exactly this amount of bodies
@@ -26,27 +62,76 @@ struct SimulationInitialConditions
 	double speed_variance;
 };
 
+// How sums over bodies computed by several threads are added up
+enum class ReductionMode
+{
+	// In whatever way the work was split between the threads, so the last bits can change from run to run
+	Fast,
+	// Over fixed blocks in a fixed tree, bit for bit the same for any thread count
+	Reproducible
+};
+
 class Simulation
 {
 public:
 	Simulation(const SimulationInitialConditions& conditions);
+	Simulation(const InitialConditionGenerator& generator, double step_size);
+	// Continues the run saved in a valid checkpoint
+	Simulation(const CheckpointFile& checkpoint);
 	void simulate(int steps);
+	// Threads for the gravity and get_system_velocity(), 1 and fast by default. Collisions stay serial.
+	void set_parallelism(unsigned int thread_count, ReductionMode mode);
+	// Times the phases of every step into stats, which is not owned. Null, the default, turns it off.
+	void set_phase_stats(PhaseStats* stats);
+	// Reads hardware counters around the phases of every step, the same way. They must have been opened on
+	// the thread that calls simulate(), and with more than one thread they miss the share of the others.
+	void set_perf_counters(PerfCounters* counters);
+	// Defined with the graphics (SimulationDraw.cpp), so the physics builds without them
 	void draw(Graphics& drawer);
 	Vector3d get_system_velocity() const;
 	int get_body_count() const;
+	unsigned long long get_step_count() const;
+	// Memory per body, for comparing layouts
+	static std::size_t get_bytes_per_body();
+	// Heap a run is expected to need at most: the bodies with the overhead of their deque and the partial forces
+	// of the threads. Collisions add a little on top while few bodies merge at once.
+	static std::size_t estimate_bytes(std::size_t body_count, unsigned int thread_count, ReductionMode mode);
+	// In seconds
+	double get_elapsed_time() const;
+	// Saves everything needed to continue the run bit for bit. Returns false on failure.
+	bool write_checkpoint(const std::string& path) const;
+	// The same checkpoint written on the calling thread without touching the heap, for a forked child.
+	// It goes to temporary_path first and is renamed to path once complete.
+	bool write_checkpoint_after_fork(const char* path, const char* temporary_path) const;
+	// Copies the current bodies into snapshot, reusing its memory
+	void copy_snapshot(Snapshot& snapshot) const;
+	// Copies the current bodies into caller owned columns with room for every body, in parallel.
+	// Positions and velocities are x, y, z interleaved, columns that aren't wanted can be null.
+	void copy_columns(double* positions, double* velocities, double* masses, double* radii, unsigned int* ids) const;
+	// The gravity on every body in newtons as the next step will compute it, x, y, z interleaved
+	void copy_forces(double* forces) const;
+	// Observers are not owned and must be removed before they are destroyed
+	void add_observer(SimulationObserver* observer);
+	void remove_observer(SimulationObserver* observer);
 
 	// In seconds
 	const double STEPSIZE;
 
 private:
+	// The microbenchmarks time the phases of a step one by one
+	friend class KernelBenchmark;
+
 	void calculate_gravity();
+	// The gravity split into blocks of rows, for more than one thread or reproducible sums
+	void calculate_gravity_blocks();
 	void integrate();
 	void handle_collisions();
+	void remove_merged_bodies();
 	static double radius_from_mass(double mass);
 
 	struct Body
 	{
-		Body(Vector3d position, Vector3d previous_position, double mass);
+		Body(Vector3d position, Vector3d previous_position, double mass, unsigned int id);
 		// meters
 		Vector3d position;
 		Vector3d previous_position;
@@ -58,15 +143,41 @@ private:
 		double inverse_mass;
 		// meters
 		double radius;
+		// Stays the same for the life of the body, merged bodies get a new one
+		unsigned int id;
 		bool remove;
 	};
 
 	// Deque should give better performance when removing
 	// elements and for very large collections
 	std::deque<Body> m_bodies;
+	unsigned long long m_step_count;
+	unsigned int m_next_id;
+	std::vector<SimulationObserver*> m_observers;
+	// Reused for the participants of merge events
+	std::vector<unsigned int> m_merge_ids;
+	std::vector<double> m_merge_masses;
+	unsigned int m_thread_count;
+	ReductionMode m_reduction_mode;
+	// Partial forces of every block or thread, x, y, z interleaved
+	std::vector<double> m_force_partials;
+	PhaseStats* m_phase_stats;
+	PerfCounters* m_perf_counters;
 	// In N*m^2/kg^2
 	static const double G;
 	static const double PI;
 };
 
+// Runs any number of steps on Simulation, SimulationFloat or SimulationBatch, whose simulate() takes an int
+template<typename SimulationType>
+void simulate_steps(SimulationType& simulation, unsigned long long steps)
+{
+	for(unsigned long long done = 0; done < steps; )
+	{
+		const int count = static_cast<int>(steps - done < 0x7fffffffULL ? steps - done : 0x7fffffffULL);
+		simulation.simulate(count);
+		done += count;
+	}
+}
+
 #endif //SPELFYSIK_SLUTUPPGIFT_SIMULATION_H
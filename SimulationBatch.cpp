@@ -0,0 +1,465 @@
+#include "SimulationBatch.h"
+#include "Parallel.h"
+#include "PhysicalConstants.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
+const double SimulationBatch::G = PhysicalConstants::G;
+const double SimulationBatch::PI = PhysicalConstants::PI;
+
+namespace
+{
+	// The inner loops over the lanes of two slots i and j. They are separate functions so that the
+	// compiler knows the columns don't overlap and can vectorize them.
+
+	// Adds the same forces as Simulation in every lane, pairs with an empty slot add exactly zero
+	void gravity_lanes(std::size_t lanes, const double* __restrict x_i, const double* __restrict y_i,
+	                   const double* __restrict z_i, const double* __restrict mass_i,
+	                   const double* __restrict alive_i, const double* __restrict x_j,
+	                   const double* __restrict y_j, const double* __restrict z_j,
+	                   const double* __restrict mass_j, const double* __restrict alive_j,
+	                   double* __restrict force_x_i, double* __restrict force_y_i, double* __restrict force_z_i,
+	                   double* __restrict force_x_j, double* __restrict force_y_j, double* __restrict force_z_j,
+	                   double G)
+	{
+		for(std::size_t k = 0; k < lanes; ++k)
+		{
+			// 1 if both bodies exist, blended in with arithmetic since branches stop the vectorization.
+			// A pair with an empty slot gets distance 1 and, since empty slots have no mass, no force.
+			const double pair = alive_i[k] * alive_j[k];
+			const double dx = x_j[k] - x_i[k];
+			const double dy = y_j[k] - y_i[k];
+			const double dz = z_j[k] - z_i[k];
+			const double distance_squared = pair * (dx*dx + dy*dy + dz*dz) + (1.0 - pair);
+			const double inv_length = 1.0/std::sqrt(distance_squared);
+			const double magnitude = G * mass_i[k] * mass_j[k] / distance_squared;
+			const double fx = dx * inv_length * magnitude;
+			const double fy = dy * inv_length * magnitude;
+			const double fz = dz * inv_length * magnitude;
+			force_x_i[k] += fx;
+			force_y_i[k] += fy;
+			force_z_i[k] += fz;
+			force_x_j[k] -= fx;
+			force_y_j[k] -= fy;
+			force_z_j[k] -= fz;
+		}
+	}
+
+	// Stormer-Verlet like Simulation, clearing the forces for the next step
+	void integrate_columns(std::size_t count, double step_squared, double* __restrict x, double* __restrict y,
+	                       double* __restrict z, double* __restrict previous_x, double* __restrict previous_y,
+	                       double* __restrict previous_z, double* __restrict force_x, double* __restrict force_y,
+	                       double* __restrict force_z, const double* __restrict inverse_mass)
+	{
+		for(std::size_t i = 0; i < count; ++i)
+		{
+			const double ax = force_x[i] * inverse_mass[i];
+			const double ay = force_y[i] * inverse_mass[i];
+			const double az = force_z[i] * inverse_mass[i];
+			force_x[i] = 0.0;
+			force_y[i] = 0.0;
+			force_z[i] = 0.0;
+			const double current_x = x[i];
+			const double current_y = y[i];
+			const double current_z = z[i];
+			x[i] += current_x - previous_x[i] + ax * step_squared;
+			y[i] += current_y - previous_y[i] + ay * step_squared;
+			z[i] += current_z - previous_z[i] + az * step_squared;
+			previous_x[i] = current_x;
+			previous_y[i] = current_y;
+			previous_z[i] = current_z;
+		}
+	}
+
+	// Counts the collisions in every lane with the same test as Simulation
+	void collisions_lanes(std::size_t lanes, const double* __restrict x_i, const double* __restrict y_i,
+	                      const double* __restrict z_i, const double* __restrict radius_i,
+	                      const double* __restrict alive_i, const double* __restrict x_j,
+	                      const double* __restrict y_j, const double* __restrict z_j,
+	                      const double* __restrict radius_j, const double* __restrict alive_j,
+	                      double* __restrict collisions)
+	{
+		for(std::size_t k = 0; k < lanes; ++k)
+		{
+			const double dx = x_j[k] - x_i[k];
+			const double dy = y_j[k] - y_i[k];
+			const double dz = z_j[k] - z_i[k];
+			const bool hit = std::sqrt(dx*dx + dy*dy + dz*dz) <= radius_j[k] + radius_i[k];
+			collisions[k] += hit ? alive_i[k] * alive_j[k] : 0.0;
+		}
+	}
+}
+
+SimulationBatch::SimulationBatch(const std::vector<SimulationInitialConditions>& conditions)
+: STEPSIZE(conditions.empty() ? 0.0 : conditions.front().step_size),
+  m_error(), m_lanes(0), m_slots(0), m_step_count(0)
+{
+	std::vector<std::unique_ptr<InitialConditionGenerator>> owned;
+	std::vector<const InitialConditionGenerator*> generators;
+	for(const SimulationInitialConditions& cond : conditions)
+	{
+		if(cond.step_size != STEPSIZE)
+		{
+			m_error = "Every simulation in a batch needs the same step size";
+			return;
+		}
+		owned.push_back(make_initial_condition_generator(cond));
+		generators.push_back(owned.back().get());
+	}
+	initialize(generators);
+}
+
+SimulationBatch::SimulationBatch(const std::vector<const InitialConditionGenerator*>& generators, double step_size)
+: STEPSIZE(step_size), m_error(), m_lanes(0), m_slots(0), m_step_count(0)
+{
+	initialize(generators);
+}
+
+bool SimulationBatch::is_valid() const
+{
+	return m_error.empty();
+}
+
+const std::string& SimulationBatch::get_error() const
+{
+	return m_error;
+}
+
+void SimulationBatch::simulate(int steps)
+{
+	for(int i = 0; i < steps && is_valid(); ++i)
+	{
+		calculate_gravity();
+		integrate();
+		handle_collisions();
+		++m_step_count;
+	}
+}
+
+std::size_t SimulationBatch::get_lane_count() const
+{
+	return m_lanes;
+}
+
+int SimulationBatch::get_body_count(std::size_t lane) const
+{
+	return m_body_counts[lane];
+}
+
+Vector3d SimulationBatch::get_system_velocity(std::size_t lane) const
+{
+	// Same order of operations as Simulation, so the lanes can be compared exactly
+	Vector3d velocity(0.0, 0.0, 0.0);
+	double system_mass = 0.0;
+	for(std::size_t i = lane; i < m_slots * m_lanes; i += m_lanes)
+	{
+		if(m_alive[i] != 0.0)
+		{
+			Vector3d position(m_x[i], m_y[i], m_z[i]);
+			Vector3d previous_position(m_previous_x[i], m_previous_y[i], m_previous_z[i]);
+			Vector3d i_vel = (position - previous_position) * (1.0 / STEPSIZE);
+			velocity += i_vel * m_mass[i];
+			system_mass += m_mass[i];
+		}
+	}
+	velocity *= 1.0 / system_mass;
+	return velocity;
+}
+
+void SimulationBatch::copy_columns(std::size_t lane, double* positions, double* masses) const
+{
+	// The bodies of a lane are always in its first slots
+	for(std::size_t slot = 0; slot < static_cast<std::size_t>(m_body_counts[lane]); ++slot)
+	{
+		const std::size_t i = slot * m_lanes + lane;
+		if(positions)
+		{
+			*positions++ = m_x[i];
+			*positions++ = m_y[i];
+			*positions++ = m_z[i];
+		}
+		if(masses)
+		{
+			*masses++ = m_mass[i];
+		}
+	}
+}
+
+unsigned long long SimulationBatch::get_step_count() const
+{
+	return m_step_count;
+}
+
+std::size_t SimulationBatch::get_bytes_per_body()
+{
+	// The columns
+	return 13 * sizeof(double);
+}
+
+void SimulationBatch::initialize(const std::vector<const InitialConditionGenerator*>& generators)
+{
+	if(generators.empty())
+	{
+		m_error = "A batch needs at least one simulation";
+		return;
+	}
+	const std::size_t body_count = generators.front()->body_count();
+	for(const InitialConditionGenerator* generator : generators)
+	{
+		if(generator->body_count() != body_count)
+		{
+			m_error = "Every simulation in a batch needs the same number of bodies";
+			return;
+		}
+	}
+	m_lanes = generators.size();
+	m_slots = body_count;
+	for(std::vector<double>* column : {&m_x, &m_y, &m_z, &m_previous_x, &m_previous_y, &m_previous_z,
+	                                   &m_force_x, &m_force_y, &m_force_z, &m_mass, &m_inverse_mass, &m_radius,
+	                                   &m_alive})
+	{
+		column->resize(m_slots * m_lanes, 0.0);
+	}
+	m_body_counts.assign(m_lanes, static_cast<int>(body_count));
+	m_colliding.resize(m_lanes);
+	m_merge_lists.resize(m_lanes);
+	for(std::size_t lane = 0; lane < m_lanes; ++lane)
+	{
+		const InitialConditionGenerator& generator = *generators[lane];
+		parallel_for_chunks(body_count, generator.chunk_size(), [&](std::size_t chunk, std::size_t begin, std::size_t end)
+		{
+			generator.generate(chunk, begin, end,
+			                   [&](std::size_t index, const Vector3d& position, const Vector3d& previous_position,
+			                       double mass)
+			{
+				const std::size_t i = index * m_lanes + lane;
+				m_x[i] = position.get_x();
+				m_y[i] = position.get_y();
+				m_z[i] = position.get_z();
+				m_previous_x[i] = previous_position.get_x();
+				m_previous_y[i] = previous_position.get_y();
+				m_previous_z[i] = previous_position.get_z();
+				m_mass[i] = mass;
+				m_inverse_mass[i] = mass > 0.0 ? 1.0/mass : 0.0;
+				m_radius[i] = radius_from_mass(mass);
+				m_alive[i] = 1.0;
+			});
+		});
+	}
+}
+
+void SimulationBatch::calculate_gravity()
+{
+	const std::size_t lanes = m_lanes;
+	for(std::size_t a = 0; a < m_slots; ++a)
+	{
+		const std::size_t i = a * lanes;
+		for(std::size_t b = a + 1; b < m_slots; ++b)
+		{
+			const std::size_t j = b * lanes;
+			gravity_lanes(lanes, &m_x[i], &m_y[i], &m_z[i], &m_mass[i], &m_alive[i],
+			              &m_x[j], &m_y[j], &m_z[j], &m_mass[j], &m_alive[j],
+			              &m_force_x[i], &m_force_y[i], &m_force_z[i], &m_force_x[j], &m_force_y[j], &m_force_z[j], G);
+		}
+	}
+}
+
+void SimulationBatch::integrate()
+{
+	// Stormer-Verlet like Simulation. Empty slots have no force and no velocity, so they stay put.
+	integrate_columns(m_slots * m_lanes, STEPSIZE * STEPSIZE, m_x.data(), m_y.data(), m_z.data(),
+	                  m_previous_x.data(), m_previous_y.data(), m_previous_z.data(),
+	                  m_force_x.data(), m_force_y.data(), m_force_z.data(), m_inverse_mass.data());
+}
+
+void SimulationBatch::handle_collisions()
+{
+	const std::size_t lanes = m_lanes;
+	// Find the lanes with any collision at all, for every lane at once
+	std::fill(m_colliding.begin(), m_colliding.end(), 0.0);
+	for(std::size_t a = 0; a < m_slots; ++a)
+	{
+		const std::size_t i = a * lanes;
+		for(std::size_t b = a + 1; b < m_slots; ++b)
+		{
+			const std::size_t j = b * lanes;
+			collisions_lanes(lanes, &m_x[i], &m_y[i], &m_z[i], &m_radius[i], &m_alive[i],
+			                 &m_x[j], &m_y[j], &m_z[j], &m_radius[j], &m_alive[j], m_colliding.data());
+		}
+	}
+
+	// Build the merge lists of those lanes one at a time, in the same order as Simulation, and merge them
+	std::vector<long> list_of(m_slots);
+	for(std::size_t k = 0; k < lanes; ++k)
+	{
+		std::vector<std::vector<std::size_t>>& lists = m_merge_lists[k];
+		lists.clear();
+		if(m_colliding[k] == 0.0)
+		{
+			continue;
+		}
+		std::fill(list_of.begin(), list_of.end(), -1);
+		for(std::size_t a = 0; a < m_slots; ++a)
+		{
+			const std::size_t i = a * lanes + k;
+			if(m_alive[i] == 0.0)
+			{
+				continue;
+			}
+			for(std::size_t b = a + 1; b < m_slots; ++b)
+			{
+				const std::size_t j = b * lanes + k;
+				if(m_alive[j] == 0.0)
+				{
+					continue;
+				}
+				const double dx = m_x[j] - m_x[i];
+				const double dy = m_y[j] - m_y[i];
+				const double dz = m_z[j] - m_z[i];
+				if(std::sqrt(dx*dx + dy*dy + dz*dz) > m_radius[j] + m_radius[i])
+				{
+					continue;
+				}
+				if(list_of[a] < 0 && list_of[b] < 0)
+				{
+					list_of[a] = list_of[b] = static_cast<long>(lists.size());
+					lists.push_back(std::vector<std::size_t>{a, b});
+				}
+				else if(list_of[b] < 0)
+				{
+					lists[list_of[a]].push_back(b);
+					list_of[b] = list_of[a];
+				}
+				else if(list_of[a] < 0)
+				{
+					lists[list_of[b]].push_back(a);
+					list_of[a] = list_of[b];
+				}
+				else if(list_of[a] != list_of[b])
+				{
+					// Join the two lists, the emptied one is skipped below
+					const long from = list_of[b];
+					const long to = list_of[a];
+					lists[to].insert(lists[to].end(), lists[from].begin(), lists[from].end());
+					for(std::size_t slot : lists[from])
+					{
+						list_of[slot] = to;
+					}
+					lists[from].clear();
+				}
+			}
+		}
+		merge_lane(k);
+	}
+
+	// Lanes with fewer bodies left have empty slots at the end, the ones empty in every lane go
+	const int slots = *std::max_element(m_body_counts.begin(), m_body_counts.end());
+	if(static_cast<std::size_t>(slots) < m_slots)
+	{
+		m_slots = static_cast<std::size_t>(slots);
+		for(std::vector<double>* column : {&m_x, &m_y, &m_z, &m_previous_x, &m_previous_y, &m_previous_z,
+		                                   &m_force_x, &m_force_y, &m_force_z, &m_mass, &m_inverse_mass,
+		                                   &m_radius, &m_alive})
+		{
+			column->resize(m_slots * m_lanes);
+		}
+	}
+}
+
+void SimulationBatch::merge_lane(std::size_t k)
+{
+	const std::size_t lanes = m_lanes;
+	struct Merged
+	{
+		double x, y, z, previous_x, previous_y, previous_z, mass, inverse_mass;
+	};
+	std::vector<Merged> merged;
+	for(const std::vector<std::size_t>& list : m_merge_lists[k])
+	{
+		if(list.empty())
+		{
+			continue;
+		}
+		Merged body = Merged();
+		for(std::size_t slot : list)
+		{
+			body.mass += m_mass[slot * lanes + k];
+		}
+		body.inverse_mass = 1.0 / body.mass;
+		for(std::size_t slot : list)
+		{
+			const std::size_t i = slot * lanes + k;
+			const double weight = body.inverse_mass * m_mass[i];
+			body.x += m_x[i] * weight;
+			body.y += m_y[i] * weight;
+			body.z += m_z[i] * weight;
+			body.previous_x += m_previous_x[i] * weight;
+			body.previous_y += m_previous_y[i] * weight;
+			body.previous_z += m_previous_z[i] * weight;
+		}
+		for(std::size_t slot : list)
+		{
+			m_alive[slot * lanes + k] = 0.0;
+		}
+		merged.push_back(body);
+	}
+
+	// Move the bodies left down in order and put the merged ones after them, the same order as Simulation's.
+	// Forces are already cleared by integrate().
+	std::size_t kept = 0;
+	for(std::size_t slot = 0; slot < m_slots; ++slot)
+	{
+		const std::size_t i = slot * lanes + k;
+		if(m_alive[i] == 0.0)
+		{
+			continue;
+		}
+		const std::size_t n = kept++ * lanes + k;
+		if(n != i)
+		{
+			m_x[n] = m_x[i];
+			m_y[n] = m_y[i];
+			m_z[n] = m_z[i];
+			m_previous_x[n] = m_previous_x[i];
+			m_previous_y[n] = m_previous_y[i];
+			m_previous_z[n] = m_previous_z[i];
+			m_mass[n] = m_mass[i];
+			m_inverse_mass[n] = m_inverse_mass[i];
+			m_radius[n] = m_radius[i];
+			m_alive[n] = 1.0;
+		}
+	}
+	for(const Merged& body : merged)
+	{
+		const std::size_t n = kept++ * lanes + k;
+		m_x[n] = body.x;
+		m_y[n] = body.y;
+		m_z[n] = body.z;
+		m_previous_x[n] = body.previous_x;
+		m_previous_y[n] = body.previous_y;
+		m_previous_z[n] = body.previous_z;
+		m_mass[n] = body.mass;
+		m_inverse_mass[n] = body.inverse_mass;
+		m_radius[n] = radius_from_mass(body.mass);
+		m_alive[n] = 1.0;
+	}
+	m_body_counts[k] = static_cast<int>(kept);
+	// Empty slots have no mass and keep still
+	for(std::size_t slot = kept; slot < m_slots; ++slot)
+	{
+		const std::size_t i = slot * lanes + k;
+		m_x[i] = m_y[i] = m_z[i] = 0.0;
+		m_previous_x[i] = m_previous_y[i] = m_previous_z[i] = 0.0;
+		m_mass[i] = m_inverse_mass[i] = m_radius[i] = 0.0;
+		m_alive[i] = 0.0;
+	}
+}
+
+double SimulationBatch::radius_from_mass(double mass)
+{
+	// Same as Simulation::radius_from_mass()
+	double p = 2000;
+	return std::sqrt((3.0 * mass) / (4.0 * PI * p));
+}
@@ -0,0 +1,74 @@
+#ifndef SPELFYSIK_SLUTUPPGIFT_SIMULATIONBATCH_H
+#define SPELFYSIK_SLUTUPPGIFT_SIMULATIONBATCH_H
+
+#include "Vector3d.h"
+#include "InitialConditions.h"
+#include "Simulation.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Independent simulations with the same number of bodies, stepped together. Each simulation is a lane,
+// and every body column is stored slot by slot with the lanes of a slot next to each other, so the
+// inner loops of gravity and integration run over all simulations at once and vectorize.
+//
+// Lanes with fewer bodies left after merges have empty slots at the end, which are masked out of the
+// calculations. Each lane keeps its bodies in the same order as Simulation, so it gives exactly the same
+// results as a Simulation started from the same bodies.
+class SimulationBatch
+{
+public:
+	// Every lane needs the same step size and number of bodies
+	explicit SimulationBatch(const std::vector<SimulationInitialConditions>& conditions);
+	SimulationBatch(const std::vector<const InitialConditionGenerator*>& generators, double step_size);
+
+	// False if the lanes didn't have the same number of bodies or step size
+	bool is_valid() const;
+	const std::string& get_error() const;
+	void simulate(int steps);
+	std::size_t get_lane_count() const;
+	int get_body_count(std::size_t lane) const;
+	Vector3d get_system_velocity(std::size_t lane) const;
+	// Copies the bodies of a lane into caller owned columns with room for every body, in Simulation's order.
+	// Positions are x, y, z interleaved, columns that aren't wanted can be null.
+	void copy_columns(std::size_t lane, double* positions, double* masses) const;
+	unsigned long long get_step_count() const;
+	// Memory per body and lane, for comparing layouts
+	static std::size_t get_bytes_per_body();
+
+	// In seconds
+	const double STEPSIZE;
+
+private:
+	void initialize(const std::vector<const InitialConditionGenerator*>& generators);
+	void calculate_gravity();
+	void integrate();
+	void handle_collisions();
+	// Merges the bodies in the lane's merge lists and moves its bodies to the first slots
+	void merge_lane(std::size_t lane);
+	static double radius_from_mass(double mass);
+
+	std::string m_error;
+	std::size_t m_lanes;
+	std::size_t m_slots;
+	// Slot s of lane k is at s * m_lanes + k. In meters, newtons, kg, kg^-1 and meters.
+	std::vector<double> m_x, m_y, m_z;
+	std::vector<double> m_previous_x, m_previous_y, m_previous_z;
+	std::vector<double> m_force_x, m_force_y, m_force_z;
+	std::vector<double> m_mass;
+	std::vector<double> m_inverse_mass;
+	std::vector<double> m_radius;
+	// 1 for a body, 0 for an empty slot
+	std::vector<double> m_alive;
+	std::vector<int> m_body_counts;
+	unsigned long long m_step_count;
+	// Reused by handle_collisions(), the number of collisions in each lane
+	std::vector<double> m_colliding;
+	std::vector<std::vector<std::vector<std::size_t>>> m_merge_lists;
+	// In N*m^2/kg^2
+	static const double G;
+	static const double PI;
+};
+
+#endif //SPELFYSIK_SLUTUPPGIFT_SIMULATIONBATCH_H
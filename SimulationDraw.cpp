@@ -0,0 +1,22 @@
+// Drawing is kept apart from the rest of the simulations so the physics links without SFML and OpenGL
+#include "Simulation.h"
+#include "SimulationFloat.h"
+#include "Graphics.h"
+
+void Simulation::draw(Graphics& drawer)
+{
+	for(Body& i : m_bodies)
+	{
+		drawer.draw_sphere(i.position, i.radius);
+	}
+}
+
+void SimulationFloat::draw(Graphics& drawer)
+{
+	for(Body& i : m_bodies)
+	{
+		// Graphics wants a double vector
+		Vector3d double_pos(i.position.get_x(), i.position.get_y(), i.position.get_z());
+		drawer.draw_sphere(double_pos, i.radius);
+	}
+}
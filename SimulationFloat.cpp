@@ -1,94 +1,37 @@
+#include <algorithm>
 #include <deque>
 #include <unordered_map>
 #include <cmath>
 #include "Vector3d.h"
 #include "SimulationFloat.h"
+#include "Parallel.h"
+#include "PhysicalConstants.h"
 
-const float SimulationFloat::G = 0.00000000006674f; //6.674*10^-11
-const float SimulationFloat::PI = 3.141592653589793238463f;
+const float SimulationFloat::G = static_cast<float>(PhysicalConstants::G);
+const float SimulationFloat::PI = static_cast<float>(PhysicalConstants::PI);
 
-namespace
+SimulationFloat::SimulationFloat(const SimulationFloatInitialConditions& cond)
+: SimulationFloat(*make_initial_condition_generator(cond), cond.step_size)
 {
-	static const float D_RAND_MAX = static_cast<float>(RAND_MAX);
-
-	// Returns a random value in the range (-base*size/2, base*size/2)
-	float variance(float base, float size)
-	{
-		float rand = static_cast<float>(std::rand()) / D_RAND_MAX;
-		return (base * size) * (rand - 0.5f);
-	}
-
-	Vector3f random_step(float speed, float distribution, float step_size)
-	{
-		// Get random direction
-		float x, y, z;
-		// Loop because direction must not be all zeroes
-		do
-		{
-			x = (static_cast<float>(std::rand()) / D_RAND_MAX) - 0.5f;
-			y = (static_cast<float>(std::rand()) / D_RAND_MAX) - 0.5f;
-			z = (static_cast<float>(std::rand()) / D_RAND_MAX) - 0.5f;
-		}
-		while(x == 0.0f && y == 0.0f && z == 0.0f);
-		Vector3f direction(x, y, z);
-		direction.normalize();
-
-		// Get random speed
-		float rand_speed = variance(speed, distribution);
-
-		// Return step of the correct size
-		return direction * (rand_speed * step_size);
-	}
 }
 
-SimulationFloat::SimulationFloat(const SimulationFloatInitialConditions& cond)
-: STEPSIZE(cond.step_size), m_bodies()
+SimulationFloat::SimulationFloat(const InitialConditionGenerator& generator, float step_size)
+: STEPSIZE(step_size), m_bodies()
 {
-	std::srand(cond.random_seed);
-
-	const float dist = cond.distribution;
-	const float hd = dist / 2.0f;
-	const float average_mass = cond.system_mass / cond.number_of_bodies;
-	// Due to rounding we'll likely be placing a bit too few bodies. But who's counting?
-	const int quadrant_side = static_cast<int>(std::sqrt(cond.number_of_bodies / 4.0));
-	for(int i = 0; i < quadrant_side; ++i)
+	// Make room for every body up front so the chunks can be filled in concurrently
+	const Body empty_body({0.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 0.0f}, 0.0f);
+	m_bodies.resize(generator.body_count(), empty_body);
+	parallel_for_chunks(generator.body_count(), generator.chunk_size(),
+	                    [&](std::size_t chunk, std::size_t begin, std::size_t end)
 	{
-		for(int j = 0; j < quadrant_side; ++j)
+		generator.generate(chunk, begin, end,
+		                   [&](std::size_t index, const Vector3d& position, const Vector3d& previous_position, double mass)
 		{
-			const float x_base = hd + i*cond.distribution;
-			const float y_base = hd + j*cond.distribution;
-
-			for(int k = 0; k < 4; ++k)
-			{
-				float x_pos = x_base + variance(cond.distribution, cond.distribution_variance);
-				float y_pos = y_base + variance(cond.distribution, cond.distribution_variance);
-				Vector3f position(0.0, 0.0, 0.0);
-
-				switch(k)
-				{
-				case 0:
-					// First quadrant +x +y
-					position = Vector3f(x_pos, y_pos, 0.0f);
-					break;
-				case 1:
-					// Second quadrant +x -y
-					position = Vector3f(x_pos, -y_pos, 0.0f);
-					break;
-				case 2:
-					// Third quadrant -x -y
-					position = Vector3f(-x_pos, -y_pos, 0.0f);
-					break;
-				case 3:
-					// Forth quadrant -x +y
-					position = Vector3f(-x_pos, y_pos, 0.0f);
-					break;
-				}
-				float mass = average_mass + variance(average_mass, cond.mass_variance);
-				Vector3f previous_pos = position + random_step(cond.speed, cond.speed_variance, STEPSIZE);
-				m_bodies.emplace_back(position, previous_pos, mass);
-			}
-		}
-	}
+			Vector3f position_f(position.get_x(), position.get_y(), position.get_z());
+			Vector3f previous_f(previous_position.get_x(), previous_position.get_y(), previous_position.get_z());
+			m_bodies[index] = Body(position_f, previous_f, static_cast<float>(mass));
+		});
+	});
 }
 
 void SimulationFloat::simulate(int steps)
@@ -98,17 +41,7 @@ void SimulationFloat::simulate(int steps)
 		calculate_gravity();
 		integrate();
 		handle_collisions();
-		m_bodies.erase(std::remove_if(m_bodies.begin(), m_bodies.end(), [](const Body& b){return b.remove;}), m_bodies.end());
-	}
-}
-
-void SimulationFloat::draw(Graphics& drawer)
-{
-	for(Body& i : m_bodies)
-	{
-		// Graphics wants a double vector
-		Vector3d double_pos(i.position.get_x(), i.position.get_y(), i.position.get_z());
-		drawer.draw_sphere(double_pos, i.radius);
+		remove_merged_bodies();
 	}
 }
 
@@ -120,7 +53,7 @@ Vector3d SimulationFloat::get_system_velocity() const
 	for(const Body& i : m_bodies)
 	{
 		Vector3d i_pos(i.position.get_x(), i.position.get_y(), i.position.get_z());
-		Vector3d i_prev_pos(i.previous_position.get_x(), i.position.get_y(), i.position.get_z());
+		Vector3d i_prev_pos(i.previous_position.get_x(), i.previous_position.get_y(), i.previous_position.get_z());
 		Vector3d i_vel = (i_pos - i_prev_pos) * (1.0 / STEPSIZE);
 
 		velocity += i_vel * i.mass;
@@ -135,6 +68,48 @@ int SimulationFloat::get_body_count() const
 	return m_bodies.size();
 }
 
+void SimulationFloat::copy_columns(double* positions, double* velocities, double* masses) const
+{
+	for(const Body& body : m_bodies)
+	{
+		if(positions)
+		{
+			*positions++ = body.position.get_x();
+			*positions++ = body.position.get_y();
+			*positions++ = body.position.get_z();
+		}
+		if(velocities)
+		{
+			// Same estimate as get_system_velocity()
+			*velocities++ = (static_cast<double>(body.position.get_x()) - body.previous_position.get_x()) * (1.0 / STEPSIZE);
+			*velocities++ = (static_cast<double>(body.position.get_y()) - body.previous_position.get_y()) * (1.0 / STEPSIZE);
+			*velocities++ = (static_cast<double>(body.position.get_z()) - body.previous_position.get_z()) * (1.0 / STEPSIZE);
+		}
+		if(masses)
+		{
+			*masses++ = body.mass;
+		}
+	}
+}
+
+void SimulationFloat::copy_forces(double* forces) const
+{
+	// Integration clears the forces after every step, so calculate them again on a copy
+	SimulationFloat copy(*this);
+	copy.calculate_gravity();
+	for(const Body& body : copy.m_bodies)
+	{
+		*forces++ = body.incoming_force.get_x();
+		*forces++ = body.incoming_force.get_y();
+		*forces++ = body.incoming_force.get_z();
+	}
+}
+
+std::size_t SimulationFloat::get_bytes_per_body()
+{
+	return sizeof(Body);
+}
+
 void SimulationFloat::calculate_gravity()
 {
 	const unsigned int body_count = m_bodies.size();
@@ -172,7 +147,8 @@ void SimulationFloat::handle_collisions()
 	typedef std::vector<Body*> MergeList;
 	// Important! Deque does not invalidate member pointers on insert
 	std::deque<MergeList> merge_lists;
-	std::unordered_map<unsigned int, MergeList*> merge_look_up;
+	// Every body in a merge list points to that list here
+	std::unordered_map<const Body*, MergeList*> merge_look_up;
 	const unsigned int body_count = m_bodies.size();
 	// Identify colliding objects and put them in together in "merge lists"
 	for(unsigned int i = 0; i < body_count ; ++i)
@@ -185,38 +161,46 @@ void SimulationFloat::handle_collisions()
 			if(distance <= J.radius + I.radius)
 			{
 				// Check if they already are to be merged
-				bool i_merging = merge_look_up.count(i);
-				bool j_merging = merge_look_up.count(j);
+				bool i_merging = merge_look_up.count(&I);
+				bool j_merging = merge_look_up.count(&J);
 				if(!i_merging && !j_merging)
 				{
 					// Create new merge list
 					merge_lists.emplace_back(std::initializer_list<Body*>{&I, &J});
 					MergeList* mlp = &merge_lists.back();
-					merge_look_up[i] = mlp;
-					merge_look_up[j] = mlp;
+					merge_look_up[&I] = mlp;
+					merge_look_up[&J] = mlp;
 				}
 				else if(i_merging && !j_merging)
 				{
-					// Add j to i's merge list
-					merge_look_up[i]->push_back(&J);
+					// Add j to i's merge list, j must point to it too or a later collision starts a second list for it
+					MergeList* mlp = merge_look_up[&I];
+					mlp->push_back(&J);
+					merge_look_up[&J] = mlp;
 				}
 				else if(!i_merging && j_merging)
 				{
 					// Add i to j's merge list
-					merge_look_up[j]->push_back(&I);
+					MergeList* mlp = merge_look_up[&J];
+					mlp->push_back(&I);
+					merge_look_up[&I] = mlp;
 				}
 				else //if(i_merging && j_merging) We don't need this check
 				{
-					MergeList* mlp1 = merge_look_up[i];
-					MergeList* mlp2 = merge_look_up[j];
+					MergeList* mlp1 = merge_look_up[&I];
+					MergeList* mlp2 = merge_look_up[&J];
 					if(mlp1 != mlp2)
 					{
 						// They are in different merge lists
-						// Merge the two merge lists
+						// Merge the two merge lists, every body of the emptied one has to point to the other
+						// one, not only j, or a later collision adds to the emptied list again
+						for(const Body* body : *mlp2)
+						{
+							merge_look_up[body] = mlp1;
+						}
 						mlp1->reserve(mlp1->size() + mlp2->size());
 						mlp1->insert(mlp1->end(), mlp2->begin(), mlp2->end());
 						mlp2->clear();
-						merge_look_up[j] = mlp1;
 					}
 				}
 			}
@@ -226,6 +210,11 @@ void SimulationFloat::handle_collisions()
 	// Merge all colliding objects
 	for(MergeList& ml : merge_lists)
 	{
+		// Lists that were merged into others are empty, and would give a body without mass
+		if(ml.empty())
+		{
+			continue;
+		}
 		Body new_body({0.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 0.0f}, 0.0f);
 		for(Body* body : ml)
 		{
@@ -245,6 +234,11 @@ void SimulationFloat::handle_collisions()
 	}
 }
 
+void SimulationFloat::remove_merged_bodies()
+{
+	m_bodies.erase(std::remove_if(m_bodies.begin(), m_bodies.end(), [](const Body& b){return b.remove;}), m_bodies.end());
+}
+
 SimulationFloat::Body::Body(Vector3f position, Vector3f previous_position, float mass)
 : position(position),
   previous_position(previous_position),
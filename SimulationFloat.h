@@ -2,12 +2,15 @@
 #define SPELFYSIK_SLUTUPPGIFT_SIMULATIONFLOAT_H
 
 #include "Vector3f.h"
-#include "Graphics.h"
+#include "InitialConditions.h"
 
 #include <deque>
 
+class Graphics;
+
 struct SimulationFloatInitialConditions
 {
+	InitialLayout layout;
 	int step_size;
 	int random_seed;
 	// No guarantees that it will give exactly this amount of bodies
@@ -31,18 +34,32 @@ class SimulationFloat
 {
 public:
 	SimulationFloat(const SimulationFloatInitialConditions& conditions);
+	// Bodies are generated in double precision and rounded to float
+	SimulationFloat(const InitialConditionGenerator& generator, float step_size);
 	void simulate(int steps);
+	// Defined with the graphics (SimulationDraw.cpp), so the physics builds without them
 	void draw(Graphics& drawer);
 	Vector3d get_system_velocity() const;
 	int get_body_count() const;
+	// Copies the current bodies into caller owned columns with room for every body, as doubles.
+	// Positions and velocities are x, y, z interleaved, columns that aren't wanted can be null.
+	void copy_columns(double* positions, double* velocities, double* masses) const;
+	// The gravity on every body in newtons as the next step will compute it, x, y, z interleaved
+	void copy_forces(double* forces) const;
+	// Memory per body, for comparing layouts
+	static std::size_t get_bytes_per_body();
 
 	// In seconds
 	const float STEPSIZE;
 
 private:
+	// The microbenchmarks time the phases of a step one by one
+	friend class KernelBenchmark;
+
 	void calculate_gravity();
 	void integrate();
 	void handle_collisions();
+	void remove_merged_bodies();
 	static float radius_from_mass(float mass);
 
 	struct Body
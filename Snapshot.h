@@ -0,0 +1,26 @@
+#ifndef SPELFYSIK_SLUTUPPGIFT_SNAPSHOT_H
+#define SPELFYSIK_SLUTUPPGIFT_SNAPSHOT_H
+
+#include <cstddef>
+#include <vector>
+
+// Copy of the body state at one step, in columns. Reusing a snapshot reuses its memory.
+struct Snapshot
+{
+	unsigned long long step;
+	// In seconds
+	double time;
+	// Persistent body ids, a merge gives the new body a new id
+	std::vector<unsigned int> ids;
+	// In meters, x, y, z interleaved
+	std::vector<double> positions;
+	// In meters
+	std::vector<double> radii;
+
+	std::size_t body_count() const
+	{
+		return ids.size();
+	}
+};
+
+#endif //SPELFYSIK_SLUTUPPGIFT_SNAPSHOT_H
@@ -0,0 +1,242 @@
+#include "StateHash.h"
+#include "Checksum.h"
+#include "MappedFile.h"
+
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+	// The bucket a coordinate falls in, values too large for a bucket number keep their bits
+	std::int64_t bucket(double value, double bucket_size)
+	{
+		const double index = std::floor(value / bucket_size);
+		if(std::abs(index) < 9.0e18)
+		{
+			return static_cast<std::int64_t>(index);
+		}
+		std::int64_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		return bits;
+	}
+}
+
+StateHasher::StateHasher(const std::string& path, unsigned long long interval, StateHashMode mode,
+                         double bucket_size, bool per_body)
+: m_file(nullptr),
+  m_interval(interval > 0 ? interval : 1),
+  m_mode(mode),
+  m_bucket_size(mode == StateHashMode::Bucketed ? bucket_size : 0.0),
+  m_per_body(per_body),
+  m_write_failed(false),
+  m_positions(),
+  m_velocities(),
+  m_masses(),
+  m_ids(),
+  m_hashes(),
+  m_record()
+{
+	using namespace StateHashFormat;
+	if(!host_is_little_endian() || (mode == StateHashMode::Bucketed && !(bucket_size > 0.0)))
+	{
+		return;
+	}
+	m_file = std::fopen(path.c_str(), "wb");
+	if(!m_file)
+	{
+		return;
+	}
+	char header[HEADER_SIZE] = {};
+	std::memcpy(header, MAGIC, sizeof(MAGIC));
+	write_value<std::uint32_t>(header + 8, VERSION);
+	write_value<std::uint32_t>(header + 12, mode == StateHashMode::Exact ? 0 : 1);
+	write_value<std::uint64_t>(header + 16, m_interval);
+	write_value<double>(header + 24, m_bucket_size);
+	write_value<std::uint32_t>(header + 32, per_body ? 1 : 0);
+	m_write_failed = std::fwrite(header, 1, HEADER_SIZE, m_file) != HEADER_SIZE;
+}
+
+StateHasher::~StateHasher()
+{
+	if(m_file)
+	{
+		std::fclose(m_file);
+	}
+}
+
+bool StateHasher::is_ok() const
+{
+	return m_file && !m_write_failed;
+}
+
+void StateHasher::on_step(const Simulation& simulation)
+{
+	if(simulation.get_step_count() % m_interval == 0)
+	{
+		hash(simulation);
+	}
+}
+
+void StateHasher::hash(const Simulation& simulation)
+{
+	using namespace StateHashFormat;
+	if(!is_ok())
+	{
+		return;
+	}
+	const std::size_t count = simulation.get_body_count();
+	m_positions.resize(3 * count);
+	m_velocities.resize(3 * count);
+	m_masses.resize(count);
+	m_ids.resize(count);
+	const bool exact = m_mode == StateHashMode::Exact;
+	simulation.copy_columns(m_positions.data(), exact ? m_velocities.data() : nullptr, exact ? m_masses.data() : nullptr,
+	                        nullptr, m_ids.data());
+
+	m_record.assign(RECORD_HEADER_SIZE + (m_per_body ? BODY_SIZE * count : 0), 0);
+	write_value<std::uint64_t>(m_record.data(), simulation.get_step_count());
+	write_value<std::uint32_t>(m_record.data() + 8, static_cast<std::uint32_t>(count));
+	// The state hash is a hash of the body hashes, in body order
+	m_hashes.resize(count);
+	for(std::size_t i = 0; i < count; ++i)
+	{
+		if(exact)
+		{
+			const double values[8] = {static_cast<double>(m_ids[i]), m_positions[3 * i], m_positions[3 * i + 1],
+			                          m_positions[3 * i + 2], m_velocities[3 * i], m_velocities[3 * i + 1],
+			                          m_velocities[3 * i + 2], m_masses[i]};
+			m_hashes[i] = checksum64(values, sizeof(values));
+		}
+		else
+		{
+			const std::int64_t values[4] = {m_ids[i], bucket(m_positions[3 * i], m_bucket_size),
+			                                bucket(m_positions[3 * i + 1], m_bucket_size),
+			                                bucket(m_positions[3 * i + 2], m_bucket_size)};
+			m_hashes[i] = checksum64(values, sizeof(values));
+		}
+		if(m_per_body)
+		{
+			char* body = m_record.data() + RECORD_HEADER_SIZE + BODY_SIZE * i;
+			write_value<std::uint32_t>(body, m_ids[i]);
+			write_value<std::uint64_t>(body + 8, m_hashes[i]);
+		}
+	}
+	write_value<std::uint64_t>(m_record.data() + 16, checksum64(m_hashes.data(), 8 * count, count));
+	m_write_failed = std::fwrite(m_record.data(), 1, m_record.size(), m_file) != m_record.size();
+}
+
+StateHashFile::StateHashFile(const std::string& path)
+: m_error(), m_file(), m_mode(StateHashMode::Exact), m_interval(1), m_bucket_size(0.0), m_body_hashes(false),
+  m_offsets(), m_truncated(false)
+{
+	using namespace StateHashFormat;
+	if(!host_is_little_endian())
+	{
+		m_error = "State hash streams can only be read on little endian machines";
+		return;
+	}
+	if(!m_file.open(path))
+	{
+		m_error = "Could not open " + path;
+		return;
+	}
+	const char* data = m_file.data();
+	const std::size_t size = m_file.size();
+	if(size < HEADER_SIZE || std::memcmp(data, MAGIC, sizeof(MAGIC)) != 0)
+	{
+		m_error = path + " is not a state hash stream";
+		return;
+	}
+	if(read_value<std::uint32_t>(data + 8) != VERSION)
+	{
+		m_error = path + " has an unsupported version";
+		return;
+	}
+	m_mode = read_value<std::uint32_t>(data + 12) == 0 ? StateHashMode::Exact : StateHashMode::Bucketed;
+	m_interval = read_value<std::uint64_t>(data + 16);
+	m_bucket_size = read_value<double>(data + 24);
+	m_body_hashes = read_value<std::uint32_t>(data + 32) != 0;
+
+	std::size_t offset = HEADER_SIZE;
+	while(offset < size)
+	{
+		if(size - offset < RECORD_HEADER_SIZE)
+		{
+			m_truncated = true;
+			break;
+		}
+		const std::size_t record_size = RECORD_HEADER_SIZE + (m_body_hashes ? BODY_SIZE
+		                                * read_value<std::uint32_t>(data + offset + 8) : 0);
+		if(size - offset < record_size)
+		{
+			// Where a crashed run stopped writing
+			m_truncated = true;
+			break;
+		}
+		m_offsets.push_back(offset);
+		offset += record_size;
+	}
+}
+
+bool StateHashFile::is_valid() const
+{
+	return m_error.empty();
+}
+
+const std::string& StateHashFile::get_error() const
+{
+	return m_error;
+}
+
+StateHashMode StateHashFile::get_mode() const
+{
+	return m_mode;
+}
+
+unsigned long long StateHashFile::get_interval() const
+{
+	return m_interval;
+}
+
+double StateHashFile::get_bucket_size() const
+{
+	return m_bucket_size;
+}
+
+bool StateHashFile::has_body_hashes() const
+{
+	return m_body_hashes;
+}
+
+std::size_t StateHashFile::get_record_count() const
+{
+	return m_offsets.size();
+}
+
+void StateHashFile::read_record(std::size_t index, StateHashRecord& record, bool with_bodies) const
+{
+	using namespace StateHashFormat;
+	const char* data = m_file.data() + m_offsets[index];
+	record.step = read_value<std::uint64_t>(data);
+	record.body_count = read_value<std::uint32_t>(data + 8);
+	record.hash = read_value<std::uint64_t>(data + 16);
+	record.ids.clear();
+	record.body_hashes.clear();
+	if(!with_bodies || !m_body_hashes)
+	{
+		return;
+	}
+	record.ids.resize(record.body_count);
+	record.body_hashes.resize(record.body_count);
+	for(std::size_t i = 0; i < record.body_count; ++i)
+	{
+		const char* body = data + RECORD_HEADER_SIZE + BODY_SIZE * i;
+		record.ids[i] = read_value<std::uint32_t>(body);
+		record.body_hashes[i] = read_value<std::uint64_t>(body + 8);
+	}
+}
+
+bool StateHashFile::is_truncated() const
+{
+	return m_truncated;
+}
@@ -0,0 +1,125 @@
+#ifndef SPELFYSIK_SLUTUPPGIFT_STATEHASH_H
+#define SPELFYSIK_SLUTUPPGIFT_STATEHASH_H
+
+#include "MappedFile.h"
+#include "Simulation.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// State hash stream (.nbhs), a hash of the bodies every few steps, everything little endian:
+//
+//   Header
+//   0       8         magic "NBODYHS" followed by a zero byte
+//   8       4         uint32 version, currently 1
+//   12      4         uint32 mode, 0 for exact and 1 for bucketed
+//   16      8         uint64 steps between records
+//   24      8         double bucket size in meters, 0 when exact
+//   32      4         uint32 1 if records have a hash per body, otherwise 0
+//   36      28        reserved, must be 0
+//
+//   Record, repeated until the end of the file
+//   0       8         uint64 step count
+//   8       4         uint32 number of bodies N
+//   12      4         reserved, 0
+//   16      8         uint64 hash of the whole state
+//   24      16*N      per body hashes if the header says so, each a uint32 id, 4 reserved bytes and a uint64 hash
+//
+// Exact hashes take the bits of the id, position, velocity and mass of every body, so any difference at all
+// changes them. Bucketed hashes only take the id and the position rounded down to a multiple of the bucket
+// size, so runs that differ by less than that usually hash the same, except where a value straddles a bucket
+// boundary.
+namespace StateHashFormat
+{
+	const char MAGIC[8] = {'N', 'B', 'O', 'D', 'Y', 'H', 'S', '\0'};
+	const std::uint32_t VERSION = 1;
+	const std::size_t HEADER_SIZE = 64;
+	const std::size_t RECORD_HEADER_SIZE = 24;
+	const std::size_t BODY_SIZE = 16;
+}
+
+enum class StateHashMode
+{
+	Exact,
+	Bucketed
+};
+
+// Writes the hash of the state to a stream after every interval steps. Hashing is a pass over the
+// bodies, a lot cheaper than the step itself.
+class StateHasher : public SimulationObserver
+{
+public:
+	// bucket_size is in meters and only used when bucketed. per_body also writes a hash for every body,
+	// so that a diff can tell which body diverged first.
+	StateHasher(const std::string& path, unsigned long long interval, StateHashMode mode, double bucket_size,
+	            bool per_body);
+	~StateHasher();
+	StateHasher(const StateHasher&) = delete;
+	StateHasher& operator=(const StateHasher&) = delete;
+
+	// False if the file couldn't be created or a write has failed
+	bool is_ok() const;
+	// Hashes the state if the step count is a multiple of the interval
+	void on_step(const Simulation& simulation) override;
+	// Hashes the state no matter the step count, e.g. the initial one
+	void hash(const Simulation& simulation);
+
+private:
+	std::FILE* m_file;
+	const unsigned long long m_interval;
+	const StateHashMode m_mode;
+	const double m_bucket_size;
+	const bool m_per_body;
+	bool m_write_failed;
+	// Reused between records
+	std::vector<double> m_positions;
+	std::vector<double> m_velocities;
+	std::vector<double> m_masses;
+	std::vector<unsigned int> m_ids;
+	std::vector<std::uint64_t> m_hashes;
+	std::vector<char> m_record;
+};
+
+// One record as read back from a stream
+struct StateHashRecord
+{
+	unsigned long long step;
+	unsigned int body_count;
+	std::uint64_t hash;
+	// Empty unless the stream has per body hashes
+	std::vector<unsigned int> ids;
+	std::vector<std::uint64_t> body_hashes;
+};
+
+// Reads a state hash stream. The records are read on demand, since per body streams get large.
+class StateHashFile
+{
+public:
+	explicit StateHashFile(const std::string& path);
+	// False if the file couldn't be opened or isn't a state hash stream
+	bool is_valid() const;
+	const std::string& get_error() const;
+	StateHashMode get_mode() const;
+	unsigned long long get_interval() const;
+	double get_bucket_size() const;
+	bool has_body_hashes() const;
+	std::size_t get_record_count() const;
+	// Only reads the per body hashes when with_bodies is true
+	void read_record(std::size_t index, StateHashRecord& record, bool with_bodies) const;
+	// True if the stream ended with an incomplete record
+	bool is_truncated() const;
+
+private:
+	std::string m_error;
+	MappedFile m_file;
+	StateHashMode m_mode;
+	unsigned long long m_interval;
+	double m_bucket_size;
+	bool m_body_hashes;
+	std::vector<std::size_t> m_offsets;
+	bool m_truncated;
+};
+
+#endif //SPELFYSIK_SLUTUPPGIFT_STATEHASH_H
@@ -0,0 +1,442 @@
+#include "StreamServer.h"
+#include "TrajectoryFile.h"
+#include "MappedFile.h"
+
+#include <cstring>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	// How long the server thread waits for something to happen before checking whether it should stop
+	const int POLL_TIMEOUT_MS = 100;
+
+#ifndef _WIN32
+	bool set_non_blocking(int descriptor)
+	{
+		const int flags = fcntl(descriptor, F_GETFL, 0);
+		return flags >= 0 && fcntl(descriptor, F_SETFL, flags | O_NONBLOCK) == 0;
+	}
+
+	// A client that has gone away must not take the whole process down with SIGPIPE
+	ssize_t send_without_signal(int socket, const char* data, std::size_t size)
+	{
+#ifdef MSG_NOSIGNAL
+		return send(socket, data, size, MSG_NOSIGNAL);
+#else
+		return send(socket, data, size, 0);
+#endif
+	}
+#endif
+
+	bool is_selected(const StreamSubscription& subscription, unsigned int id, const double* position)
+	{
+		if(subscription.stride > 1 && id % subscription.stride != 0)
+		{
+			return false;
+		}
+		if(subscription.use_region)
+		{
+			for(int axis = 0; axis < 3; ++axis)
+			{
+				if(position[axis] < subscription.min[axis] || position[axis] > subscription.max[axis])
+				{
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+}
+
+StreamSubscription::StreamSubscription()
+: use_region(false), min{0.0, 0.0, 0.0}, max{0.0, 0.0, 0.0}, stride(1)
+{
+}
+
+StreamServer::StreamServer(const std::string& socket_path, unsigned int interval,
+                           const TrajectoryCompression& compression)
+: m_path(socket_path),
+  m_error(),
+  m_interval(interval > 0 ? interval : 1),
+  m_compression(compression.is_enabled() ? compression : TrajectoryCompression(16, compression.keyframe_interval)),
+  m_listener(-1),
+  m_wake_pipe{-1, -1},
+  m_mutex(),
+  m_latest(),
+  m_has_latest(false),
+  m_clients(),
+  m_frame(),
+  m_selection(),
+  m_decoded(),
+  m_payload(),
+  m_client_count(0),
+  m_frames_sent(0),
+  m_frames_skipped(0),
+  m_stop(false),
+  m_thread()
+{
+#ifndef _WIN32
+	if(!host_is_little_endian())
+	{
+		m_error = "Streaming is only supported on little endian machines";
+		return;
+	}
+	sockaddr_un address;
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if(socket_path.size() >= sizeof(address.sun_path))
+	{
+		m_error = "Socket path is too long: " + socket_path;
+		return;
+	}
+	std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size());
+
+	m_listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	// A socket file left behind by an earlier run would make bind() fail
+	unlink(socket_path.c_str());
+	if(m_listener < 0 || bind(m_listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+	   || listen(m_listener, 8) != 0 || !set_non_blocking(m_listener))
+	{
+		m_error = "Could not listen on " + socket_path;
+		return;
+	}
+	if(pipe(m_wake_pipe) != 0 || !set_non_blocking(m_wake_pipe[0]) || !set_non_blocking(m_wake_pipe[1]))
+	{
+		m_error = "Could not create the wake up pipe";
+		return;
+	}
+	m_thread = std::thread(&StreamServer::run, this);
+#else
+	m_error = "Streaming needs Unix domain sockets";
+#endif
+}
+
+StreamServer::~StreamServer()
+{
+#ifndef _WIN32
+	if(m_thread.joinable())
+	{
+		m_stop = true;
+		const char wake = 0;
+		(void)write(m_wake_pipe[1], &wake, 1);
+		m_thread.join();
+	}
+	for(Client& client : m_clients)
+	{
+		close(client.socket);
+	}
+	for(int descriptor : m_wake_pipe)
+	{
+		if(descriptor >= 0)
+		{
+			close(descriptor);
+		}
+	}
+	if(m_listener >= 0)
+	{
+		close(m_listener);
+		unlink(m_path.c_str());
+	}
+#endif
+}
+
+bool StreamServer::is_open() const
+{
+	return m_thread.joinable();
+}
+
+const std::string& StreamServer::get_error() const
+{
+	return m_error;
+}
+
+void StreamServer::on_step(const Simulation& simulation)
+{
+	if(simulation.get_step_count() % m_interval == 0)
+	{
+		publish(simulation);
+	}
+}
+
+void StreamServer::publish(const Simulation& simulation)
+{
+	// Nobody to send it to, don't bother copying
+	if(!is_open() || m_client_count == 0)
+	{
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		simulation.copy_snapshot(m_latest);
+		m_has_latest = true;
+	}
+#ifndef _WIN32
+	// If the pipe is full the server is awake already
+	const char wake = 0;
+	(void)write(m_wake_pipe[1], &wake, 1);
+#endif
+}
+
+std::size_t StreamServer::get_client_count() const
+{
+	return m_client_count;
+}
+
+unsigned long long StreamServer::get_frames_sent() const
+{
+	return m_frames_sent;
+}
+
+unsigned long long StreamServer::get_frames_skipped() const
+{
+	return m_frames_skipped;
+}
+
+void StreamServer::run()
+{
+#ifndef _WIN32
+	std::vector<pollfd> descriptors;
+	while(!m_stop)
+	{
+		descriptors.clear();
+		descriptors.push_back({m_wake_pipe[0], POLLIN, 0});
+		descriptors.push_back({m_listener, POLLIN, 0});
+		for(const Client& client : m_clients)
+		{
+			const short events = POLLIN | (client.pending_sent < client.pending.size() ? POLLOUT : 0);
+			descriptors.push_back({client.socket, events, 0});
+		}
+		if(poll(descriptors.data(), descriptors.size(), POLL_TIMEOUT_MS) < 0 && errno != EINTR)
+		{
+			break;
+		}
+
+		if(descriptors[0].revents & POLLIN)
+		{
+			char wake[64];
+			while(read(m_wake_pipe[0], wake, sizeof(wake)) > 0)
+			{
+			}
+		}
+		// Serve the clients that were polled before accepting new ones, which shifts the indices
+		std::vector<bool> gone(m_clients.size(), false);
+		for(std::size_t i = 0; i < m_clients.size(); ++i)
+		{
+			const short events = descriptors[i + 2].revents;
+			gone[i] = (events & (POLLERR | POLLNVAL)) || ((events & (POLLIN | POLLHUP)) && !receive(m_clients[i]))
+			          || ((events & POLLOUT) && !send_pending(m_clients[i]));
+		}
+		for(std::size_t i = m_clients.size(); i-- > 0;)
+		{
+			if(gone[i])
+			{
+				close(m_clients[i].socket);
+				m_clients.erase(m_clients.begin() + i);
+			}
+		}
+		if(descriptors[1].revents & POLLIN)
+		{
+			accept_clients();
+		}
+		m_client_count = m_clients.size();
+
+		bool has_frame;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			has_frame = m_has_latest;
+			if(has_frame)
+			{
+				std::swap(m_latest, m_frame);
+				m_has_latest = false;
+			}
+		}
+		if(!has_frame)
+		{
+			continue;
+		}
+		for(std::size_t i = m_clients.size(); i-- > 0;)
+		{
+			Client& client = m_clients[i];
+			if(client.pending_sent < client.pending.size())
+			{
+				// Still busy with an earlier frame. Frames are coded against what the client has
+				// actually received, so skipping one doesn't break the next.
+				++m_frames_skipped;
+				continue;
+			}
+			queue_frame(client, m_frame);
+			if(!send_pending(client))
+			{
+				close(client.socket);
+				m_clients.erase(m_clients.begin() + i);
+			}
+		}
+		m_client_count = m_clients.size();
+	}
+#endif
+}
+
+void StreamServer::accept_clients()
+{
+#ifndef _WIN32
+	while(true)
+	{
+		const int socket = accept(m_listener, nullptr, nullptr);
+		if(socket < 0)
+		{
+			return;
+		}
+		if(!set_non_blocking(socket))
+		{
+			close(socket);
+			continue;
+		}
+#ifdef SO_NOSIGPIPE
+		const int one = 1;
+		setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+		Client client = Client();
+		client.socket = socket;
+		client.pending_sent = 0;
+		client.chain_length = 0;
+		// Every stream starts out as a trajectory file that has no index yet
+		client.pending.assign(TrajectoryFormat::HEADER_SIZE, 0);
+		std::memcpy(client.pending.data(), TrajectoryFormat::MAGIC, sizeof(TrajectoryFormat::MAGIC));
+		write_value(client.pending.data() + 8, TrajectoryFormat::VERSION);
+		m_clients.push_back(std::move(client));
+	}
+#endif
+}
+
+bool StreamServer::receive(Client& client)
+{
+#ifndef _WIN32
+	using namespace StreamFormat;
+	char buffer[256];
+	while(true)
+	{
+		const ssize_t received = recv(client.socket, buffer, sizeof(buffer), 0);
+		if(received == 0)
+		{
+			return false;
+		}
+		if(received < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			if(errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				return false;
+			}
+			break;
+		}
+		client.received.insert(client.received.end(), buffer, buffer + received);
+	}
+
+	// Only the latest complete subscription matters
+	std::size_t offset = 0;
+	for(; client.received.size() - offset >= SUBSCRIPTION_SIZE; offset += SUBSCRIPTION_SIZE)
+	{
+		const char* message = client.received.data() + offset;
+		if(std::memcmp(message, SUBSCRIPTION_MAGIC, sizeof(SUBSCRIPTION_MAGIC)) != 0)
+		{
+			// Not speaking our protocol
+			return false;
+		}
+		StreamSubscription& subscription = client.subscription;
+		subscription.use_region = read_value<std::uint32_t>(message + 4) != 0;
+		std::memcpy(subscription.min, message + 8, sizeof(subscription.min));
+		std::memcpy(subscription.max, message + 32, sizeof(subscription.max));
+		subscription.stride = read_value<std::uint32_t>(message + 56);
+	}
+	client.received.erase(client.received.begin(), client.received.begin() + offset);
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool StreamServer::send_pending(Client& client)
+{
+#ifndef _WIN32
+	while(client.pending_sent < client.pending.size())
+	{
+		const ssize_t sent = send_without_signal(client.socket, client.pending.data() + client.pending_sent,
+		                                         client.pending.size() - client.pending_sent);
+		if(sent < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		}
+		client.pending_sent += sent;
+	}
+	client.pending.clear();
+	client.pending_sent = 0;
+	return true;
+#else
+	return false;
+#endif
+}
+
+void StreamServer::queue_frame(Client& client, const Snapshot& frame)
+{
+	using namespace TrajectoryFormat;
+	// Filtering keeps the ids in ascending order, which the delta coding relies on
+	const Snapshot* selected = &frame;
+	const StreamSubscription& subscription = client.subscription;
+	if(subscription.use_region || subscription.stride > 1)
+	{
+		m_selection.step = frame.step;
+		m_selection.time = frame.time;
+		m_selection.ids.clear();
+		m_selection.positions.clear();
+		m_selection.radii.clear();
+		for(std::size_t i = 0; i < frame.body_count(); ++i)
+		{
+			const double* position = &frame.positions[3 * i];
+			if(is_selected(subscription, frame.ids[i], position))
+			{
+				m_selection.ids.push_back(frame.ids[i]);
+				m_selection.positions.insert(m_selection.positions.end(), position, position + 3);
+				m_selection.radii.push_back(frame.radii[i]);
+			}
+		}
+		selected = &m_selection;
+	}
+
+	const bool keyframe = client.chain_length == 0 || (m_compression.keyframe_interval > 0
+	                                                   && client.chain_length >= m_compression.keyframe_interval);
+	TrajectoryCompressionStats stats;
+	encode_quantized_frame(*selected, keyframe ? nullptr : &client.previous,
+	                       keyframe || client.chain_length < 2 ? nullptr : &client.older,
+	                       m_compression.bits, m_payload, m_decoded, stats);
+	std::swap(client.older, client.previous);
+	std::swap(client.previous, m_decoded);
+	client.chain_length = quantized_frame_references(m_payload.data(), m_payload.size()) == 0 ? 1
+	                      : client.chain_length + 1;
+
+	client.pending.resize(FRAME_HEADER_SIZE + m_payload.size());
+	char* header = client.pending.data();
+	std::memcpy(header, FRAME_MAGIC, sizeof(FRAME_MAGIC));
+	write_value(header + 4, ENCODING_QUANTIZED);
+	write_value(header + 8, static_cast<std::uint64_t>(selected->step));
+	write_value(header + 16, selected->time);
+	write_value(header + 24, static_cast<std::uint64_t>(selected->body_count()));
+	write_value(header + 32, static_cast<std::uint64_t>(m_payload.size()));
+	std::memcpy(header + FRAME_HEADER_SIZE, m_payload.data(), m_payload.size());
+	client.pending_sent = 0;
+	++m_frames_sent;
+}
@@ -0,0 +1,119 @@
+#ifndef SPELFYSIK_SLUTUPPGIFT_STREAMSERVER_H
+#define SPELFYSIK_SLUTUPPGIFT_STREAMSERVER_H
+
+#include "Simulation.h"
+#include "Snapshot.h"
+#include "TrajectoryCodec.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// What a server sends is a trajectory file without index: the file header followed by quantized frames
+// (see TrajectoryFile.h), starting with a keyframe. Saved as is, a stream plays in the replay viewer.
+//
+// A client can send subscriptions at any time to only get part of the bodies, everything little endian:
+//
+//   0       4         magic "NBSB"
+//   4       4         uint32 1 to only send bodies inside the box below, 0 for all bodies
+//   8       24        double minimum x, y, z of the box in meters
+//   32      24        double maximum x, y, z of the box in meters
+//   56      4         uint32 stride, only bodies whose id is a multiple of it are sent, 0 or 1 for all
+//   60      4         uint32 reserved, must be 0
+namespace StreamFormat
+{
+	const char SUBSCRIPTION_MAGIC[4] = {'N', 'B', 'S', 'B'};
+	const std::size_t SUBSCRIPTION_SIZE = 64;
+}
+
+// What part of the bodies a client wants
+struct StreamSubscription
+{
+	StreamSubscription();
+
+	bool use_region;
+	double min[3];
+	double max[3];
+	unsigned int stride;
+};
+
+// Streams the simulation to local viewers over a Unix domain socket. Every interval steps the
+// simulating thread copies the bodies for a background thread, which encodes a frame for every
+// client against what that client has received so far. A client that hasn't read its previous
+// frame yet skips frames until it has, so a slow viewer never holds up the simulation or the others.
+class StreamServer : public SimulationObserver
+{
+public:
+	StreamServer(const std::string& socket_path, unsigned int interval,
+	             const TrajectoryCompression& compression = TrajectoryCompression(16, 32));
+	// Disconnects every client and removes the socket
+	~StreamServer();
+	StreamServer(const StreamServer&) = delete;
+	StreamServer& operator=(const StreamServer&) = delete;
+
+	// False if the socket couldn't be created
+	bool is_open() const;
+	const std::string& get_error() const;
+	// Publishes a frame if the step is on the streaming interval
+	void on_step(const Simulation& simulation) override;
+	// Publishes a frame regardless of the step, replacing one the server hasn't picked up yet
+	void publish(const Simulation& simulation);
+
+	std::size_t get_client_count() const;
+	unsigned long long get_frames_sent() const;
+	// Frames not sent to a client because it was still reading an earlier one
+	unsigned long long get_frames_skipped() const;
+
+private:
+	struct Client
+	{
+		int socket;
+		StreamSubscription subscription;
+		std::vector<char> received;
+		// Bytes waiting to go out, and how many of them have been sent
+		std::vector<char> pending;
+		std::size_t pending_sent;
+		// The frames this client has decoded, for coding the next one against
+		Snapshot previous;
+		Snapshot older;
+		unsigned int chain_length;
+	};
+
+	void run();
+	void accept_clients();
+	// Each returns false if the client has gone away
+	bool receive(Client& client);
+	bool send_pending(Client& client);
+	void queue_frame(Client& client, const Snapshot& frame);
+
+	std::string m_path;
+	std::string m_error;
+	const unsigned int m_interval;
+	const TrajectoryCompression m_compression;
+	int m_listener;
+	// Writing a byte here wakes the server thread
+	int m_wake_pipe[2];
+
+	// The latest frame handed over by the simulation, guarded by m_mutex
+	std::mutex m_mutex;
+	Snapshot m_latest;
+	bool m_has_latest;
+
+	// Only touched by the server thread
+	std::vector<Client> m_clients;
+	Snapshot m_frame;
+	Snapshot m_selection;
+	Snapshot m_decoded;
+	std::vector<char> m_payload;
+
+	std::atomic<std::size_t> m_client_count;
+	std::atomic<unsigned long long> m_frames_sent;
+	std::atomic<unsigned long long> m_frames_skipped;
+	std::atomic<bool> m_stop;
+	std::thread m_thread;
+};
+
+#endif //SPELFYSIK_SLUTUPPGIFT_STREAMSERVER_H
@@ -0,0 +1,207 @@
+#include "Trace.h"
+
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+	// Events per thread buffer, 40 bytes each
+	const std::size_t BUFFER_EVENTS = 1 << 16;
+
+	struct Event
+	{
+		const char* category;
+		const char* name;
+		std::uint64_t start;
+		std::uint64_t end;
+		unsigned int thread;
+	};
+
+	// Written only by the thread holding it, read when the trace is written
+	struct Buffer
+	{
+		Buffer() : events(BUFFER_EVENTS), written(0) {}
+		std::vector<Event> events;
+		std::atomic<std::uint64_t> written;
+	};
+
+	// Buffers outlive their threads. The pool workers keep theirs, but the threads started when the pool is busy
+	// (nested parallel loops) come and go and take over the buffers of the ones that are done
+	struct Registry
+	{
+		Registry() : epoch(std::chrono::steady_clock::now()), next_thread(1) {}
+		const std::chrono::steady_clock::time_point epoch;
+		std::mutex mutex;
+		std::vector<std::unique_ptr<Buffer>> buffers;
+		std::vector<Buffer*> free_buffers;
+		std::map<unsigned int, const char*> thread_names;
+		unsigned int next_thread;
+	};
+
+	Registry& registry()
+	{
+		// Never destroyed, threads may still give back their buffers during exit
+		static Registry* registry = new Registry();
+		return *registry;
+	}
+
+	struct ThreadState
+	{
+		ThreadState() : buffer(nullptr), thread(0) {}
+		~ThreadState()
+		{
+			if(buffer)
+			{
+				Registry& r = registry();
+				std::lock_guard<std::mutex> lock(r.mutex);
+				r.free_buffers.push_back(buffer);
+			}
+		}
+		Buffer* buffer;
+		unsigned int thread;
+	};
+
+	thread_local ThreadState thread_state;
+
+	unsigned int thread_id()
+	{
+		if(thread_state.thread == 0)
+		{
+			Registry& r = registry();
+			std::lock_guard<std::mutex> lock(r.mutex);
+			thread_state.thread = r.next_thread++;
+		}
+		return thread_state.thread;
+	}
+
+	Buffer& thread_buffer()
+	{
+		if(!thread_state.buffer)
+		{
+			thread_id();
+			Registry& r = registry();
+			std::lock_guard<std::mutex> lock(r.mutex);
+			if(r.free_buffers.empty())
+			{
+				r.buffers.emplace_back(new Buffer());
+				thread_state.buffer = r.buffers.back().get();
+			}
+			else
+			{
+				thread_state.buffer = r.free_buffers.back();
+				r.free_buffers.pop_back();
+			}
+		}
+		return *thread_state.buffer;
+	}
+
+	// Names end up in JSON strings
+	void write_escaped(std::FILE* file, const char* string)
+	{
+		for(; *string; ++string)
+		{
+			if(*string == '"' || *string == '\\')
+			{
+				std::fputc('\\', file);
+			}
+			if(static_cast<unsigned char>(*string) >= 0x20)
+			{
+				std::fputc(*string, file);
+			}
+		}
+	}
+}
+
+std::atomic<bool> TraceDetail::enabled(false);
+
+std::uint64_t TraceDetail::now()
+{
+	const std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - registry().epoch;
+	// 0 means not started
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() + 1;
+}
+
+void TraceDetail::record(const char* category, const char* name, std::uint64_t start, std::uint64_t end)
+{
+	Buffer& buffer = thread_buffer();
+	const std::uint64_t written = buffer.written.load(std::memory_order_relaxed);
+	buffer.events[written % BUFFER_EVENTS] = Event{category, name, start, end, thread_state.thread};
+	buffer.written.store(written + 1, std::memory_order_release);
+}
+
+void set_tracing(bool enabled)
+{
+	// Sets up the clock before the first event needs it
+	registry();
+	TraceDetail::enabled.store(enabled);
+}
+
+bool is_tracing()
+{
+	return TraceDetail::enabled.load();
+}
+
+void set_trace_thread_name(const char* name)
+{
+	const unsigned int thread = thread_id();
+	Registry& r = registry();
+	std::lock_guard<std::mutex> lock(r.mutex);
+	r.thread_names[thread] = name;
+}
+
+bool write_chrome_trace(const std::string& path)
+{
+	std::FILE* file = std::fopen(path.c_str(), "w");
+	if(!file)
+	{
+		return false;
+	}
+	Registry& r = registry();
+	std::lock_guard<std::mutex> lock(r.mutex);
+	std::uint64_t dropped = 0;
+	const char* separator = "\n";
+	std::fputs("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [", file);
+	for(const auto& name : r.thread_names)
+	{
+		std::fprintf(file, "%s{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"",
+		             separator, name.first);
+		write_escaped(file, name.second);
+		std::fputs("\"}}", file);
+		separator = ",\n";
+	}
+	for(const std::unique_ptr<Buffer>& buffer : r.buffers)
+	{
+		const std::uint64_t written = buffer->written.load(std::memory_order_acquire);
+		const std::uint64_t first = written > BUFFER_EVENTS ? written - BUFFER_EVENTS : 0;
+		dropped += first;
+		for(std::uint64_t i = first; i < written; ++i)
+		{
+			const Event& event = buffer->events[i % BUFFER_EVENTS];
+			// Microseconds, to the nanosecond
+			std::fprintf(file, "%s{\"ph\": \"X\", \"cat\": \"", separator);
+			write_escaped(file, event.category);
+			std::fputs("\", \"name\": \"", file);
+			write_escaped(file, event.name);
+			std::fprintf(file, "\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}", event.thread,
+			             event.start * 1e-3, (event.end - event.start) * 1e-3);
+			separator = ",\n";
+		}
+	}
+	std::fprintf(file, "\n], \"otherData\": {\"dropped_events\": %llu}}\n", static_cast<unsigned long long>(dropped));
+	const bool ok = !std::ferror(file);
+	return std::fclose(file) == 0 && ok;
+}
+
+void clear_trace()
+{
+	Registry& r = registry();
+	std::lock_guard<std::mutex> lock(r.mutex);
+	for(const std::unique_ptr<Buffer>& buffer : r.buffers)
+	{
+		buffer->written.store(0);
+	}
+}
@@ -0,0 +1,60 @@
+#ifndef SPELFYSIK_SLUTUPPGIFT_TRACE_H
+#define SPELFYSIK_SLUTUPPGIFT_TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Timeline tracing of the phases of the simulation and rendering and of the parallel tasks, written as Chrome
+// trace JSON that chrome://tracing and ui.perfetto.dev open. Every thread records into a ring buffer of its own
+// without locking, and when a buffer fills up its oldest events are overwritten. Off by default, and then a
+// TraceScope costs a load of a flag.
+
+namespace TraceDetail
+{
+	extern std::atomic<bool> enabled;
+	std::uint64_t now();
+	void record(const char* category, const char* name, std::uint64_t start, std::uint64_t end);
+}
+
+void set_tracing(bool enabled);
+bool is_tracing();
+// Names the calling thread in the trace, name must outlive the trace like a string literal
+void set_trace_thread_name(const char* name);
+// Writes the events recorded so far. Threads that are still recording may overwrite what is being written,
+// so call it between steps when the workers are done. Returns false if the file couldn't be written.
+bool write_chrome_trace(const std::string& path);
+// Forgets the events recorded so far
+void clear_trace();
+
+// Records the time until it goes out of scope as one event. category and name must outlive the trace,
+// like string literals.
+class TraceScope
+{
+public:
+	TraceScope(const char* category, const char* name)
+	: m_category(category), m_name(name), m_start(0)
+	{
+		if(TraceDetail::enabled.load(std::memory_order_relaxed))
+		{
+			m_start = TraceDetail::now();
+		}
+	}
+	~TraceScope()
+	{
+		// Tracing that started during the scope has no start time to go by
+		if(m_start != 0 && TraceDetail::enabled.load(std::memory_order_relaxed))
+		{
+			TraceDetail::record(m_category, m_name, m_start, TraceDetail::now());
+		}
+	}
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+	const char* const m_category;
+	const char* const m_name;
+	std::uint64_t m_start;
+};
+
+#endif //SPELFYSIK_SLUTUPPGIFT_TRACE_H
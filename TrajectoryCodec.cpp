@@ -0,0 +1,565 @@
+#include "TrajectoryCodec.h"
+#include "Parallel.h"
+#include "TrajectoryFile.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace
+{
+	const std::size_t NOT_FOUND = std::numeric_limits<std::size_t>::max();
+	const std::size_t CHUNK_HEADER_SIZE = 8;
+	// Keeps the quantized values well inside an int64 even for bodies that have flown far away
+	const double MAX_QUANTA = 4.0e18;
+
+	std::uint64_t zigzag(std::int64_t value)
+	{
+		return (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63);
+	}
+
+	std::int64_t unzigzag(std::uint64_t value)
+	{
+		return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+	}
+
+	unsigned int bit_width(std::uint64_t value)
+	{
+		unsigned int width = 0;
+		for(; value != 0; value >>= 1)
+		{
+			++width;
+		}
+		return width;
+	}
+
+	// Both sides compute positions with this, so the encoder knows exactly what the decoder will see
+	double dequantize(double base, std::int64_t quanta, double quantum)
+	{
+		return base + static_cast<double>(quanta) * quantum;
+	}
+
+	std::int64_t quantize(double offset, double quantum)
+	{
+		const double quanta = offset / quantum;
+		if(!(std::abs(quanta) < MAX_QUANTA))
+		{
+			// Not finite or absurdly far, the error statistic will show it
+			return std::isfinite(quanta) ? (quanta > 0.0 ? 1 : -1) * static_cast<std::int64_t>(MAX_QUANTA) : 0;
+		}
+		return std::llround(quanta);
+	}
+
+	bool ids_ascending(const std::vector<unsigned int>& ids)
+	{
+		for(std::size_t i = 1; i < ids.size(); ++i)
+		{
+			if(ids[i] <= ids[i - 1])
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	class BitWriter
+	{
+	public:
+		explicit BitWriter(std::vector<std::uint64_t>& words)
+		: m_words(words), m_current(0), m_used(0)
+		{
+		}
+
+		void put(std::uint64_t value, unsigned int width)
+		{
+			if(width == 0)
+			{
+				return;
+			}
+			m_current |= value << m_used;
+			if(m_used + width >= 64)
+			{
+				m_words.push_back(m_current);
+				m_current = m_used > 0 ? value >> (64 - m_used) : 0;
+				m_used = m_used + width - 64;
+			}
+			else
+			{
+				m_used += width;
+			}
+		}
+
+		void flush()
+		{
+			if(m_used > 0)
+			{
+				m_words.push_back(m_current);
+				m_current = 0;
+				m_used = 0;
+			}
+		}
+
+	private:
+		std::vector<std::uint64_t>& m_words;
+		std::uint64_t m_current;
+		unsigned int m_used;
+	};
+
+	// The caller checks that there are enough words for everything it reads
+	class BitReader
+	{
+	public:
+		explicit BitReader(const char* words)
+		: m_words(words), m_word(0), m_used(0)
+		{
+		}
+
+		std::uint64_t get(unsigned int width)
+		{
+			if(width == 0)
+			{
+				return 0;
+			}
+			std::uint64_t value = read_value<std::uint64_t>(m_words + 8 * m_word) >> m_used;
+			if(m_used + width >= 64)
+			{
+				++m_word;
+				if(m_used + width > 64)
+				{
+					value |= read_value<std::uint64_t>(m_words + 8 * m_word) << (64 - m_used);
+				}
+				m_used = m_used + width - 64;
+			}
+			else
+			{
+				m_used += width;
+			}
+			return width < 64 ? value & ((std::uint64_t(1) << width) - 1) : value;
+		}
+
+	private:
+		const char* m_words;
+		std::size_t m_word;
+		unsigned int m_used;
+	};
+
+	// Finds bodies of a frame in another frame, walking both in ascending id order
+	class IdMatcher
+	{
+	public:
+		// Starts at the first body with at least first_id, frame can be null
+		IdMatcher(const Snapshot* frame, unsigned int first_id)
+		: m_ids(frame ? &frame->ids : nullptr),
+		  m_from(frame ? std::lower_bound(m_ids->begin(), m_ids->end(), first_id) - m_ids->begin() : 0)
+		{
+		}
+
+		// Index of the body with id, or NOT_FOUND. Ids have to be asked for in ascending order.
+		std::size_t find(unsigned int id)
+		{
+			if(!m_ids)
+			{
+				return NOT_FOUND;
+			}
+			while(m_from < m_ids->size() && (*m_ids)[m_from] < id)
+			{
+				++m_from;
+			}
+			return m_from < m_ids->size() && (*m_ids)[m_from] == id ? m_from : NOT_FOUND;
+		}
+
+	private:
+		const std::vector<unsigned int>* m_ids;
+		std::size_t m_from;
+	};
+
+	// Keeps going the way the body went between the two previous frames, or stays where it was if it's
+	// only in the previous frame. New bodies start from the origin.
+	double predict(const Snapshot* previous, std::size_t in_previous, const Snapshot* older, std::size_t in_older,
+	               const double* origin, int axis)
+	{
+		if(in_previous == NOT_FOUND)
+		{
+			return origin[axis];
+		}
+		const double last = previous->positions[3 * in_previous + axis];
+		if(in_older == NOT_FOUND)
+		{
+			return last;
+		}
+		return last + (last - older->positions[3 * in_older + axis]);
+	}
+
+	std::size_t block_count(std::size_t values)
+	{
+		return (values + QuantizedFrame::BLOCK_SIZE - 1) / QuantizedFrame::BLOCK_SIZE;
+	}
+
+	// Appends the width of the widest value in every block
+	void add_block_widths(const std::vector<std::uint64_t>& values, std::vector<unsigned char>& widths)
+	{
+		for(std::size_t begin = 0; begin < values.size(); begin += QuantizedFrame::BLOCK_SIZE)
+		{
+			const std::size_t end = std::min(begin + QuantizedFrame::BLOCK_SIZE, values.size());
+			unsigned int width = 0;
+			for(std::size_t i = begin; i < end; ++i)
+			{
+				width = std::max(width, bit_width(values[i]));
+			}
+			widths.push_back(static_cast<unsigned char>(width));
+		}
+	}
+
+	void pack_blocks(const std::vector<std::uint64_t>& values, const unsigned char* widths, BitWriter& writer)
+	{
+		for(std::size_t i = 0; i < values.size(); ++i)
+		{
+			writer.put(values[i], widths[i / QuantizedFrame::BLOCK_SIZE]);
+		}
+	}
+
+	std::size_t padded_to_words(std::size_t size)
+	{
+		return (size + 7) / 8 * 8;
+	}
+}
+
+TrajectoryCompression::TrajectoryCompression()
+: bits(0), keyframe_interval(0)
+{
+}
+
+TrajectoryCompression::TrajectoryCompression(unsigned int bits, unsigned int keyframe_interval)
+: bits(bits), keyframe_interval(keyframe_interval)
+{
+}
+
+bool TrajectoryCompression::is_enabled() const
+{
+	return bits > 0;
+}
+
+TrajectoryCompressionStats::TrajectoryCompressionStats()
+: frames(0), raw_bytes(0), encoded_bytes(0), max_error(0.0)
+{
+}
+
+double TrajectoryCompressionStats::get_ratio() const
+{
+	return encoded_bytes > 0 ? static_cast<double>(raw_bytes) / encoded_bytes : 1.0;
+}
+
+void encode_quantized_frame(const Snapshot& frame, const Snapshot* previous, const Snapshot* older,
+                            unsigned int bits, std::vector<char>& payload, Snapshot& decoded,
+                            TrajectoryCompressionStats& stats)
+{
+	const std::size_t body_count = frame.body_count();
+	bits = std::min(std::max(bits, 1u), 52u);
+	// Matching bodies by walking the id lists needs them sorted
+	if(previous && (!ids_ascending(frame.ids) || !ids_ascending(previous->ids)))
+	{
+		previous = nullptr;
+	}
+	if(!previous || (older && !ids_ascending(older->ids)))
+	{
+		older = nullptr;
+	}
+	const std::uint32_t references = previous ? (older ? 2 : 1) : 0;
+
+	// The grid covers the bounding box of the finite positions
+	double min[3] = {0.0, 0.0, 0.0};
+	double max[3] = {0.0, 0.0, 0.0};
+	bool any_finite = false;
+	for(std::size_t i = 0; i < body_count; ++i)
+	{
+		const double* p = &frame.positions[3 * i];
+		if(!std::isfinite(p[0]) || !std::isfinite(p[1]) || !std::isfinite(p[2]))
+		{
+			continue;
+		}
+		for(int axis = 0; axis < 3; ++axis)
+		{
+			min[axis] = any_finite ? std::min(min[axis], p[axis]) : p[axis];
+			max[axis] = any_finite ? std::max(max[axis], p[axis]) : p[axis];
+		}
+		any_finite = true;
+	}
+	const double extent = std::max(max[0] - min[0], std::max(max[1] - min[1], max[2] - min[2]));
+	const double quantum = extent > 0.0 ? extent / static_cast<double>((std::uint64_t(1) << bits) - 1) : 1.0;
+
+	decoded.step = frame.step;
+	decoded.time = frame.time;
+	decoded.ids = frame.ids;
+	decoded.positions.resize(3 * body_count);
+	decoded.radii.resize(body_count);
+
+	const std::size_t chunk_count = (body_count + QuantizedFrame::CHUNK_SIZE - 1) / QuantizedFrame::CHUNK_SIZE;
+	std::vector<std::vector<char>> chunks(chunk_count);
+	std::vector<std::vector<double>> chunk_new_radii(chunk_count);
+	std::vector<double> chunk_errors(chunk_count, 0.0);
+
+	parallel_for_chunks(body_count, QuantizedFrame::CHUNK_SIZE,
+		[&](std::size_t chunk, std::size_t begin, std::size_t end)
+		{
+			// Columns of ids differences and x, y, z values
+			std::vector<std::uint64_t> columns[4];
+			columns[0].reserve(end - begin - 1);
+			for(int axis = 0; axis < 3; ++axis)
+			{
+				columns[axis + 1].resize(end - begin);
+			}
+			IdMatcher in_previous(previous, frame.ids[begin]);
+			IdMatcher in_older(older, frame.ids[begin]);
+			double error = 0.0;
+			for(std::size_t i = begin; i < end; ++i)
+			{
+				if(i > begin)
+				{
+					columns[0].push_back(zigzag(static_cast<std::int64_t>(frame.ids[i]) - frame.ids[i - 1]));
+				}
+				const std::size_t p = in_previous.find(frame.ids[i]);
+				const std::size_t o = in_older.find(frame.ids[i]);
+				for(int axis = 0; axis < 3; ++axis)
+				{
+					const double exact = frame.positions[3 * i + axis];
+					const double base = predict(previous, p, older, o, min, axis);
+					const std::int64_t quanta = quantize(exact - base, quantum);
+					columns[axis + 1][i - begin] = zigzag(quanta);
+					decoded.positions[3 * i + axis] = dequantize(base, quanta, quantum);
+					if(std::isfinite(exact))
+					{
+						error = std::max(error, std::abs(decoded.positions[3 * i + axis] - exact));
+					}
+				}
+				if(p != NOT_FOUND)
+				{
+					decoded.radii[i] = previous->radii[p];
+				}
+				else
+				{
+					decoded.radii[i] = frame.radii[i];
+					chunk_new_radii[chunk].push_back(frame.radii[i]);
+				}
+			}
+			chunk_errors[chunk] = error;
+
+			// Small values don't pay for the few large ones in other blocks
+			std::vector<unsigned char> widths;
+			for(const std::vector<std::uint64_t>& column : columns)
+			{
+				add_block_widths(column, widths);
+			}
+			std::vector<std::uint64_t> words;
+			BitWriter writer(words);
+			const unsigned char* column_widths = widths.data();
+			for(const std::vector<std::uint64_t>& column : columns)
+			{
+				pack_blocks(column, column_widths, writer);
+				column_widths += block_count(column.size());
+			}
+			writer.flush();
+
+			std::vector<char>& out = chunks[chunk];
+			const std::size_t widths_size = padded_to_words(widths.size());
+			out.assign(CHUNK_HEADER_SIZE + widths_size + 8 * words.size(), 0);
+			write_value(out.data(), static_cast<std::uint32_t>(frame.ids[begin]));
+			std::memcpy(out.data() + CHUNK_HEADER_SIZE, widths.data(), widths.size());
+			std::memcpy(out.data() + CHUNK_HEADER_SIZE + widths_size, words.data(), 8 * words.size());
+		});
+
+	// Stitch the chunks together behind their offset table
+	std::size_t chunks_size = 0;
+	std::size_t new_body_count = 0;
+	for(std::size_t chunk = 0; chunk < chunk_count; ++chunk)
+	{
+		chunks_size += chunks[chunk].size();
+		new_body_count += chunk_new_radii[chunk].size();
+	}
+	const std::size_t table_size = 8 * (chunk_count + 1);
+	payload.resize(QuantizedFrame::HEADER_SIZE + table_size + chunks_size + 8 * new_body_count);
+	char* out = payload.data();
+	write_value(out, static_cast<std::uint32_t>(bits));
+	write_value(out + 4, references);
+	std::memcpy(out + 8, min, sizeof(min));
+	std::memcpy(out + 32, max, sizeof(max));
+	write_value(out + 56, quantum);
+	write_value(out + 64, static_cast<std::uint64_t>(chunk_count));
+	char* table = out + QuantizedFrame::HEADER_SIZE;
+	char* chunk_data = table + table_size;
+	std::uint64_t chunk_offset = 0;
+	for(std::size_t chunk = 0; chunk < chunk_count; ++chunk)
+	{
+		write_value(table + 8 * chunk, chunk_offset);
+		std::memcpy(chunk_data + chunk_offset, chunks[chunk].data(), chunks[chunk].size());
+		chunk_offset += chunks[chunk].size();
+	}
+	write_value(table + 8 * chunk_count, chunk_offset);
+	char* radii = chunk_data + chunks_size;
+	for(const std::vector<double>& chunk_radii : chunk_new_radii)
+	{
+		std::memcpy(radii, chunk_radii.data(), sizeof(double) * chunk_radii.size());
+		radii += sizeof(double) * chunk_radii.size();
+	}
+
+	++stats.frames;
+	stats.raw_bytes += TrajectoryFormat::FRAME_HEADER_SIZE + TrajectoryFormat::raw_payload_size(body_count);
+	stats.encoded_bytes += TrajectoryFormat::FRAME_HEADER_SIZE + payload.size();
+	for(double error : chunk_errors)
+	{
+		stats.max_error = std::max(stats.max_error, error);
+	}
+}
+
+bool decode_quantized_frame(const char* payload, std::size_t size, std::uint64_t body_count,
+                            const Snapshot* previous, const Snapshot* older, Snapshot& decoded)
+{
+	if(size < QuantizedFrame::HEADER_SIZE)
+	{
+		return false;
+	}
+	const std::uint32_t references = read_value<std::uint32_t>(payload + 4);
+	const std::uint64_t chunk_count = read_value<std::uint64_t>(payload + 64);
+	if(references > 2 || (references >= 1 && !previous) || (references >= 2 && !older)
+	   || chunk_count != (body_count + QuantizedFrame::CHUNK_SIZE - 1) / QuantizedFrame::CHUNK_SIZE
+	   || chunk_count >= (size - QuantizedFrame::HEADER_SIZE) / 8)
+	{
+		return false;
+	}
+	if(references < 2)
+	{
+		older = nullptr;
+	}
+	if(references < 1)
+	{
+		previous = nullptr;
+	}
+	double min[3];
+	std::memcpy(min, payload + 8, sizeof(min));
+	const double quantum = read_value<double>(payload + 56);
+	const char* table = payload + QuantizedFrame::HEADER_SIZE;
+	const std::size_t table_size = 8 * (chunk_count + 1);
+	const char* chunk_data = table + table_size;
+	const std::uint64_t chunks_size = read_value<std::uint64_t>(table + 8 * chunk_count);
+	const std::size_t available = size - QuantizedFrame::HEADER_SIZE - table_size;
+	if(chunks_size > available || (available - chunks_size) % 8 != 0)
+	{
+		return false;
+	}
+	const char* new_radii = chunk_data + chunks_size;
+	const std::size_t new_body_count = (available - chunks_size) / 8;
+
+	const std::size_t count = static_cast<std::size_t>(body_count);
+	decoded.ids.resize(count);
+	decoded.positions.resize(3 * count);
+	decoded.radii.resize(count);
+	// Where each body is in the previous frame, radii of new bodies are filled in afterwards
+	std::vector<std::size_t> in_previous(count);
+	std::vector<char> chunk_ok(chunk_count, 0);
+
+	parallel_for_chunks(count, QuantizedFrame::CHUNK_SIZE,
+		[&](std::size_t chunk, std::size_t begin, std::size_t end)
+		{
+			const std::uint64_t offset = read_value<std::uint64_t>(table + 8 * chunk);
+			const std::uint64_t next = read_value<std::uint64_t>(table + 8 * (chunk + 1));
+			const std::size_t value_counts[4] = {end - begin - 1, end - begin, end - begin, end - begin};
+			std::size_t width_count = 0;
+			for(std::size_t values : value_counts)
+			{
+				width_count += block_count(values);
+			}
+			const std::size_t widths_size = padded_to_words(width_count);
+			if(next < offset || next > chunks_size || next - offset < CHUNK_HEADER_SIZE + widths_size)
+			{
+				return;
+			}
+			const char* data = chunk_data + offset;
+			const unsigned char* widths = reinterpret_cast<const unsigned char*>(data + CHUNK_HEADER_SIZE);
+			std::uint64_t bit_count = 0;
+			const unsigned char* column_widths = widths;
+			for(std::size_t values : value_counts)
+			{
+				for(std::size_t i = 0; i < values; i += QuantizedFrame::BLOCK_SIZE)
+				{
+					const unsigned int width = column_widths[i / QuantizedFrame::BLOCK_SIZE];
+					if(width > 64)
+					{
+						return;
+					}
+					bit_count += width * std::min(QuantizedFrame::BLOCK_SIZE, values - i);
+				}
+				column_widths += block_count(values);
+			}
+			if((bit_count + 63) / 64 * 8 != next - offset - CHUNK_HEADER_SIZE - widths_size)
+			{
+				return;
+			}
+
+			BitReader reader(data + CHUNK_HEADER_SIZE + widths_size);
+			decoded.ids[begin] = read_value<std::uint32_t>(data);
+			for(std::size_t i = begin + 1; i < end; ++i)
+			{
+				const unsigned int width = widths[(i - begin - 1) / QuantizedFrame::BLOCK_SIZE];
+				decoded.ids[i] = static_cast<unsigned int>(decoded.ids[i - 1] + unzigzag(reader.get(width)));
+			}
+			IdMatcher previous_matcher(previous, decoded.ids[begin]);
+			IdMatcher older_matcher(older, decoded.ids[begin]);
+			std::vector<std::size_t> in_older(end - begin);
+			for(std::size_t i = begin; i < end; ++i)
+			{
+				in_previous[i] = previous_matcher.find(decoded.ids[i]);
+				in_older[i - begin] = older_matcher.find(decoded.ids[i]);
+			}
+			column_widths = widths + block_count(value_counts[0]);
+			for(int axis = 0; axis < 3; ++axis)
+			{
+				for(std::size_t i = begin; i < end; ++i)
+				{
+					const unsigned int width = column_widths[(i - begin) / QuantizedFrame::BLOCK_SIZE];
+					const double base = predict(previous, in_previous[i], older, in_older[i - begin], min, axis);
+					decoded.positions[3 * i + axis] = dequantize(base, unzigzag(reader.get(width)), quantum);
+				}
+				column_widths += block_count(end - begin);
+			}
+			chunk_ok[chunk] = 1;
+		});
+
+	if(std::find(chunk_ok.begin(), chunk_ok.end(), 0) != chunk_ok.end())
+	{
+		return false;
+	}
+	std::size_t next_new = 0;
+	for(std::size_t i = 0; i < count; ++i)
+	{
+		if(in_previous[i] != NOT_FOUND)
+		{
+			decoded.radii[i] = previous->radii[in_previous[i]];
+		}
+		else if(next_new < new_body_count)
+		{
+			decoded.radii[i] = read_value<double>(new_radii + 8 * next_new++);
+		}
+		else
+		{
+			return false;
+		}
+	}
+	return next_new == new_body_count;
+}
+
+unsigned int quantized_frame_references(const char* payload, std::size_t size)
+{
+	return size >= QuantizedFrame::HEADER_SIZE ? read_value<std::uint32_t>(payload + 4) : 0;
+}
+
+bool quantized_frame_bounds(const char* payload, std::size_t size, double* min, double* max)
+{
+	if(size < QuantizedFrame::HEADER_SIZE)
+	{
+		return false;
+	}
+	std::memcpy(min, payload + 8, 3 * sizeof(double));
+	std::memcpy(max, payload + 32, 3 * sizeof(double));
+	return true;
+}
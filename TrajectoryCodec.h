@@ -0,0 +1,90 @@
+#ifndef SPELFYSIK_SLUTUPPGIFT_TRAJECTORYCODEC_H
+#define SPELFYSIK_SLUTUPPGIFT_TRAJECTORYCODEC_H
+
+#include "Snapshot.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Lossy trajectory compression settings
+struct TrajectoryCompression
+{
+	// Raw frames
+	TrajectoryCompression();
+	// Positions are rounded to 1/2^bits of the frame's bounding box, and every keyframe_interval
+	// frames one is written without reference to the previous frame
+	TrajectoryCompression(unsigned int bits, unsigned int keyframe_interval);
+
+	bool is_enabled() const;
+
+	// 0 means raw, otherwise 1-52
+	unsigned int bits;
+	// 0 means only the first frame
+	unsigned int keyframe_interval;
+};
+
+// Quantized frame payload (frame encoding 1), everything little endian:
+//
+//   0       4         uint32 bits of precision
+//   4       4         uint32 number of previous frames positions are predicted from, 0 for a keyframe
+//   8       24        double minimum x, y, z of the positions, origin of the quantization grid
+//   32      24        double maximum x, y, z of the positions
+//   56      8         double quantum, the grid spacing in meters
+//   64      8         uint64 number of chunks C
+//   72      8*(C+1)   uint64 offset of each chunk from the end of this table, then the total chunk size
+//   ...               chunks
+//   ...     8*M       radii of the M bodies that aren't in the previous frame, in body order
+//
+// Bodies are split in chunks of CHUNK_SIZE that are coded independently, so they can be coded in parallel:
+//
+//   0       4         uint32 id of the first body
+//   4       4         uint32 reserved, must be 0
+//   8       ...       bits per value of every block of BLOCK_SIZE values, first for the id differences to
+//                     the body before, then for x, y and z, padded with zeroes to a multiple of 8 bytes
+//   ...     ...       uint64 words of packed bits: the id differences, then all x, y and z values
+//
+// All values are zigzag coded integers, the number of quanta a body is off from its predicted position.
+// A body that was in the two previous frames is predicted to keep moving the way it did between them,
+// a body that was only in the previous frame to stay where it was, and a new body to be at the origin.
+// Predicting from the decoded rather than the exact frames keeps the error within half a quantum no
+// matter how long the chain of frames is. A body keeps its radius for as long as it keeps its id, so
+// only new bodies store one. Ids are expected in ascending order, which Simulation guarantees.
+// Frames with unordered ids are written as keyframes.
+namespace QuantizedFrame
+{
+	const std::size_t HEADER_SIZE = 72;
+	const std::size_t CHUNK_SIZE = 1 << 12;
+	const std::size_t BLOCK_SIZE = 64;
+}
+
+// Statistics over all frames a writer has encoded
+struct TrajectoryCompressionStats
+{
+	TrajectoryCompressionStats();
+	double get_ratio() const;
+
+	unsigned long long frames;
+	// Size the frames would have had as raw frames
+	unsigned long long raw_bytes;
+	unsigned long long encoded_bytes;
+	// Largest distance along any axis between an exact and a decoded position, in meters
+	double max_error;
+};
+
+// Encodes frame against the decoded previous frame and the one before that. Without previous it becomes
+// a keyframe, without older it's predicted from previous alone. decoded gets what the decoder will
+// see, which is the previous frame for the next one.
+void encode_quantized_frame(const Snapshot& frame, const Snapshot* previous, const Snapshot* older,
+                            unsigned int bits, std::vector<char>& payload, Snapshot& decoded,
+                            TrajectoryCompressionStats& stats);
+// Decodes the ids, positions and radii of a frame with body_count bodies. Returns false if the payload
+// is damaged or needs more previous frames than it was given.
+bool decode_quantized_frame(const char* payload, std::size_t size, std::uint64_t body_count,
+                            const Snapshot* previous, const Snapshot* older, Snapshot& decoded);
+// Number of previous frames a frame needs to be decoded, 0 for a keyframe
+unsigned int quantized_frame_references(const char* payload, std::size_t size);
+// Bounding box stored in the payload, min and max have room for three values each
+bool quantized_frame_bounds(const char* payload, std::size_t size, double* min, double* max);
+
+#endif //SPELFYSIK_SLUTUPPGIFT_TRAJECTORYCODEC_H
@@ -0,0 +1,464 @@
+#include "TrajectoryFile.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+namespace
+{
+	const std::size_t NO_FRAME = std::numeric_limits<std::size_t>::max();
+
+	void bounding_box(const double* positions, std::uint64_t body_count, double* min, double* max)
+	{
+		for(int axis = 0; axis < 3; ++axis)
+		{
+			min[axis] = body_count > 0 ? std::numeric_limits<double>::infinity() : 0.0;
+			max[axis] = body_count > 0 ? -std::numeric_limits<double>::infinity() : 0.0;
+		}
+		for(std::uint64_t i = 0; i < body_count; ++i)
+		{
+			for(int axis = 0; axis < 3; ++axis)
+			{
+				min[axis] = std::min(min[axis], positions[3 * i + axis]);
+				max[axis] = std::max(max[axis], positions[3 * i + axis]);
+			}
+		}
+	}
+}
+
+bool is_trajectory_file(const std::string& path)
+{
+	char magic[sizeof(TrajectoryFormat::MAGIC)];
+	std::ifstream file(path, std::ios::binary);
+	return file.read(magic, sizeof(magic)) && std::memcmp(magic, TrajectoryFormat::MAGIC, sizeof(magic)) == 0;
+}
+
+TrajectoryFileWriter::TrajectoryFileWriter()
+: m_file(nullptr),
+  m_failed(false),
+  m_offset(0),
+  m_index(),
+  m_compression(),
+  m_stats(),
+  m_previous(),
+  m_older(),
+  m_decoded(),
+  m_chain_length(0),
+  m_payload()
+{
+}
+
+TrajectoryFileWriter::~TrajectoryFileWriter()
+{
+	close();
+}
+
+bool TrajectoryFileWriter::open(const std::string& path, const TrajectoryCompression& compression)
+{
+	using namespace TrajectoryFormat;
+	close();
+	if(!host_is_little_endian())
+	{
+		return false;
+	}
+	m_file = std::fopen(path.c_str(), "wb");
+	if(!m_file)
+	{
+		return false;
+	}
+	m_failed = false;
+	m_index.clear();
+	m_compression = compression;
+	m_stats = TrajectoryCompressionStats();
+	m_chain_length = 0;
+	char header[HEADER_SIZE] = {};
+	std::memcpy(header, MAGIC, sizeof(MAGIC));
+	std::memcpy(header + 8, &VERSION, sizeof(VERSION));
+	m_failed = std::fwrite(header, 1, HEADER_SIZE, m_file) != HEADER_SIZE;
+	m_offset = HEADER_SIZE;
+	return !m_failed;
+}
+
+bool TrajectoryFileWriter::is_open() const
+{
+	return m_file != nullptr;
+}
+
+bool TrajectoryFileWriter::write_frame(const Snapshot& snapshot)
+{
+	using namespace TrajectoryFormat;
+	if(!m_file || m_failed)
+	{
+		return false;
+	}
+	const std::uint64_t body_count = snapshot.body_count();
+	const bool quantized = m_compression.is_enabled();
+	if(quantized)
+	{
+		// A keyframe every so often keeps the decoding needed to seek bounded
+		const bool keyframe = m_chain_length == 0 || (m_compression.keyframe_interval > 0
+		                                              && m_chain_length >= m_compression.keyframe_interval);
+		encode_quantized_frame(snapshot, keyframe ? nullptr : &m_previous,
+		                       keyframe || m_chain_length < 2 ? nullptr : &m_older,
+		                       m_compression.bits, m_payload, m_decoded, m_stats);
+		std::swap(m_older, m_previous);
+		std::swap(m_previous, m_decoded);
+		m_chain_length = quantized_frame_references(m_payload.data(), m_payload.size()) == 0 ? 1 : m_chain_length + 1;
+	}
+	const std::uint64_t payload_size = quantized ? m_payload.size() : raw_payload_size(body_count);
+	const std::uint32_t encoding = quantized ? ENCODING_QUANTIZED : ENCODING_RAW;
+	char header[FRAME_HEADER_SIZE] = {};
+	std::memcpy(header, FRAME_MAGIC, sizeof(FRAME_MAGIC));
+	std::memcpy(header + 4, &encoding, sizeof(encoding));
+	const std::uint64_t step = snapshot.step;
+	std::memcpy(header + 8, &step, sizeof(step));
+	std::memcpy(header + 16, &snapshot.time, sizeof(snapshot.time));
+	std::memcpy(header + 24, &body_count, sizeof(body_count));
+	std::memcpy(header + 32, &payload_size, sizeof(payload_size));
+
+	static_assert(sizeof(unsigned int) == 4, "Body ids are stored as 32 bit integers");
+	const char padding[8] = {};
+	const std::size_t padding_size = padded_ids_size(body_count) - 4 * body_count;
+	bool ok = std::fwrite(header, 1, FRAME_HEADER_SIZE, m_file) == FRAME_HEADER_SIZE;
+	if(quantized)
+	{
+		ok = ok && std::fwrite(m_payload.data(), 1, m_payload.size(), m_file) == m_payload.size();
+	}
+	else
+	{
+		ok = ok && std::fwrite(snapshot.ids.data(), 4, body_count, m_file) == body_count
+		     && std::fwrite(padding, 1, padding_size, m_file) == padding_size
+		     && std::fwrite(snapshot.positions.data(), sizeof(double), 3 * body_count, m_file) == 3 * body_count
+		     && std::fwrite(snapshot.radii.data(), sizeof(double), body_count, m_file) == body_count;
+		++m_stats.frames;
+		m_stats.raw_bytes += FRAME_HEADER_SIZE + payload_size;
+		m_stats.encoded_bytes += FRAME_HEADER_SIZE + payload_size;
+	}
+	m_failed = !ok;
+	if(ok)
+	{
+		TrajectoryFrameInfo info;
+		info.step = step;
+		info.time = snapshot.time;
+		info.offset = m_offset;
+		info.body_count = body_count;
+		bounding_box(snapshot.positions.data(), body_count, info.min, info.max);
+		m_index.push_back(info);
+		m_offset += FRAME_HEADER_SIZE + payload_size;
+	}
+	return ok;
+}
+
+bool TrajectoryFileWriter::close()
+{
+	using namespace TrajectoryFormat;
+	if(!m_file)
+	{
+		return !m_failed;
+	}
+	if(!m_failed)
+	{
+		// Index entries and footer in one block
+		std::vector<char> index(m_index.size() * INDEX_ENTRY_SIZE + FOOTER_SIZE);
+		char* entry = index.data();
+		for(const TrajectoryFrameInfo& info : m_index)
+		{
+			write_value(entry, info.step);
+			write_value(entry + 8, info.time);
+			write_value(entry + 16, info.offset);
+			write_value(entry + 24, info.body_count);
+			std::memcpy(entry + 32, info.min, sizeof(info.min));
+			std::memcpy(entry + 56, info.max, sizeof(info.max));
+			entry += INDEX_ENTRY_SIZE;
+		}
+		const std::uint64_t entry_count = m_index.size();
+		std::memcpy(entry, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+		write_value(entry + 8, entry_count);
+		write_value(entry + 16, m_offset);
+		m_failed = std::fwrite(index.data(), 1, index.size(), m_file) != index.size();
+		// Only point the header at the index once the index is complete
+		m_failed = m_failed || std::fflush(m_file) != 0 || std::fseek(m_file, 16, SEEK_SET) != 0
+		           || std::fwrite(&m_offset, sizeof(m_offset), 1, m_file) != 1;
+	}
+	const bool ok = (std::fclose(m_file) == 0) && !m_failed;
+	m_file = nullptr;
+	m_failed = !ok;
+	m_index.clear();
+	m_previous = Snapshot();
+	m_older = Snapshot();
+	return ok;
+}
+
+const TrajectoryCompressionStats& TrajectoryFileWriter::get_compression_stats() const
+{
+	return m_stats;
+}
+
+TrajectoryFileReader::TrajectoryFileReader(const std::string& path)
+: m_file(),
+  m_error(),
+  m_index(),
+  m_decode_mutex(),
+  m_decoded(),
+  m_decoded_older(),
+  m_decode_scratch(),
+  m_decoded_frame(NO_FRAME),
+  m_has_decoded_older(false)
+{
+	using namespace TrajectoryFormat;
+	if(!host_is_little_endian())
+	{
+		m_error = "Trajectories can only be read on little endian machines";
+		return;
+	}
+	if(!m_file.open(path))
+	{
+		m_error = "Could not open " + path;
+		return;
+	}
+	if(m_file.size() < HEADER_SIZE || std::memcmp(m_file.data(), MAGIC, sizeof(MAGIC)) != 0)
+	{
+		m_error = path + " is not a trajectory";
+		return;
+	}
+	const std::uint32_t version = read_value<std::uint32_t>(m_file.data() + 8);
+	if(version != 1 && version != VERSION)
+	{
+		m_error = path + " has an unsupported version";
+		return;
+	}
+	if(!load_index())
+	{
+		// Unfinished or old file, find the frames the slow way
+		scan_frames();
+	}
+}
+
+bool TrajectoryFileReader::is_valid() const
+{
+	return m_error.empty();
+}
+
+const std::string& TrajectoryFileReader::get_error() const
+{
+	return m_error;
+}
+
+std::size_t TrajectoryFileReader::frame_count() const
+{
+	return m_index.size();
+}
+
+const TrajectoryFrameInfo& TrajectoryFileReader::get_frame_info(std::size_t frame) const
+{
+	return m_index[frame];
+}
+
+std::size_t TrajectoryFileReader::find_frame(std::uint64_t step) const
+{
+	// Frames are written in step order
+	auto after = std::upper_bound(m_index.begin(), m_index.end(), step,
+	                              [](std::uint64_t s, const TrajectoryFrameInfo& info){return s < info.step;});
+	return after == m_index.begin() ? 0 : (after - m_index.begin()) - 1;
+}
+
+bool TrajectoryFileReader::read_frame(std::size_t frame, Snapshot& snapshot) const
+{
+	if(frame >= m_index.size())
+	{
+		return false;
+	}
+	if(is_keyframe(frame))
+	{
+		return decode_frame(frame, nullptr, nullptr, snapshot);
+	}
+
+	std::lock_guard<std::mutex> lock(m_decode_mutex);
+	// Go back to the last keyframe, or to the frame decoded last time if that is closer
+	std::size_t first = frame;
+	while(first != m_decoded_frame && !is_keyframe(first))
+	{
+		if(first == 0)
+		{
+			return false;
+		}
+		--first;
+	}
+	if(first != m_decoded_frame)
+	{
+		m_decoded_frame = NO_FRAME;
+		if(!decode_frame(first, nullptr, nullptr, m_decoded))
+		{
+			return false;
+		}
+		m_decoded_frame = first;
+		m_has_decoded_older = false;
+	}
+	while(m_decoded_frame < frame)
+	{
+		if(!decode_frame(m_decoded_frame + 1, &m_decoded, m_has_decoded_older ? &m_decoded_older : nullptr,
+		                 m_decode_scratch))
+		{
+			m_decoded_frame = NO_FRAME;
+			return false;
+		}
+		std::swap(m_decoded_older, m_decoded);
+		std::swap(m_decoded, m_decode_scratch);
+		m_has_decoded_older = true;
+		++m_decoded_frame;
+	}
+	snapshot.step = m_decoded.step;
+	snapshot.time = m_decoded.time;
+	snapshot.ids = m_decoded.ids;
+	snapshot.positions = m_decoded.positions;
+	snapshot.radii = m_decoded.radii;
+	return true;
+}
+
+bool TrajectoryFileReader::view_frame(std::size_t frame, FrameView& view) const
+{
+	using namespace TrajectoryFormat;
+	if(frame >= m_index.size())
+	{
+		return false;
+	}
+	const TrajectoryFrameInfo& info = m_index[frame];
+	const char* header = m_file.data() + info.offset;
+	if(read_value<std::uint32_t>(header + 4) != ENCODING_RAW
+	   || read_value<std::uint64_t>(header + 32) != raw_payload_size(info.body_count))
+	{
+		return false;
+	}
+	const char* payload = header + FRAME_HEADER_SIZE;
+	view.step = info.step;
+	view.time = info.time;
+	view.body_count = info.body_count;
+	// The frame starts 8 byte aligned in a page aligned mapping, and so does every column
+	view.ids = reinterpret_cast<const std::uint32_t*>(payload);
+	view.positions = reinterpret_cast<const double*>(payload + padded_ids_size(info.body_count));
+	view.radii = view.positions + 3 * info.body_count;
+	return true;
+}
+
+bool TrajectoryFileReader::is_keyframe(std::size_t frame) const
+{
+	using namespace TrajectoryFormat;
+	const char* header = m_file.data() + m_index[frame].offset;
+	return read_value<std::uint32_t>(header + 4) != ENCODING_QUANTIZED
+	       || quantized_frame_references(header + FRAME_HEADER_SIZE, read_value<std::uint64_t>(header + 32)) == 0;
+}
+
+bool TrajectoryFileReader::decode_frame(std::size_t frame, const Snapshot* previous, const Snapshot* older,
+                                        Snapshot& snapshot) const
+{
+	using namespace TrajectoryFormat;
+	const TrajectoryFrameInfo& info = m_index[frame];
+	const char* header = m_file.data() + info.offset;
+	if(read_value<std::uint32_t>(header + 4) == ENCODING_QUANTIZED)
+	{
+		if(!decode_quantized_frame(header + FRAME_HEADER_SIZE, read_value<std::uint64_t>(header + 32),
+		                           info.body_count, previous, older, snapshot))
+		{
+			return false;
+		}
+		snapshot.step = info.step;
+		snapshot.time = info.time;
+		return true;
+	}
+
+	FrameView view;
+	if(!view_frame(frame, view))
+	{
+		return false;
+	}
+	snapshot.step = view.step;
+	snapshot.time = view.time;
+	snapshot.ids.assign(view.ids, view.ids + view.body_count);
+	snapshot.positions.assign(view.positions, view.positions + 3 * view.body_count);
+	snapshot.radii.assign(view.radii, view.radii + view.body_count);
+	return true;
+}
+
+bool TrajectoryFileReader::load_index()
+{
+	using namespace TrajectoryFormat;
+	const char* data = m_file.data();
+	const std::size_t size = m_file.size();
+	const std::uint64_t index_offset = read_value<std::uint64_t>(data + 16);
+	if(index_offset == 0 || size < HEADER_SIZE + FOOTER_SIZE)
+	{
+		return false;
+	}
+	const char* footer = data + size - FOOTER_SIZE;
+	const std::uint64_t entry_count = read_value<std::uint64_t>(footer + 8);
+	if(std::memcmp(footer, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0
+	   || read_value<std::uint64_t>(footer + 16) != index_offset
+	   || index_offset < HEADER_SIZE || index_offset > size - FOOTER_SIZE
+	   || entry_count != (size - FOOTER_SIZE - index_offset) / INDEX_ENTRY_SIZE)
+	{
+		return false;
+	}
+
+	m_index.resize(entry_count);
+	const char* entry = data + index_offset;
+	for(TrajectoryFrameInfo& info : m_index)
+	{
+		info.step = read_value<std::uint64_t>(entry);
+		info.time = read_value<double>(entry + 8);
+		info.offset = read_value<std::uint64_t>(entry + 16);
+		info.body_count = read_value<std::uint64_t>(entry + 24);
+		std::memcpy(info.min, entry + 32, sizeof(info.min));
+		std::memcpy(info.max, entry + 56, sizeof(info.max));
+		// Don't trust offsets that point outside the frames. Added rather than subtracted so nothing wraps.
+		if(info.offset < HEADER_SIZE || info.offset + FRAME_HEADER_SIZE > index_offset
+		   || read_value<std::uint64_t>(data + info.offset + 32) > index_offset - info.offset - FRAME_HEADER_SIZE)
+		{
+			m_index.clear();
+			return false;
+		}
+		entry += INDEX_ENTRY_SIZE;
+	}
+	return true;
+}
+
+void TrajectoryFileReader::scan_frames()
+{
+	using namespace TrajectoryFormat;
+	const char* data = m_file.data();
+	const std::size_t size = m_file.size();
+	std::size_t offset = HEADER_SIZE;
+	// Stops at the first incomplete frame, which is where a crashed writer left off
+	while(offset + FRAME_HEADER_SIZE <= size && std::memcmp(data + offset, FRAME_MAGIC, sizeof(FRAME_MAGIC)) == 0)
+	{
+		const std::uint64_t payload_size = read_value<std::uint64_t>(data + offset + 32);
+		if(payload_size > size - offset - FRAME_HEADER_SIZE)
+		{
+			break;
+		}
+		TrajectoryFrameInfo info;
+		info.step = read_value<std::uint64_t>(data + offset + 8);
+		info.time = read_value<double>(data + offset + 16);
+		info.offset = offset;
+		info.body_count = read_value<std::uint64_t>(data + offset + 24);
+		m_index.push_back(info);
+		FrameView view;
+		const bool quantized = read_value<std::uint32_t>(data + offset + 4) == ENCODING_QUANTIZED;
+		if(quantized ? quantized_frame_bounds(data + offset + FRAME_HEADER_SIZE, payload_size, m_index.back().min,
+		                                      m_index.back().max)
+		             : view_frame(m_index.size() - 1, view))
+		{
+			if(!quantized)
+			{
+				bounding_box(view.positions, view.body_count, m_index.back().min, m_index.back().max);
+			}
+		}
+		else
+		{
+			m_index.pop_back();
+			break;
+		}
+		offset += FRAME_HEADER_SIZE + payload_size;
+	}
+}
@@ -0,0 +1,173 @@
+#ifndef SPELFYSIK_SLUTUPPGIFT_TRAJECTORYFILE_H
+#define SPELFYSIK_SLUTUPPGIFT_TRAJECTORYFILE_H
+
+#include "MappedFile.h"
+#include "Snapshot.h"
+#include "TrajectoryCodec.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Trajectory file (.nbtr), everything little endian. A file header, frames, and an index at the end:
+//
+//   File header
+//   0       8         magic "NBODYTR" followed by a zero byte
+//   8       4         uint32 version, currently 2
+//   12      4         uint32 reserved, must be 0
+//   16      8         uint64 offset of the index, 0 until the file has been closed properly
+//   24      8         reserved, must be 0
+//
+//   Frame header, repeated for every frame
+//   0       4         magic "FRAM"
+//   4       4         uint32 encoding, 0 = raw, 1 = quantized (see TrajectoryCodec.h)
+//   8       8         uint64 step
+//   16      8         double time in seconds
+//   24      8         uint64 body count N
+//   32      8         uint64 payload size in bytes
+//
+//   Raw payload
+//   0       4*N       uint32 body ids, padded with zeroes to a multiple of 8 bytes
+//   ...     24*N      positions in meters, double x, y, z per body
+//   ...     8*N       radii in meters, double
+//
+//   Index entry, one per frame in file order
+//   0       8         uint64 step
+//   8       8         double time
+//   16      8         uint64 offset of the frame header
+//   24      8         uint64 body count
+//   32      24        double minimum x, y, z of the body positions
+//   56      24        double maximum x, y, z of the body positions
+//
+//   Footer, the last 24 bytes of the file
+//   0       8         magic "NBTRIDX" followed by a zero byte
+//   8       8         uint64 number of index entries
+//   16      8         uint64 offset of the index
+//
+// The body count changes between frames as bodies merge, so frames differ in size and the index is
+// what makes seeking cheap. A file that was never closed has no index, but can still be read by
+// walking the frame headers. Version 1 files are the same without index and footer.
+// Quantized frames may refer to the frame before them, so reading one means decoding from the last
+// keyframe before it.
+namespace TrajectoryFormat
+{
+	const char MAGIC[8] = {'N', 'B', 'O', 'D', 'Y', 'T', 'R', '\0'};
+	const char FRAME_MAGIC[4] = {'F', 'R', 'A', 'M'};
+	const char INDEX_MAGIC[8] = {'N', 'B', 'T', 'R', 'I', 'D', 'X', '\0'};
+	const std::uint32_t VERSION = 2;
+	const std::size_t HEADER_SIZE = 32;
+	const std::size_t FRAME_HEADER_SIZE = 40;
+	const std::size_t INDEX_ENTRY_SIZE = 80;
+	const std::size_t FOOTER_SIZE = 24;
+	const std::uint32_t ENCODING_RAW = 0;
+	const std::uint32_t ENCODING_QUANTIZED = 1;
+	inline std::size_t padded_ids_size(std::uint64_t body_count)
+	{
+		return (4 * static_cast<std::size_t>(body_count) + 7) / 8 * 8;
+	}
+	inline std::size_t raw_payload_size(std::uint64_t body_count)
+	{
+		return padded_ids_size(body_count) + 4 * sizeof(double) * static_cast<std::size_t>(body_count);
+	}
+}
+
+// Cheap check of the magic bytes only
+bool is_trajectory_file(const std::string& path);
+
+// What the index knows about a frame
+struct TrajectoryFrameInfo
+{
+	std::uint64_t step;
+	double time;
+	std::uint64_t offset;
+	std::uint64_t body_count;
+	double min[3];
+	double max[3];
+};
+
+// Appends frames to a trajectory file, the index is written by close()
+class TrajectoryFileWriter
+{
+public:
+	TrajectoryFileWriter();
+	~TrajectoryFileWriter();
+	TrajectoryFileWriter(const TrajectoryFileWriter&) = delete;
+	TrajectoryFileWriter& operator=(const TrajectoryFileWriter&) = delete;
+
+	// Creates or truncates path, returns false on failure
+	bool open(const std::string& path, const TrajectoryCompression& compression = TrajectoryCompression());
+	bool is_open() const;
+	bool write_frame(const Snapshot& snapshot);
+	// Writes the index and returns false if anything failed since open
+	bool close();
+	// Of the frames written since open, raw frames count with a ratio of 1 and no error
+	const TrajectoryCompressionStats& get_compression_stats() const;
+
+private:
+	std::FILE* m_file;
+	bool m_failed;
+	std::uint64_t m_offset;
+	std::vector<TrajectoryFrameInfo> m_index;
+	TrajectoryCompression m_compression;
+	TrajectoryCompressionStats m_stats;
+	// The two previous frames as the reader will decode them
+	Snapshot m_previous;
+	Snapshot m_older;
+	Snapshot m_decoded;
+	// Frames since and including the last keyframe
+	unsigned int m_chain_length;
+	std::vector<char> m_payload;
+};
+
+// Random access to the frames of a mapped trajectory file
+class TrajectoryFileReader
+{
+public:
+	// Positions and radii of a raw frame, pointing straight into the mapped file
+	struct FrameView
+	{
+		std::uint64_t step;
+		double time;
+		std::uint64_t body_count;
+		const std::uint32_t* ids;
+		const double* positions;
+		const double* radii;
+	};
+
+	explicit TrajectoryFileReader(const std::string& path);
+	// False if the file couldn't be opened or isn't a trajectory
+	bool is_valid() const;
+	const std::string& get_error() const;
+	std::size_t frame_count() const;
+	const TrajectoryFrameInfo& get_frame_info(std::size_t frame) const;
+	// Index of the last frame at or before step, 0 if step is before the first frame
+	std::size_t find_frame(std::uint64_t step) const;
+	// Copies or decodes a frame into snapshot, reusing its memory. Returns false if the frame is damaged.
+	// Safe to call from several threads. Quantized frames are quickest to read in ascending order.
+	bool read_frame(std::size_t frame, Snapshot& snapshot) const;
+	// Zero copy access to a raw frame. Returns false if the frame is damaged or not raw.
+	bool view_frame(std::size_t frame, FrameView& view) const;
+
+private:
+	bool load_index();
+	void scan_frames();
+	bool is_keyframe(std::size_t frame) const;
+	// Decodes a frame of any encoding, previous and older are the decoded frames before it
+	bool decode_frame(std::size_t frame, const Snapshot* previous, const Snapshot* older, Snapshot& snapshot) const;
+
+	MappedFile m_file;
+	std::string m_error;
+	std::vector<TrajectoryFrameInfo> m_index;
+
+	// The last two decoded frames, which saves going back to the keyframe when reading frames in order
+	mutable std::mutex m_decode_mutex;
+	mutable Snapshot m_decoded;
+	mutable Snapshot m_decoded_older;
+	mutable Snapshot m_decode_scratch;
+	mutable std::size_t m_decoded_frame;
+	mutable bool m_has_decoded_older;
+};
+
+#endif //SPELFYSIK_SLUTUPPGIFT_TRAJECTORYFILE_H
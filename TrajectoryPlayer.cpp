@@ -0,0 +1,230 @@
+#include "TrajectoryPlayer.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace
+{
+	const std::size_t NO_FRAME = std::numeric_limits<std::size_t>::max();
+}
+
+TrajectoryPlayer::TrajectoryPlayer(const std::string& path, std::size_t prefetch_frames)
+: m_reader(path),
+  m_error(m_reader.get_error()),
+  m_position(0.0),
+  m_speed(30.0),
+  m_paused(false),
+  m_current(),
+  m_current_frame(NO_FRAME),
+  m_mutex(),
+  m_wanted_changed(),
+  m_cache(prefetch_frames > 0 ? prefetch_frames : 1),
+  m_wanted(0),
+  m_backwards(false),
+  m_stop(false),
+  m_thread()
+{
+	if(m_error.empty() && m_reader.frame_count() == 0)
+	{
+		m_error = path + " has no frames";
+	}
+	for(CacheEntry& entry : m_cache)
+	{
+		entry.frame = NO_FRAME;
+		entry.ready = false;
+	}
+	if(m_error.empty())
+	{
+		m_thread = std::thread(&TrajectoryPlayer::prefetch, this);
+	}
+}
+
+TrajectoryPlayer::~TrajectoryPlayer()
+{
+	if(m_thread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_wanted_changed.notify_all();
+		m_thread.join();
+	}
+}
+
+bool TrajectoryPlayer::is_valid() const
+{
+	return m_error.empty();
+}
+
+const std::string& TrajectoryPlayer::get_error() const
+{
+	return m_error;
+}
+
+std::size_t TrajectoryPlayer::frame_count() const
+{
+	return m_reader.frame_count();
+}
+
+std::size_t TrajectoryPlayer::get_frame() const
+{
+	return static_cast<std::size_t>(m_position);
+}
+
+void TrajectoryPlayer::advance(double seconds)
+{
+	if(m_paused || frame_count() == 0)
+	{
+		return;
+	}
+	const double last = static_cast<double>(frame_count() - 1);
+	m_position += m_speed * seconds;
+	if(m_position <= 0.0 || m_position >= last)
+	{
+		m_position = std::min(std::max(m_position, 0.0), last);
+		m_paused = true;
+	}
+}
+
+void TrajectoryPlayer::seek(std::size_t frame)
+{
+	if(frame_count() > 0)
+	{
+		m_position = static_cast<double>(std::min(frame, frame_count() - 1));
+	}
+}
+
+void TrajectoryPlayer::step(long long frames)
+{
+	const long long target = static_cast<long long>(get_frame()) + frames;
+	seek(target > 0 ? static_cast<std::size_t>(target) : 0);
+}
+
+void TrajectoryPlayer::set_speed(double frames_per_second)
+{
+	m_speed = frames_per_second;
+}
+
+double TrajectoryPlayer::get_speed() const
+{
+	return m_speed;
+}
+
+void TrajectoryPlayer::set_paused(bool paused)
+{
+	m_paused = paused;
+}
+
+bool TrajectoryPlayer::is_paused() const
+{
+	return m_paused;
+}
+
+const Snapshot& TrajectoryPlayer::get_snapshot()
+{
+	const std::size_t frame = get_frame();
+	bool prefetched = frame == m_current_frame;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for(CacheEntry& entry : m_cache)
+		{
+			if(!prefetched && entry.ready && entry.frame == frame)
+			{
+				// Trade our old snapshot for the prefetched one, the thread will reuse its memory
+				std::swap(entry.snapshot, m_current);
+				entry.frame = NO_FRAME;
+				entry.ready = false;
+				prefetched = true;
+			}
+		}
+		m_wanted = frame;
+		m_backwards = m_speed < 0.0;
+	}
+	m_wanted_changed.notify_all();
+
+	if(!prefetched && !m_reader.read_frame(frame, m_current))
+	{
+		m_current.ids.clear();
+		m_current.positions.clear();
+		m_current.radii.clear();
+	}
+	m_current_frame = frame;
+	return m_current;
+}
+
+void TrajectoryPlayer::draw(Graphics& drawer)
+{
+	const Snapshot& snapshot = get_snapshot();
+	for(std::size_t i = 0; i < snapshot.body_count(); ++i)
+	{
+		const double* p = &snapshot.positions[3 * i];
+		drawer.draw_sphere(Vector3d(p[0], p[1], p[2]), snapshot.radii[i]);
+	}
+}
+
+void TrajectoryPlayer::prefetch()
+{
+	const std::size_t window = m_cache.size();
+	const std::size_t frames = m_reader.frame_count();
+	Snapshot scratch;
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while(!m_stop)
+	{
+		// Frames that are within the window ahead of the playback position
+		auto in_window = [&](std::size_t frame)
+		{
+			return m_backwards ? frame < m_wanted && m_wanted - frame <= window
+			                   : frame > m_wanted && frame - m_wanted <= window;
+		};
+
+		// Find the nearest frame ahead that isn't cached or on its way
+		std::size_t target = NO_FRAME;
+		for(std::size_t k = 1; k <= window && target == NO_FRAME; ++k)
+		{
+			if(m_backwards ? k > m_wanted : m_wanted + k >= frames)
+			{
+				break;
+			}
+			const std::size_t frame = m_backwards ? m_wanted - k : m_wanted + k;
+			bool cached = false;
+			for(const CacheEntry& entry : m_cache)
+			{
+				cached = cached || entry.frame == frame;
+			}
+			if(!cached)
+			{
+				target = frame;
+			}
+		}
+		// And somewhere to put it
+		CacheEntry* slot = nullptr;
+		for(CacheEntry& entry : m_cache)
+		{
+			if(entry.frame == NO_FRAME || (entry.ready && !in_window(entry.frame)))
+			{
+				slot = &entry;
+				break;
+			}
+		}
+		if(target == NO_FRAME || slot == nullptr)
+		{
+			m_wanted_changed.wait(lock);
+			continue;
+		}
+
+		slot->frame = target;
+		slot->ready = false;
+		lock.unlock();
+		if(!m_reader.read_frame(target, scratch))
+		{
+			// A damaged frame shows up as empty, same as when it's read directly
+			scratch.ids.clear();
+			scratch.positions.clear();
+			scratch.radii.clear();
+		}
+		lock.lock();
+		std::swap(slot->snapshot, scratch);
+		slot->ready = true;
+	}
+}
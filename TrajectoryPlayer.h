@@ -0,0 +1,73 @@
+#ifndef SPELFYSIK_SLUTUPPGIFT_TRAJECTORYPLAYER_H
+#define SPELFYSIK_SLUTUPPGIFT_TRAJECTORYPLAYER_H
+
+#include "Graphics.h"
+#include "Snapshot.h"
+#include "TrajectoryFile.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Plays back a recorded trajectory instead of simulating. A background thread reads the frames
+// ahead of the playback position (in whichever direction it's going), so drawing never waits for the disk.
+class TrajectoryPlayer
+{
+public:
+	explicit TrajectoryPlayer(const std::string& path, std::size_t prefetch_frames = 8);
+	~TrajectoryPlayer();
+	TrajectoryPlayer(const TrajectoryPlayer&) = delete;
+	TrajectoryPlayer& operator=(const TrajectoryPlayer&) = delete;
+
+	// False if the file couldn't be read or has no frames
+	bool is_valid() const;
+	const std::string& get_error() const;
+	std::size_t frame_count() const;
+	std::size_t get_frame() const;
+
+	// Moves the playback position by speed * seconds frames unless paused, stops at either end
+	void advance(double seconds);
+	void seek(std::size_t frame);
+	// Relative seek, negative goes backwards
+	void step(long long frames);
+	// In frames per second, negative plays backwards
+	void set_speed(double frames_per_second);
+	double get_speed() const;
+	void set_paused(bool paused);
+	bool is_paused() const;
+
+	// Body state of the current frame, valid until the next call
+	const Snapshot& get_snapshot();
+	void draw(Graphics& drawer);
+
+private:
+	struct CacheEntry
+	{
+		std::size_t frame;
+		bool ready;
+		Snapshot snapshot;
+	};
+
+	void prefetch();
+
+	TrajectoryFileReader m_reader;
+	std::string m_error;
+	double m_position;
+	double m_speed;
+	bool m_paused;
+	Snapshot m_current;
+	std::size_t m_current_frame;
+
+	// Shared with the prefetch thread and guarded by m_mutex
+	std::mutex m_mutex;
+	std::condition_variable m_wanted_changed;
+	std::vector<CacheEntry> m_cache;
+	std::size_t m_wanted;
+	bool m_backwards;
+	bool m_stop;
+	std::thread m_thread;
+};
+
+#endif //SPELFYSIK_SLUTUPPGIFT_TRAJECTORYPLAYER_H
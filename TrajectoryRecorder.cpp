@@ -0,0 +1,163 @@
+#include "TrajectoryRecorder.h"
+
+TrajectoryRecorder::TrajectoryRecorder(const std::string& path, unsigned int interval, OverflowPolicy policy,
+                                       const TrajectoryCompression& compression, unsigned int buffer_count)
+: m_file(),
+  m_interval(interval > 0 ? interval : 1),
+  m_policy(policy),
+  m_buffers(buffer_count > 0 ? buffer_count : 1),
+  m_mutex(),
+  m_queued_changed(),
+  m_read_slot(0),
+  m_queued(0),
+  m_decimation(1),
+  m_frames_written(0),
+  m_frames_dropped(0),
+  m_compression_stats(),
+  m_write_failed(false),
+  m_stop(false),
+  m_thread()
+{
+	if(m_file.open(path, compression))
+	{
+		m_thread = std::thread(&TrajectoryRecorder::run, this);
+	}
+}
+
+TrajectoryRecorder::~TrajectoryRecorder()
+{
+	if(m_thread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_queued_changed.notify_all();
+		m_thread.join();
+	}
+	m_file.close();
+}
+
+bool TrajectoryRecorder::is_open() const
+{
+	return m_thread.joinable();
+}
+
+bool TrajectoryRecorder::is_ok() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return is_open() && !m_write_failed;
+}
+
+void TrajectoryRecorder::on_step(const Simulation& simulation)
+{
+	unsigned int decimation;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		decimation = m_decimation;
+	}
+	if(simulation.get_step_count() % (static_cast<unsigned long long>(m_interval) * decimation) == 0)
+	{
+		publish(simulation);
+	}
+}
+
+void TrajectoryRecorder::publish(const Simulation& simulation)
+{
+	if(!is_open())
+	{
+		return;
+	}
+	std::size_t slot;
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if(m_queued == m_buffers.size())
+		{
+			switch(m_policy)
+			{
+			case OverflowPolicy::Block:
+				m_queued_changed.wait(lock, [this]{return m_queued < m_buffers.size();});
+				break;
+			case OverflowPolicy::Decimate:
+				m_decimation *= 2;
+				++m_frames_dropped;
+				return;
+			case OverflowPolicy::Drop:
+				++m_frames_dropped;
+				return;
+			}
+		}
+		else if(m_queued == 0 && m_decimation > 1)
+		{
+			// The writer has caught up, try recording more often again
+			m_decimation /= 2;
+		}
+		slot = (m_read_slot + m_queued) % m_buffers.size();
+	}
+
+	// Nobody else touches a buffer that isn't queued, so it can be filled without holding the lock
+	simulation.copy_snapshot(m_buffers[slot]);
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		++m_queued;
+	}
+	m_queued_changed.notify_all();
+}
+
+unsigned long long TrajectoryRecorder::get_frames_written() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_frames_written;
+}
+
+unsigned long long TrajectoryRecorder::get_frames_dropped() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_frames_dropped;
+}
+
+unsigned int TrajectoryRecorder::get_decimation() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_decimation;
+}
+
+TrajectoryCompressionStats TrajectoryRecorder::get_compression_stats() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_compression_stats;
+}
+
+void TrajectoryRecorder::run()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while(true)
+	{
+		m_queued_changed.wait(lock, [this]{return m_queued > 0 || m_stop;});
+		if(m_queued == 0)
+		{
+			// Stopping and everything has been written
+			return;
+		}
+		const std::size_t slot = m_read_slot;
+		lock.unlock();
+
+		const bool ok = m_file.write_frame(m_buffers[slot]);
+
+		lock.lock();
+		m_read_slot = (m_read_slot + 1) % m_buffers.size();
+		--m_queued;
+		if(ok)
+		{
+			++m_frames_written;
+			// The file is only touched by this thread, so copy the stats for everyone else
+			m_compression_stats = m_file.get_compression_stats();
+		}
+		else
+		{
+			m_write_failed = true;
+		}
+		m_queued_changed.notify_all();
+	}
+}
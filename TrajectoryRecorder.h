@@ -0,0 +1,77 @@
+#ifndef SPELFYSIK_SLUTUPPGIFT_TRAJECTORYRECORDER_H
+#define SPELFYSIK_SLUTUPPGIFT_TRAJECTORYRECORDER_H
+
+#include "Simulation.h"
+#include "Snapshot.h"
+#include "TrajectoryFile.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Records a trajectory file without making the simulation wait for the disk.
+// Every interval steps the simulating thread copies the bodies into one of a few preallocated
+// snapshot buffers, and a background thread writes the filled buffers in order.
+class TrajectoryRecorder : public SimulationObserver
+{
+public:
+	// What to do when every buffer is still waiting to be written
+	enum class OverflowPolicy
+	{
+		// Wait for the writer
+		Block,
+		// Skip the snapshot
+		Drop,
+		// Skip the snapshot and record less often until the writer has caught up
+		Decimate
+	};
+
+	TrajectoryRecorder(const std::string& path, unsigned int interval, OverflowPolicy policy,
+	                   const TrajectoryCompression& compression = TrajectoryCompression(),
+	                   unsigned int buffer_count = 2);
+	// Writes whatever is still buffered before closing the file
+	~TrajectoryRecorder();
+	TrajectoryRecorder(const TrajectoryRecorder&) = delete;
+	TrajectoryRecorder& operator=(const TrajectoryRecorder&) = delete;
+
+	// False if the file couldn't be created
+	bool is_open() const;
+	// False if the file couldn't be created or a write has failed
+	bool is_ok() const;
+	// Publishes a snapshot if the step is on the recording interval
+	void on_step(const Simulation& simulation) override;
+	// Publishes a snapshot regardless of the step
+	void publish(const Simulation& simulation);
+
+	unsigned long long get_frames_written() const;
+	unsigned long long get_frames_dropped() const;
+	// Current interval multiplier under OverflowPolicy::Decimate, 1 otherwise
+	unsigned int get_decimation() const;
+	TrajectoryCompressionStats get_compression_stats() const;
+
+private:
+	void run();
+
+	TrajectoryFileWriter m_file;
+	const unsigned int m_interval;
+	const OverflowPolicy m_policy;
+	std::vector<Snapshot> m_buffers;
+
+	// Everything below is shared with the writer thread and guarded by m_mutex.
+	// Buffers from m_read_slot and m_queued onwards (wrapping around) are waiting to be written.
+	mutable std::mutex m_mutex;
+	std::condition_variable m_queued_changed;
+	std::size_t m_read_slot;
+	std::size_t m_queued;
+	unsigned int m_decimation;
+	unsigned long long m_frames_written;
+	unsigned long long m_frames_dropped;
+	TrajectoryCompressionStats m_compression_stats;
+	bool m_write_failed;
+	bool m_stop;
+	std::thread m_thread;
+};
+
+#endif //SPELFYSIK_SLUTUPPGIFT_TRAJECTORYRECORDER_H
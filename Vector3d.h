@@ -100,5 +100,11 @@ inline bool operator!=(const Vector3d &lhs, const Vector3d &rhs)
 {
 	return !(lhs == rhs);
 }
+// How far the total system velocity has drifted, summed over the axes. Should stay near zero.
+inline double velocity_deviation(const Vector3d& initial, const Vector3d& current)
+{
+	const Vector3d deviation = current - initial;
+	return std::abs(deviation.get_x()) + std::abs(deviation.get_y()) + std::abs(deviation.get_z());
+}
 
 #endif //SPELFYSIK_SLUTUPPGIFT_VECTOR3D_H
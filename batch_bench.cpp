@@ -0,0 +1,105 @@
+// Times a SimulationBatch against the same simulations run one after another as separate Simulations,
+// on one thread, and checks that every lane ends up exactly where its Simulation does.
+//
+// nbody_batch_bench [--config file] [--option value ...]
+//
+// Lane k uses seed + k, with all other initial conditions shared, so every lane has the same number of bodies.
+
+#include "CommandLine.h"
+#include "Simulation.h"
+#include "SimulationBatch.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+	const char* const USAGE =
+			"Usage: nbody_batch_bench [--config file] [--option value ...]\n"
+			"\n"
+			"  --lanes n                      simulations stepped together (8)\n"
+			"  --steps n                      steps to simulate (1000)\n"
+			"  --layout --bodies --seed --step-size --mass --mass-variance --distribution\n"
+			"  --distribution-variance --speed --speed-variance\n"
+			"                                 initial conditions, see nbody_headless. Lane k uses seed + k.\n";
+
+	double seconds_since(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	const std::vector<std::string> known_options = {"lanes", "steps"};
+	const CommandLine options(argc, argv, known_options);
+	if(!options.is_valid())
+	{
+		std::cerr << options.get_error() << "\n\n" << USAGE;
+		return EXIT_FAILURE;
+	}
+	SimulationInitialConditions base = CommandLine::default_initial_conditions();
+	unsigned long long lanes = 8;
+	int steps = 1000;
+	if(!options.get_initial_conditions(base) || !options.get("lanes", lanes) || !options.get("steps", steps))
+	{
+		std::cerr << options.get_error() << "\n\n" << USAGE;
+		return EXIT_FAILURE;
+	}
+	if(lanes == 0 || lanes > 4096 || steps < 0)
+	{
+		std::cerr << "lanes must be between 1 and 4096 and steps can't be negative" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::vector<SimulationInitialConditions> conditions(lanes, base);
+	for(std::size_t lane = 0; lane < conditions.size(); ++lane)
+	{
+		conditions[lane].random_seed = base.random_seed + static_cast<int>(lane);
+	}
+	std::cout << lanes << " simulations of " << base.number_of_bodies << " " << layout_name(base.layout)
+	          << " bodies, " << steps << " steps" << std::endl;
+
+	// Set up first so that only the stepping is timed
+	std::vector<std::unique_ptr<Simulation>> simulations;
+	for(const SimulationInitialConditions& cond : conditions)
+	{
+		simulations.push_back(std::unique_ptr<Simulation>(new Simulation(cond)));
+	}
+	SimulationBatch batch(conditions);
+	if(!batch.is_valid())
+	{
+		std::cerr << batch.get_error() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+	for(const std::unique_ptr<Simulation>& simulation : simulations)
+	{
+		simulation->simulate(steps);
+	}
+	const double separate_time = seconds_since(start_time);
+	start_time = std::chrono::steady_clock::now();
+	batch.simulate(steps);
+	const double batch_time = seconds_since(start_time);
+
+	int mismatches = 0;
+	for(std::size_t lane = 0; lane < simulations.size(); ++lane)
+	{
+		if(simulations[lane]->get_body_count() != batch.get_body_count(lane)
+		   || !(simulations[lane]->get_system_velocity() == batch.get_system_velocity(lane)))
+		{
+			std::cerr << "Lane " << lane << " differs from its Simulation: " << batch.get_body_count(lane)
+			          << " bodies instead of " << simulations[lane]->get_body_count() << std::endl;
+			++mismatches;
+		}
+	}
+	std::cout << "Separate: " << separate_time << " s" << std::endl;
+	std::cout << "Batch:    " << batch_time << " s" << std::endl;
+	std::cout << "Speedup:  " << separate_time / batch_time << "x" << std::endl;
+	return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
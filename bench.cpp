@@ -0,0 +1,693 @@
+// Runs a matrix of benchmark scenarios and writes the results as JSON and/or CSV, to compare builds and machines.
+//
+// nbody_bench [--config file] [--option value ...]
+//
+// Every combination of bodies, precision, backend and threads is a scenario. Each one runs warm-up repetitions
+// that aren't counted, then the measured ones. With more than one thread every thread steps its own copy of the
+// simulation, with seed + copy, and the rates are for all copies together. The threads-fast and threads-reproducible
+// backends instead step one Simulation that splits every step over the threads.
+//
+// With --counters 1 the direct double scenarios run one more repetition that reads the hardware counters
+// around every phase of a step, and report them per body and per pair interaction. Reading them slows the
+// steps down, so it doesn't count towards the rates. Counters only see the thread that opens them, so the
+// threads-* backends are only counted on one thread.
+
+#include "CommandLine.h"
+#include "Parallel.h"
+#include "PerfCounters.h"
+#include "Simulation.h"
+#include "SimulationFloat.h"
+#include "SimulationBatch.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+	const char* const USAGE =
+			"Usage: nbody_bench [--config file] [--option value ...]\n"
+			"\n"
+			"Scenarios, every combination of:\n"
+			"  --bodies-list list             numbers of bodies (128,1024,8192)\n"
+			"  --precisions list              double and/or float (double,float)\n"
+			"  --backends list                direct (Simulation, SimulationFloat), batch (SimulationBatch),\n"
+			"                                 threads-fast and/or threads-reproducible (one Simulation on\n"
+			"                                 all threads), the last three double only (direct,batch)\n"
+			"  --threads list                 threads, each stepping its own copy, or sharing the one\n"
+			"                                 simulation of the threads-* backends (1 and one per core)\n"
+			"\n"
+			"Measuring:\n"
+			"  --lanes n                      simulations in a batch (8)\n"
+			"  --warmup n                     repetitions run before measuring (1)\n"
+			"  --repetitions n                measured repetitions (5)\n"
+			"  --repetition-pairs n           pair interactions per copy to aim for in a repetition (1e8)\n"
+			"  --max-step-pairs n             skip scenarios with more pair interactions per copy and step (1e9)\n"
+			"  --counters n                   1 to read hardware counters per phase, direct double and\n"
+			"                                 threads-* on one thread only (0)\n"
+			"\n"
+			"Output:\n"
+			"  --json path                    results as JSON\n"
+			"  --csv path                     results as CSV\n"
+			"\n"
+			"The other initial conditions are shared by every scenario, see nbody_headless:\n"
+			"  --layout --seed --step-size --mass --mass-variance --distribution\n"
+			"  --distribution-variance --speed --speed-variance\n";
+
+	struct Scenario
+	{
+		int bodies;
+		std::string precision;
+		std::string backend;
+		unsigned int threads;
+		// Stepped side by side, one per thread unless the simulation uses the threads itself
+		unsigned int copies;
+		// Simulations in each copy
+		unsigned int lanes;
+	};
+
+	struct Result
+	{
+		Scenario scenario;
+		bool measured;
+		// Why it wasn't
+		std::string skip_reason;
+		int initial_bodies;
+		int final_bodies;
+		int steps_per_repetition;
+		// Steps of all simulations per second, mean and sample standard deviation over the repetitions
+		double steps_per_second;
+		double steps_per_second_deviation;
+		double pair_interactions_per_second;
+		std::size_t bytes_per_body;
+		// Same metric as the interactive performance test, mean over all simulations
+		double velocity_deviation;
+		// Hardware counters of the extra repetition, summed over the copies
+		bool counted;
+		// Why they weren't, or which ones are missing
+		std::string counter_error;
+		PhaseCounts counts;
+		bool has_counter[PERF_COUNTER_COUNT];
+		// Bodies times steps and pair interactions of the extra repetition
+		double counted_body_steps;
+		double counted_pairs;
+	};
+
+	// The phases of a step, in the order they run
+	const Phase STEP_PHASES[] = {Phase::Gravity, Phase::Integrate, Phase::Collisions, Phase::Compaction};
+
+	void attach_counters(Simulation& simulation, PerfCounters* counters)
+	{
+		simulation.set_perf_counters(counters);
+	}
+
+	void attach_counters(SimulationFloat&, PerfCounters*)
+	{
+	}
+
+	bool is_threaded_backend(const std::string& backend)
+	{
+		return backend == "threads-fast" || backend == "threads-reproducible";
+	}
+
+	void set_parallelism(Simulation& simulation, const std::string& backend, unsigned int threads)
+	{
+		if(backend == "threads-fast")
+		{
+			simulation.set_parallelism(threads, ReductionMode::Fast);
+		}
+		else if(backend == "threads-reproducible")
+		{
+			simulation.set_parallelism(threads, ReductionMode::Reproducible);
+		}
+	}
+
+	void set_parallelism(SimulationFloat&, const std::string&, unsigned int)
+	{
+	}
+
+	double pair_count(double bodies)
+	{
+		return 0.5 * bodies * (bodies - 1.0);
+	}
+
+	// One copy of a scenario, stepped by one thread, or by all of them for the threads-* backends
+	class Runner
+	{
+	public:
+		virtual ~Runner() {}
+		// Steps once and returns the pair interactions of the step
+		virtual double step() = 0;
+		// Of the first simulation
+		virtual int get_body_count() const = 0;
+		// Summed over every simulation of the copy
+		virtual double get_velocity_deviation() const = 0;
+		// Counts the phases of the steps from now on, or stops with null
+		virtual void set_perf_counters(PerfCounters*) {}
+	};
+
+	// Simulation or SimulationFloat
+	template<typename SimulationType>
+	class DirectRunner : public Runner
+	{
+	public:
+		DirectRunner(const InitialConditionGenerator& generator, double step_size, const std::string& backend,
+		             unsigned int threads)
+		: m_simulation(generator, step_size), m_initial_system_velocity(0.0, 0.0, 0.0)
+		{
+			set_parallelism(m_simulation, backend, threads);
+			m_initial_system_velocity = m_simulation.get_system_velocity();
+		}
+
+		double step() override
+		{
+			const double pairs = pair_count(m_simulation.get_body_count());
+			m_simulation.simulate(1);
+			return pairs;
+		}
+
+		int get_body_count() const override
+		{
+			return m_simulation.get_body_count();
+		}
+
+		double get_velocity_deviation() const override
+		{
+			return velocity_deviation(m_initial_system_velocity, m_simulation.get_system_velocity());
+		}
+
+		void set_perf_counters(PerfCounters* counters) override
+		{
+			attach_counters(m_simulation, counters);
+		}
+
+	private:
+		SimulationType m_simulation;
+		Vector3d m_initial_system_velocity;
+	};
+
+	class BatchRunner : public Runner
+	{
+	public:
+		BatchRunner(const std::vector<const InitialConditionGenerator*>& generators, double step_size)
+		: m_batch(generators, step_size), m_initial_system_velocities()
+		{
+			for(std::size_t lane = 0; lane < m_batch.get_lane_count(); ++lane)
+			{
+				m_initial_system_velocities.push_back(m_batch.get_system_velocity(lane));
+			}
+		}
+
+		double step() override
+		{
+			double pairs = 0.0;
+			for(std::size_t lane = 0; lane < m_batch.get_lane_count(); ++lane)
+			{
+				pairs += pair_count(m_batch.get_body_count(lane));
+			}
+			m_batch.simulate(1);
+			return pairs;
+		}
+
+		int get_body_count() const override
+		{
+			return m_batch.get_body_count(0);
+		}
+
+		double get_velocity_deviation() const override
+		{
+			double deviation = 0.0;
+			for(std::size_t lane = 0; lane < m_batch.get_lane_count(); ++lane)
+			{
+				deviation += velocity_deviation(m_initial_system_velocities[lane], m_batch.get_system_velocity(lane));
+			}
+			return deviation;
+		}
+
+	private:
+		SimulationBatch m_batch;
+		std::vector<Vector3d> m_initial_system_velocities;
+	};
+
+	std::unique_ptr<Runner> make_runner(const Scenario& scenario, SimulationInitialConditions cond, int copy)
+	{
+		cond.number_of_bodies = scenario.bodies;
+		std::vector<std::unique_ptr<InitialConditionGenerator>> generators;
+		std::vector<const InitialConditionGenerator*> lanes;
+		for(unsigned int lane = 0; lane < scenario.lanes; ++lane)
+		{
+			SimulationInitialConditions lane_cond = cond;
+			lane_cond.random_seed = cond.random_seed + copy * static_cast<int>(scenario.lanes) + static_cast<int>(lane);
+			generators.push_back(make_initial_condition_generator(lane_cond));
+			lanes.push_back(generators.back().get());
+		}
+		if(scenario.backend == "batch")
+		{
+			return std::unique_ptr<Runner>(new BatchRunner(lanes, cond.step_size));
+		}
+		if(scenario.precision == "float")
+		{
+			return std::unique_ptr<Runner>(new DirectRunner<SimulationFloat>(*lanes.front(), cond.step_size,
+			                                                                 scenario.backend, scenario.threads));
+		}
+		return std::unique_ptr<Runner>(new DirectRunner<Simulation>(*lanes.front(), cond.step_size, scenario.backend,
+		                                                            scenario.threads));
+	}
+
+	double seconds_since(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// One more repetition with the hardware counters on, every copy counting on its own thread
+	void count_scenario(std::vector<std::unique_ptr<Runner>>& runners, Result& result)
+	{
+		std::vector<PhaseCounts> counts(runners.size(), PhaseCounts());
+		std::vector<double> body_steps(runners.size(), 0.0);
+		std::vector<double> pairs(runners.size(), 0.0);
+		std::vector<std::string> errors(runners.size());
+		std::vector<char> counted(runners.size(), 0);
+		std::vector<char> has_counter(PERF_COUNTER_COUNT, 1);
+		parallel_for_chunks(runners.size(), 1, [&](std::size_t, std::size_t copy, std::size_t)
+		{
+			// Counters only follow the thread that opens them
+			PerfCounters counters;
+			errors[copy] = counters.get_error();
+			if(!counters.is_open())
+			{
+				return;
+			}
+			runners[copy]->set_perf_counters(&counters);
+			for(int step = 0; step < result.steps_per_repetition; ++step)
+			{
+				body_steps[copy] += runners[copy]->get_body_count();
+				pairs[copy] += runners[copy]->step();
+			}
+			runners[copy]->set_perf_counters(nullptr);
+			counts[copy] = counters.get_counts();
+			counted[copy] = 1;
+			// Every copy opens the same counters
+			for(std::size_t c = 0; c < PERF_COUNTER_COUNT && copy == 0; ++c)
+			{
+				has_counter[c] = counters.has(static_cast<PerfCounter>(c));
+			}
+		}, result.scenario.threads);
+
+		result.counter_error = errors.front();
+		result.counted = std::find(counted.begin(), counted.end(), 0) == counted.end();
+		if(!result.counted)
+		{
+			return;
+		}
+		result.counts = PhaseCounts();
+		for(std::size_t c = 0; c < PERF_COUNTER_COUNT; ++c)
+		{
+			result.has_counter[c] = has_counter[c] != 0;
+		}
+		for(std::size_t copy = 0; copy < runners.size(); ++copy)
+		{
+			result.counts.add(counts[copy]);
+			result.counted_body_steps += body_steps[copy];
+			result.counted_pairs += pairs[copy];
+		}
+	}
+
+	// Summed over the phases of a step
+	double step_count(const Result& result, PerfCounter counter)
+	{
+		double count = 0.0;
+		for(Phase phase : STEP_PHASES)
+		{
+			count += result.counts.get(phase, counter);
+		}
+		return count;
+	}
+
+	Result run_scenario(const Scenario& scenario, const SimulationInitialConditions& cond, unsigned long long warmup,
+	                    unsigned long long repetitions, double repetition_pairs, double max_step_pairs, bool count)
+	{
+		Result result = Result();
+		result.scenario = scenario;
+		if(pair_count(scenario.bodies) * scenario.lanes > max_step_pairs)
+		{
+			result.skip_reason = "more than max-step-pairs pair interactions per step";
+			return result;
+		}
+		result.bytes_per_body = scenario.backend == "batch" ? SimulationBatch::get_bytes_per_body()
+		                        : scenario.precision == "float" ? SimulationFloat::get_bytes_per_body()
+		                        : Simulation::get_bytes_per_body();
+
+		// Set up on this thread, the grid layout uses std::rand
+		std::vector<std::unique_ptr<Runner>> runners;
+		for(unsigned int copy = 0; copy < scenario.copies; ++copy)
+		{
+			runners.push_back(make_runner(scenario, cond, static_cast<int>(copy)));
+		}
+		// The grid layout doesn't always give the number of bodies asked for
+		result.initial_bodies = runners.front()->get_body_count();
+		const double step_pairs = pair_count(result.initial_bodies) * scenario.lanes;
+		result.steps_per_repetition = static_cast<int>(std::min(std::max(std::ceil(repetition_pairs / step_pairs), 1.0),
+		                                                        1e9));
+
+		std::vector<double> rates;
+		double measured_pairs = 0.0;
+		double measured_time = 0.0;
+		for(unsigned long long repetition = 0; repetition < warmup + repetitions; ++repetition)
+		{
+			std::vector<double> pairs(runners.size(), 0.0);
+			const std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+			parallel_for_chunks(runners.size(), 1, [&](std::size_t, std::size_t begin, std::size_t)
+			{
+				for(int step = 0; step < result.steps_per_repetition; ++step)
+				{
+					pairs[begin] += runners[begin]->step();
+				}
+			}, scenario.threads);
+			const double time = seconds_since(start_time);
+			if(repetition >= warmup)
+			{
+				const double steps = static_cast<double>(result.steps_per_repetition) * scenario.copies
+				                     * scenario.lanes;
+				rates.push_back(steps / time);
+				for(double copy_pairs : pairs)
+				{
+					measured_pairs += copy_pairs;
+				}
+				measured_time += time;
+			}
+		}
+
+		result.measured = true;
+		result.final_bodies = runners.front()->get_body_count();
+		double rate_sum = 0.0;
+		for(double rate : rates)
+		{
+			rate_sum += rate;
+		}
+		result.steps_per_second = rate_sum / rates.size();
+		double squared_sum = 0.0;
+		for(double rate : rates)
+		{
+			squared_sum += (rate - result.steps_per_second) * (rate - result.steps_per_second);
+		}
+		result.steps_per_second_deviation = rates.size() > 1 ? std::sqrt(squared_sum / (rates.size() - 1)) : 0.0;
+		result.pair_interactions_per_second = measured_pairs / measured_time;
+		double deviation = 0.0;
+		for(const std::unique_ptr<Runner>& runner : runners)
+		{
+			deviation += runner->get_velocity_deviation();
+		}
+		result.velocity_deviation = deviation / (static_cast<double>(scenario.copies) * scenario.lanes);
+		if(count)
+		{
+			if(scenario.backend == "batch" || scenario.precision != "double")
+			{
+				result.counter_error = "Only the double Simulation backends count their phases";
+			}
+			else if(is_threaded_backend(scenario.backend) && scenario.threads != 1)
+			{
+				result.counter_error = "Counters don't see the threads of a threaded simulation";
+			}
+			else
+			{
+				count_scenario(runners, result);
+			}
+		}
+		return result;
+	}
+
+	bool write_json(const std::string& path, const std::vector<Result>& results, const SimulationInitialConditions& cond,
+	                unsigned long long warmup, unsigned long long repetitions)
+	{
+		std::ofstream file(path);
+		file.precision(17);
+		file << "{\n";
+		file << "  \"layout\": \"" << layout_name(cond.layout) << "\",\n";
+		file << "  \"seed\": " << cond.random_seed << ",\n";
+		file << "  \"step_size\": " << cond.step_size << ",\n";
+		file << "  \"warmup\": " << warmup << ",\n";
+		file << "  \"repetitions\": " << repetitions << ",\n";
+		file << "  \"hardware_threads\": " << default_thread_count() << ",\n";
+#ifdef __VERSION__
+		file << "  \"compiler_version\": \"" << __VERSION__ << "\",\n";
+#endif
+		file << "  \"scenarios\": [";
+		for(std::size_t i = 0; i < results.size(); ++i)
+		{
+			const Result& result = results[i];
+			const Scenario& scenario = result.scenario;
+			file << (i > 0 ? ",\n" : "\n") << "    {\"bodies\": " << scenario.bodies << ", \"precision\": \""
+			     << scenario.precision << "\", \"backend\": \"" << scenario.backend << "\", \"threads\": "
+			     << scenario.threads << ", \"lanes\": " << scenario.lanes << ", ";
+			if(!result.measured)
+			{
+				file << "\"skipped\": \"" << result.skip_reason << "\"}";
+				continue;
+			}
+			file << "\"initial_bodies\": " << result.initial_bodies << ", \"final_bodies\": " << result.final_bodies
+			     << ", \"steps_per_repetition\": " << result.steps_per_repetition << ", \"steps_per_second\": "
+			     << result.steps_per_second << ", \"steps_per_second_stddev\": " << result.steps_per_second_deviation
+			     << ", \"pair_interactions_per_second\": " << result.pair_interactions_per_second
+			     << ", \"bytes_per_body\": " << result.bytes_per_body << ", \"velocity_deviation\": "
+			     << result.velocity_deviation;
+			if(!result.counter_error.empty())
+			{
+				file << ", \"counters_error\": \"" << result.counter_error << "\"";
+			}
+			if(result.counted)
+			{
+				// Per phase, counters that couldn't be opened are left out
+				file << ", \"counters\": {";
+				for(std::size_t p = 0; p < sizeof(STEP_PHASES) / sizeof(STEP_PHASES[0]); ++p)
+				{
+					const Phase phase = STEP_PHASES[p];
+					file << (p > 0 ? ", " : "") << "\"" << phase_name(phase) << "\": {";
+					bool first = true;
+					for(std::size_t c = 0; c < PERF_COUNTER_COUNT; ++c)
+					{
+						const PerfCounter counter = static_cast<PerfCounter>(c);
+						if(!result.has_counter[c])
+						{
+							continue;
+						}
+						const double value = result.counts.get(phase, counter);
+						file << (first ? "" : ", ") << "\"" << perf_counter_name(counter) << "\": {\"per_body\": "
+						     << value / result.counted_body_steps << ", \"per_pair\": " << value / result.counted_pairs
+						     << "}";
+						first = false;
+					}
+					file << "}";
+				}
+				file << "}";
+			}
+			file << "}";
+		}
+		file << "\n  ]\n}\n";
+		file.flush();
+		return static_cast<bool>(file);
+	}
+
+	bool write_csv(const std::string& path, const std::vector<Result>& results)
+	{
+		std::ofstream file(path);
+		file.precision(17);
+		file << "bodies,precision,backend,threads,lanes,skipped,initial_bodies,final_bodies,steps_per_repetition,"
+		        "steps_per_second,steps_per_second_stddev,pair_interactions_per_second,bytes_per_body,"
+		        "velocity_deviation";
+		// Counters summed over the phases of a step
+		for(std::size_t c = 0; c < PERF_COUNTER_COUNT; ++c)
+		{
+			const char* name = perf_counter_name(static_cast<PerfCounter>(c));
+			file << "," << name << "_per_body," << name << "_per_pair";
+		}
+		file << "\n";
+		for(const Result& result : results)
+		{
+			const Scenario& scenario = result.scenario;
+			file << scenario.bodies << "," << scenario.precision << "," << scenario.backend << "," << scenario.threads
+			     << "," << scenario.lanes << "," << result.skip_reason << ",";
+			if(result.measured)
+			{
+				file << result.initial_bodies << "," << result.final_bodies << "," << result.steps_per_repetition << ","
+				     << result.steps_per_second << "," << result.steps_per_second_deviation << ","
+				     << result.pair_interactions_per_second << "," << result.bytes_per_body << ","
+				     << result.velocity_deviation;
+			}
+			else
+			{
+				file << ",,,,,,,";
+			}
+			for(std::size_t c = 0; c < PERF_COUNTER_COUNT; ++c)
+			{
+				const PerfCounter counter = static_cast<PerfCounter>(c);
+				if(result.counted && result.has_counter[c])
+				{
+					file << "," << step_count(result, counter) / result.counted_body_steps << ","
+					     << step_count(result, counter) / result.counted_pairs;
+				}
+				else
+				{
+					file << ",,";
+				}
+			}
+			file << "\n";
+		}
+		file.flush();
+		return static_cast<bool>(file);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	const std::vector<std::string> known_options = {
+			"bodies-list", "precisions", "backends", "threads", "lanes", "warmup", "repetitions", "repetition-pairs",
+			"max-step-pairs", "counters", "json", "csv"};
+	const CommandLine options(argc, argv, known_options);
+	if(!options.is_valid())
+	{
+		std::cerr << options.get_error() << "\n\n" << USAGE;
+		return EXIT_FAILURE;
+	}
+
+	SimulationInitialConditions cond = CommandLine::default_initial_conditions();
+	std::vector<int> body_counts = {128, 1024, 8192};
+	std::vector<std::string> precisions = {"double", "float"};
+	std::vector<std::string> backends = {"direct", "batch"};
+	std::vector<int> thread_counts = {1, static_cast<int>(default_thread_count())};
+	unsigned long long lanes = 8;
+	unsigned long long warmup = 1;
+	unsigned long long repetitions = 5;
+	double repetition_pairs = 1e8;
+	double max_step_pairs = 1e9;
+	unsigned long long counters = 0;
+	std::string json_path;
+	std::string csv_path;
+	const bool options_valid =
+			options.get_initial_conditions(cond)
+			&& options.get("bodies-list", body_counts)
+			&& options.get("precisions", precisions)
+			&& options.get("backends", backends)
+			&& options.get("threads", thread_counts)
+			&& options.get("lanes", lanes)
+			&& options.get("warmup", warmup)
+			&& options.get("repetitions", repetitions)
+			&& options.get("repetition-pairs", repetition_pairs)
+			&& options.get("max-step-pairs", max_step_pairs)
+			&& options.get("counters", counters)
+			&& options.get("json", json_path)
+			&& options.get("csv", csv_path);
+	if(!options_valid)
+	{
+		std::cerr << options.get_error() << std::endl;
+		return EXIT_FAILURE;
+	}
+	for(const std::string& precision : precisions)
+	{
+		if(precision != "double" && precision != "float")
+		{
+			std::cerr << "precisions must be double or float, not " << precision << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+	for(const std::string& backend : backends)
+	{
+		if(backend != "direct" && backend != "batch" && !is_threaded_backend(backend))
+		{
+			std::cerr << "backends must be direct, batch, threads-fast or threads-reproducible, not " << backend
+			          << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+	if(lanes == 0 || lanes > 4096 || repetitions == 0 || repetition_pairs <= 0.0)
+	{
+		std::cerr << "lanes must be between 1 and 4096, and repetitions and repetition-pairs more than 0" << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::sort(thread_counts.begin(), thread_counts.end());
+	thread_counts.erase(std::unique(thread_counts.begin(), thread_counts.end()), thread_counts.end());
+	if(thread_counts.front() == 0 || thread_counts.back() > 4096)
+	{
+		std::cerr << "threads must be between 1 and 4096" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::vector<Scenario> scenarios;
+	for(int bodies : body_counts)
+	{
+		for(const std::string& precision : precisions)
+		{
+			for(const std::string& backend : backends)
+			{
+				// Only the direct backend comes in float
+				if(backend != "direct" && precision != "double")
+				{
+					continue;
+				}
+				for(int threads : thread_counts)
+				{
+					const unsigned int copies = is_threaded_backend(backend) ? 1 : static_cast<unsigned int>(threads);
+					const unsigned int copy_lanes = backend == "batch" ? static_cast<unsigned int>(lanes) : 1;
+					scenarios.push_back(Scenario{bodies, precision, backend, static_cast<unsigned int>(threads),
+					                             copies, copy_lanes});
+				}
+			}
+		}
+	}
+
+	std::vector<Result> results;
+	for(const Scenario& scenario : scenarios)
+	{
+		std::cout << scenario.bodies << " bodies, " << scenario.precision << ", " << scenario.backend << ", "
+		          << scenario.threads << " threads: " << std::flush;
+		results.push_back(run_scenario(scenario, cond, warmup, repetitions, repetition_pairs, max_step_pairs,
+		                               counters != 0));
+		const Result& result = results.back();
+		if(!result.measured)
+		{
+			std::cout << "skipped, " << result.skip_reason << std::endl;
+			continue;
+		}
+		std::cout << result.steps_per_second << " +- " << result.steps_per_second_deviation << " steps/s, "
+		          << result.pair_interactions_per_second << " pairs/s, velocity deviation "
+		          << result.velocity_deviation << std::endl;
+		if(counters != 0 && !result.counter_error.empty())
+		{
+			std::cout << "  " << result.counter_error << std::endl;
+		}
+		if(result.counted)
+		{
+			for(Phase phase : STEP_PHASES)
+			{
+				std::cout << "  " << phase_name(phase) << " per pair:";
+				for(std::size_t c = 0; c < PERF_COUNTER_COUNT; ++c)
+				{
+					const PerfCounter counter = static_cast<PerfCounter>(c);
+					if(result.has_counter[c])
+					{
+						std::cout << " " << result.counts.get(phase, counter) / result.counted_pairs << " "
+						          << perf_counter_name(counter);
+					}
+				}
+				std::cout << std::endl;
+			}
+		}
+	}
+
+	if(!json_path.empty() && !write_json(json_path, results, cond, warmup, repetitions))
+	{
+		std::cerr << "Could not write " << json_path << std::endl;
+		return EXIT_FAILURE;
+	}
+	if(!csv_path.empty() && !write_csv(csv_path, results))
+	{
+		std::cerr << "Could not write " << csv_path << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
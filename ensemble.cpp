@@ -0,0 +1,130 @@
+// Runs a sweep of independent simulations on every core and writes one CSV row per run.
+//
+// nbody_ensemble [--config file] [--option value ...]
+//
+// Lists are comma separated or first:last[:step], e.g. --seeds 1:100 --mass-variances 0.5,1,1.5.
+// Every combination of the lists is run. Options work as for nbody_headless.
+
+#include "CommandLine.h"
+#include "Ensemble.h"
+#include "Parallel.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+	const char* const USAGE =
+			"Usage: nbody_ensemble [--config file] [--option value ...]\n"
+			"\n"
+			"Swept, as a list like 1,2,3 or a range like 1:100 or 0.5:2:0.25:\n"
+			"  --seeds list                   random seeds\n"
+			"  --body-counts list             numbers of bodies\n"
+			"  --mass-variances list\n"
+			"  --speed-variances list\n"
+			"\n"
+			"Shared by every run, see nbody_headless for the defaults:\n"
+			"  --layout --bodies --seed --step-size --mass --mass-variance --distribution\n"
+			"  --distribution-variance --speed --speed-variance\n"
+			"  --steps n                      steps per run (60000)\n"
+			"\n"
+			"  --threads n                    simulations running at once (one per core)\n"
+			"  --lanes n                      step up to n runs with the same layout, bodies, step size\n"
+			"                                 and steps together with vector instructions (1)\n"
+			"  --output path                  CSV file for the results (standard output)\n";
+}
+
+int main(int argc, char* argv[])
+{
+	if(argc < 2)
+	{
+		std::cerr << USAGE;
+		return EXIT_FAILURE;
+	}
+	const std::vector<std::string> known_options = {
+			"seeds", "body-counts", "mass-variances", "speed-variances", "steps", "threads", "lanes", "output"};
+	const CommandLine options(argc, argv, known_options);
+	if(!options.is_valid())
+	{
+		std::cerr << options.get_error() << "\n\n" << USAGE;
+		return EXIT_FAILURE;
+	}
+
+	SimulationInitialConditions base = CommandLine::default_initial_conditions();
+	unsigned long long steps = 60000;
+	unsigned long long threads = default_thread_count();
+	unsigned long long lanes = 1;
+	std::string output_path;
+	std::vector<int> seeds;
+	std::vector<int> body_counts;
+	std::vector<double> mass_variances;
+	std::vector<double> speed_variances;
+	if(!options.get_initial_conditions(base) || !options.get("steps", steps) || !options.get("threads", threads)
+	   || !options.get("lanes", lanes) || !options.get("output", output_path)
+	   || !options.get("seeds", seeds) || !options.get("body-counts", body_counts)
+	   || !options.get("mass-variances", mass_variances) || !options.get("speed-variances", speed_variances))
+	{
+		std::cerr << options.get_error() << std::endl;
+		return EXIT_FAILURE;
+	}
+	if(threads == 0 || threads > 4096)
+	{
+		std::cerr << "threads must be between 1 and 4096" << std::endl;
+		return EXIT_FAILURE;
+	}
+	if(lanes == 0 || lanes > 4096)
+	{
+		std::cerr << "lanes must be between 1 and 4096" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::ofstream file;
+	if(!output_path.empty())
+	{
+		file.open(output_path);
+		if(!file)
+		{
+			std::cerr << "Could not create " << output_path << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+	std::ostream& output = output_path.empty() ? std::cout : file;
+
+	const std::vector<EnsembleRun> runs = make_parameter_grid(base, steps, seeds, body_counts, mass_variances,
+	                                                          speed_variances);
+	std::cerr << "Running " << runs.size() << " simulations on " << threads << " threads" << std::endl;
+	std::size_t finished = 0;
+	const std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+	const std::vector<EnsembleResult> results = run_ensemble(runs, static_cast<unsigned int>(threads),
+	                                                         [&](const EnsembleResult& result)
+	{
+		++finished;
+		std::cerr << "Run " << result.run << " done in " << result.wall_time << " s (" << finished << "/"
+		          << runs.size() << ")" << std::endl;
+	}, static_cast<unsigned int>(lanes));
+	const double total_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+	// In run order, so sweeps can be compared line by line
+	output.precision(17);
+	output << "run,layout,seed,bodies,mass_variance,speed_variance,steps,final_bodies,velocity_deviation,wall_time_s\n";
+	for(const EnsembleResult& result : results)
+	{
+		const SimulationInitialConditions& cond = runs[result.run].conditions;
+		output << result.run << "," << layout_name(cond.layout) << "," << cond.random_seed << ","
+		       << result.initial_body_count << "," << cond.mass_variance << "," << cond.speed_variance << ","
+		       << runs[result.run].steps << "," << result.final_body_count << "," << result.velocity_deviation << ","
+		       << result.wall_time << "\n";
+	}
+	output.flush();
+	if(!output)
+	{
+		std::cerr << "Could not write the results" << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::cerr << runs.size() << " simulations in " << total_time << " s" << std::endl;
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,165 @@
+// Compares two state hash streams written by nbody_headless --hash-stream and says where the runs diverge.
+//
+// nbody_hashdiff first.nbhs second.nbhs
+//
+// Only steps both streams have are compared. Exits with 0 if they all match, 1 if the runs diverge and 2 if a
+// stream couldn't be read, like cmp.
+
+#include "StateHash.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <string>
+
+namespace
+{
+	const char* const USAGE = "Usage: nbody_hashdiff first.nbhs second.nbhs\n";
+
+	std::string describe(const StateHashFile& file)
+	{
+		std::string description = file.get_mode() == StateHashMode::Exact ? "exact" : "bucketed";
+		if(file.get_mode() == StateHashMode::Bucketed)
+		{
+			description += " to " + std::to_string(file.get_bucket_size()) + " m";
+		}
+		description += ", every " + std::to_string(file.get_interval()) + " steps, "
+		               + std::to_string(file.get_record_count()) + " records";
+		if(file.has_body_hashes())
+		{
+			description += " with body hashes";
+		}
+		if(file.is_truncated())
+		{
+			description += ", truncated";
+		}
+		return description;
+	}
+
+	// Names the first body whose hash differs, by position and by id
+	void report_first_body(const StateHashRecord& first, const StateHashRecord& second)
+	{
+		const std::size_t count = std::min(first.ids.size(), second.ids.size());
+		for(std::size_t i = 0; i < count; ++i)
+		{
+			if(first.ids[i] != second.ids[i])
+			{
+				// The bodies are in a different order, which means a merge happened in one run only
+				std::cout << "Body " << i << " is id " << first.ids[i] << " in the first run and id " << second.ids[i]
+				          << " in the second" << std::endl;
+				break;
+			}
+			if(first.body_hashes[i] != second.body_hashes[i])
+			{
+				std::cout << "First diverging body: " << i << " (id " << first.ids[i] << ")" << std::endl;
+				return;
+			}
+		}
+		if(first.ids.size() != second.ids.size())
+		{
+			std::cout << "The first run has " << first.body_count << " bodies and the second " << second.body_count
+			          << std::endl;
+		}
+		// Match by id for the bodies both runs still have
+		std::map<unsigned int, std::uint64_t> second_hashes;
+		for(std::size_t i = 0; i < second.ids.size(); ++i)
+		{
+			second_hashes[second.ids[i]] = second.body_hashes[i];
+		}
+		for(std::size_t i = 0; i < first.ids.size(); ++i)
+		{
+			const std::map<unsigned int, std::uint64_t>::const_iterator match = second_hashes.find(first.ids[i]);
+			if(match == second_hashes.end())
+			{
+				std::cout << "First body missing from the second run: " << i << " (id " << first.ids[i] << ")"
+				          << std::endl;
+				return;
+			}
+			if(match->second != first.body_hashes[i])
+			{
+				std::cout << "First diverging body: " << i << " (id " << first.ids[i] << ")" << std::endl;
+				return;
+			}
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if(argc != 3)
+	{
+		std::cerr << USAGE;
+		return 2;
+	}
+	const StateHashFile first(argv[1]);
+	const StateHashFile second(argv[2]);
+	for(const StateHashFile* file : {&first, &second})
+	{
+		if(!file->is_valid())
+		{
+			std::cerr << file->get_error() << std::endl;
+			return 2;
+		}
+	}
+	std::cout << argv[1] << ": " << describe(first) << "\n" << argv[2] << ": " << describe(second) << std::endl;
+	if(first.get_mode() != second.get_mode() || first.get_bucket_size() != second.get_bucket_size())
+	{
+		std::cerr << "The streams are hashed differently and can't be compared" << std::endl;
+		return 2;
+	}
+
+	StateHashRecord first_record = StateHashRecord();
+	StateHashRecord second_record = StateHashRecord();
+	std::size_t i = 0;
+	std::size_t j = 0;
+	std::size_t compared = 0;
+	unsigned long long last_matching_step = 0;
+	while(i < first.get_record_count() && j < second.get_record_count())
+	{
+		first.read_record(i, first_record, false);
+		second.read_record(j, second_record, false);
+		// The streams may have different intervals, or one may start from a checkpoint
+		if(first_record.step < second_record.step)
+		{
+			++i;
+			continue;
+		}
+		if(second_record.step < first_record.step)
+		{
+			++j;
+			continue;
+		}
+		++compared;
+		if(first_record.hash != second_record.hash || first_record.body_count != second_record.body_count)
+		{
+			std::cout << "First diverging step: " << first_record.step;
+			if(compared > 1)
+			{
+				std::cout << ", the last matching one is " << last_matching_step;
+			}
+			std::cout << std::endl;
+			if(first.has_body_hashes() && second.has_body_hashes())
+			{
+				first.read_record(i, first_record, true);
+				second.read_record(j, second_record, true);
+				report_first_body(first_record, second_record);
+			}
+			else
+			{
+				std::cout << "Write both streams with --hash-bodies 1 to find the first diverging body" << std::endl;
+			}
+			return 1;
+		}
+		last_matching_step = first_record.step;
+		++i;
+		++j;
+	}
+	if(compared == 0)
+	{
+		std::cerr << "The streams have no steps in common" << std::endl;
+		return 2;
+	}
+	std::cout << "All " << compared << " common steps match, up to step " << last_matching_step << std::endl;
+	return 0;
+}
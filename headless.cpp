@@ -0,0 +1,632 @@
+// Runs a simulation without a window, for compute nodes and benchmarks.
+//
+// nbody_headless [--config file] [--option value ...]
+//
+// Every option can also go in the config file as "option = value", one per line, with # starting a comment.
+// Options on the command line override the config file. Run without arguments for the list of options.
+
+#include "CommandLine.h"
+#include "Simulation.h"
+#include "SimulationFloat.h"
+#include "InitialConditionsFile.h"
+#include "Checkpoint.h"
+#include "BackgroundCheckpointer.h"
+#include "TrajectoryRecorder.h"
+#include "MergeLog.h"
+#include "StateHash.h"
+#include "PhaseTimer.h"
+#include "Trace.h"
+#include "AllocationTracker.h"
+#include "SharedState.h"
+#include "StreamServer.h"
+#include "MetricsServer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+	const char* const USAGE =
+			"Usage: nbody_headless [--config file] [--option value ...]\n"
+			"\n"
+			"Initial conditions, from a file or generated:\n"
+			"  --initial path                 .nbic initial conditions or .nbck checkpoint to continue\n"
+			"  --layout name                  grid, plummer, kepler-disk or cold-collapse (grid)\n"
+			"  --bodies n                     number of bodies (128)\n"
+			"  --seed n                       random seed (42)\n"
+			"  --step-size s                  seconds per step (1800)\n"
+			"  --mass kg                      system mass (4e8)\n"
+			"  --mass-variance x              (1.0)\n"
+			"  --distribution m               distance between bodies (1500)\n"
+			"  --distribution-variance x      (1.8)\n"
+			"  --speed m/s                    (0.003)\n"
+			"  --speed-variance x             (1.8)\n"
+			"\n"
+			"Running:\n"
+			"  --steps n                      steps to simulate (60000)\n"
+			"  --precision name               double or float (double)\n"
+			"  --report-every n               print progress every n steps, 0 for never (0)\n"
+			"  --threads n                    threads for the gravity, double precision only (1)\n"
+			"  --reductions name              fast, or reproducible for the same bits with any number of threads (fast)\n"
+			"  --memory-budget bytes          refuse to start if the run is projected to need more heap, 0 for any (0)\n"
+			"\n"
+			"Output, double precision only:\n"
+			"  --checkpoint path              checkpoint written when done\n"
+			"  --checkpoint-every n           also write it every n steps from a forked child, skipped while the\n"
+			"                                 last one is still being written, 0 for only when done (0)\n"
+			"  --trajectory path              record a trajectory\n"
+			"  --trajectory-interval n        steps between frames (10)\n"
+			"  --trajectory-bits n            quantize positions to n bits, 0 for exact (0)\n"
+			"  --merge-log path               log every merge\n"
+			"  --hash-stream path             write a hash of the state, compare runs with nbody_hashdiff\n"
+			"  --hash-interval n              steps between hashes (1)\n"
+			"  --hash-tolerance m             hash positions in buckets of m meters, 0 for exact bits (0)\n"
+			"  --hash-bodies n                1 to also hash every body, to find the first one to diverge (0)\n"
+			"  --shared-state name            export the state to shared memory, like /nbody\n"
+			"  --stream path                  stream to viewers on a Unix domain socket\n"
+			"  --metrics-port n               serve Prometheus metrics at http://127.0.0.1:n/metrics, 0 for off (0)\n"
+			"  --metrics-interval n           steps between samples of the energy and momentum drift (100)\n"
+			"  --phase-times n                1 to print where the time goes with every report and at the end (0)\n"
+			"  --trace path                   write a Chrome trace of the steps and their phases when done\n"
+			"  --memory-report n              1 to track the heap and print it per subsystem at the end, needs a\n"
+			"                                 build with the CMake option NBODY_TRACK_ALLOCATIONS (0)\n";
+
+	double seconds_since(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// Allocations of every step, including those of the observers before it
+	class AllocationCounter : public SimulationObserver
+	{
+	public:
+		AllocationCounter()
+		: m_last(get_memory_stats().allocations), m_steps(0), m_total(0), m_max(0)
+		{
+		}
+
+		void on_step(const Simulation&) override
+		{
+			const unsigned long long allocations = get_memory_stats().allocations;
+			const unsigned long long step_allocations = allocations - m_last;
+			m_last = allocations;
+			++m_steps;
+			m_total += step_allocations;
+			m_max = std::max(m_max, step_allocations);
+		}
+
+		double get_mean() const
+		{
+			return m_steps > 0 ? static_cast<double>(m_total) / m_steps : 0.0;
+		}
+
+		unsigned long long get_max() const
+		{
+			return m_max;
+		}
+
+	private:
+		unsigned long long m_last;
+		unsigned long long m_steps;
+		unsigned long long m_total;
+		unsigned long long m_max;
+	};
+
+	// Writes the checkpoint every interval steps as well, so a long run that gets killed can be continued.
+	// The steps only wait for the fork, a child writes the checkpoint like the interactive simulator's.
+	class PeriodicCheckpointer : public SimulationObserver
+	{
+	public:
+		PeriodicCheckpointer(const std::string& path, unsigned long long interval, MetricsServer* metrics)
+		: m_path(path), m_interval(interval), m_metrics(metrics), m_checkpointer(), m_running(false), m_ok(true)
+		{
+		}
+
+		void on_step(const Simulation& simulation) override
+		{
+			collect();
+			// An interval that comes up while the last checkpoint is still being written is skipped
+			if(!m_ok || m_running || simulation.get_step_count() % m_interval != 0)
+			{
+				return;
+			}
+			m_running = m_checkpointer.start(simulation, m_path, false);
+			m_ok = m_running;
+		}
+
+		// Waits for the last checkpoint, so that the one written when done doesn't race it
+		void finish()
+		{
+			m_checkpointer.wait();
+			collect();
+		}
+
+		bool is_ok() const
+		{
+			return m_ok;
+		}
+
+	private:
+		void collect()
+		{
+			if(!m_running)
+			{
+				return;
+			}
+			const BackgroundCheckpointer::State state = m_checkpointer.poll();
+			if(state == BackgroundCheckpointer::State::Running)
+			{
+				return;
+			}
+			m_running = false;
+			m_ok = state == BackgroundCheckpointer::State::Succeeded;
+			if(m_ok && m_metrics)
+			{
+				m_metrics->add_checkpoint(m_checkpointer.get_last_stall(), m_checkpointer.get_last_duration());
+			}
+		}
+
+		const std::string m_path;
+		const unsigned long long m_interval;
+		MetricsServer* const m_metrics;
+		BackgroundCheckpointer m_checkpointer;
+		bool m_running;
+		bool m_ok;
+	};
+
+	void print_memory_report(const MemoryStats& stats, std::size_t initial_bodies, std::size_t bodies_left,
+	                         std::size_t projected_bytes, const AllocationCounter& counter)
+	{
+		std::cout << "Heap by subsystem, bytes now / peak / allocations:\n";
+		for(std::size_t i = 0; i < MEMORY_TAG_COUNT; ++i)
+		{
+			const MemoryTagStats& tag = stats.tags[i];
+			std::cout << "  " << memory_tag_name(static_cast<MemoryTag>(i)) << ": " << tag.current_bytes << " / "
+			          << tag.peak_bytes << " / " << tag.allocations << "\n";
+		}
+		// Per body at the start for the peak, the run only loses bodies from there
+		std::cout << "Peak " << stats.peak_bytes << " bytes, "
+		          << static_cast<double>(stats.peak_bytes) / std::max<std::size_t>(initial_bodies, 1)
+		          << " per body (projected " << projected_bytes << ")\n"
+		          << "Steady state " << stats.current_bytes << " bytes, "
+		          << static_cast<double>(stats.current_bytes) / std::max<std::size_t>(bodies_left, 1) << " per body\n"
+		          << "Allocations per step: " << counter.get_mean() << " on average, " << counter.get_max()
+		          << " at most" << std::endl;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if(argc < 2)
+	{
+		std::cerr << USAGE;
+		return EXIT_FAILURE;
+	}
+	const std::vector<std::string> known_options = {
+			"initial", "steps", "precision", "report-every", "threads", "reductions", "phase-times", "trace", "memory-budget", "memory-report", "checkpoint", "checkpoint-every", "trajectory", "trajectory-interval",
+			"trajectory-bits", "merge-log", "hash-stream", "hash-interval", "hash-tolerance", "hash-bodies",
+			"shared-state", "stream", "metrics-port", "metrics-interval"};
+	const CommandLine options(argc, argv, known_options);
+	if(!options.is_valid())
+	{
+		std::cerr << options.get_error() << "\n\n" << USAGE;
+		return EXIT_FAILURE;
+	}
+
+	SimulationInitialConditions cond = CommandLine::default_initial_conditions();
+	std::string initial_path;
+	unsigned long long steps = 60000;
+	std::string precision = "double";
+	unsigned long long report_every = 0;
+	unsigned long long threads = 1;
+	std::string reductions = "fast";
+	unsigned long long phase_times = 0;
+	std::string trace_path;
+	double memory_budget = 0.0;
+	unsigned long long memory_report = 0;
+	std::string checkpoint_path;
+	unsigned long long checkpoint_every = 0;
+	std::string trajectory_path;
+	unsigned long long trajectory_interval = 10;
+	unsigned long long trajectory_bits = 0;
+	std::string merge_log_path;
+	std::string hash_path;
+	unsigned long long hash_interval = 1;
+	double hash_tolerance = 0.0;
+	unsigned long long hash_bodies = 0;
+	std::string shared_state_name;
+	std::string stream_path;
+	unsigned long long metrics_port = 0;
+	unsigned long long metrics_interval = 100;
+	const bool options_valid =
+			options.get_initial_conditions(cond)
+			&& options.get("initial", initial_path)
+			&& options.get("steps", steps)
+			&& options.get("precision", precision)
+			&& options.get("report-every", report_every)
+			&& options.get("threads", threads)
+			&& options.get("reductions", reductions)
+			&& options.get("phase-times", phase_times)
+			&& options.get("trace", trace_path)
+			&& options.get("memory-budget", memory_budget)
+			&& options.get("memory-report", memory_report)
+			&& options.get("checkpoint", checkpoint_path)
+			&& options.get("checkpoint-every", checkpoint_every)
+			&& options.get("trajectory", trajectory_path)
+			&& options.get("trajectory-interval", trajectory_interval)
+			&& options.get("trajectory-bits", trajectory_bits)
+			&& options.get("merge-log", merge_log_path)
+			&& options.get("hash-stream", hash_path)
+			&& options.get("hash-interval", hash_interval)
+			&& options.get("hash-tolerance", hash_tolerance)
+			&& options.get("hash-bodies", hash_bodies)
+			&& options.get("shared-state", shared_state_name)
+			&& options.get("stream", stream_path)
+			&& options.get("metrics-port", metrics_port)
+			&& options.get("metrics-interval", metrics_interval);
+	if(!options_valid)
+	{
+		std::cerr << options.get_error() << std::endl;
+		return EXIT_FAILURE;
+	}
+	if(precision != "double" && precision != "float")
+	{
+		std::cerr << "precision must be double or float, not " << precision << std::endl;
+		return EXIT_FAILURE;
+	}
+	const bool has_output = !checkpoint_path.empty() || !trajectory_path.empty() || !merge_log_path.empty()
+	                        || !hash_path.empty() || !shared_state_name.empty() || !stream_path.empty() || metrics_port != 0
+	                        || phase_times != 0 || !trace_path.empty() || memory_report != 0;
+	if(precision == "float" && has_output)
+	{
+		std::cerr << "Output options need double precision" << std::endl;
+		return EXIT_FAILURE;
+	}
+	if(reductions != "fast" && reductions != "reproducible")
+	{
+		std::cerr << "reductions must be fast or reproducible, not " << reductions << std::endl;
+		return EXIT_FAILURE;
+	}
+	if(threads == 0 || threads > 1024 || (precision == "float" && (threads > 1 || reductions != "fast")))
+	{
+		std::cerr << "threads must be from 1 to 1024, and more than 1 or reproducible reductions need double precision"
+		          << std::endl;
+		return EXIT_FAILURE;
+	}
+	if(trajectory_bits > 52 || trajectory_interval == 0)
+	{
+		std::cerr << "trajectory-bits must be at most 52 and trajectory-interval at least 1" << std::endl;
+		return EXIT_FAILURE;
+	}
+	if(hash_interval == 0 || hash_tolerance < 0.0)
+	{
+		std::cerr << "hash-interval must be at least 1 and hash-tolerance at least 0" << std::endl;
+		return EXIT_FAILURE;
+	}
+	if(metrics_port > 65535 || metrics_interval == 0)
+	{
+		std::cerr << "metrics-port must be at most 65535 and metrics-interval at least 1" << std::endl;
+		return EXIT_FAILURE;
+	}
+	if(checkpoint_every != 0 && checkpoint_path.empty())
+	{
+		std::cerr << "checkpoint-every needs a checkpoint path" << std::endl;
+		return EXIT_FAILURE;
+	}
+	if(memory_budget < 0.0)
+	{
+		std::cerr << "memory-budget must be at least 0" << std::endl;
+		return EXIT_FAILURE;
+	}
+	if(memory_report != 0 && !can_track_allocations())
+	{
+		std::cerr << "memory-report needs a build with NBODY_TRACK_ALLOCATIONS on" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	// Initial conditions, in the same order of precedence as the interactive simulator
+	const bool restart = !initial_path.empty() && is_checkpoint_file(initial_path);
+	std::unique_ptr<InitialConditionGenerator> generator;
+	std::unique_ptr<CheckpointFile> checkpoint;
+	if(initial_path.empty())
+	{
+		generator = make_initial_condition_generator(cond);
+	}
+	else if(restart)
+	{
+		checkpoint.reset(new CheckpointFile(initial_path));
+		if(!checkpoint->is_valid())
+		{
+			std::cerr << checkpoint->get_error() << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+	else
+	{
+		InitialConditionsFile* file = new InitialConditionsFile(initial_path, cond.step_size);
+		generator.reset(file);
+		if(!file->is_valid())
+		{
+			std::cerr << file->get_error() << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Refused before anything big is allocated
+	const std::size_t initial_bodies = restart ? checkpoint->body_count() : generator->body_count();
+	const std::size_t projected_bytes =
+			precision == "float" ? initial_bodies * SimulationFloat::get_bytes_per_body()
+			                     : Simulation::estimate_bytes(initial_bodies, static_cast<unsigned int>(threads),
+			                                                  reductions == "reproducible" ? ReductionMode::Reproducible
+			                                                                               : ReductionMode::Fast);
+	if(memory_budget > 0.0 && static_cast<double>(projected_bytes) > memory_budget)
+	{
+		std::cerr << initial_bodies << " bodies are projected to need " << projected_bytes
+		          << " bytes, over the memory budget of " << memory_budget << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	const std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+	const unsigned long long chunk = report_every > 0 ? report_every : steps;
+	unsigned long long steps_done = 0;
+	int bodies_left = 0;
+	double deviation = 0.0;
+	double elapsed_time = 0.0;
+	if(precision == "float")
+	{
+		const InitialConditionGenerator& float_generator = restart ? *checkpoint : *generator;
+		const double step_size = restart ? checkpoint->get_data().step_size : cond.step_size;
+		SimulationFloat simulation(float_generator, static_cast<float>(step_size));
+		const Vector3d initial_system_velocity = simulation.get_system_velocity();
+		while(steps_done < steps)
+		{
+			const unsigned long long count = std::min(chunk, steps - steps_done);
+			simulate_steps(simulation, count);
+			steps_done += count;
+			if(report_every > 0)
+			{
+				std::cout << "Step " << steps_done << ": " << simulation.get_body_count() << " bodies, velocity deviation "
+				          << velocity_deviation(initial_system_velocity, simulation.get_system_velocity()) << ", "
+				          << seconds_since(start_time) << " s" << std::endl;
+			}
+		}
+		bodies_left = simulation.get_body_count();
+		deviation = velocity_deviation(initial_system_velocity, simulation.get_system_velocity());
+		elapsed_time = steps_done * static_cast<double>(simulation.STEPSIZE);
+	}
+	else
+	{
+		// From before the bodies are allocated, so that the peak includes them
+		if(memory_report != 0)
+		{
+			set_allocation_tracking(true);
+		}
+		Simulation simulation = restart ? Simulation(*checkpoint) : Simulation(*generator, cond.step_size);
+		simulation.set_parallelism(static_cast<unsigned int>(threads),
+		                           reductions == "reproducible" ? ReductionMode::Reproducible : ReductionMode::Fast);
+		const Vector3d initial_system_velocity = simulation.get_system_velocity();
+		PhaseStats phase_stats;
+		if(phase_times != 0)
+		{
+			simulation.set_phase_stats(&phase_stats);
+		}
+		AllocationCounter allocation_counter;
+		if(memory_report != 0)
+		{
+			simulation.add_observer(&allocation_counter);
+		}
+		if(!trace_path.empty())
+		{
+			set_trace_thread_name("Main");
+			set_tracing(true);
+		}
+
+		std::unique_ptr<TrajectoryRecorder> recorder;
+		if(!trajectory_path.empty())
+		{
+			// Nothing is waiting for the simulation, so the recorder may as well hold it up instead of dropping frames
+			recorder.reset(new TrajectoryRecorder(trajectory_path, static_cast<unsigned int>(trajectory_interval),
+			                                      TrajectoryRecorder::OverflowPolicy::Block,
+			                                      TrajectoryCompression(static_cast<unsigned int>(trajectory_bits), 32)));
+			if(!recorder->is_open())
+			{
+				std::cerr << "Could not create " << trajectory_path << std::endl;
+				return EXIT_FAILURE;
+			}
+			recorder->publish(simulation);
+			simulation.add_observer(recorder.get());
+		}
+		std::unique_ptr<MergeLog> merge_log;
+		if(!merge_log_path.empty())
+		{
+			merge_log.reset(new MergeLog(merge_log_path));
+			if(!merge_log->is_open())
+			{
+				std::cerr << "Could not create " << merge_log_path << std::endl;
+				return EXIT_FAILURE;
+			}
+			simulation.add_observer(merge_log.get());
+		}
+		std::unique_ptr<StateHasher> hasher;
+		if(!hash_path.empty())
+		{
+			hasher.reset(new StateHasher(hash_path, hash_interval,
+			                             hash_tolerance > 0.0 ? StateHashMode::Bucketed : StateHashMode::Exact,
+			                             hash_tolerance, hash_bodies != 0));
+			if(!hasher->is_ok())
+			{
+				std::cerr << "Could not create " << hash_path << std::endl;
+				return EXIT_FAILURE;
+			}
+			// The starting state too, a restart that doesn't match shows up before the first step
+			if(simulation.get_step_count() % hash_interval == 0)
+			{
+				hasher->hash(simulation);
+			}
+			simulation.add_observer(hasher.get());
+		}
+		std::unique_ptr<SharedStateExporter> shared_state;
+		if(!shared_state_name.empty())
+		{
+			shared_state.reset(new SharedStateExporter(shared_state_name, simulation, 10));
+			if(!shared_state->is_open())
+			{
+				std::cerr << shared_state->get_error() << std::endl;
+				return EXIT_FAILURE;
+			}
+			simulation.add_observer(shared_state.get());
+		}
+		std::unique_ptr<StreamServer> stream_server;
+		if(!stream_path.empty())
+		{
+			stream_server.reset(new StreamServer(stream_path, 5));
+			if(!stream_server->is_open())
+			{
+				std::cerr << stream_server->get_error() << std::endl;
+				return EXIT_FAILURE;
+			}
+			simulation.add_observer(stream_server.get());
+		}
+		std::unique_ptr<MetricsServer> metrics;
+		if(metrics_port != 0)
+		{
+			metrics.reset(new MetricsServer(static_cast<unsigned short>(metrics_port),
+			                                static_cast<unsigned int>(metrics_interval)));
+			if(!metrics->is_open())
+			{
+				std::cerr << metrics->get_error() << std::endl;
+				return EXIT_FAILURE;
+			}
+			// The drifts are relative to the starting state
+			metrics->publish(simulation);
+			simulation.add_observer(metrics.get());
+		}
+		std::unique_ptr<PeriodicCheckpointer> checkpointer;
+		if(checkpoint_every != 0)
+		{
+			checkpointer.reset(new PeriodicCheckpointer(checkpoint_path, checkpoint_every, metrics.get()));
+			simulation.add_observer(checkpointer.get());
+		}
+
+		while(steps_done < steps)
+		{
+			const unsigned long long count = std::min(chunk, steps - steps_done);
+			simulate_steps(simulation, count);
+			steps_done += count;
+			if(report_every > 0)
+			{
+				std::cout << "Step " << simulation.get_step_count() << ": " << simulation.get_body_count()
+				          << " bodies, velocity deviation "
+				          << velocity_deviation(initial_system_velocity, simulation.get_system_velocity()) << ", "
+				          << seconds_since(start_time) << " s" << std::endl;
+				if(phase_times != 0 && steps_done < steps)
+				{
+					std::cout << phase_stats.describe() << std::endl;
+				}
+			}
+		}
+		bodies_left = simulation.get_body_count();
+		deviation = velocity_deviation(initial_system_velocity, simulation.get_system_velocity());
+		elapsed_time = simulation.get_elapsed_time();
+		if(phase_times != 0)
+		{
+			simulation.set_phase_stats(nullptr);
+			std::cout << phase_stats.describe() << std::endl;
+		}
+		if(memory_report != 0)
+		{
+			simulation.remove_observer(&allocation_counter);
+			print_memory_report(get_memory_stats(), initial_bodies, simulation.get_body_count(), projected_bytes,
+			                    allocation_counter);
+		}
+		if(!trace_path.empty())
+		{
+			set_tracing(false);
+			if(!write_chrome_trace(trace_path))
+			{
+				std::cerr << "Could not write trace " << trace_path << std::endl;
+				return EXIT_FAILURE;
+			}
+		}
+
+		if(checkpointer)
+		{
+			simulation.remove_observer(checkpointer.get());
+			checkpointer->finish();
+			if(!checkpointer->is_ok())
+			{
+				std::cerr << "Could not write checkpoint " << checkpoint_path << std::endl;
+				return EXIT_FAILURE;
+			}
+		}
+		if(metrics)
+		{
+			simulation.remove_observer(metrics.get());
+		}
+		if(stream_server)
+		{
+			simulation.remove_observer(stream_server.get());
+		}
+		if(shared_state)
+		{
+			simulation.remove_observer(shared_state.get());
+		}
+		if(hasher)
+		{
+			simulation.remove_observer(hasher.get());
+			if(!hasher->is_ok())
+			{
+				std::cerr << "Failed to write state hashes to " << hash_path << std::endl;
+				return EXIT_FAILURE;
+			}
+			hasher.reset();
+		}
+		if(merge_log)
+		{
+			simulation.remove_observer(merge_log.get());
+			if(!merge_log->is_ok())
+			{
+				std::cerr << "Failed to log merges to " << merge_log_path << std::endl;
+				return EXIT_FAILURE;
+			}
+			merge_log.reset();
+		}
+		if(recorder)
+		{
+			simulation.remove_observer(recorder.get());
+			if(!recorder->is_ok())
+			{
+				std::cerr << "Failed to record trajectory to " << trajectory_path << std::endl;
+				return EXIT_FAILURE;
+			}
+			recorder.reset();
+		}
+		if(!checkpoint_path.empty())
+		{
+			const std::chrono::steady_clock::time_point checkpoint_start = std::chrono::steady_clock::now();
+			if(!simulation.write_checkpoint(checkpoint_path))
+			{
+				std::cerr << "Could not write checkpoint " << checkpoint_path << std::endl;
+				return EXIT_FAILURE;
+			}
+			if(metrics)
+			{
+				// Written in place, so it held up the run for as long as it took
+				const std::chrono::microseconds duration = std::chrono::duration_cast<std::chrono::microseconds>(
+						std::chrono::steady_clock::now() - checkpoint_start);
+				metrics->add_checkpoint(duration, duration);
+			}
+		}
+	}
+
+	std::cout << bodies_left << " bodies remaining after " << steps_done << " steps (" << elapsed_time
+	          << " s simulated)\nDeviation in total system velocity: " << deviation
+	          << "\nRun time: " << seconds_since(start_time) << " s" << std::endl;
+	return EXIT_SUCCESS;
+}
@@ -1,10 +1,22 @@
 #include "Graphics.h"
 #include "Simulation.h"
 #include "SimulationFloat.h"
+#include "InitialConditionsFile.h"
+#include "Checkpoint.h"
+#include "BackgroundCheckpointer.h"
+#include "TrajectoryRecorder.h"
+#include "TrajectoryPlayer.h"
+#include "MergeLog.h"
+#include "SharedState.h"
+#include "StreamServer.h"
+#include "PhaseTimer.h"
+#include "Trace.h"
 
 #include <SFML/Graphics.hpp>
 #include <string>
 #include <chrono>
+#include <iostream>
+#include <memory>
 
 namespace
 {
@@ -77,11 +89,23 @@ namespace
 		}
 	}
 
-	std::string get_settings_string(const SimulationInitialConditions& cond, int steps_per_frame)
+	std::string get_settings_string(const SimulationInitialConditions& cond, int steps_per_frame,
+	                                const std::string& initial_conditions_path)
 	{
 		std::string string = "Use number keys to change settings \n"
 		                     "Press space to start simulation. Press D or F to run performance test using doubles or floats respectively.\n"
+		                     "Press G to change the initial layout.\n"
 				             "Variance is specified as a part of the regular value, e.g. 0.2 = 20% -> +-(0, 10%) \n\n";
+		string += "Layout = ";
+		if(initial_conditions_path.empty())
+		{
+			string += layout_name(cond.layout);
+		}
+		else
+		{
+			string += initial_conditions_path + " (only step size and steps per frame apply)";
+		}
+		string += "\n";
 		string += "1: Step size = ";
 		string += std::to_string(cond.step_size);
 		string += " seconds \n";
@@ -187,17 +211,156 @@ namespace
 	                                  "Q/E zoom out/in \n"
 			                          "Arrow keys move \n"
 			                          "Page up/down change steps \n"
+			                          "C save checkpoint \n"
+			                          "T start/stop recording trajectory \n"
+			                          "Shift+T record compressed trajectory \n"
+			                          "M start/stop logging merges \n"
+			                          "H start/stop sharing state in shared memory \n"
+			                          "V start/stop streaming to local viewers \n"
+			                          "P show/hide phase timings \n"
+			                          "K start tracing/save trace \n"
 	                                  "Esc quit";
+
+	const std::string REPLAY_CONTROLS_TEXT = "W/S rotate up/down \n"
+	                                         "A/D rotate left/right \n"
+	                                         "Q/E zoom out/in \n"
+	                                         "Arrow keys move \n"
+	                                         "Space pause/play \n"
+	                                         "R reverse \n"
+	                                         "+/- change playback speed \n"
+	                                         "Comma/period step one frame \n"
+	                                         "Z/X jump back/forward \n"
+	                                         "Home/End go to start/end \n"
+	                                         "Esc quit";
+
+	// Shows a recorded trajectory instead of simulating
+	int run_replay(Graphics& graphics, const std::string& path)
+	{
+		TrajectoryPlayer player(path);
+		if(!player.is_valid())
+		{
+			std::cerr << player.get_error() << std::endl;
+			return EXIT_FAILURE;
+		}
+		graphics.set_text_upper(REPLAY_CONTROLS_TEXT);
+		bool read_input = true;
+		const long long jump = std::max<long long>(1, player.frame_count() / 20);
+		sf::Clock frame_clock;
+
+		while(graphics.window.isOpen())
+		{
+			// Process events
+			sf::Event event;
+			while(graphics.window.pollEvent(event))
+			{
+				// Exit if the close botton on the window is pressed
+				if(event.type == sf::Event::Closed)
+				{
+					graphics.window.close();
+				}
+				// Adjust the viewport when the window is resized
+				if(event.type == sf::Event::Resized)
+				{
+					graphics.resize(event.size.width, event.size.height);
+				}
+				// Only take input if the window has focus
+				if(event.type == sf::Event::LostFocus)
+				{
+					read_input = false;
+				}
+				if(event.type == sf::Event::GainedFocus)
+				{
+					read_input = true;
+				}
+				if(event.type == sf::Event::KeyPressed)
+				{
+					switch(event.key.code)
+					{
+					case sf::Keyboard::Escape:
+						graphics.window.close();
+						break;
+					case sf::Keyboard::Space:
+						player.set_paused(!player.is_paused());
+						break;
+					case sf::Keyboard::R:
+						player.set_speed(-player.get_speed());
+						break;
+					case sf::Keyboard::Add:
+					case sf::Keyboard::Equal:
+						player.set_speed(player.get_speed() * 2.0);
+						break;
+					case sf::Keyboard::Subtract:
+					case sf::Keyboard::Dash:
+						player.set_speed(player.get_speed() / 2.0);
+						break;
+					case sf::Keyboard::Comma:
+						player.set_paused(true);
+						player.step(-1);
+						break;
+					case sf::Keyboard::Period:
+						player.set_paused(true);
+						player.step(1);
+						break;
+					case sf::Keyboard::Z:
+						player.step(-jump);
+						break;
+					case sf::Keyboard::X:
+						player.step(jump);
+						break;
+					case sf::Keyboard::Home:
+						player.seek(0);
+						break;
+					case sf::Keyboard::End:
+						player.seek(player.frame_count() - 1);
+						break;
+					default:
+						break;
+					}
+				}
+			}
+
+			if(read_input)
+			{
+				control_camera(graphics.camera);
+			}
+
+			player.advance(frame_clock.restart().asSeconds());
+			graphics.start_frame();
+			player.draw(graphics);
+
+			const Snapshot& snapshot = player.get_snapshot();
+			graphics.set_text_lower("Frame " + std::to_string(player.get_frame() + 1) + " of "
+			                        + std::to_string(player.frame_count()) + ", step " + std::to_string(snapshot.step)
+			                        + (player.is_paused() ? ", paused" : "")
+			                        + "\nPlayback speed: " + to_scientific_string(player.get_speed()) + " frames per second"
+			                        + "\n" + std::to_string(snapshot.body_count()) + " bodies, "
+			                        + get_time_string(static_cast<unsigned long long>(snapshot.time)));
+			graphics.draw_text_lower();
+			graphics.draw_text_upper();
+			graphics.end_frame();
+		}
+		return EXIT_SUCCESS;
+	}
 }
 
-int main()
+int main(int argc, char* argv[])
 {
 	// I apologise for the mess that is this main function. I was in a hurry
 
+	// Optionally start from an initial condition file instead of a generated layout, continue from a checkpoint
+	// or replay a recorded trajectory
+	const std::string initial_conditions_path = argc > 1 ? argv[1] : "";
+
 	Graphics graphics;
 
+	if(!initial_conditions_path.empty() && is_trajectory_file(initial_conditions_path))
+	{
+		return run_replay(graphics, initial_conditions_path);
+	}
+
 	SimulationInitialConditions cond;
 	// These are the default values
+	cond.layout = InitialLayout::Grid;
 	cond.step_size = 60*30;
 	int steps_per_frame = 3;
 	cond.random_seed = 42;
@@ -260,6 +423,12 @@ int main()
 						performance_test = PerformanceTest::Float;
 						setup_complete = true;
 					}
+
+					// G cycles through the initial layouts
+					if(event.key.code == sf::Keyboard::G)
+					{
+						cond.layout = next_layout(cond.layout);
+					}
 				}
 
 				if(event.type == sf::Event::TextEntered)
@@ -301,7 +470,7 @@ int main()
 
 			// Draw setup process
 			graphics.start_frame();
-			graphics.set_text_upper(get_settings_string(cond, steps_per_frame));
+			graphics.set_text_upper(get_settings_string(cond, steps_per_frame, initial_conditions_path));
 			graphics.draw_text_upper();
 			graphics.set_text_lower(user_input);
 			graphics.draw_text_lower();
@@ -310,9 +479,55 @@ int main()
 	}
 
 	// Initialize system and values
-	Simulation simulation(cond);
+	const bool restart = !initial_conditions_path.empty() && is_checkpoint_file(initial_conditions_path);
+	std::unique_ptr<InitialConditionGenerator> generator;
+	std::unique_ptr<CheckpointFile> checkpoint;
+	if(initial_conditions_path.empty())
+	{
+		generator = make_initial_condition_generator(cond);
+	}
+	else if(restart)
+	{
+		checkpoint.reset(new CheckpointFile(initial_conditions_path));
+		if(!checkpoint->is_valid())
+		{
+			std::cerr << checkpoint->get_error() << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+	else
+	{
+		InitialConditionsFile* file = new InitialConditionsFile(initial_conditions_path, cond.step_size);
+		generator.reset(file);
+		if(!file->is_valid())
+		{
+			std::cerr << file->get_error() << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+	Simulation simulation = restart ? Simulation(*checkpoint) : Simulation(*generator, cond.step_size);
 	const Vector3d initial_system_velocity = simulation.get_system_velocity();
-	unsigned long long int elapsed_sim_time = 0;
+	unsigned long long int elapsed_sim_time = simulation.get_elapsed_time();
+	const std::string checkpoint_path = "checkpoint.nbck";
+	BackgroundCheckpointer checkpointer;
+	const std::string trajectory_path = "trajectory.nbtr";
+	const unsigned int trajectory_interval = 10;
+	// Positions to a millionth of the size of the system, with a keyframe every 32 frames
+	const TrajectoryCompression trajectory_compression(20, 32);
+	std::unique_ptr<TrajectoryRecorder> recorder;
+	const std::string merge_log_path = "merges.nbmg";
+	std::unique_ptr<MergeLog> merge_log;
+	const std::string shared_state_name = "/nbody";
+	const unsigned int shared_state_interval = 10;
+	std::unique_ptr<SharedStateExporter> shared_state;
+	const std::string stream_path = "nbody.sock";
+	const unsigned int stream_interval = 5;
+	std::unique_ptr<StreamServer> stream_server;
+	PhaseStats phase_stats;
+	bool show_phase_stats = false;
+	const std::string trace_path = "trace.json";
+	std::string trace_status = "";
+	set_trace_thread_name("Main");
 	graphics.set_text_upper(CONTROLS_TEXT);
 	bool read_input = true;
 
@@ -321,20 +536,9 @@ int main()
 	{
 		std::string test_type_string = performance_test == PerformanceTest::Double ? "doubles" : "floats";
 
-		// Initialize float system and values
-		SimulationFloatInitialConditions cond_float;
-		// Copy values over from the double version
-		cond_float.step_size = cond.step_size;
-		cond_float.random_seed = cond.random_seed;
-		cond_float.number_of_bodies = cond.number_of_bodies;
-		cond_float.system_mass = cond.system_mass;
-		cond_float.mass_variance = cond.mass_variance;
-		cond_float.distribution = cond.distribution;
-		cond_float.distribution_variance = cond.distribution_variance;
-		cond_float.speed = cond.speed;
-		cond_float.speed_variance = cond.speed_variance;
-
-		SimulationFloat simulation_float(cond_float);
+		// Initialize float system and values from the same bodies as the double version
+		const InitialConditionGenerator& float_generator = restart ? *checkpoint : *generator;
+		SimulationFloat simulation_float(float_generator, simulation.STEPSIZE);
 		Vector3d initial_float_system_velocity = simulation_float.get_system_velocity();
 
 		// Print a message to show while the application locks up (as it's single threaded)
@@ -457,6 +661,91 @@ int main()
 				{
 					steps_per_frame = std::max(0, steps_per_frame - 1);
 				}
+				else if(event.key.code == sf::Keyboard::C)
+				{
+					// Ignored while the previous checkpoint is still being written
+					checkpointer.start(simulation, checkpoint_path, false);
+				}
+				else if(event.key.code == sf::Keyboard::T)
+				{
+					if(recorder)
+					{
+						simulation.remove_observer(recorder.get());
+						recorder.reset();
+					}
+					else
+					{
+						recorder.reset(new TrajectoryRecorder(trajectory_path, trajectory_interval,
+						                                      TrajectoryRecorder::OverflowPolicy::Decimate,
+						                                      event.key.shift ? trajectory_compression
+						                                                      : TrajectoryCompression()));
+						simulation.add_observer(recorder.get());
+						// Record where we start from as well
+						recorder->publish(simulation);
+					}
+				}
+				else if(event.key.code == sf::Keyboard::M)
+				{
+					if(merge_log)
+					{
+						simulation.remove_observer(merge_log.get());
+						merge_log.reset();
+					}
+					else
+					{
+						merge_log.reset(new MergeLog(merge_log_path));
+						simulation.add_observer(merge_log.get());
+					}
+				}
+				else if(event.key.code == sf::Keyboard::H)
+				{
+					if(shared_state)
+					{
+						simulation.remove_observer(shared_state.get());
+						shared_state.reset();
+					}
+					else
+					{
+						shared_state.reset(new SharedStateExporter(shared_state_name, simulation, shared_state_interval));
+						simulation.add_observer(shared_state.get());
+					}
+				}
+				else if(event.key.code == sf::Keyboard::V)
+				{
+					if(stream_server)
+					{
+						simulation.remove_observer(stream_server.get());
+						stream_server.reset();
+					}
+					else
+					{
+						stream_server.reset(new StreamServer(stream_path, stream_interval));
+						simulation.add_observer(stream_server.get());
+					}
+				}
+				else if(event.key.code == sf::Keyboard::P)
+				{
+					// Only timed while shown, and from scratch every time
+					show_phase_stats = !show_phase_stats;
+					phase_stats.clear();
+					simulation.set_phase_stats(show_phase_stats ? &phase_stats : nullptr);
+					graphics.set_text_upper(CONTROLS_TEXT);
+				}
+				else if(event.key.code == sf::Keyboard::K)
+				{
+					if(is_tracing())
+					{
+						set_tracing(false);
+						trace_status = write_chrome_trace(trace_path) ? "\nSaved trace to " + trace_path
+						               : "\nFailed to save trace to " + trace_path;
+					}
+					else
+					{
+						clear_trace();
+						set_tracing(true);
+						trace_status = "\nTracing, press K to save to " + trace_path;
+					}
+				}
 			}
 		}
 
@@ -465,21 +754,81 @@ int main()
 			control_camera(graphics.camera);
 		}
 
+		TraceScope frame_trace("render", "Frame");
+		PhaseStats* const frame_stats = show_phase_stats ? &phase_stats : nullptr;
 		simulation.simulate(steps_per_frame);
 		graphics.start_frame();
-		simulation.draw(graphics);
+		{
+			ScopedPhaseTimer timer(frame_stats, Phase::Draw);
+			simulation.draw(graphics);
+		}
 
 		Vector3d system_velocity_deviation = simulation.get_system_velocity() - initial_system_velocity;
 		double deviation = std::abs(system_velocity_deviation.get_x()) + std::abs(system_velocity_deviation.get_y())
 						   + std::abs(system_velocity_deviation.get_z());
 		elapsed_sim_time += steps_per_frame * simulation.STEPSIZE;
+		checkpointer.poll();
+		const std::string checkpoint_status = checkpointer.describe();
+		std::string trajectory_status = "";
+		if(recorder)
+		{
+			const TrajectoryCompressionStats stats = recorder->get_compression_stats();
+			trajectory_status = !recorder->is_ok() ? "\nFailed to record trajectory to " + trajectory_path
+			                    : "\nRecording " + trajectory_path + ": " + std::to_string(recorder->get_frames_written())
+			                      + " frames, " + std::to_string(recorder->get_frames_dropped()) + " dropped";
+			if(recorder->is_ok() && stats.encoded_bytes < stats.raw_bytes)
+			{
+				trajectory_status += "\nCompressed " + to_scientific_string(stats.get_ratio()) + "x, max error "
+				                     + to_scientific_string(stats.max_error) + " m";
+			}
+		}
+		std::string merge_log_status = "";
+		if(merge_log)
+		{
+			merge_log_status = !merge_log->is_ok() ? "\nFailed to log merges to " + merge_log_path
+			                   : "\nLogging merges to " + merge_log_path + ": "
+			                     + std::to_string(merge_log->get_events_logged()) + " merges";
+		}
+		std::string shared_state_status = "";
+		if(shared_state)
+		{
+			shared_state_status = !shared_state->is_open() ? "\n" + shared_state->get_error()
+			                      : "\nSharing state in " + shared_state_name + ": "
+			                        + std::to_string(shared_state->get_updates()) + " updates";
+		}
+		std::string stream_status = "";
+		if(stream_server)
+		{
+			stream_status = !stream_server->is_open() ? "\n" + stream_server->get_error()
+			                : "\nStreaming on " + stream_path + ": " + std::to_string(stream_server->get_client_count())
+			                  + " viewers, " + std::to_string(stream_server->get_frames_sent()) + " frames sent, "
+			                  + std::to_string(stream_server->get_frames_skipped()) + " skipped";
+		}
 		graphics.set_text_lower("Steps per frame: " + std::to_string(steps_per_frame)
 								+ "\nVelocity deviation: " + to_scientific_string(deviation)
-								+ "\n" + std::to_string(simulation.get_body_count()) + " bodies, " + get_time_string(elapsed_sim_time));
+								+ "\n" + std::to_string(simulation.get_body_count()) + " bodies, " + get_time_string(elapsed_sim_time)
+								+ (checkpoint_status.empty() ? "" : "\n" + checkpoint_status)
+								+ trajectory_status + merge_log_status + shared_state_status + stream_status + trace_status);
+		if(show_phase_stats)
+		{
+			graphics.set_text_upper(CONTROLS_TEXT + "\n\n" + phase_stats.describe());
+		}
 		graphics.draw_text_lower();
 		graphics.draw_text_upper();
-		graphics.end_frame();
+		{
+			ScopedPhaseTimer timer(frame_stats, Phase::EndFrame);
+			graphics.end_frame();
+		}
 	}
 
+	// Tracing that is still going when the window closes gets saved too
+	if(is_tracing())
+	{
+		set_tracing(false);
+		if(!write_chrome_trace(trace_path))
+		{
+			std::cerr << "Could not write trace " << trace_path << std::endl;
+		}
+	}
 	return EXIT_SUCCESS;
 }
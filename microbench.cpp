@@ -0,0 +1,389 @@
+// Times the vector primitives and the phases of a simulation step in isolation, on fixed inputs, with 95%
+// confidence intervals over the samples. Every sample of a phase starts from a copy of the same state.
+//
+// nbody_microbench [--config file] [--option value ...]
+//
+// Cycles are time stamp counter ticks, which run at a fixed rate that isn't always the core clock.
+
+#include "CommandLine.h"
+#include "Simulation.h"
+#include "SimulationFloat.h"
+#include "Vector3d.h"
+#include "Vector3f.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Calls the private phases of a step, it is a friend of the simulations
+class KernelBenchmark
+{
+public:
+	template<typename SimulationType>
+	static void calculate_gravity(SimulationType& simulation)
+	{
+		simulation.calculate_gravity();
+	}
+
+	template<typename SimulationType>
+	static void integrate(SimulationType& simulation)
+	{
+		simulation.integrate();
+	}
+
+	template<typename SimulationType>
+	static void handle_collisions(SimulationType& simulation)
+	{
+		simulation.handle_collisions();
+	}
+
+	template<typename SimulationType>
+	static void remove_merged_bodies(SimulationType& simulation)
+	{
+		simulation.remove_merged_bodies();
+	}
+};
+
+namespace
+{
+	const char* const USAGE =
+			"Usage: nbody_microbench [--config file] [--option value ...]\n"
+			"\n"
+			"  --samples n                    samples per benchmark (30)\n"
+			"  --vectors n                    vectors per primitive sample (4096)\n"
+			"  --passes n                     passes over the vectors per primitive sample (64)\n"
+			"  --layout --bodies --seed ...   initial conditions for the phases, see nbody_headless\n"
+			"                                 (1024 bodies, otherwise the nbody_headless defaults)\n";
+
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+	const bool HAS_CYCLE_COUNTER = true;
+
+	unsigned long long read_cycle_counter()
+	{
+		return __rdtsc();
+	}
+#else
+	const bool HAS_CYCLE_COUNTER = false;
+
+	unsigned long long read_cycle_counter()
+	{
+		return 0;
+	}
+#endif
+
+	// Keeps results alive so that the timed work isn't optimized away
+	volatile double sink;
+	// Close to 1 so that repeated scaling stays in range, and unknown to the compiler
+	volatile double scale = 1.000001;
+
+	// Mean of the samples and the half width of its 95% confidence interval
+	struct Estimate
+	{
+		double mean;
+		double interval;
+	};
+
+	Estimate estimate(const std::vector<double>& samples)
+	{
+		// Two sided 95% quantiles of Student's t distribution for 1 to 30 degrees of freedom
+		static const double T_95[] = {
+				12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131,
+				2.120, 2.110, 2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+		Estimate result = {0.0, 0.0};
+		for(double sample : samples)
+		{
+			result.mean += sample;
+		}
+		result.mean /= samples.size();
+		if(samples.size() < 2)
+		{
+			return result;
+		}
+		double squared_sum = 0.0;
+		for(double sample : samples)
+		{
+			squared_sum += (sample - result.mean) * (sample - result.mean);
+		}
+		const std::size_t freedom = samples.size() - 1;
+		const double t = freedom <= 30 ? T_95[freedom - 1] : 1.96;
+		result.interval = t * std::sqrt(squared_sum / freedom / samples.size());
+		return result;
+	}
+
+	// Times samples of work on count items each and prints the time and cycles per item.
+	// prepare runs untimed before every sample.
+	template<typename Prepare, typename Work>
+	void measure(const std::string& name, const std::string& unit, double count, unsigned long long samples,
+	             Prepare prepare, Work work)
+	{
+		std::vector<double> nanoseconds;
+		std::vector<double> cycles;
+		// One more sample than asked for, the first one warms up caches and branch predictors
+		for(unsigned long long sample = 0; sample <= samples; ++sample)
+		{
+			prepare();
+			const unsigned long long start_cycles = read_cycle_counter();
+			const std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+			work();
+			const double time = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start_time)
+					.count();
+			const unsigned long long end_cycles = read_cycle_counter();
+			if(sample > 0)
+			{
+				nanoseconds.push_back(time / count);
+				cycles.push_back((end_cycles - start_cycles) / count);
+			}
+		}
+		const Estimate time = estimate(nanoseconds);
+		std::cout << std::left << std::setw(40) << name << std::right << std::fixed << std::setprecision(3)
+		          << std::setw(12) << time.mean << " +- " << std::setw(9) << time.interval << " ns/" << unit;
+		if(HAS_CYCLE_COUNTER)
+		{
+			const Estimate ticks = estimate(cycles);
+			std::cout << std::setw(12) << ticks.mean << " +- " << std::setw(9) << ticks.interval << " cycles/" << unit;
+		}
+		std::cout << std::endl;
+	}
+
+	template<typename Work>
+	void measure(const std::string& name, const std::string& unit, double count, unsigned long long samples, Work work)
+	{
+		measure(name, unit, count, samples, []{}, work);
+	}
+
+	// The same layout as the vectors, without the user written copy constructor and assignment
+	template<typename Scalar>
+	struct PlainVector
+	{
+		Scalar x, y, z;
+	};
+
+	// Vector3d or Vector3f next to the same operations written out on plain structs
+	template<typename Vector, typename Scalar>
+	void measure_primitives(const std::string& type, std::size_t count, unsigned long long passes,
+	                        unsigned long long samples)
+	{
+		std::vector<Vector> source;
+		std::vector<PlainVector<Scalar>> plain_source;
+		for(std::size_t i = 0; i < count; ++i)
+		{
+			// Fixed inputs, never zero so normalize() holds
+			const Scalar x = static_cast<Scalar>(1.0 + i % 7);
+			const Scalar y = static_cast<Scalar>(2.0 - i % 5);
+			const Scalar z = static_cast<Scalar>(0.5 + i % 3);
+			source.push_back(Vector(x, y, z));
+			plain_source.push_back(PlainVector<Scalar>{x, y, z});
+		}
+		std::vector<Vector> destination(count, Vector(0, 0, 0));
+		std::vector<PlainVector<Scalar>> plain_destination(count);
+		const double items = static_cast<double>(count) * passes;
+
+		// Copies into raw memory, so they go through the copy constructor
+		std::unique_ptr<unsigned char[]> raw(new unsigned char[count * sizeof(Vector)]);
+		measure(type + " copy constructor", "vector", items, samples, [&]
+		{
+			for(unsigned long long pass = 0; pass < passes; ++pass)
+			{
+				std::uninitialized_copy(source.begin(), source.end(), reinterpret_cast<Vector*>(raw.get()));
+			}
+			sink = reinterpret_cast<Vector*>(raw.get())[count - 1].get_x();
+		});
+		std::unique_ptr<unsigned char[]> plain_raw(new unsigned char[count * sizeof(PlainVector<Scalar>)]);
+		measure("  plain struct", "vector", items, samples, [&]
+		{
+			for(unsigned long long pass = 0; pass < passes; ++pass)
+			{
+				std::uninitialized_copy(plain_source.begin(), plain_source.end(),
+				                        reinterpret_cast<PlainVector<Scalar>*>(plain_raw.get()));
+			}
+			sink = reinterpret_cast<PlainVector<Scalar>*>(plain_raw.get())[count - 1].x;
+		});
+
+		measure(type + " assignment", "vector", items, samples, [&]
+		{
+			for(unsigned long long pass = 0; pass < passes; ++pass)
+			{
+				std::copy(source.begin(), source.end(), destination.begin());
+			}
+			sink = destination[count - 1].get_x();
+		});
+		measure("  plain struct", "vector", items, samples, [&]
+		{
+			for(unsigned long long pass = 0; pass < passes; ++pass)
+			{
+				std::copy(plain_source.begin(), plain_source.end(), plain_destination.begin());
+			}
+			sink = plain_destination[count - 1].x;
+		});
+
+#ifdef NDEBUG
+		const std::string normalize_name = type + "::normalize() (assert off)";
+#else
+		const std::string normalize_name = type + "::normalize() (assert on)";
+#endif
+		measure(normalize_name, "vector", items, samples, [&]
+		{
+			for(unsigned long long pass = 0; pass < passes; ++pass)
+			{
+				for(std::size_t i = 0; i < count; ++i)
+				{
+					destination[i] = source[i];
+					destination[i].normalize();
+				}
+			}
+			sink = destination[count - 1].get_x();
+		});
+		measure("  plain struct", "vector", items, samples, [&]
+		{
+			for(unsigned long long pass = 0; pass < passes; ++pass)
+			{
+				for(std::size_t i = 0; i < count; ++i)
+				{
+					const PlainVector<Scalar>& v = plain_source[i];
+					const Scalar inv_length = static_cast<Scalar>(1.0) / std::sqrt(v.x*v.x + v.y*v.y + v.z*v.z);
+					plain_destination[i] = PlainVector<Scalar>{v.x * inv_length, v.y * inv_length, v.z * inv_length};
+				}
+			}
+			sink = plain_destination[count - 1].x;
+		});
+
+		// In place, so that every pass depends on the one before
+		measure(type + " scalar * vector", "vector", items, samples,
+		        [&]{std::copy(source.begin(), source.end(), destination.begin());}, [&]
+		{
+			const Scalar scalar = static_cast<Scalar>(scale);
+			for(unsigned long long pass = 0; pass < passes; ++pass)
+			{
+				for(std::size_t i = 0; i < count; ++i)
+				{
+					destination[i] = scalar * destination[i];
+				}
+			}
+			sink = destination[count - 1].get_x();
+		});
+		measure("  plain struct", "vector", items, samples,
+		        [&]{std::copy(plain_source.begin(), plain_source.end(), plain_destination.begin());}, [&]
+		{
+			const Scalar scalar = static_cast<Scalar>(scale);
+			for(unsigned long long pass = 0; pass < passes; ++pass)
+			{
+				for(std::size_t i = 0; i < count; ++i)
+				{
+					PlainVector<Scalar>& v = plain_destination[i];
+					v.x *= scalar;
+					v.y *= scalar;
+					v.z *= scalar;
+				}
+			}
+			sink = plain_destination[count - 1].x;
+		});
+
+		measure(type + " vector * vector (dot)", "vector", items, samples, [&]
+		{
+			Scalar sum = 0;
+			for(unsigned long long pass = 0; pass < passes; ++pass)
+			{
+				for(std::size_t i = 1; i < count; ++i)
+				{
+					sum += source[i] * source[i - 1];
+				}
+			}
+			sink = sum;
+		});
+		measure("  plain struct", "vector", items, samples, [&]
+		{
+			Scalar sum = 0;
+			for(unsigned long long pass = 0; pass < passes; ++pass)
+			{
+				for(std::size_t i = 1; i < count; ++i)
+				{
+					const PlainVector<Scalar>& a = plain_source[i];
+					const PlainVector<Scalar>& b = plain_source[i - 1];
+					sum += a.x * b.x + a.y * b.y + a.z * b.z;
+				}
+			}
+			sink = sum;
+		});
+	}
+
+	// Every sample of a phase starts from a copy of the state right before that phase in the first step
+	template<typename SimulationType>
+	void measure_phases(const std::string& type, const SimulationType& initial, unsigned long long samples)
+	{
+		const double bodies = initial.get_body_count();
+		const double pairs = 0.5 * bodies * (bodies - 1.0);
+		std::unique_ptr<SimulationType> simulation;
+		SimulationType before_integrate(initial);
+		KernelBenchmark::calculate_gravity(before_integrate);
+		SimulationType before_collisions(before_integrate);
+		KernelBenchmark::integrate(before_collisions);
+		SimulationType before_remove(before_collisions);
+		KernelBenchmark::handle_collisions(before_remove);
+		SimulationType after_remove(before_remove);
+		KernelBenchmark::remove_merged_bodies(after_remove);
+		std::cout << type << ": " << initial.get_body_count() << " bodies, "
+		          << before_remove.get_body_count() - after_remove.get_body_count() << " of them merging in the first step"
+		          << std::endl;
+
+		measure(type + "::calculate_gravity()", "pair", pairs, samples,
+		        [&]{simulation.reset(new SimulationType(initial));},
+		        [&]{KernelBenchmark::calculate_gravity(*simulation);});
+		measure(type + "::integrate()", "body", bodies, samples,
+		        [&]{simulation.reset(new SimulationType(before_integrate));},
+		        [&]{KernelBenchmark::integrate(*simulation);});
+		measure(type + "::handle_collisions()", "pair", pairs, samples,
+		        [&]{simulation.reset(new SimulationType(before_collisions));},
+		        [&]{KernelBenchmark::handle_collisions(*simulation);});
+		measure(type + "::remove_merged_bodies()", "body", bodies, samples,
+		        [&]{simulation.reset(new SimulationType(before_remove));},
+		        [&]{KernelBenchmark::remove_merged_bodies(*simulation);});
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	const std::vector<std::string> known_options = {"samples", "vectors", "passes"};
+	const CommandLine options(argc, argv, known_options);
+	if(!options.is_valid())
+	{
+		std::cerr << options.get_error() << "\n\n" << USAGE;
+		return EXIT_FAILURE;
+	}
+	SimulationInitialConditions cond = CommandLine::default_initial_conditions();
+	cond.number_of_bodies = 1024;
+	unsigned long long samples = 30;
+	unsigned long long vectors = 4096;
+	unsigned long long passes = 64;
+	if(!options.get_initial_conditions(cond) || !options.get("samples", samples) || !options.get("vectors", vectors)
+	   || !options.get("passes", passes))
+	{
+		std::cerr << options.get_error() << "\n\n" << USAGE;
+		return EXIT_FAILURE;
+	}
+	if(samples == 0 || vectors < 2 || passes == 0)
+	{
+		std::cerr << "samples and passes must be at least 1 and vectors at least 2" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::cout << samples << " samples per benchmark, 95% confidence intervals" << std::endl;
+	measure_primitives<Vector3d, double>("Vector3d", vectors, passes, samples);
+	measure_primitives<Vector3f, float>("Vector3f", vectors, passes, samples);
+
+	const std::unique_ptr<InitialConditionGenerator> generator = make_initial_condition_generator(cond);
+	measure_phases("Simulation", Simulation(*generator, cond.step_size), samples);
+	measure_phases("SimulationFloat", SimulationFloat(*generator, static_cast<float>(cond.step_size)), samples);
+	return EXIT_SUCCESS;
+}
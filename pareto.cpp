@@ -0,0 +1,313 @@
+// Sweeps the solver settings over the same initial conditions and simulated time, measures the run time and
+// accuracy of each, and prints the Pareto front of time against error.
+//
+// nbody_pareto [--config file] [--option value ...]
+//
+// Energy drift includes what merges lose, so layouts without collisions show the integration error best.
+
+#include "CommandLine.h"
+#include "Conservation.h"
+#include "PhysicalConstants.h"
+#include "Simulation.h"
+#include "SimulationFloat.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+	const char* const USAGE =
+			"Usage: nbody_pareto [--config file] [--option value ...]\n"
+			"\n"
+			"Settings, every combination of:\n"
+			"  --precisions list              double and/or float (double,float)\n"
+			"  --step-sizes list              seconds per step (450,900,1800,3600)\n"
+			"\n"
+			"  --duration s                   simulated time of every run (3600000)\n"
+			"  --force-samples n              bodies the forces are checked on (64)\n"
+			"  --objective name               error the front is taken over: energy, momentum or force (energy)\n"
+			"  --csv path                     every run as CSV\n"
+			"\n"
+			"Initial conditions, see nbody_headless (512 bodies, otherwise the nbody_headless defaults):\n"
+			"  --layout --bodies --seed --mass --mass-variance --distribution\n"
+			"  --distribution-variance --speed --speed-variance\n";
+
+	using PhysicalConstants::G;
+
+	struct Settings
+	{
+		std::string precision;
+		int step_size;
+	};
+
+	struct Result
+	{
+		Settings settings;
+		unsigned long long steps;
+		int final_bodies;
+		// In seconds
+		double wall_time;
+		// Change of the total energy relative to the initial total energy
+		double energy_drift;
+		// Change of the total momentum relative to the summed momentum magnitudes at the start
+		double momentum_drift;
+		// Root mean square and largest relative error of the force on the sampled bodies, at the end
+		double force_error;
+		double max_force_error;
+		bool pareto;
+	};
+
+	// The state of a simulation in double precision
+	struct State
+	{
+		std::vector<double> positions;
+		std::vector<double> velocities;
+		std::vector<double> masses;
+	};
+
+	State copy_state(const Simulation& simulation)
+	{
+		const std::size_t count = simulation.get_body_count();
+		State state = {std::vector<double>(3 * count), std::vector<double>(3 * count), std::vector<double>(count)};
+		simulation.copy_columns(state.positions.data(), state.velocities.data(), state.masses.data(), nullptr, nullptr);
+		return state;
+	}
+
+	State copy_state(const SimulationFloat& simulation)
+	{
+		const std::size_t count = simulation.get_body_count();
+		State state = {std::vector<double>(3 * count), std::vector<double>(3 * count), std::vector<double>(count)};
+		simulation.copy_columns(state.positions.data(), state.velocities.data(), state.masses.data());
+		return state;
+	}
+
+	double state_energy(const State& state)
+	{
+		return total_energy(state.positions.data(), state.velocities.data(), state.masses.data(), state.masses.size());
+	}
+
+	Vector3d state_momentum(const State& state)
+	{
+		return total_momentum(state.velocities.data(), state.masses.data(), state.masses.size());
+	}
+
+	// Compares the solver's forces with a direct sum in double precision over the same bodies
+	template<typename SimulationType>
+	void force_error(const SimulationType& simulation, std::size_t samples, Result& result)
+	{
+		const State state = copy_state(simulation);
+		const std::size_t count = state.masses.size();
+		std::vector<double> forces(3 * count);
+		simulation.copy_forces(forces.data());
+		double squared_sum = 0.0;
+		result.max_force_error = 0.0;
+		samples = std::min(samples, count);
+		for(std::size_t sample = 0; sample < samples; ++sample)
+		{
+			// Spread evenly over the bodies
+			const std::size_t i = sample * count / samples;
+			double reference[3] = {0.0, 0.0, 0.0};
+			for(std::size_t j = 0; j < count; ++j)
+			{
+				if(j == i)
+				{
+					continue;
+				}
+				const double d[3] = {state.positions[3 * j] - state.positions[3 * i],
+				                     state.positions[3 * j + 1] - state.positions[3 * i + 1],
+				                     state.positions[3 * j + 2] - state.positions[3 * i + 2]};
+				const double distance_squared = d[0]*d[0] + d[1]*d[1] + d[2]*d[2];
+				const double magnitude = G * state.masses[i] * state.masses[j] / distance_squared
+				                         / std::sqrt(distance_squared);
+				for(int axis = 0; axis < 3; ++axis)
+				{
+					reference[axis] += d[axis] * magnitude;
+				}
+			}
+			double error_squared = 0.0;
+			double reference_squared = 0.0;
+			for(int axis = 0; axis < 3; ++axis)
+			{
+				const double error = forces[3 * i + axis] - reference[axis];
+				error_squared += error * error;
+				reference_squared += reference[axis] * reference[axis];
+			}
+			const double error = reference_squared > 0.0 ? std::sqrt(error_squared / reference_squared) : 0.0;
+			squared_sum += error * error;
+			result.max_force_error = std::max(result.max_force_error, error);
+		}
+		result.force_error = samples > 0 ? std::sqrt(squared_sum / samples) : 0.0;
+	}
+
+	template<typename SimulationType>
+	void run(SimulationType& simulation, unsigned long long steps, std::size_t force_samples, Result& result)
+	{
+		const State initial = copy_state(simulation);
+		const std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+		simulate_steps(simulation, steps);
+		result.wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+		const State final = copy_state(simulation);
+		const double initial_energy = state_energy(initial);
+		result.energy_drift = std::abs(state_energy(final) - initial_energy) / std::abs(initial_energy);
+		const Vector3d momentum_change = state_momentum(final) - state_momentum(initial);
+		result.momentum_drift = momentum_change.length()
+		                        / momentum_scale(initial.velocities.data(), initial.masses.data(), initial.masses.size());
+		result.final_bodies = simulation.get_body_count();
+		force_error(simulation, force_samples, result);
+	}
+
+	double objective_error(const Result& result, const std::string& objective)
+	{
+		if(objective == "momentum")
+		{
+			return result.momentum_drift;
+		}
+		if(objective == "force")
+		{
+			return result.force_error;
+		}
+		return result.energy_drift;
+	}
+
+	// Marks the runs that no other run beats in both time and error
+	void mark_pareto_front(std::vector<Result>& results, const std::string& objective)
+	{
+		for(Result& result : results)
+		{
+			result.pareto = true;
+			const double error = objective_error(result, objective);
+			for(const Result& other : results)
+			{
+				const double other_error = objective_error(other, objective);
+				if(other.wall_time <= result.wall_time && other_error <= error
+				   && (other.wall_time < result.wall_time || other_error < error))
+				{
+					result.pareto = false;
+					break;
+				}
+			}
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	const std::vector<std::string> known_options = {
+			"precisions", "step-sizes", "duration", "force-samples", "objective", "csv"};
+	const CommandLine options(argc, argv, known_options);
+	if(!options.is_valid())
+	{
+		std::cerr << options.get_error() << "\n\n" << USAGE;
+		return EXIT_FAILURE;
+	}
+	SimulationInitialConditions cond = CommandLine::default_initial_conditions();
+	cond.number_of_bodies = 512;
+	std::vector<std::string> precisions = {"double", "float"};
+	std::vector<int> step_sizes = {450, 900, 1800, 3600};
+	double duration = 3600000.0;
+	unsigned long long force_samples = 64;
+	std::string objective = "energy";
+	std::string csv_path;
+	if(!options.get_initial_conditions(cond) || !options.get("precisions", precisions)
+	   || !options.get("step-sizes", step_sizes) || !options.get("duration", duration)
+	   || !options.get("force-samples", force_samples) || !options.get("objective", objective)
+	   || !options.get("csv", csv_path))
+	{
+		std::cerr << options.get_error() << "\n\n" << USAGE;
+		return EXIT_FAILURE;
+	}
+	for(const std::string& precision : precisions)
+	{
+		if(precision != "double" && precision != "float")
+		{
+			std::cerr << "precisions must be double or float, not " << precision << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+	if(objective != "energy" && objective != "momentum" && objective != "force")
+	{
+		std::cerr << "objective must be energy, momentum or force, not " << objective << std::endl;
+		return EXIT_FAILURE;
+	}
+	if(duration <= 0.0 || std::find(step_sizes.begin(), step_sizes.end(), 0) != step_sizes.end())
+	{
+		std::cerr << "duration and step sizes must be more than 0" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::vector<Result> results;
+	for(const std::string& precision : precisions)
+	{
+		for(int step_size : step_sizes)
+		{
+			// The same bodies for every run, the step size only sets their previous positions
+			SimulationInitialConditions run_cond = cond;
+			run_cond.step_size = step_size;
+			const std::unique_ptr<InitialConditionGenerator> generator = make_initial_condition_generator(run_cond);
+			Result result = Result();
+			result.settings = Settings{precision, step_size};
+			result.steps = static_cast<unsigned long long>(std::llround(duration / step_size));
+			std::cout << precision << ", " << step_size << " s steps: " << std::flush;
+			if(precision == "float")
+			{
+				SimulationFloat simulation(*generator, static_cast<float>(step_size));
+				run(simulation, result.steps, force_samples, result);
+			}
+			else
+			{
+				Simulation simulation(*generator, step_size);
+				run(simulation, result.steps, force_samples, result);
+			}
+			std::cout << result.wall_time << " s, energy drift " << result.energy_drift << ", momentum drift "
+			          << result.momentum_drift << ", force error " << result.force_error << std::endl;
+			results.push_back(result);
+		}
+	}
+
+	mark_pareto_front(results, objective);
+	std::vector<const Result*> front;
+	for(const Result& result : results)
+	{
+		if(result.pareto)
+		{
+			front.push_back(&result);
+		}
+	}
+	std::sort(front.begin(), front.end(), [](const Result* a, const Result* b){return a->wall_time < b->wall_time;});
+	std::cout << "\nPareto front of wall time against " << objective << " error, fastest first:" << std::endl;
+	for(const Result* result : front)
+	{
+		std::cout << "  " << result->settings.precision << ", " << result->settings.step_size << " s steps: "
+		          << result->wall_time << " s, error " << objective_error(*result, objective) << std::endl;
+	}
+
+	if(!csv_path.empty())
+	{
+		std::ofstream file(csv_path);
+		file.precision(17);
+		file << "precision,step_size,steps,final_bodies,wall_time_s,energy_drift,momentum_drift,force_error,"
+		        "max_force_error,pareto\n";
+		for(const Result& result : results)
+		{
+			file << result.settings.precision << "," << result.settings.step_size << "," << result.steps << ","
+			     << result.final_bodies << "," << result.wall_time << "," << result.energy_drift << ","
+			     << result.momentum_drift << "," << result.force_error << "," << result.max_force_error << ","
+			     << (result.pareto ? 1 : 0) << "\n";
+		}
+		file.flush();
+		if(!file)
+		{
+			std::cerr << "Could not write " << csv_path << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,748 @@
+// Checks every backend against golden data recorded with the reference Simulation: body counts, positions and
+// merge events after a fixed number of steps of small fixed scenarios. Exits with failure if any check fails.
+//
+// nbody_regress [--golden path]                 check against the golden data (regression_golden.txt in the
+//                                               source directory)
+// nbody_regress --write path [--option value]   record new golden data with the reference Simulation
+//
+// Golden data is text, one block per scenario:
+//
+//   scenario layout step_size seed bodies mass mass_variance distribution distribution_variance speed
+//            speed_variance steps
+//   merge step id mass participant_count participant_id...     for every merge, in order
+//   body id x y z mass                                         for every body left, in order
+//   end
+//
+// Position errors are relative to the RMS distance of the golden bodies from their centroid. The golden data
+// only uses the plummer layout. It is drawn from the seeded std::mt19937_64 of the generators, which gives the same
+// bodies with every standard library, where the grid layout uses std::rand. The kepler-disk and cold-collapse
+// layouts are portable too, but their orbits and merges drift apart in float well within 500 steps.
+//
+// Every backend also runs a few hand placed clusters of touching bodies for one step. Each cluster has to merge
+// into a single body with all the mass, which catches merge lists that lose or double count bodies when
+// collisions chain through several pairs.
+
+#include "CommandLine.h"
+#include "Simulation.h"
+#include "SimulationBatch.h"
+#include "SimulationFloat.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+	const char* const USAGE =
+			"Usage: nbody_regress [--config file] [--option value ...]\n"
+			"\n"
+			"Checking:\n"
+			"  --golden path                  golden data to check against (regression_golden.txt in the\n"
+			"                                 source directory)\n"
+			"  --backends list                double (Simulation), threads-fast and threads-reproducible\n"
+			"                                 (Simulation on --threads threads with either reduction),\n"
+			"                                 batch (SimulationBatch) and/or float (SimulationFloat)\n"
+			"                                 (double,threads-fast,threads-reproducible,batch,float)\n"
+			"  --threads n                    threads of the threads backends (4)\n"
+			"  --tolerance-double x           largest position and mass error allowed per backend,\n"
+			"  --tolerance-threads-fast x     positions relative to the size of the system\n"
+			"  --tolerance-threads-reproducible x\n"
+			"  --tolerance-batch x            (1e-9 for all but float, 0.05 for float)\n"
+			"  --tolerance-float x\n"
+			"\n"
+			"Recording:\n"
+			"  --write path                   run the reference Simulation and write golden data\n"
+			"  --layouts list                 (plummer)\n"
+			"  --body-counts list             (64,128)\n"
+			"  --seeds list                   (1,2,3,4,5,6)\n"
+			"  --steps n                      (500)\n"
+			"  --step-size --mass --mass-variance --distribution --distribution-variance --speed\n"
+			"  --speed-variance               see nbody_headless\n";
+
+	struct Scenario
+	{
+		SimulationInitialConditions conditions;
+		unsigned long long steps;
+	};
+
+	struct Merge
+	{
+		unsigned long long step;
+		unsigned int id;
+		double mass;
+		std::vector<unsigned int> participants;
+	};
+
+	// The bodies after a run. Only the reference Simulation has ids and merge events.
+	struct Outcome
+	{
+		bool has_ids;
+		std::vector<unsigned int> ids;
+		// x, y, z interleaved
+		std::vector<double> positions;
+		std::vector<double> masses;
+		bool has_merges;
+		std::vector<Merge> merges;
+	};
+
+	std::string describe(const Scenario& scenario)
+	{
+		std::ostringstream stream;
+		stream << layout_name(scenario.conditions.layout) << ", " << scenario.conditions.number_of_bodies
+		       << " bodies, seed " << scenario.conditions.random_seed << ", " << scenario.steps << " steps";
+		return stream.str();
+	}
+
+	class MergeRecorder : public SimulationObserver
+	{
+	public:
+		explicit MergeRecorder(std::vector<Merge>& merges)
+		: m_merges(merges)
+		{
+		}
+
+		void on_step(const Simulation&) override
+		{
+		}
+
+		void on_merge(const Simulation&, const MergeEvent& event) override
+		{
+			const Merge merge = {event.step, event.id, event.mass, std::vector<unsigned int>(
+					event.participant_ids, event.participant_ids + event.participant_count)};
+			m_merges.push_back(merge);
+		}
+
+	private:
+		std::vector<Merge>& m_merges;
+	};
+
+	// The reference Simulation runs on one thread for double, on threads threads for the others
+	void set_parallelism(Simulation& simulation, const std::string& backend, unsigned int threads)
+	{
+		if(backend == "threads-fast")
+		{
+			simulation.set_parallelism(threads, ReductionMode::Fast);
+		}
+		else if(backend == "threads-reproducible")
+		{
+			simulation.set_parallelism(threads, ReductionMode::Reproducible);
+		}
+	}
+
+	// Bodies at rest on a line or lattice, with coordinates in units of the radius of mass
+	class ClusterGenerator : public InitialConditionGenerator
+	{
+	public:
+		ClusterGenerator(const std::vector<Vector3d>& positions, double mass, double radius)
+		: m_positions(positions),
+		  m_mass(mass),
+		  m_radius(radius)
+		{
+		}
+
+		std::size_t body_count() const override
+		{
+			return m_positions.size();
+		}
+
+		void generate(std::size_t, std::size_t begin, std::size_t end, const BodySink& sink) const override
+		{
+			for(std::size_t i = begin; i < end; ++i)
+			{
+				const Vector3d position = m_positions[i] * m_radius;
+				sink(i, position, position, m_mass);
+			}
+		}
+
+	private:
+		const std::vector<Vector3d> m_positions;
+		const double m_mass;
+		const double m_radius;
+	};
+
+	struct Cluster
+	{
+		const char* name;
+		// Neighbours 1.5 radii apart touch, bodies 3 radii apart don't
+		std::vector<Vector3d> positions;
+	};
+
+	std::vector<Cluster> make_clusters()
+	{
+		std::vector<Cluster> clusters;
+		// 0 touches 1 and 2, then 2 touches 3: 2 used to be left in the first list and start a second one
+		clusters.push_back({"chain through a list member",
+		                    {Vector3d(0.0, 0.0, 0.0), Vector3d(1.5, 0.0, 0.0), Vector3d(-1.5, 0.0, 0.0),
+		                     Vector3d(-3.0, 0.0, 0.0)}});
+		// 0-3 and 1-2 start two lists that 1-3 joins, which used to leave an empty list and stale look-ups
+		clusters.push_back({"two lists joined",
+		                    {Vector3d(0.0, 0.0, 0.0), Vector3d(3.0, 0.0, 0.0), Vector3d(4.5, 0.0, 0.0),
+		                     Vector3d(1.5, 0.0, 0.0)}});
+		Cluster lattice = {"3x3x3 lattice", {}};
+		for(int x = 0; x < 3; ++x)
+		{
+			for(int y = 0; y < 3; ++y)
+			{
+				for(int z = 0; z < 3; ++z)
+				{
+					lattice.positions.push_back(Vector3d(1.5 * x, 1.5 * y, 1.5 * z));
+				}
+			}
+		}
+		clusters.push_back(lattice);
+		return clusters;
+	}
+
+	// One step of the cluster on backend, which has to leave a single body with all the mass at the centroid
+	bool check_cluster(const Cluster& cluster, const std::string& backend, unsigned int threads, std::ostream& report)
+	{
+		const double mass = 1e6;
+		const double step_size = 1.0;
+		// The radius isn't public, a body on its own has it
+		const ClusterGenerator probe(std::vector<Vector3d>(1, Vector3d(0.0, 0.0, 0.0)), mass, 1.0);
+		double radius = 0.0;
+		Simulation(probe, step_size).copy_columns(nullptr, nullptr, nullptr, &radius, nullptr);
+		const ClusterGenerator generator(cluster.positions, mass, radius);
+
+		std::vector<Merge> merges;
+		std::vector<double> positions;
+		std::vector<double> masses;
+		if(backend == "float")
+		{
+			SimulationFloat simulation(generator, static_cast<float>(step_size));
+			simulation.simulate(1);
+			positions.resize(3 * simulation.get_body_count());
+			masses.resize(simulation.get_body_count());
+			simulation.copy_columns(positions.data(), nullptr, masses.data());
+		}
+		else if(backend == "batch")
+		{
+			SimulationBatch batch(std::vector<const InitialConditionGenerator*>(1, &generator), step_size);
+			batch.simulate(1);
+			positions.resize(3 * batch.get_body_count(0));
+			masses.resize(batch.get_body_count(0));
+			batch.copy_columns(0, positions.data(), masses.data());
+		}
+		else
+		{
+			Simulation simulation(generator, step_size);
+			set_parallelism(simulation, backend, threads);
+			MergeRecorder recorder(merges);
+			simulation.add_observer(&recorder);
+			simulation.simulate(1);
+			simulation.remove_observer(&recorder);
+			positions.resize(3 * simulation.get_body_count());
+			masses.resize(simulation.get_body_count());
+			simulation.copy_columns(positions.data(), nullptr, masses.data(), nullptr, nullptr);
+		}
+
+		bool passed = true;
+		const double total_mass = mass * cluster.positions.size();
+		if(masses.size() != 1)
+		{
+			report << "    " << masses.size() << " bodies left instead of 1\n";
+			passed = false;
+		}
+		else
+		{
+			Vector3d centroid(0.0, 0.0, 0.0);
+			for(const Vector3d& position : cluster.positions)
+			{
+				centroid += position * (radius / cluster.positions.size());
+			}
+			const Vector3d position(positions[0], positions[1], positions[2]);
+			const double tolerance = backend == "float" ? 1e-5 : 1e-12;
+			if(!(std::abs(masses[0] - total_mass) <= tolerance * total_mass))
+			{
+				report << "    mass " << masses[0] << " instead of " << total_mass << "\n";
+				passed = false;
+			}
+			if(!((position - centroid).length() <= 1e-3 * radius))
+			{
+				report << "    merged body " << (position - centroid).length() / radius
+				       << " radii from the centroid\n";
+				passed = false;
+			}
+		}
+		// Every body merges exactly once. Only the reference Simulation reports merges.
+		std::vector<int> merged(cluster.positions.size(), 0);
+		for(const Merge& merge : merges)
+		{
+			for(unsigned int id : merge.participants)
+			{
+				if(id < merged.size())
+				{
+					++merged[id];
+				}
+			}
+		}
+		for(std::size_t id = 0; id < merged.size() && backend != "batch" && backend != "float"; ++id)
+		{
+			if(merged[id] != 1)
+			{
+				report << "    body " << id << " merged " << merged[id] << " times\n";
+				passed = false;
+			}
+		}
+		return passed;
+	}
+
+	Outcome run_reference(const Scenario& scenario, const std::string& backend = "double", unsigned int threads = 1)
+	{
+		Outcome outcome = Outcome();
+		outcome.has_ids = true;
+		outcome.has_merges = true;
+		Simulation simulation(scenario.conditions);
+		set_parallelism(simulation, backend, threads);
+		MergeRecorder recorder(outcome.merges);
+		simulation.add_observer(&recorder);
+		simulate_steps(simulation, scenario.steps);
+		simulation.remove_observer(&recorder);
+		const std::size_t count = simulation.get_body_count();
+		outcome.ids.resize(count);
+		outcome.positions.resize(3 * count);
+		outcome.masses.resize(count);
+		simulation.copy_columns(outcome.positions.data(), nullptr, outcome.masses.data(), nullptr, outcome.ids.data());
+		return outcome;
+	}
+
+	Outcome run_float(const Scenario& scenario)
+	{
+		Outcome outcome = Outcome();
+		const std::unique_ptr<InitialConditionGenerator> generator = make_initial_condition_generator(
+				scenario.conditions);
+		SimulationFloat simulation(*generator, static_cast<float>(scenario.conditions.step_size));
+		simulate_steps(simulation, scenario.steps);
+		const std::size_t count = simulation.get_body_count();
+		outcome.positions.resize(3 * count);
+		outcome.masses.resize(count);
+		simulation.copy_columns(outcome.positions.data(), nullptr, outcome.masses.data());
+		return outcome;
+	}
+
+	// Scenarios that only differ in their seed run as lanes of one batch
+	std::vector<Outcome> run_batches(const std::vector<Scenario>& scenarios)
+	{
+		std::vector<Outcome> outcomes(scenarios.size());
+		std::vector<bool> done(scenarios.size(), false);
+		for(std::size_t first = 0; first < scenarios.size(); ++first)
+		{
+			if(done[first])
+			{
+				continue;
+			}
+			std::vector<std::size_t> members;
+			std::vector<SimulationInitialConditions> conditions;
+			for(std::size_t i = first; i < scenarios.size(); ++i)
+			{
+				SimulationInitialConditions cond = scenarios[i].conditions;
+				cond.random_seed = scenarios[first].conditions.random_seed;
+				const SimulationInitialConditions& first_cond = scenarios[first].conditions;
+				const bool same = !done[i] && scenarios[i].steps == scenarios[first].steps
+				                  && cond.layout == first_cond.layout && cond.step_size == first_cond.step_size
+				                  && cond.number_of_bodies == first_cond.number_of_bodies
+				                  && cond.system_mass == first_cond.system_mass
+				                  && cond.mass_variance == first_cond.mass_variance
+				                  && cond.distribution == first_cond.distribution
+				                  && cond.distribution_variance == first_cond.distribution_variance
+				                  && cond.speed == first_cond.speed && cond.speed_variance == first_cond.speed_variance;
+				if(same)
+				{
+					members.push_back(i);
+					conditions.push_back(scenarios[i].conditions);
+					done[i] = true;
+				}
+			}
+			SimulationBatch batch(conditions);
+			if(batch.is_valid())
+			{
+				simulate_steps(batch, scenarios[first].steps);
+			}
+			for(std::size_t lane = 0; lane < members.size(); ++lane)
+			{
+				Outcome& outcome = outcomes[members[lane]];
+				if(!batch.is_valid())
+				{
+					continue;
+				}
+				const std::size_t count = batch.get_body_count(lane);
+				outcome.positions.resize(3 * count);
+				outcome.masses.resize(count);
+				batch.copy_columns(lane, outcome.positions.data(), outcome.masses.data());
+			}
+		}
+		return outcomes;
+	}
+
+	double relative_difference(double value, double golden)
+	{
+		return golden != 0.0 ? std::abs(value - golden) / std::abs(golden) : std::abs(value);
+	}
+
+	// Returns false and explains every difference beyond tolerance in report
+	bool compare(const Outcome& golden, const Outcome& outcome, double tolerance, std::ostream& report)
+	{
+		bool passed = true;
+		const std::size_t count = golden.masses.size();
+		if(outcome.masses.size() != count)
+		{
+			report << "    " << outcome.masses.size() << " bodies left instead of " << count << "\n";
+			passed = false;
+		}
+
+		if(outcome.has_merges)
+		{
+			const std::size_t merges = std::min(golden.merges.size(), outcome.merges.size());
+			for(std::size_t i = 0; i < merges; ++i)
+			{
+				const Merge& expected = golden.merges[i];
+				const Merge& merge = outcome.merges[i];
+				if(merge.step != expected.step || merge.id != expected.id || merge.participants != expected.participants
+				   || relative_difference(merge.mass, expected.mass) > tolerance)
+				{
+					report << "    merge " << i + 1 << " is body " << merge.id << " of " << merge.participants.size()
+					       << " bodies with mass " << merge.mass << " kg in step " << merge.step << ", golden is body "
+					       << expected.id << " of " << expected.participants.size() << " bodies with mass "
+					       << expected.mass << " kg in step " << expected.step << "\n";
+					passed = false;
+					break;
+				}
+			}
+			if(golden.merges.size() != outcome.merges.size())
+			{
+				report << "    " << outcome.merges.size() << " merges instead of " << golden.merges.size() << "\n";
+				passed = false;
+			}
+		}
+
+		if(outcome.masses.size() != count || count == 0)
+		{
+			return passed;
+		}
+		// The size of the system, for relative position errors
+		double centroid[3] = {0.0, 0.0, 0.0};
+		for(std::size_t i = 0; i < 3 * count; ++i)
+		{
+			centroid[i % 3] += golden.positions[i] / count;
+		}
+		double squared_sum = 0.0;
+		for(std::size_t i = 0; i < 3 * count; ++i)
+		{
+			squared_sum += (golden.positions[i] - centroid[i % 3]) * (golden.positions[i] - centroid[i % 3]);
+		}
+		const double radius = std::max(std::sqrt(squared_sum / count), 1e-300);
+
+		double worst_error = 0.0;
+		std::size_t worst = 0;
+		for(std::size_t i = 0; i < count; ++i)
+		{
+			if(outcome.has_ids && outcome.ids[i] != golden.ids[i])
+			{
+				report << "    body " << i << " is id " << outcome.ids[i] << ", golden is id " << golden.ids[i] << "\n";
+				return false;
+			}
+			const double dx = outcome.positions[3 * i] - golden.positions[3 * i];
+			const double dy = outcome.positions[3 * i + 1] - golden.positions[3 * i + 1];
+			const double dz = outcome.positions[3 * i + 2] - golden.positions[3 * i + 2];
+			const double error = std::sqrt(dx*dx + dy*dy + dz*dz) / radius;
+			if(error > worst_error || std::isnan(error))
+			{
+				worst_error = error;
+				worst = i;
+			}
+			if(relative_difference(outcome.masses[i], golden.masses[i]) > tolerance)
+			{
+				report << "    body " << i << " has mass " << outcome.masses[i] << " kg, golden is "
+				       << golden.masses[i] << " kg\n";
+				passed = false;
+			}
+		}
+		if(!(worst_error <= tolerance))
+		{
+			report << "    body " << worst << " is off by " << worst_error << " of the system size, at ("
+			       << outcome.positions[3 * worst] << ", " << outcome.positions[3 * worst + 1] << ", "
+			       << outcome.positions[3 * worst + 2] << "), golden is (" << golden.positions[3 * worst] << ", "
+			       << golden.positions[3 * worst + 1] << ", " << golden.positions[3 * worst + 2] << ")\n";
+			passed = false;
+		}
+		else
+		{
+			report << "    largest position error " << worst_error << " of the system size\n";
+		}
+		return passed;
+	}
+
+	bool write_golden(const std::string& path, const std::vector<Scenario>& scenarios,
+	                  const std::vector<Outcome>& outcomes)
+	{
+		std::ofstream file(path);
+		file.precision(17);
+		file << "# nbody_regress golden data, recorded with the reference Simulation\n";
+		for(std::size_t i = 0; i < scenarios.size(); ++i)
+		{
+			const SimulationInitialConditions& cond = scenarios[i].conditions;
+			file << "scenario " << layout_name(cond.layout) << " " << cond.step_size << " " << cond.random_seed << " "
+			     << cond.number_of_bodies << " " << cond.system_mass << " " << cond.mass_variance << " "
+			     << cond.distribution << " " << cond.distribution_variance << " " << cond.speed << " "
+			     << cond.speed_variance << " " << scenarios[i].steps << "\n";
+			const Outcome& outcome = outcomes[i];
+			for(const Merge& merge : outcome.merges)
+			{
+				file << "merge " << merge.step << " " << merge.id << " " << merge.mass << " "
+				     << merge.participants.size();
+				for(unsigned int id : merge.participants)
+				{
+					file << " " << id;
+				}
+				file << "\n";
+			}
+			for(std::size_t body = 0; body < outcome.masses.size(); ++body)
+			{
+				file << "body " << outcome.ids[body] << " " << outcome.positions[3 * body] << " "
+				     << outcome.positions[3 * body + 1] << " " << outcome.positions[3 * body + 2] << " "
+				     << outcome.masses[body] << "\n";
+			}
+			file << "end\n";
+		}
+		file.flush();
+		return static_cast<bool>(file);
+	}
+
+	bool read_golden(const std::string& path, std::vector<Scenario>& scenarios, std::vector<Outcome>& outcomes,
+	                 std::string& error)
+	{
+		std::ifstream file(path);
+		if(!file)
+		{
+			error = "Could not open " + path;
+			return false;
+		}
+		std::string line;
+		int line_number = 0;
+		bool in_scenario = false;
+		while(std::getline(file, line))
+		{
+			++line_number;
+			std::istringstream stream(line);
+			std::string kind;
+			if(!(stream >> kind) || kind[0] == '#')
+			{
+				continue;
+			}
+			bool valid = true;
+			if(kind == "scenario" && !in_scenario)
+			{
+				Scenario scenario = Scenario();
+				SimulationInitialConditions& cond = scenario.conditions;
+				std::string layout;
+				valid = static_cast<bool>(stream >> layout >> cond.step_size >> cond.random_seed >> cond.number_of_bodies
+				                                 >> cond.system_mass >> cond.mass_variance >> cond.distribution
+				                                 >> cond.distribution_variance >> cond.speed >> cond.speed_variance
+				                                 >> scenario.steps) && layout_from_name(layout, cond.layout);
+				scenarios.push_back(scenario);
+				Outcome outcome = Outcome();
+				outcome.has_ids = true;
+				outcome.has_merges = true;
+				outcomes.push_back(outcome);
+				in_scenario = true;
+			}
+			else if(kind == "merge" && in_scenario)
+			{
+				Merge merge = Merge();
+				std::size_t count = 0;
+				valid = static_cast<bool>(stream >> merge.step >> merge.id >> merge.mass >> count);
+				merge.participants.resize(valid ? count : 0);
+				for(unsigned int& id : merge.participants)
+				{
+					valid = valid && static_cast<bool>(stream >> id);
+				}
+				outcomes.back().merges.push_back(merge);
+			}
+			else if(kind == "body" && in_scenario)
+			{
+				unsigned int id;
+				double x, y, z, mass;
+				valid = static_cast<bool>(stream >> id >> x >> y >> z >> mass);
+				Outcome& outcome = outcomes.back();
+				outcome.ids.push_back(id);
+				outcome.positions.insert(outcome.positions.end(), {x, y, z});
+				outcome.masses.push_back(mass);
+			}
+			else if(kind == "end" && in_scenario)
+			{
+				in_scenario = false;
+			}
+			else
+			{
+				valid = false;
+			}
+			if(!valid)
+			{
+				error = path + ":" + std::to_string(line_number) + ": can't read \"" + line + "\"";
+				return false;
+			}
+		}
+		if(in_scenario || scenarios.empty())
+		{
+			error = path + " ends in the middle of a scenario or has none";
+			return false;
+		}
+		return true;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	const std::vector<std::string> known_options = {
+			"golden", "backends", "threads", "tolerance-double", "tolerance-threads-fast",
+			"tolerance-threads-reproducible", "tolerance-batch", "tolerance-float", "write", "layouts", "body-counts",
+			"seeds", "steps"};
+	const CommandLine options(argc, argv, known_options);
+	if(!options.is_valid())
+	{
+		std::cerr << options.get_error() << "\n\n" << USAGE;
+		return EXIT_FAILURE;
+	}
+#ifdef NBODY_SOURCE_DIR
+	std::string golden_path = NBODY_SOURCE_DIR "/regression_golden.txt";
+#else
+	std::string golden_path = "regression_golden.txt";
+#endif
+	std::vector<std::string> backends = {"double", "threads-fast", "threads-reproducible", "batch", "float"};
+	std::map<std::string, double> tolerances = {{"double", 1e-9}, {"threads-fast", 1e-9},
+	                                            {"threads-reproducible", 1e-9}, {"batch", 1e-9}, {"float", 0.05}};
+	int threads = 4;
+	std::string write_path;
+	SimulationInitialConditions base = CommandLine::default_initial_conditions();
+	std::vector<std::string> layouts = {"plummer"};
+	std::vector<int> body_counts = {64, 128};
+	std::vector<int> seeds = {1, 2, 3, 4, 5, 6};
+	unsigned long long steps = 500;
+	if(!options.get("golden", golden_path) || !options.get("backends", backends) || !options.get("threads", threads)
+	   || !options.get("tolerance-double", tolerances["double"])
+	   || !options.get("tolerance-threads-fast", tolerances["threads-fast"])
+	   || !options.get("tolerance-threads-reproducible", tolerances["threads-reproducible"])
+	   || !options.get("tolerance-batch", tolerances["batch"])
+	   || !options.get("tolerance-float", tolerances["float"]) || !options.get("write", write_path)
+	   || !options.get_initial_conditions(base) || !options.get("layouts", layouts)
+	   || !options.get("body-counts", body_counts) || !options.get("seeds", seeds) || !options.get("steps", steps))
+	{
+		std::cerr << options.get_error() << "\n\n" << USAGE;
+		return EXIT_FAILURE;
+	}
+	for(const std::string& backend : backends)
+	{
+		if(!tolerances.count(backend))
+		{
+			std::cerr << "backends must be double, threads-fast, threads-reproducible, batch or float, not " << backend
+			          << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+	if(threads < 1 || threads > 1024)
+	{
+		std::cerr << "threads must be between 1 and 1024" << std::endl;
+		return EXIT_FAILURE;
+	}
+	const unsigned int thread_count = static_cast<unsigned int>(threads);
+
+	if(!write_path.empty())
+	{
+		std::vector<Scenario> scenarios;
+		for(const std::string& name : layouts)
+		{
+			InitialLayout layout;
+			if(!layout_from_name(name, layout))
+			{
+				std::cerr << "Unknown layout " << name << std::endl;
+				return EXIT_FAILURE;
+			}
+			for(int bodies : body_counts)
+			{
+				for(int seed : seeds)
+				{
+					Scenario scenario = {base, steps};
+					scenario.conditions.layout = layout;
+					scenario.conditions.number_of_bodies = bodies;
+					scenario.conditions.random_seed = seed;
+					scenarios.push_back(scenario);
+				}
+			}
+		}
+		std::vector<Outcome> outcomes;
+		for(const Scenario& scenario : scenarios)
+		{
+			std::cout << describe(scenario) << std::endl;
+			outcomes.push_back(run_reference(scenario));
+		}
+		if(!write_golden(write_path, scenarios, outcomes))
+		{
+			std::cerr << "Could not write " << write_path << std::endl;
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
+	std::vector<Scenario> scenarios;
+	std::vector<Outcome> golden;
+	std::string error;
+	if(!read_golden(golden_path, scenarios, golden, error))
+	{
+		std::cerr << error << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::map<std::string, std::vector<Outcome>> outcomes;
+	for(const std::string& backend : backends)
+	{
+		std::vector<Outcome>& backend_outcomes = outcomes[backend];
+		if(backend == "batch")
+		{
+			backend_outcomes = run_batches(scenarios);
+			continue;
+		}
+		for(const Scenario& scenario : scenarios)
+		{
+			backend_outcomes.push_back(backend == "float" ? run_float(scenario) : run_reference(scenario, backend, thread_count));
+		}
+	}
+
+	int failures = 0;
+	for(std::size_t i = 0; i < scenarios.size(); ++i)
+	{
+		std::cout << describe(scenarios[i]) << "\n";
+		for(const std::string& backend : backends)
+		{
+			std::ostringstream report;
+			const bool passed = compare(golden[i], outcomes[backend][i], tolerances[backend], report);
+			failures += passed ? 0 : 1;
+			std::cout << "  " << backend << ": " << (passed ? "ok" : "FAILED") << "\n" << report.str();
+		}
+	}
+	const std::vector<Cluster> clusters = make_clusters();
+	for(const Cluster& cluster : clusters)
+	{
+		std::cout << "collisions, " << cluster.name << "\n";
+		for(const std::string& backend : backends)
+		{
+			std::ostringstream report;
+			const bool passed = check_cluster(cluster, backend, thread_count, report);
+			failures += passed ? 0 : 1;
+			std::cout << "  " << backend << ": " << (passed ? "ok" : "FAILED") << "\n" << report.str();
+		}
+	}
+	const std::size_t checks = (scenarios.size() + clusters.size()) * backends.size();
+	if(failures > 0)
+	{
+		std::cout << failures << " of " << checks << " checks failed" << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::cout << "All " << checks << " checks passed" << std::endl;
+	return EXIT_SUCCESS;
+}
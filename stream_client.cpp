@@ -0,0 +1,201 @@
+// Test client for StreamServer. Connects to a running simulation, decodes every frame it receives
+// and optionally saves the stream, which the simulator can replay later like any trajectory.
+//
+// nbody_stream_client <socket> [output.nbtr] [--frames N] [--stride K] [--region x0 y0 z0 x1 y1 z1]
+
+#include "StreamServer.h"
+#include "TrajectoryCodec.h"
+#include "TrajectoryFile.h"
+#include "MappedFile.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	void print_usage()
+	{
+		std::cerr << "Usage: nbody_stream_client <socket> [output.nbtr] [--frames N] [--stride K]"
+		             " [--region x0 y0 z0 x1 y1 z1]" << std::endl;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+#ifndef _WIN32
+	if(argc < 2)
+	{
+		print_usage();
+		return EXIT_FAILURE;
+	}
+	const std::string socket_path = argv[1];
+	std::string output_path;
+	unsigned long long max_frames = 0;
+	bool use_region = false;
+	double region_min[3] = {0.0, 0.0, 0.0};
+	double region_max[3] = {0.0, 0.0, 0.0};
+	unsigned int stride = 1;
+	for(int i = 2; i < argc; ++i)
+	{
+		const std::string argument = argv[i];
+		if(argument == "--frames" && i + 1 < argc)
+		{
+			max_frames = std::strtoull(argv[++i], nullptr, 10);
+		}
+		else if(argument == "--stride" && i + 1 < argc)
+		{
+			stride = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if(argument == "--region" && i + 6 < argc)
+		{
+			use_region = true;
+			for(int axis = 0; axis < 3; ++axis)
+			{
+				region_min[axis] = std::strtod(argv[++i], nullptr);
+			}
+			for(int axis = 0; axis < 3; ++axis)
+			{
+				region_max[axis] = std::strtod(argv[++i], nullptr);
+			}
+		}
+		else if(output_path.empty() && argument.compare(0, 2, "--") != 0)
+		{
+			output_path = argument;
+		}
+		else
+		{
+			print_usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	sockaddr_un address;
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+	const int server = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(server < 0 || connect(server, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+	{
+		std::cerr << "Could not connect to " << socket_path << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	if(use_region || stride > 1)
+	{
+		using namespace StreamFormat;
+		char message[SUBSCRIPTION_SIZE] = {};
+		std::memcpy(message, SUBSCRIPTION_MAGIC, sizeof(SUBSCRIPTION_MAGIC));
+		write_value(message + 4, static_cast<std::uint32_t>(use_region ? 1 : 0));
+		std::memcpy(message + 8, region_min, sizeof(region_min));
+		std::memcpy(message + 32, region_max, sizeof(region_max));
+		write_value(message + 56, static_cast<std::uint32_t>(stride));
+		if(send(server, message, sizeof(message), 0) != static_cast<ssize_t>(sizeof(message)))
+		{
+			std::cerr << "Could not subscribe" << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	std::FILE* output = output_path.empty() ? nullptr : std::fopen(output_path.c_str(), "wb");
+	if(!output_path.empty() && !output)
+	{
+		std::cerr << "Could not create " << output_path << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	using namespace TrajectoryFormat;
+	std::vector<char> buffer;
+	std::size_t parsed = 0;
+	bool header_checked = false;
+	Snapshot previous;
+	Snapshot older;
+	Snapshot decoded;
+	unsigned long long frames = 0;
+	unsigned long long received_bytes = 0;
+	unsigned long long raw_bytes = 0;
+	bool ok = true;
+	char chunk[1 << 16];
+	while(ok && (max_frames == 0 || frames < max_frames))
+	{
+		const ssize_t received = recv(server, chunk, sizeof(chunk), 0);
+		if(received <= 0)
+		{
+			break;
+		}
+		buffer.insert(buffer.end(), chunk, chunk + received);
+		received_bytes += received;
+		if(output && std::fwrite(chunk, 1, received, output) != static_cast<std::size_t>(received))
+		{
+			std::cerr << "Could not write to " << output_path << std::endl;
+			ok = false;
+		}
+
+		if(!header_checked && buffer.size() >= HEADER_SIZE)
+		{
+			header_checked = true;
+			if(std::memcmp(buffer.data(), MAGIC, sizeof(MAGIC)) != 0)
+			{
+				std::cerr << socket_path << " does not send a trajectory stream" << std::endl;
+				ok = false;
+			}
+			parsed = HEADER_SIZE;
+		}
+		// Decode every complete frame
+		while(ok && header_checked && buffer.size() - parsed >= FRAME_HEADER_SIZE)
+		{
+			const char* header = buffer.data() + parsed;
+			const std::uint64_t payload_size = read_value<std::uint64_t>(header + 32);
+			if(buffer.size() - parsed - FRAME_HEADER_SIZE < payload_size)
+			{
+				break;
+			}
+			const std::uint64_t body_count = read_value<std::uint64_t>(header + 24);
+			const char* payload = header + FRAME_HEADER_SIZE;
+			if(std::memcmp(header, FRAME_MAGIC, sizeof(FRAME_MAGIC)) != 0
+			   || read_value<std::uint32_t>(header + 4) != ENCODING_QUANTIZED
+			   || !decode_quantized_frame(payload, payload_size, body_count, &previous, &older, decoded))
+			{
+				std::cerr << "Frame " << frames << " is damaged" << std::endl;
+				ok = false;
+				break;
+			}
+			std::swap(older, previous);
+			std::swap(previous, decoded);
+			++frames;
+			raw_bytes += FRAME_HEADER_SIZE + raw_payload_size(body_count);
+			std::cout << "Frame " << frames << ": step " << read_value<std::uint64_t>(header + 8) << ", "
+			          << body_count << " bodies, " << FRAME_HEADER_SIZE + payload_size << " bytes" << std::endl;
+			parsed += FRAME_HEADER_SIZE + payload_size;
+		}
+		// Keep the buffer from growing forever
+		buffer.erase(buffer.begin(), buffer.begin() + parsed);
+		parsed = 0;
+	}
+	close(server);
+	if(output)
+	{
+		ok = std::fclose(output) == 0 && ok;
+	}
+
+	std::cout << frames << " frames, " << received_bytes << " bytes received";
+	if(received_bytes > 0)
+	{
+		std::cout << ", " << static_cast<double>(raw_bytes) / received_bytes << "x smaller than raw frames";
+	}
+	std::cout << std::endl;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+#else
+	std::cerr << "Streaming needs Unix domain sockets" << std::endl;
+	return EXIT_FAILURE;
+#endif
+}